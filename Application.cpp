@@ -1,12 +1,14 @@
 #include "rtweekend.h"
 
-#include "bvh.h"
-#include "camera.h"
-#include "hittable.h"
-#include "hittable_list.h"
-#include "material.h"
-#include "primitives.h"
-#include "texture.h"
+#include "interactive.h"
+#include "render_daemon.h"
+#include "scene.h"
+#include "scene_file.h"
+#include "scenes.h"
+
+#include <fstream>
+#include <string>
+#include <vector>
 
 // Made following "Ray Tracing in One Weekend"
 // https://raytracing.github.io/books/RayTracingInOneWeekend.html#overview
@@ -15,248 +17,398 @@
 
 // Continue at 9 Volumes
 
-void bouncing_spheres() {
-	// World
-
-	hittable_list world;
-
-	auto checker = make_shared<checker_texture>(0.32, color(0.2, 0.3, 0.1), color(0.9, 0.9, 0.9));
-	world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(checker)));
-
-	for (int a = -11; a < 11; a++) {
-		for (int b = -11; b < 11; b++) {
-			auto choose_mat = random_double();
-			point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
-
-			if ((center - point3(4, 0.2, 0)).length() > 0.9) {
-				shared_ptr<material> sphere_material;
-
-				if (choose_mat < 0.8) {
-					// diffuse material
-					auto albedo = color::random() * color::random();
-					sphere_material = make_shared<lambertian>(albedo);
-					auto center2 = center + vec3(0, random_double(0, .5), 0);
-					world.add(make_shared<sphere>(center, center2, 0.2, sphere_material));
-				}
-				else if (choose_mat < 0.95) {
-					// metal material
-					auto albedo = color::random(0.5, 1);
-					auto roughness = random_double(0, 0.5);
-					sphere_material = make_shared<metal>(albedo, roughness);
-					world.add(make_shared<sphere>(center, 0.2, sphere_material));
-				}
-				else {
-					// glass
-					sphere_material = make_shared<dielectric>(1.5);
-					world.add(make_shared<sphere>(center, 0.2, sphere_material));
-				}
-			}
+// Command line settings. Anything left at -1 keeps the value from the scene.
+struct options {
+	std::vector<std::string> scene_files;
+	std::string builtin;
+	std::string output;
+	std::string heatmap;
+	std::string preview;
+	std::string frames = "-";
+	std::string daemon;
+	std::string aovs;
+	std::string hdr;
+	std::string regrade;
+	std::string tone_map;
+	double exposure = 0;
+	std::string filter;
+	double filter_radius = -1;
+	double sample_clamp = -1;
+	bool interactive = false;
+	bool denoise = false;
+	bool spectral = false;
+	long preview_interval = -1;
+	long texture_cache_mb = 0;
+	int samples_per_pixel = -1;
+	int image_width = -1;
+	int max_depth = -1;
+	int threads = -1;
+	long seed = -1;
+};
+
+void print_usage(const char* program) {
+	std::cerr <<
+		"Usage: " << program << " [options] [scene files...]\n"
+		"\n"
+		"Renders each scene file in turn. With no scene files, renders the built-in\n"
+		"Cornell box to stdout.\n"
+		"\n"
+		"Options:\n"
+		"  --builtin <name>  Render a built-in scene: bouncing_spheres, quads, earth,\n"
+		"                    perlin_spheres, simple_light, cornell_box, cornell_smoke\n"
+		"  --spp <n>         Samples per pixel\n"
+		"  --width <n>       Image width in pixels (height follows the aspect ratio)\n"
+		"  --max-depth <n>   Maximum bounces per path\n"
+		"  --threads <n>     Render threads, 0 for all hardware threads\n"
+		"  --seed <n>        Random seed for scene generation and sampling\n"
+		"  --output <path>   Output .ppm file. With several scenes, an output directory.\n"
+		"  --preview <path>  Rewrite the image so far to <path> during the render, with\n"
+		"                    its status (samples, rays/s, ETA) in <path>.json\n"
+		"  --preview-interval <s>  Seconds between preview writes (default 10)\n"
+		"  --interactive     Preview a single scene interactively: read camera changes\n"
+		"                    (lookfrom x y z, lookat x y z, vfov d, quit) from stdin\n"
+		"                    and send progressively refined frames to --frames\n"
+		"  --frames <path>   Directory for interactive frames, or - for a PPM stream\n"
+		"                    on stdout (default)\n"
+		"  --filter <name>   Pixel filter: box (default), gaussian, mitchell or\n"
+		"                    blackman_harris\n"
+		"  --filter-radius <r> Filter radius in pixels (default depends on the filter)\n"
+		"  --clamp <value>   Clamp each sample's brightest channel to <value> to\n"
+		"                    suppress fireflies (0 disables)\n"
+		"  --exposure <stops> Brighten (or darken, if negative) before tone mapping\n"
+		"  --tonemap <name>  clamp (default), reinhard, aces or filmic\n"
+		"  --hdr <path>      Also save the linear image as a .pfm for regrading\n"
+		"  --regrade <pfm>   Grade a saved .pfm to --output instead of rendering\n"
+		"  --denoise         Filter the image with the AOV-guided a-trous denoiser\n"
+		"  --spectral        Trace four wavelengths per sample instead of RGB, so\n"
+		"                    dispersive glass splits light into colors\n"
+		"  --aovs <prefix>   Also write <prefix>_albedo.ppm, _normal.ppm and _depth.ppm\n"
+		"  --daemon <dir>    Keep running and render the .job files put in <dir>,\n"
+		"                    keeping threads, scenes and textures loaded between jobs\n"
+		"  --texture-cache <MB>  Stream image textures in tiles from a converted copy\n"
+		"                    next to each image (<image>.rtwtex), keeping at most\n"
+		"                    <MB> of tiles in memory\n"
+		"  --heatmap <path>  Write per-tile render times as a .ppm (RTW_STATS builds only)\n"
+		"  --help            Show this message\n";
+}
+
+bool parse_options(int argc, char* argv[], options& opts) {
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+
+		if (arg == "--help" || arg == "-h") return false;
+
+		if (arg == "--interactive") {
+			opts.interactive = true;
+			continue;
 		}
-	}
 
-	auto material1 = make_shared<dielectric>(1.5);
-	world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
+		if (arg == "--denoise") {
+			opts.denoise = true;
+			continue;
+		}
+
+		if (arg == "--spectral") {
+			opts.spectral = true;
+			continue;
+		}
 
-	auto material2 = make_shared<noise_texture>(10);
-	world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, make_shared<lambertian>(material2)));
+		if (arg.compare(0, 2, "--") != 0) {
+			opts.scene_files.push_back(arg);
+			continue;
+		}
+
+		if (i + 1 >= argc) {
+			std::cerr << "ERROR: Missing value for '" << arg << "'.\n";
+			return false;
+		}
+		std::string value = argv[++i];
+
+		auto number = [&](long& out) {
+			char* end = nullptr;
+			out = std::strtol(value.c_str(), &end, 10);
+			if (value.empty() || *end != '\0' || out < 0) {
+				std::cerr << "ERROR: '" << arg << "' expects a non-negative integer, got '" << value << "'.\n";
+				return false;
+			}
+			return true;
+		};
+
+		auto real = [&](double& out) {
+			char* end = nullptr;
+			out = std::strtod(value.c_str(), &end);
+			if (value.empty() || *end != '\0') {
+				std::cerr << "ERROR: '" << arg << "' expects a number, got '" << value << "'.\n";
+				return false;
+			}
+			return true;
+		};
+
+		long n = 0;
+		if (arg == "--builtin") opts.builtin = value;
+		else if (arg == "--hdr") opts.hdr = value;
+		else if (arg == "--regrade") opts.regrade = value;
+		else if (arg == "--exposure") { if (!real(opts.exposure)) return false; }
+		else if (arg == "--filter-radius") {
+			if (!real(opts.filter_radius)) return false;
+			if (!(opts.filter_radius > 0)) {
+				std::cerr << "ERROR: '--filter-radius' must be positive, got '" << value << "'.\n";
+				return false;
+			}
+		}
+		else if (arg == "--clamp") {
+			if (!real(opts.sample_clamp)) return false;
+			if (!(opts.sample_clamp >= 0)) {
+				std::cerr << "ERROR: '--clamp' must not be negative, got '" << value << "'.\n";
+				return false;
+			}
+		}
+		else if (arg == "--filter") {
+			pixel_filter_type type = filter_box;
+			if (!pixel_filter::parse(value, type)) {
+				std::cerr << "ERROR: Unknown pixel filter '" << value << "'.\n";
+				return false;
+			}
+			opts.filter = value;
+		}
+		else if (arg == "--tonemap") {
+			tone_map_operator op;
+			if (!parse_tone_map(value, op)) {
+				std::cerr << "ERROR: Unknown tone mapping operator '" << value << "'.\n";
+				return false;
+			}
+			opts.tone_map = value;
+		}
+		else if (arg == "--output") opts.output = value;
+		else if (arg == "--heatmap") opts.heatmap = value;
+		else if (arg == "--preview") opts.preview = value;
+		else if (arg == "--frames") opts.frames = value;
+		else if (arg == "--daemon") opts.daemon = value;
+		else if (arg == "--aovs") opts.aovs = value;
+		else if (arg == "--preview-interval") { if (!number(n)) return false; opts.preview_interval = n; }
+		else if (arg == "--texture-cache") { if (!number(n)) return false; opts.texture_cache_mb = n; }
+		else if (arg == "--spp") { if (!number(n)) return false; opts.samples_per_pixel = int(n); }
+		else if (arg == "--width") { if (!number(n)) return false; opts.image_width = int(n); }
+		else if (arg == "--max-depth") { if (!number(n)) return false; opts.max_depth = int(n); }
+		else if (arg == "--threads") { if (!number(n)) return false; opts.threads = int(n); }
+		else if (arg == "--seed") { if (!number(n)) return false; opts.seed = n; }
+		else {
+			std::cerr << "ERROR: Unknown option '" << arg << "'.\n";
+			return false;
+		}
+	}
 
-	auto e_tex = make_shared<image_texture>("earthmap.jpg");
-	auto material3 = make_shared<metal>(e_tex, 0.5);
-	world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material3));
+	if (!opts.builtin.empty() && !opts.scene_files.empty()) {
+		std::cerr << "ERROR: --builtin cannot be combined with scene files.\n";
+		return false;
+	}
 
-	world = hittable_list(make_shared<bvh_node>(world));
+	if (opts.interactive && opts.scene_files.size() > 1) {
+		std::cerr << "ERROR: --interactive previews a single scene.\n";
+		return false;
+	}
 
-	camera cam;
+	if (!opts.daemon.empty() && (opts.interactive || !opts.builtin.empty() || !opts.scene_files.empty())) {
+		std::cerr << "ERROR: --daemon takes its scenes from job files.\n";
+		return false;
+	}
 
-	cam.aspect_ratio = 16.0 / 9.0;
-	cam.image_width = 800;
-	cam.samples_per_pixel = 50;
-	cam.max_depth = 50;
-	cam.background = color(0.70, 0.80, 1.00);
+	if (!opts.heatmap.empty() && !rtw_stats::enabled()) {
+		std::cerr << "ERROR: --heatmap needs a build with RTW_STATS defined.\n";
+		return false;
+	}
 
-	cam.vfov = 20;
-	cam.lookfrom = point3(13, 2, 3);
-	cam.lookat = point3(0, 0, 0);
-	cam.vup = point3(0, 1, 0);
+	if ((!opts.heatmap.empty() || !opts.aovs.empty() || !opts.hdr.empty()) && opts.scene_files.size() > 1) {
+		std::cerr << "ERROR: --heatmap, --aovs and --hdr only support a single scene.\n";
+		return false;
+	}
 
-	cam.defocus_angle = 0.6;
-	cam.focus_dist = 10.0;
+	return true;
+}
 
-	cam.render(world);
+void apply_overrides(const options& opts, camera& cam) {
+	if (opts.samples_per_pixel > 0) cam.samples_per_pixel = opts.samples_per_pixel;
+	if (opts.image_width > 0) cam.image_width = opts.image_width;
+	if (opts.max_depth >= 0) cam.max_depth = opts.max_depth;
+	if (opts.threads >= 0) cam.thread_count = opts.threads;
+	if (opts.seed >= 0) cam.seed = unsigned(opts.seed);
+	if (!opts.preview.empty()) cam.preview_path = opts.preview;
+	if (opts.preview_interval >= 0) cam.preview_interval = double(opts.preview_interval);
+	if (opts.denoise) cam.denoise = true;
+	if (opts.spectral) cam.spectral = true;
+	if (!opts.aovs.empty()) cam.record_aovs = true;
+	if (!opts.tone_map.empty()) parse_tone_map(opts.tone_map, cam.grade.tone_map);
+	cam.grade.exposure += opts.exposure;
+
+	if (!opts.filter.empty()) {
+		pixel_filter_type type = filter_box;
+		pixel_filter::parse(opts.filter, type);
+		cam.filter = pixel_filter(type);
+	}
+	if (opts.filter_radius > 0) cam.filter.radius = opts.filter_radius;
+	if (opts.sample_clamp >= 0) cam.sample_clamp = opts.sample_clamp;
 }
 
-void quads() {
-	hittable_list world;
+// Prints the render counters and writes the tile heatmap, if stats are compiled in.
+bool report_stats(const scene& s, const std::string& heatmap) {
+	if (!rtw_stats::enabled()) return true;
 
-	// Materials
-	auto left_red = make_shared<lambertian>(color(1.0, 0.2, 0.2));
-	auto back_green = make_shared<lambertian>(color(0.2, 1.0, 0.2));
-	auto right_blue = make_shared<lambertian>(color(0.2, 0.2, 1.0));
-	auto upper_orange = make_shared<lambertian>(color(1.0, 0.5, 0.2));
-	auto lower_teal = make_shared<lambertian>(color(0.2, 0.8, 0.8));
+	rtw_stats::print_report(std::clog, rtw_stats::collect());
+	rtw_stats::reset();
 
-	world.add(make_shared<quad>(point3(-3, -2, 5), vec3(0, 0, -4), vec3(0, 4, 0), left_red));
-	world.add(make_shared<disk>(point3(0, 0, 0), vec3(4, 0, 0), vec3(0, 4, 0), 0.5, back_green));
-	world.add(make_shared<quad>(point3(3, -2, 1), vec3(0, 0, 4), vec3(0, 4, 0), right_blue));
-	world.add(make_shared<quad>(point3(-2, 3, 1), vec3(4, 0, 0), vec3(0, 0, 4), upper_orange));
-	world.add(make_shared<triangle>(point3(-2, -3, 5), vec3(4, 0, 0), vec3(0, 0, -4), lower_teal));
+	if (heatmap.empty()) return true;
 
-	camera cam;
+	std::ofstream out(heatmap, std::ios::binary);
+	if (!out || !s.cam.write_tile_heatmap(out)) {
+		std::cerr << "ERROR: Could not write heatmap '" << heatmap << "'.\n";
+		return false;
+	}
+	return true;
+}
 
-	cam.aspect_ratio = 1.0;
-	cam.image_width = 400;
-	cam.samples_per_pixel = 100;
-	cam.max_depth = 50;
-	cam.background = color(0.70, 0.80, 1.00);
+// Writes everything besides the image that the options asked for.
+bool write_extras(const scene& s, const options& opts) {
+	if (!report_stats(s, opts.heatmap)) return false;
 
-	cam.vfov = 80;
-	cam.lookfrom = point3(3, 3, 9);
-	cam.lookat = point3(0, 0, 0);
-	cam.vup = vec3(0, 1, 0);
+	auto& textures = texture_cache::shared();
+	if (textures.streaming() && textures.tile_loads > 0) {
+		std::clog << "Texture tiles: " << textures.tile_loads << " read, " << textures.tile_evictions << " evicted, "
+				  << textures.resident_bytes() / 1048576.0 << " MB resident\n";
+	}
 
-	cam.defocus_angle = 0;
+	int height = int(s.cam.framebuffer.size() / s.cam.image_width);
+	if (!opts.hdr.empty() && !write_pfm(opts.hdr, s.cam.image_width, height, s.cam.framebuffer)) return false;
 
-	cam.render(world);
+	if (opts.aovs.empty()) return true;
+	return write_aov_images(opts.aovs, s.cam.image_width, height, s.cam.aovs);
 }
 
-void earth() {
-	auto earth_texture = make_shared<image_texture>("earthmap.jpg");
-	auto earth_surface = make_shared<lambertian>(earth_texture);
-	auto globe = make_shared<sphere>(point3(0, 0, 0), 2, earth_surface);
+// Renders `s` to `output`, or to stdout if `output` is empty.
+bool render_to(scene& s, const std::string& output, const options& opts) {
+	if (output.empty()) {
+		s.render(std::cout);
+		return write_extras(s, opts);
+	}
 
-	camera cam;
+	std::ofstream out(output, std::ios::binary);
+	if (!out) {
+		std::cerr << "ERROR: Could not open output file '" << output << "'.\n";
+		return false;
+	}
 
-	cam.aspect_ratio = 16.0 / 9.0;
-	cam.image_width = 400;
-	cam.samples_per_pixel = 100;
-	cam.max_depth = 50;
-	cam.background = color(0.70, 0.80, 1.00);
+	s.render(out);
+	return write_extras(s, opts);
+}
 
-	cam.vfov = 20;
-	cam.lookfrom = point3(0, 0, 12);
-	cam.lookat = point3(0, 0, 0);
-	cam.vup = vec3(0, 1, 0);
+// Grades a saved linear image again with the exposure and tone mapping options.
+bool regrade_image(const options& opts) {
+	int width, height;
+	std::vector<color> pixels;
+	if (!read_pfm(opts.regrade, width, height, pixels)) return false;
 
-	cam.defocus_angle = 0;
+	image_grade grade;
+	if (!opts.tone_map.empty()) parse_tone_map(opts.tone_map, grade.tone_map);
+	grade.exposure = opts.exposure;
 
-	cam.render(hittable_list(globe));
-}
+	if (opts.output.empty()) {
+		write_ppm(std::cout, width, height, pixels, grade, false);
+		return true;
+	}
 
-void perlin_spheres() {
-	hittable_list world;
+	std::ofstream out(opts.output, std::ios::binary);
+	if (!out) {
+		std::cerr << "ERROR: Could not open output file '" << opts.output << "'.\n";
+		return false;
+	}
+	write_ppm(out, width, height, pixels, grade, false);
+	return true;
+}
 
-	auto pertext = make_shared<noise_texture>(4.3);
-	world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(pertext)));
-	world.add(make_shared<sphere>(point3(0, 2, 0), 2, make_shared<lambertian>(pertext)));
+// The output file for a scene file when rendering a batch.
+std::string batch_output(const std::string& scene_file, const std::string& directory) {
+	auto slash = scene_file.find_last_of("/\\");
+	auto base = slash == std::string::npos ? scene_file : scene_file.substr(slash + 1);
+	auto dot = base.find_last_of('.');
+	if (dot != std::string::npos) base.erase(dot);
 
-	camera cam;
+	if (directory.empty()) return base + ".ppm";
+	auto last = directory.back();
+	return directory + ((last == '/' || last == '\\') ? "" : "/") + base + ".ppm";
+}
 
-	cam.aspect_ratio = 16.0 / 9.0;
-	cam.image_width = 400;
-	cam.samples_per_pixel = 100;
-	cam.max_depth = 50;
-	cam.background = color(0.70, 0.80, 1.00);
+int main(int argc, char* argv[]) {
+	options opts;
+	if (!parse_options(argc, argv, opts)) {
+		print_usage(argv[0]);
+		return 1;
+	}
 
-	cam.vfov = 20;
-	cam.lookfrom = point3(13, 2, 3);
-	cam.lookat = point3(0, 0, 0);
-	cam.vup = vec3(0, 1, 0);
+	if (!opts.regrade.empty())
+		return regrade_image(opts) ? 0 : 1;
 
-	cam.defocus_angle = 0;
+	seed_random(opts.seed >= 0 ? unsigned(opts.seed) : std::random_device{}());
+	texture_cache::shared().set_budget(size_t(opts.texture_cache_mb) << 20);
 
-	cam.render(world);
-}
+	if (!opts.daemon.empty()) {
+		render_daemon daemon;
+		daemon.directory = opts.daemon;
+		if (opts.threads >= 0) daemon.thread_count = opts.threads;
+		return daemon.run() ? 0 : 1;
+	}
 
-void simple_light() {
-	hittable_list world;
+	if (opts.interactive) {
+		scene s;
+		if (!opts.scene_files.empty()) {
+			if (!load_scene(opts.scene_files[0], s)) return 1;
+		}
+		else if (!builtin_scene(opts.builtin.empty() ? std::string("cornell_box") : opts.builtin, s)) {
+			std::cerr << "ERROR: Unknown built-in scene '" << opts.builtin << "'.\n";
+			return 1;
+		}
 
-	auto pertex = make_shared<noise_texture>(4);
-	world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(pertex)));
-	world.add(make_shared<sphere>(point3(0, 2, 0), 2, make_shared<lambertian>(pertex)));
+		apply_overrides(opts, s.cam);
 
-	auto diffLight = make_shared<diffuse_light>(color(4, 4, 4));
-	auto diffLight2 = make_shared<diffuse_light>(color(3, 5, 3));
-	auto diffLight3 = make_shared<diffuse_light>(color(3, 3, 6));
-	world.add(make_shared<sphere>(point3(0, 7, 0), 1, diffLight3));
-	world.add(make_shared<quad>(point3(3, 1, -2), vec3(2, 0, 0), vec3(0, 2, 0), diffLight));
-	world.add(make_shared<sphere>(point3(3, 1, 5), 0.2, diffLight2));
+		interactive_preview preview;
+		preview.frames_path = opts.frames;
+		return preview.run(s.world, s.cam) ? 0 : 1;
+	}
 
+	if (opts.scene_files.empty()) {
+		scene s;
+		auto name = opts.builtin.empty() ? std::string("cornell_box") : opts.builtin;
+		if (!builtin_scene(name, s)) {
+			std::cerr << "ERROR: Unknown built-in scene '" << name << "'.\n";
+			return 1;
+		}
 
-	camera cam;
+		apply_overrides(opts, s.cam);
+		if (!render_to(s, opts.output, opts)) return 1;
 
-	cam.aspect_ratio = 16.0 / 9.0;
-	cam.image_width = 400;
-	cam.samples_per_pixel = 500;
-	cam.max_depth = 50;
-	cam.background = color(0, 0, 0);
+		// Keep the console open when launched without arguments, e.g. from Visual Studio.
+		if (argc == 1) {
+			std::clog << "\nPress [ENTER] to close..." << std::endl;
+			std::cin.get();
+		}
+		return 0;
+	}
 
-	cam.vfov = 20;
-	cam.lookfrom = point3(26, 3, 6);
-	cam.lookat = point3(0, 2, 0);
-	cam.vup = vec3(0, 0, 0);
+	int failures = 0;
+	bool batch = opts.scene_files.size() > 1;
 
-	cam.defocus_angle = 0;
+	for (const auto& file : opts.scene_files) {
+		scene s;
+		if (!load_scene(file, s)) {
+			failures++;
+			continue;
+		}
 
-	cam.render(world);
-}
+		apply_overrides(opts, s.cam);
 
-void cornell_box() {
-	hittable_list world;
-
-	auto red = make_shared<lambertian>(color(0.65, 0.05, 0.05));
-	auto white = make_shared<lambertian>(color(0.73, 0.73, 0.73));
-	auto green = make_shared<lambertian>(color(0.12, 0.45, 0.15));
-	auto light = make_shared<diffuse_light>(color(15, 15, 15));
-
-	world.add(make_shared<quad>(point3(555, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), green));
-	world.add(make_shared<quad>(point3(0, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), red));
-	world.add(make_shared<quad>(point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), light));
-	world.add(make_shared<quad>(point3(0, 0, 0), vec3(555, 0, 0), vec3(0, 0, 555), white));
-	world.add(make_shared<quad>(point3(555, 555, 555), vec3(-555, 0, 0), vec3(0, 0, -555), white));
-	world.add(make_shared<quad>(point3(0, 0, 555), vec3(555, 0, 0), vec3(0, 555, 0), white));
-
-	shared_ptr<hittable> box1 = box(point3(0, 0, 0), point3(165, 330, 165), white);
-	box1 = make_shared<rotate_y>(box1, 15);
-	box1 = make_shared<translate>(box1, vec3(265, 0, 295));
-	world.add(box1);
-
-	/*
-	shared_ptr<hittable> box2 = box(point3(0, 0, 0), point3(165, 165, 165), white);
-	box2 = make_shared<rotate_y>(box2, -18);
-	box2 = make_shared<translate>(box2, vec3(130, 0, 65));
-	world.add(box2);
-	*/
-
-	auto glass = make_shared<dielectric>(1.53);
-	world.add(make_shared<sphere>(point3(150, 84, 120), 84, glass));
-
-	camera cam;
-
-	cam.aspect_ratio = 1.0;
-	cam.image_width = 600;
-	cam.samples_per_pixel = 10000;
-	cam.max_depth = 50;
-	cam.background = color(0, 0, 0);
-
-	cam.vfov = 40;
-	cam.lookfrom = point3(278, 278, -800);
-	cam.lookat = point3(278, 278, 0);
-	cam.vup = vec3(0, 1, 0);
-
-	cam.defocus_angle = 0;
-	cam.render(world);
-}
+		auto output = batch ? batch_output(file, opts.output) : opts.output;
+		std::clog << "Rendering '" << file << "'" << (output.empty() ? "" : " to '" + output + "'") << "\n";
 
-int main() {
-	std::srand(std::time(nullptr));
-	switch (6) {
-		case 1: bouncing_spheres(); break;
-		case 2: quads(); break;
-		case 3: earth(); break;
-		case 4: perlin_spheres(); break;
-		case 5: simple_light(); break;
-		case 6: cornell_box(); break;
+		if (!render_to(s, output, opts)) failures++;
 	}
 
-	return 0;
-}
\ No newline at end of file
+	return failures == 0 ? 0 : 1;
+}
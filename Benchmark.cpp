@@ -0,0 +1,322 @@
+// Non-interactive benchmark: renders a fixed set of scenes at fixed seeds and
+// reports build time, ray throughput, traversal cost and peak memory, both as
+// a table on stderr and as JSON for tracking regressions over time.
+//
+// As built, the renderer is the plain one, so the timings are those of a real
+// render and only primary rays, which follow from the image size, are
+// counted. Built with RTW_STATS defined, it also reports secondary rays, BVH
+// node visits and primitive tests, at the cost of counting them; compare
+// timings only between builds of the same kind.
+
+#include "rtweekend.h"
+
+#include "motion.h"
+#include "scene.h"
+#include "scenes.h"
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+	#ifndef WIN32_LEAN_AND_MEAN
+		#define WIN32_LEAN_AND_MEAN
+	#endif
+	#ifndef NOMINMAX
+		#define NOMINMAX
+	#endif
+	#include <windows.h>
+	#include <psapi.h>
+	#pragma comment(lib, "psapi.lib")
+#else
+	#include <sys/resource.h>
+#endif
+
+// Peak resident set size of the whole process so far, in bytes.
+uint64_t peak_rss_bytes() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return uint64_t(counters.PeakWorkingSetSize);
+	return 0;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+	#ifdef __APPLE__
+		return uint64_t(usage.ru_maxrss);
+	#else
+		return uint64_t(usage.ru_maxrss) * 1024;
+	#endif
+#endif
+}
+
+// A large synthetic scene: a dense field of small spheres with mixed materials
+// around a few thousand instanced boxes sharing one BLAS. When `moving`, the
+// spheres bounce and the boxes slide and spin while the shutter is open, each
+// across several times its own size.
+void synthetic_field(scene& s, bool moving) {
+	auto& world = s.world;
+	auto& cam = s.cam;
+
+	auto ground = make_shared<lambertian>(make_shared<checker_texture>(1.0, color(0.2, 0.3, 0.1), color(0.9, 0.9, 0.9)));
+	world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, ground));
+
+	const int field = 300;
+	for (int a = -field / 2; a < field / 2; a++) {
+		for (int b = -field / 2; b < field / 2; b++) {
+			auto choose_mat = random_double();
+			point3 center(0.5 * a + 0.3 * random_double(), 0.1, 0.5 * b + 0.3 * random_double());
+
+			shared_ptr<material> sphere_material;
+			if (choose_mat < 0.8) sphere_material = make_shared<lambertian>(color::random() * color::random());
+			else if (choose_mat < 0.95) sphere_material = make_shared<metal>(color::random(0.5, 1), random_double(0, 0.5));
+			else sphere_material = make_shared<dielectric>(1.5);
+
+			if (moving) world.add(make_shared<sphere>(center, center + vec3(0, random_double(0, 1), 0), 0.1, sphere_material));
+			else world.add(make_shared<sphere>(center, 0.1, sphere_material));
+		}
+	}
+
+	auto white = make_shared<lambertian>(color(0.73, 0.73, 0.73));
+	auto unit_box = make_shared<oriented_box>(point3(0, 0, 0), point3(1, 1, 1), white);
+	for (int i = 0; i < 4000; i++) {
+		auto xform = transform::translation(vec3(random_double(-70, 70), 0, random_double(-70, 70)))
+				   * transform::rotation_y(random_double(0, 90))
+				   * transform::scaling(vec3(random_double(0.2, 0.6), random_double(0.2, 2.0), random_double(0.2, 0.6)));
+		if (!moving) {
+			world.add(unit_box->transformed(xform));
+			continue;
+		}
+
+		keyframed_transform motion(xform);
+		motion.add(1, transform::translation(vec3(random_double(-2, 2), 0, random_double(-2, 2)))
+					  * xform * transform::rotation_y(random_double(-90, 90)));
+		world.add(make_shared<motion_instance>(unit_box, motion));
+	}
+
+	world = hittable_list(make_shared<bvh_node>(world));
+
+	cam.aspect_ratio = 16.0 / 9.0;
+	cam.image_width = 400;
+	cam.samples_per_pixel = 16;
+	cam.max_depth = 50;
+	cam.background = color(0.70, 0.80, 1.00);
+
+	cam.vfov = 30;
+	cam.lookfrom = point3(30, 8, 20);
+	cam.lookat = point3(0, 0, 0);
+	cam.vup = vec3(0, 1, 0);
+
+	cam.defocus_angle = 0;
+}
+
+struct benchmark_result {
+	std::string scene;
+	int width = 0;
+	int height = 0;
+	int samples_per_pixel = 0;
+	double build_seconds = 0;
+	double render_seconds = 0;
+	uint64_t primary_rays = 0;
+	render_counters counters;  // All zero unless built with RTW_STATS
+	uint64_t peak_rss = 0;     // The process's peak so far, so every earlier scene counts
+};
+
+bool run_benchmark(const std::string& name, int spp, int width, int threads, unsigned seed, benchmark_result& result) {
+	scene s;
+	seed_random(seed);
+
+	auto build_start = std::chrono::steady_clock::now();
+	if (name == "synthetic_field") synthetic_field(s, false);
+	else if (name == "synthetic_motion") synthetic_field(s, true);
+	else if (!builtin_scene(name, s)) {
+		std::cerr << "ERROR: Unknown benchmark scene '" << name << "'.\n";
+		return false;
+	}
+	auto build_end = std::chrono::steady_clock::now();
+
+	s.cam.samples_per_pixel = spp;
+	s.cam.image_width = width;
+	s.cam.thread_count = threads;
+	s.cam.seed = seed;
+	s.cam.show_progress = false;
+
+	rtw_stats::reset();
+
+	std::ostream discard(nullptr);
+	auto render_start = std::chrono::steady_clock::now();
+	s.render(discard);
+	auto render_end = std::chrono::steady_clock::now();
+
+	result.scene = name;
+	result.width = width;
+	result.height = std::max(1, int(width / s.cam.aspect_ratio));
+	result.samples_per_pixel = spp;
+	result.build_seconds = std::chrono::duration<double>(build_end - build_start).count();
+	result.render_seconds = std::chrono::duration<double>(render_end - render_start).count();
+	result.primary_rays = uint64_t(result.width) * result.height * spp;
+	result.counters = rtw_stats::collect();
+	result.peak_rss = peak_rss_bytes();
+	return true;
+}
+
+double per(double numerator, double denominator) {
+	return denominator > 0 ? numerator / denominator : 0;
+}
+
+void write_json(std::ostream& out, const std::vector<benchmark_result>& results, int threads, unsigned seed) {
+	out << "{\n"
+		<< "  \"threads\": " << threads << ",\n"
+		<< "  \"seed\": " << seed << ",\n"
+		<< "  \"counters\": " << (rtw_stats::enabled() ? "true" : "false") << ",\n"
+		<< "  \"results\": [\n";
+
+	for (size_t i = 0; i < results.size(); i++) {
+		const auto& r = results[i];
+		const auto& c = r.counters;
+		double rays = double(c.traced_rays());
+
+		out << "    {"
+			<< "\"scene\": \"" << r.scene << "\", "
+			<< "\"width\": " << r.width << ", "
+			<< "\"height\": " << r.height << ", "
+			<< "\"samples_per_pixel\": " << r.samples_per_pixel << ", "
+			<< "\"build_seconds\": " << r.build_seconds << ", "
+			<< "\"render_seconds\": " << r.render_seconds << ", "
+			<< "\"primary_rays\": " << r.primary_rays << ", "
+			<< "\"primary_rays_per_second\": " << per(double(r.primary_rays), r.render_seconds) << ", ";
+
+		if (rtw_stats::enabled()) {
+			out << "\"secondary_rays\": " << c.secondary_rays() << ", "
+				<< "\"shadow_rays\": " << c.shadow_rays << ", "
+				<< "\"secondary_rays_per_second\": " << per(double(c.secondary_rays()), r.render_seconds) << ", "
+				<< "\"bvh_nodes_per_ray\": " << per(double(c.bvh_node_visits), rays) << ", "
+				<< "\"primitive_tests_per_ray\": " << per(double(c.total_primitive_tests()), rays) << ", ";
+		}
+
+		out << "\"peak_rss_so_far_bytes\": " << r.peak_rss
+			<< "}" << (i + 1 < results.size() ? "," : "") << "\n";
+	}
+
+	out << "  ]\n}\n";
+}
+
+void print_table(std::ostream& out, const std::vector<benchmark_result>& results) {
+	char line[256];
+	if (rtw_stats::enabled())
+		std::snprintf(line, sizeof(line), "%-18s %9s %9s %12s %12s %10s %10s %11s\n",
+					  "scene", "build s", "render s", "primary/s", "second./s", "nodes/ray", "tests/ray", "max RSS MB");
+	else
+		std::snprintf(line, sizeof(line), "%-18s %9s %9s %12s %11s\n",
+					  "scene", "build s", "render s", "primary/s", "max RSS MB");
+	out << line;
+
+	for (const auto& r : results) {
+		const auto& c = r.counters;
+		double rays = double(c.traced_rays());
+		double primary_per_second = per(double(r.primary_rays), r.render_seconds);
+		double rss_mb = double(r.peak_rss) / (1024.0 * 1024.0);
+		if (rtw_stats::enabled())
+			std::snprintf(line, sizeof(line), "%-18s %9.3f %9.3f %12.0f %12.0f %10.2f %10.2f %11.1f\n",
+						  r.scene.c_str(), r.build_seconds, r.render_seconds, primary_per_second,
+						  per(double(c.secondary_rays()), r.render_seconds),
+						  per(double(c.bvh_node_visits), rays),
+						  per(double(c.total_primitive_tests()), rays),
+						  rss_mb);
+		else
+			std::snprintf(line, sizeof(line), "%-18s %9.3f %9.3f %12.0f %11.1f\n",
+						  r.scene.c_str(), r.build_seconds, r.render_seconds, primary_per_second, rss_mb);
+		out << line;
+	}
+
+	out << "max RSS is the process's peak so far, so it includes every earlier scene.\n";
+	if (!rtw_stats::enabled())
+		out << "Build with RTW_STATS defined for secondary rays and traversal counts.\n";
+}
+
+void print_usage(const char* program) {
+	std::cerr <<
+		"Usage: " << program << " [options]\n"
+		"\n"
+		"Options:\n"
+		"  --scenes <a,b,...>  Scenes to run (default: bouncing_spheres,cornell_box,\n"
+		"                      perlin_spheres,earth,synthetic_field); also\n"
+		"                      synthetic_motion, the field with everything moving\n"
+		"  --spp <n>           Samples per pixel (default 16)\n"
+		"  --width <n>         Image width (default 320)\n"
+		"  --threads <n>       Render threads, 0 for all hardware threads (default 0)\n"
+		"  --seed <n>          Seed for scene generation and sampling (default 1)\n"
+		"  --json <path>       Write JSON results to a file instead of stdout\n";
+}
+
+int main(int argc, char* argv[]) {
+	std::vector<std::string> scenes = { "bouncing_spheres", "cornell_box", "perlin_spheres", "earth", "synthetic_field" };
+	int spp = 16;
+	int width = 320;
+	int threads = 0;
+	unsigned seed = 1;
+	std::string json_path;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (i + 1 >= argc || arg.compare(0, 2, "--") != 0) {
+			print_usage(argv[0]);
+			return 1;
+		}
+		std::string value = argv[++i];
+
+		auto number = [&](long& out, long min) {
+			char* end = nullptr;
+			out = std::strtol(value.c_str(), &end, 10);
+			if (value.empty() || *end != '\0' || out < min) {
+				std::cerr << "ERROR: '" << arg << "' expects an integer of at least " << min << ", got '" << value << "'.\n";
+				return false;
+			}
+			return true;
+		};
+
+		long n = 0;
+		if (arg == "--scenes") {
+			scenes.clear();
+			std::istringstream list(value);
+			std::string name;
+			while (std::getline(list, name, ','))
+				if (!name.empty()) scenes.push_back(name);
+		}
+		else if (arg == "--spp") { if (!number(n, 1)) return 1; spp = int(n); }
+		else if (arg == "--width") { if (!number(n, 1)) return 1; width = int(n); }
+		else if (arg == "--threads") { if (!number(n, 0)) return 1; threads = int(n); }
+		else if (arg == "--seed") { if (!number(n, 0)) return 1; seed = unsigned(n); }
+		else if (arg == "--json") json_path = value;
+		else {
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	int thread_total = threads > 0 ? threads : std::max(1, int(std::thread::hardware_concurrency()));
+
+	std::vector<benchmark_result> results;
+	for (const auto& name : scenes) {
+		std::clog << "Running " << name << "..." << std::endl;
+		benchmark_result result;
+		if (!run_benchmark(name, spp, width, threads, seed, result)) return 1;
+		results.push_back(result);
+	}
+
+	print_table(std::clog, results);
+
+	if (json_path.empty()) {
+		write_json(std::cout, results, thread_total, seed);
+	}
+	else {
+		std::ofstream out(json_path);
+		if (!out) {
+			std::cerr << "ERROR: Could not open '" << json_path << "'.\n";
+			return 1;
+		}
+		write_json(out, results, thread_total, seed);
+	}
+
+	return 0;
+}
@@ -0,0 +1,309 @@
+// Kernel-level micro-benchmarks. Each kernel runs over a pre-generated batch
+// of inputs until a minimum time has passed, and reports ns/op and throughput
+// both as a table on stderr and as JSON, so a change to one hot function can
+// be measured on its own.
+//
+// This is a separate program from Benchmark.cpp so that a counting build of
+// that one (RTW_STATS) never puts counters into the kernels timed here.
+
+#include "rtweekend.h"
+
+#include "flat_texture.h"
+#include "material.h"
+#include "perlin.h"
+#include "primitives.h"
+#include "texture.h"
+
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+struct kernel_result {
+	std::string name;
+	uint64_t operations = 0;
+	double seconds = 0;
+
+	double ns_per_op() const { return operations ? 1e9 * seconds / double(operations) : 0; }
+	double ops_per_second() const { return seconds > 0 ? double(operations) / seconds : 0; }
+};
+
+// Keeps results observable so the optimizer cannot drop the work.
+volatile double benchmark_sink = 0;
+
+const size_t batch_size = 4096;
+
+// Runs `pass` (which performs batch_size operations) until `min_seconds` have passed.
+kernel_result measure(const std::string& name, double min_seconds, const std::function<double()>& pass) {
+	double sink = pass(); // warm up caches and branch predictors
+
+	kernel_result result;
+	result.name = name;
+
+	auto start = std::chrono::steady_clock::now();
+	do {
+		for (int i = 0; i < 16; i++) {
+			sink += pass();
+			result.operations += batch_size;
+		}
+		result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	} while (result.seconds < min_seconds);
+
+	benchmark_sink = benchmark_sink + sink;
+	return result;
+}
+
+// Rays from random points around the unit cube towards random points inside
+// it, so roughly half of them hit a primitive spanning that region.
+std::vector<ray> make_rays() {
+	std::vector<ray> rays;
+	rays.reserve(batch_size);
+	for (size_t i = 0; i < batch_size; i++) {
+		auto origin = unit_vector(vec3::random(-1, 1)) * 4;
+		auto target = vec3::random(-1.2, 1.2);
+		rays.emplace_back(origin, target - origin, random_double());
+	}
+	return rays;
+}
+
+// Hits gathered from a unit sphere, used as input for the scatter kernels.
+std::vector<hit_record> make_hits(const std::vector<ray>& rays, std::vector<ray>& hit_rays) {
+	auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+	sphere target(point3(0, 0, 0), 1, mat);
+
+	std::vector<hit_record> hits;
+	while (hits.size() < batch_size) {
+		for (const auto& r : rays) {
+			hit_record rec;
+			if (target.hit(r, interval(0.001, infinity), rec)) {
+				hits.push_back(rec);
+				hit_rays.push_back(r);
+				if (hits.size() == batch_size) break;
+			}
+		}
+	}
+	return hits;
+}
+
+double hit_pass(const hittable& object, const std::vector<ray>& rays) {
+	double sum = 0;
+	hit_record rec;
+	for (const auto& r : rays)
+		if (object.hit(r, interval(0.001, infinity), rec)) sum += rec.t;
+	return sum;
+}
+
+double scatter_pass(const material& mat, const std::vector<hit_record>& hits, const std::vector<ray>& rays) {
+	double sum = 0;
+	color attenuation;
+	ray scattered;
+	for (size_t i = 0; i < hits.size(); i++) {
+		if (mat.scatter(rays[i], hits[i], attenuation, scattered))
+			sum += scattered.direction().x() + attenuation.x();
+		sum += mat.emitted(hits[i].u, hits[i].v, hits[i].p).x();
+	}
+	return sum;
+}
+
+// One batched call over every hit, including drawing its random numbers.
+double scatter_batch_pass(const material& mat, hit_batch& batch, scatter_batch_result& out) {
+	batch.draw_random();
+	mat.scatter_batch(batch, 0, batch.size(), out);
+	double sum = 0;
+	for (size_t i = 0; i < out.size(); i++)
+		if (out.scattered[i]) sum += out.dir_x[i] + out.attenuation_r[i];
+	return sum;
+}
+
+void print_table(std::ostream& out, const std::vector<kernel_result>& results) {
+	char line[256];
+	std::snprintf(line, sizeof(line), "%-30s %10s %14s\n", "kernel", "ns/op", "Mops/s");
+	out << line;
+	for (const auto& r : results) {
+		std::snprintf(line, sizeof(line), "%-30s %10.2f %14.2f\n", r.name.c_str(), r.ns_per_op(), r.ops_per_second() / 1e6);
+		out << line;
+	}
+}
+
+void write_json(std::ostream& out, const std::vector<kernel_result>& results) {
+	out << "{\n  \"batch_size\": " << batch_size << ",\n  \"results\": [\n";
+	for (size_t i = 0; i < results.size(); i++) {
+		const auto& r = results[i];
+		out << "    {\"kernel\": \"" << r.name << "\", "
+			<< "\"operations\": " << r.operations << ", "
+			<< "\"seconds\": " << r.seconds << ", "
+			<< "\"ns_per_op\": " << r.ns_per_op() << ", "
+			<< "\"ops_per_second\": " << r.ops_per_second()
+			<< "}" << (i + 1 < results.size() ? "," : "") << "\n";
+	}
+	out << "  ]\n}\n";
+}
+
+void print_usage(const char* program) {
+	std::cerr <<
+		"Usage: " << program << " [options]\n"
+		"\n"
+		"Options:\n"
+		"  --filter <text>   Only run kernels whose name contains <text>\n"
+		"  --min-time <s>    Minimum time per kernel in seconds (default 0.25)\n"
+		"  --json <path>     Write JSON results to a file instead of stdout\n";
+}
+
+int main(int argc, char* argv[]) {
+	std::string filter;
+	std::string json_path;
+	double min_seconds = 0.25;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (i + 1 >= argc) {
+			print_usage(argv[0]);
+			return 1;
+		}
+		std::string value = argv[++i];
+
+		if (arg == "--filter") filter = value;
+		else if (arg == "--min-time") {
+			char* end = nullptr;
+			min_seconds = std::strtod(value.c_str(), &end);
+			if (value.empty() || *end != '\0' || !(min_seconds > 0)) {
+				std::cerr << "ERROR: '--min-time' expects a positive number, got '" << value << "'.\n";
+				return 1;
+			}
+		}
+		else if (arg == "--json") json_path = value;
+		else {
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	seed_random(1);
+
+	auto rays = make_rays();
+	std::vector<ray> hit_rays;
+	auto hits = make_hits(rays, hit_rays);
+
+	hit_batch batch;
+	scatter_batch_result batch_out;
+	batch.resize(hits.size());
+	batch_out.resize(hits.size());
+	for (size_t i = 0; i < hits.size(); i++) batch.set(i, hit_rays[i], hits[i]);
+
+	std::vector<point3> points(batch_size);
+	std::vector<double> us(batch_size), vs(batch_size);
+	for (size_t i = 0; i < batch_size; i++) {
+		points[i] = vec3::random(-50, 50);
+		us[i] = random_double();
+		vs[i] = random_double();
+	}
+
+	auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+	aabb box_bounds(point3(-1, -1, -1), point3(1, 1, 1));
+	sphere sphere_object(point3(0, 0, 0), 1, mat);
+	quad quad_object(point3(-1, -1, 0), vec3(2, 0, 0), vec3(0, 2, 0), mat);
+	triangle triangle_object(point3(-1, -1, 0), vec3(2, 0, 0), vec3(0, 2, 0), mat);
+	disk disk_object(point3(0, 0, 0), vec3(1, 0, 0), vec3(0, 1, 0), 1, mat);
+	perlin noise;
+	noise_texture baked_noise(4);
+	baked_noise.bake(point3(-50, -50, -50), point3(50, 50, 50), 128);
+	image_texture earth_texture("earthmap.jpg");
+
+	// The ground of bouncing_spheres, as a graph and compiled
+	auto checker_graph = make_shared<checker_texture>(0.32, color(0.2, 0.3, 0.1), color(0.9, 0.9, 0.9));
+	flat_texture checker_flat(*checker_graph);
+
+	lambertian lambertian_material(color(0.5, 0.5, 0.5));
+	metal metal_material(color(0.8, 0.8, 0.8), 0.3);
+	dielectric dielectric_material(1.5);
+	diffuse_light light_material(color(4, 4, 4));
+
+	struct kernel {
+		std::string name;
+		std::function<double()> pass;
+		bool needs_image = false;  // Times earth_texture, so it means nothing without the image
+	};
+
+	std::vector<kernel> kernels = {
+		{ "aabb::hit", [&]() {
+			double sum = 0;
+			for (const auto& r : rays) sum += box_bounds.hit(r, interval(0.001, infinity));
+			return sum;
+		} },
+		{ "sphere::hit",   [&]() { return hit_pass(sphere_object, rays); } },
+		{ "quad::hit",     [&]() { return hit_pass(quad_object, rays); } },
+		{ "triangle::hit", [&]() { return hit_pass(triangle_object, rays); } },
+		{ "disk::hit",     [&]() { return hit_pass(disk_object, rays); } },
+		{ "perlin::turb", [&]() {
+			double sum = 0;
+			for (const auto& p : points) sum += noise.turb(p, 7);
+			return sum;
+		} },
+		{ "noise_texture::value (baked)", [&]() {
+			double sum = 0;
+			for (const auto& p : points) sum += baked_noise.value(0, 0, p, 0).x();
+			return sum;
+		} },
+		{ "image_texture::value", [&]() {
+			double sum = 0;
+			for (size_t i = 0; i < batch_size; i++) sum += earth_texture.value(us[i], vs[i], points[i], 0).x();
+			return sum;
+		}, true },
+		{ "image_texture::value (mip)", [&]() {
+			double sum = 0;
+			for (size_t i = 0; i < batch_size; i++) sum += earth_texture.value(us[i], vs[i], points[i], 1.0 / 300).x();
+			return sum;
+		}, true },
+		{ "checker_texture::value", [&]() {
+			double sum = 0;
+			const texture& graph = *checker_graph;
+			for (const auto& p : points) sum += graph.value(0, 0, p, 0).x();
+			return sum;
+		} },
+		{ "flat_texture::value (checker)", [&]() {
+			double sum = 0;
+			for (const auto& p : points) sum += checker_flat.value(0, 0, p, 0).x();
+			return sum;
+		} },
+		{ "random_unit_vector", [&]() {
+			double sum = 0;
+			for (size_t i = 0; i < batch_size; i++) sum += random_unit_vector().x();
+			return sum;
+		} },
+		{ "lambertian::scatter",    [&]() { return scatter_pass(lambertian_material, hits, hit_rays); } },
+		{ "metal::scatter",         [&]() { return scatter_pass(metal_material, hits, hit_rays); } },
+		{ "dielectric::scatter",    [&]() { return scatter_pass(dielectric_material, hits, hit_rays); } },
+		{ "diffuse_light::scatter", [&]() { return scatter_pass(light_material, hits, hit_rays); } },
+		{ "lambertian::scatter_batch",    [&]() { return scatter_batch_pass(lambertian_material, batch, batch_out); } },
+		{ "metal::scatter_batch",         [&]() { return scatter_batch_pass(metal_material, batch, batch_out); } },
+		{ "dielectric::scatter_batch",    [&]() { return scatter_batch_pass(dielectric_material, batch, batch_out); } },
+		{ "diffuse_light::scatter_batch", [&]() { return scatter_batch_pass(light_material, batch, batch_out); } },
+	};
+
+	std::vector<kernel_result> results;
+	for (const auto& k : kernels) {
+		if (!filter.empty() && k.name.find(filter) == std::string::npos) continue;
+		if (k.needs_image && earth_texture.empty()) {
+			std::clog << "Skipping " << k.name << ": 'earthmap.jpg' did not load.\n";
+			continue;
+		}
+		results.push_back(measure(k.name, min_seconds, k.pass));
+	}
+
+	print_table(std::clog, results);
+
+	if (json_path.empty()) {
+		write_json(std::cout, results);
+	}
+	else {
+		std::ofstream out(json_path);
+		if (!out) {
+			std::cerr << "ERROR: Could not open '" << json_path << "'.\n";
+			return 1;
+		}
+		write_json(out, results);
+	}
+
+	return 0;
+}
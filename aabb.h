@@ -40,6 +40,13 @@ public:
 	}
 
 	bool hit(const ray& r, interval ray_t) const {
+		RTW_STAT(aabb_tests);
+		return clip(r, ray_t);
+	}
+
+	// Narrows `ray_t` to the part of the ray inside the box. Returns false,
+	// leaving `ray_t` undefined, if none of it is.
+	bool clip(const ray& r, interval& ray_t) const {
 		const point3& ray_orig = r.origin();
 		const vec3& ray_dir = r.direction();
 
@@ -0,0 +1,167 @@
+#ifndef ACCUMULATION_BUFFER_H
+#define ACCUMULATION_BUFFER_H
+
+#include "aov.h"
+#include "rtweekend.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+// Accumulation Buffer
+//
+// Running per-pixel radiance sums for progressive rendering. The image is cut
+// into square tiles, and every tile counts how many samples its pixels have
+// received and how many passes have been added to it.
+//
+// Each tile owns a block of weighted radiance sums and filter weights that
+// extends `margin` pixels past its edges, so a reconstruction filter wider
+// than a pixel can splat samples across the tile border without touching
+// another tile's data. Resolving a pixel adds up the blocks that overlap it,
+// always in the same order, so the image does not depend on which thread
+// rendered which tile.
+//
+// Render threads trace a pass of a tile into their own tile_pass and then add
+// it here under that tile's lock, together with first-hit AOVs when those are
+// being recorded. A reader taking a snapshot only ever waits for the one tile
+// being added at that moment, and never stalls the render.
+
+// One pass over one tile, in the layout of the tile's block: rows of
+// block_size() pixels starting `margin` pixels above and left of the tile.
+// AOVs are not filtered and cover just the tile, row by row.
+struct tile_pass {
+	std::vector<color> sums;
+	std::vector<double> weights;
+	std::vector<aov_sample> aovs;
+};
+
+class accumulation_buffer {
+public:
+	void reset(int image_width, int image_height, int tile_size, int filter_margin = 0, bool record_aovs = false) {
+		width = image_width;
+		height = image_height;
+		tile = tile_size;
+		margin = std::min(filter_margin, tile_size);
+		tiles_x = (width + tile - 1) / tile;
+		tiles_y = (height + tile - 1) / tile;
+
+		size_t block_pixels = size_t(block_size()) * block_size();
+		sums.assign(block_pixels * tile_count(), color(0, 0, 0));
+		weights.assign(block_pixels * tile_count(), 0.0);
+		aov_sums.assign(record_aovs ? size_t(width) * height : 0, aov_sample());
+		tiles.reset(new tile_state[tile_count()]);
+	}
+
+	int image_width() const { return width; }
+	int image_height() const { return height; }
+	int tile_size() const { return tile; }
+	int tile_margin() const { return margin; }
+	int block_size() const { return tile + 2 * margin; }
+	int tile_columns() const { return tiles_x; }
+	int tile_count() const { return tiles_x * tiles_y; }
+	bool has_aovs() const { return !aov_sums.empty(); }
+
+	// Pixel range [x0, x1) x [y0, y1) covered by a tile.
+	void tile_bounds(int index, int& x0, int& y0, int& x1, int& y1) const {
+		x0 = (index % tiles_x) * tile;
+		y0 = (index / tiles_x) * tile;
+		x1 = std::min(x0 + tile, width);
+		y1 = std::min(y0 + tile, height);
+	}
+
+	int tile_passes(int index) const {
+		return tiles[index].passes.load(std::memory_order_acquire);
+	}
+
+	// Adds one pass over a tile, in which each pixel took `samples` samples.
+	void add_tile(int index, const tile_pass& pass, int samples) {
+		auto& state = tiles[index];
+		std::lock_guard<std::mutex> lock(state.lock);
+
+		size_t block_pixels = size_t(block_size()) * block_size();
+		size_t base = block_pixels * index;
+		for (size_t k = 0; k < block_pixels; k++) {
+			sums[base + k] += pass.sums[k];
+			weights[base + k] += pass.weights[k];
+		}
+
+		if (has_aovs() && !pass.aovs.empty()) {
+			int x0, y0, x1, y1;
+			tile_bounds(index, x0, y0, x1, y1);
+			size_t k = 0;
+			for (int j = y0; j < y1; j++)
+				for (int i = x0; i < x1; i++)
+					aov_sums[size_t(j) * width + i] += pass.aovs[k++];
+		}
+
+		state.samples += samples;
+		state.passes.fetch_add(1, std::memory_order_release);
+	}
+
+	// Copies out the reconstructed image. Pixels that have no samples yet are black.
+	void resolve(std::vector<color>& image) const {
+		image.assign(size_t(width) * height, color(0, 0, 0));
+		std::vector<double> total_weights(image.size(), 0.0);
+
+		// Blocks in index order, so every pixel sums its overlapping blocks in the same order
+		int b = block_size();
+		for (int index = 0; index < tile_count(); index++) {
+			int bx = (index % tiles_x) * tile - margin;
+			int by = (index / tiles_x) * tile - margin;
+			size_t base = size_t(b) * b * index;
+
+			std::lock_guard<std::mutex> lock(tiles[index].lock);
+			for (int j = std::max(0, -by); j < b && by + j < height; j++) {
+				for (int i = std::max(0, -bx); i < b && bx + i < width; i++) {
+					size_t pixel = size_t(by + j) * width + (bx + i);
+					image[pixel] += sums[base + size_t(j) * b + i];
+					total_weights[pixel] += weights[base + size_t(j) * b + i];
+				}
+			}
+		}
+
+		for (size_t k = 0; k < image.size(); k++)
+			image[k] = std::fabs(total_weights[k]) > 1e-12 ? image[k] / total_weights[k] : color(0, 0, 0);
+	}
+
+	// Copies out the averaged AOVs, or nothing if they were not recorded.
+	void resolve_aovs(std::vector<aov_sample>& aovs) const {
+		aovs.resize(aov_sums.size());
+		if (aov_sums.empty()) return;
+
+		for (int index = 0; index < tile_count(); index++) {
+			int x0, y0, x1, y1;
+			tile_bounds(index, x0, y0, x1, y1);
+
+			auto& state = tiles[index];
+			std::lock_guard<std::mutex> lock(state.lock);
+
+			double scale = state.samples > 0 ? 1.0 / state.samples : 0.0;
+			for (int j = y0; j < y1; j++)
+				for (int i = x0; i < x1; i++)
+					aovs[size_t(j) * width + i] = aov_sums[size_t(j) * width + i] * scale;
+		}
+	}
+
+private:
+	struct tile_state {
+		mutable std::mutex lock;
+		int samples = 0;
+		std::atomic<int> passes{ 0 };
+	};
+
+	int width = 0;
+	int height = 0;
+	int tile = 16;
+	int margin = 0;
+	int tiles_x = 0;
+	int tiles_y = 0;
+
+	std::vector<color> sums;      // Per tile block, weighted by the filter
+	std::vector<double> weights;  // Per tile block
+	std::vector<aov_sample> aov_sums;
+	std::unique_ptr<tile_state[]> tiles;
+};
+
+#endif // !ACCUMULATION_BUFFER_H
@@ -0,0 +1,70 @@
+#ifndef AOV_H
+#define AOV_H
+
+#include "rtweekend.h"
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Auxiliary Output Variables
+//
+// What a camera ray saw at its first hit: the surface albedo, the shading
+// normal and the distance along the ray. Averaged over a pixel's samples they
+// give noise-free guide images for the denoiser. A ray that hits nothing
+// records the background as albedo, a zero normal and zero depth.
+
+struct aov_sample {
+	color albedo = color(0, 0, 0);
+	vec3 normal = vec3(0, 0, 0);
+	double depth = 0;
+
+	aov_sample& operator+=(const aov_sample& other) {
+		albedo += other.albedo;
+		normal += other.normal;
+		depth += other.depth;
+		return *this;
+	}
+
+	aov_sample operator*(double s) const {
+		aov_sample result;
+		result.albedo = s * albedo;
+		result.normal = s * normal;
+		result.depth = s * depth;
+		return result;
+	}
+};
+
+// Writes `<prefix>_albedo.ppm`, `<prefix>_normal.ppm` (mapped from [-1, 1]
+// to [0, 1]) and `<prefix>_depth.ppm` (nearest white, farthest black), without
+// gamma so the values can be read back directly.
+inline bool write_aov_images(const std::string& prefix, int width, int height, const std::vector<aov_sample>& aovs) {
+	double max_depth = 0;
+	for (const auto& a : aovs) max_depth = std::fmax(max_depth, a.depth);
+
+	auto byte = [](double x) { return int(255.999 * std::fmin(std::fmax(x, 0.0), 1.0)); };
+
+	const char* names[] = { "_albedo.ppm", "_normal.ppm", "_depth.ppm" };
+	for (int image = 0; image < 3; image++) {
+		std::ofstream out(prefix + names[image], std::ios::binary);
+		if (!out) {
+			std::cerr << "ERROR: Could not write '" << prefix + names[image] << "'.\n";
+			return false;
+		}
+
+		out << "P3\n" << width << ' ' << height << "\n255\n";
+		for (const auto& a : aovs) {
+			vec3 v;
+			if (image == 0) v = a.albedo;
+			else if (image == 1) v = 0.5 * (a.normal + vec3(1, 1, 1));
+			else {
+				double d = (a.depth > 0 && max_depth > 0) ? 1 - a.depth / max_depth : 0;
+				v = vec3(d, d, d);
+			}
+			out << byte(v.x()) << ' ' << byte(v.y()) << ' ' << byte(v.z()) << '\n';
+		}
+	}
+	return true;
+}
+
+#endif // !AOV_H
@@ -1,10 +1,28 @@
 #ifndef CAMERA_H
 #define CAMERA_H
 
+#include "accumulation_buffer.h"
+#include "denoise.h"
+#include "environment.h"
+#include "hdr_image.h"
+#include "pixel_filter.h"
 #include "hittable.h"
+#include "light_bvh.h"
 #include "material.h"
+#include "thread_pool.h"
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 class camera {
 public:
@@ -22,48 +40,272 @@ public:
 	double focus_dist = 10;
 
 	color background;
+	environment_light environment; // When set, seen by rays that miss instead of `background`
+
+	int thread_count = 0;   // Render threads, 0 uses every hardware thread
+	unsigned int seed = 0;  // Every pass over a tile derives its own random stream from this
+	bool show_progress = true;
+
+	// When set, the image so far is rewritten to this file (binary PPM) during
+	// the render, with the render status next to it in `<preview_path>.json`.
+	// The first write happens as soon as every pixel has a sample, then every
+	// `preview_interval` seconds, so a badly set up shot shows up early.
+	std::string preview_path;
+	double preview_interval = 10;
+
+	// Samples are spread over nearby pixels by the reconstruction filter. With
+	// sample_clamp above zero, the light a camera ray gathers beyond its first
+	// hit is scaled down to at most that (in its brightest channel), so rare
+	// very bright paths, e.g. caustics through glass, cannot leave fireflies.
+	// This trades a little energy in those highlights for far fewer samples.
+	pixel_filter filter;
+	double sample_clamp = 0;
+
+	// Trace each sample at four wavelengths instead of in RGB (spectrum.h),
+	// so dispersive glass splits light into its colors.
+	bool spectral = false;
+
+	// At diffuse surfaces and in media, also pick a light from a light BVH
+	// (light_bvh.h) and trace a shadow ray to it, weighing that against
+	// hitting the light by chance with multiple importance sampling.
+	bool sample_lights = true;
+
+	// First-hit albedo, normal and depth per pixel. With record_aovs the last
+	// render leaves them in `aovs`; with denoise they guide the denoiser, which
+	// then filters the image before it is written.
+	bool record_aovs = false;
+	bool denoise = false;
+	denoise_settings denoiser;
+	std::vector<aov_sample> aovs;
+
+	// How the linear image is turned into 8-bit output, and the linear image
+	// of the last render itself, which can be saved as a PFM and regraded.
+	image_grade grade;
+	std::vector<color> framebuffer;
+
+	// Wall time of every tile from the last render, summed over passes and
+	// row-major over the tile grid. Only recorded in RTW_STATS builds.
+	std::vector<double> tile_seconds;
+
+	struct render_status {
+		int passes_done = 0;         // Passes every tile has finished
+		int pass_count = 0;
+		int samples_done = 0;        // Samples per pixel in every finished pass
+		int samples_per_pixel = 0;
+		double seconds = 0;
+		double rays_per_second = 0;  // Camera rays, i.e. paths started
+		double eta_seconds = 0;
+		bool finished = false;
+	};
+
+	// Called from the rendering thread while the workers trace. Returning false cancels the render.
+	using status_callback = std::function<bool(const accumulation_buffer&, const render_status&)>;
+
+	// When set, render() also passes every status update here, e.g. to report
+	// progress somewhere other than the console.
+	std::function<void(const render_status&)> on_progress;
+
+	void render(const hittable& world) { render(world, std::cout); }
+
+	void render(const hittable& world, std::ostream& out) {
+		accumulation_buffer image;
+		render_status last;
+		auto last_preview = std::chrono::steady_clock::now();
+		bool previewed = false;
+
+		render_progressive(world, image, [&](const accumulation_buffer& buffer, const render_status& status) {
+			last = status;
+			if (show_progress) print_status(status);
+			if (on_progress) on_progress(status);
+
+			if (!preview_path.empty() && status.passes_done > 0) {
+				auto now = std::chrono::steady_clock::now();
+				bool due = !previewed || std::chrono::duration<double>(now - last_preview).count() >= preview_interval;
+				if (due || status.finished) {
+					write_preview(buffer, status);
+					last_preview = now;
+					previewed = true;
+				}
+			}
+			return true;
+		});
 
+		image.resolve(framebuffer);
+		image.resolve_aovs(aovs);
 
-	void render(const hittable& world) {
-		auto start = std::chrono::high_resolution_clock::now();
+		if (denoise) {
+			std::vector<color> filtered;
+			atrous_denoiser(denoiser).denoise(framebuffer, aovs, image_width, image_height, filtered);
+			framebuffer.swap(filtered);
+		}
 
-		initialize();
-		std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
+		write_ppm(out, image_width, image_height, framebuffer, grade, false);
 
-		for (int j = 0; j < image_height; j++) {
-			int percent = ((j * 1.0) / image_height) * 100;
+		if (show_progress) {
 			std::ostringstream oss;
-			oss << "\rScanlines remaining: " << (image_height - j)
-				<< ", " << percent << "% complete";
+			oss << "\rFinished Rendering in " << int(last.seconds) << " seconds.";
 			std::string output = oss.str();
 			output.resize(80, ' ');
-			std::clog << output << std::flush;
-			for (int i = 0; i < image_width; i++) {
-				color pixel_color(0, 0, 0);
-				for (int sample = 0; sample < samples_per_pixel; sample++) {
-					ray r = get_ray(i, j);
-					pixel_color += ray_color(r, max_depth, world);
+			std::clog << output << std::endl;
+		}
+	}
+
+	// Traces the image into `image` in passes: one sample per pixel first,
+	// then twice as many each pass up to max_pass_samples, so a complete if
+	// noisy picture exists early and keeps improving.
+	//
+	// Workers take (pass, tile) pairs from a shared counter. A tile's next pass
+	// only waits for that tile's previous pass, so threads never idle at a
+	// barrier between passes. Each pair seeds its own random stream and passes
+	// are added in order, which keeps the image identical for any thread count.
+	//
+	// `on_status` runs on the calling thread whenever a pass completes and at
+	// least every `update_interval` seconds. Returns false if it cancelled.
+	bool render_progressive(const hittable& world, accumulation_buffer& image, const status_callback& on_status, double update_interval = 0.1) {
+		auto start = std::chrono::steady_clock::now();
+
+		initialize();
+		lights = sample_lights ? light_bvh(world) : light_bvh();
+		environment_pick = !sample_lights || !environment ? 0 : lights.empty() ? 1 : 0.5;
+		image.reset(image_width, image_height, tile_size, filter.margin(), record_aovs || denoise);
+
+		auto passes = pass_schedule();
+		int pass_count = int(passes.size());
+		int tile_count = image.tile_count();
+		int item_count = tile_count * pass_count;
+		double total_rays = double(image_width) * image_height * std::max(1, samples_per_pixel);
+
+		std::atomic<int> next_item(0);
+		std::atomic<bool> cancelled(false);
+		std::atomic<uint64_t> camera_rays(0);
+		std::unique_ptr<std::atomic<int>[]> tiles_done(new std::atomic<int>[pass_count]);
+		for (int p = 0; p < pass_count; p++) tiles_done[p] = 0;
+
+		// Guarded by status_mutex
+		std::mutex status_mutex;
+		std::condition_variable status_changed;
+		int passes_done = 0;
+		int workers_done = 0;
+
+		tile_seconds.assign(rtw_stats::enabled() ? tile_count : 0, 0.0);
+
+		auto worker = [&]() {
+			tile_pass tile_result;
+			for (int item = next_item++; item < item_count && !cancelled; item = next_item++) {
+				int pass = item / tile_count;
+				int tile = item % tile_count;
+
+				// Another thread may still be adding this tile's previous pass.
+				while (image.tile_passes(tile) < pass && !cancelled)
+					std::this_thread::yield();
+				if (cancelled) break;
+
+#ifdef RTW_STATS
+				auto tile_start = std::chrono::steady_clock::now();
+#endif
+				seed_random(tile_seed(item));
+				camera_rays += render_tile(world, image, tile, passes[pass], tile_result);
+#ifdef RTW_STATS
+				// Before add_tile, which lets another thread take this tile's next pass
+				tile_seconds[tile] += std::chrono::duration<double>(std::chrono::steady_clock::now() - tile_start).count();
+#endif
+				image.add_tile(tile, tile_result, passes[pass]);
+
+				if (++tiles_done[pass] == tile_count) {
+					{
+						std::lock_guard<std::mutex> lock(status_mutex);
+						passes_done = std::max(passes_done, pass + 1);
+					}
+					status_changed.notify_one();
 				}
-				write_color(std::cout, pixel_samples_scale * pixel_color);
 			}
+			rtw_stats::flush();
+
+			{
+				std::lock_guard<std::mutex> lock(status_mutex);
+				workers_done++;
+			}
+			status_changed.notify_one();
+		};
+
+		int threads = thread_count > 0 ? thread_count : int(std::thread::hardware_concurrency());
+		threads = std::max(1, std::min(threads, tile_count));
+
+		auto& pool = thread_pool::shared();
+		pool.start(threads, worker);
+
+		int reported = 0;
+		std::unique_lock<std::mutex> lock(status_mutex);
+		while (true) {
+			status_changed.wait_for(lock, std::chrono::duration<double>(update_interval),
+				[&]() { return passes_done != reported || workers_done == threads; });
+
+			render_status status;
+			status.passes_done = reported = passes_done;
+			status.finished = workers_done == threads;
+			lock.unlock();
+
+			status.pass_count = pass_count;
+			status.samples_per_pixel = std::max(1, samples_per_pixel);
+			for (int p = 0; p < status.passes_done; p++) status.samples_done += passes[p];
+			status.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+			double rays = double(camera_rays);
+			status.rays_per_second = status.seconds > 0 ? rays / status.seconds : 0;
+			status.eta_seconds = rays > 0 ? status.seconds * (total_rays - rays) / rays : 0;
+
+			bool keep_going = on_status(image, status);
+			if (!keep_going) cancelled = true;
+
+			lock.lock();
+			if (status.finished || !keep_going) break;
 		}
+		lock.unlock();
 
-		auto end = std::chrono::high_resolution_clock::now();
-		auto duration = std::chrono::duration_cast<std::chrono::seconds>(end - start);
+		pool.wait();
 
-		std::ostringstream oss;
-		oss << "\rFinished Rendering in " << duration.count() << " seconds.";
-		std::string output = oss.str();
-		output.resize(80, ' ');
-		std::clog << output << std::flush;
+		return !cancelled;
+	}
+
+	// Writes the per-tile times of the last render as a PPM the size of the
+	// image, going from black (fastest tile) through red and yellow to white
+	// (slowest tile). Returns false if no timings were recorded.
+	bool write_tile_heatmap(std::ostream& out) const {
+		if (tile_seconds.empty()) return false;
+
+		int tiles_x = (image_width + tile_size - 1) / tile_size;
+		auto range = std::minmax_element(tile_seconds.begin(), tile_seconds.end());
+		double lo = *range.first;
+		double span = std::max(*range.second - lo, 1e-12);
 
-		std::clog << "\n\nPress [ENTER] to close..." << std::endl;
-		std::cin.get();
+		out << "P3\n" << image_width << ' ' << image_height << "\n255\n";
+		for (int j = 0; j < image_height; j++) {
+			for (int i = 0; i < image_width; i++) {
+				double t = (tile_seconds[(j / tile_size) * tiles_x + i / tile_size] - lo) / span;
+				int r = int(255.999 * std::min(1.0, 3 * t));
+				int g = int(255.999 * std::min(1.0, std::max(0.0, 3 * t - 1)));
+				int b = int(255.999 * std::min(1.0, std::max(0.0, 3 * t - 2)));
+				out << r << ' ' << g << ' ' << b << '\n';
+			}
+		}
+		return true;
+	}
+
+	// Writes a file under a temporary name and then renames it into place, so
+	// anyone polling it never reads it half written.
+	static bool replace_file(const std::string& filename, const std::string& contents) {
+		auto temp_filename = filename + ".tmp";
+		{
+			std::ofstream out(temp_filename, std::ios::binary);
+			if (!out.write(contents.data(), std::streamsize(contents.size()))) return false;
+		}
+		// rename() does not replace an existing file on Windows
+		std::remove(filename.c_str());
+		return std::rename(temp_filename.c_str(), filename.c_str()) == 0;
 	}
 
 private:
 	int image_height;
-	double pixel_samples_scale;
 	point3 center;
 	point3 pixel00_loc;
 	vec3 pixel_delta_u;
@@ -74,12 +316,16 @@ private:
 	vec3 defocus_disk_u;
 	vec3 defocus_disk_v;
 
+	light_bvh lights;
+	double environment_pick = 0; // The chance that a light sample goes to the environment
+
+	static const int tile_size = 16;
+	static const int max_pass_samples = 16;
+
 	void initialize() {
 		image_height = int(image_width / aspect_ratio);
 		image_height = (image_height < 1) ? 1 : image_height;
 
-		pixel_samples_scale = 1.0 / samples_per_pixel;
-
 		center = lookfrom;
 
 		auto theta = degrees_to_radians(vfov);
@@ -110,8 +356,136 @@ private:
 		defocus_disk_v = v * defocus_radius;
 	}
 
-	ray get_ray(int i, int j) {
-		auto offset = sample_square();
+	// Samples per pixel traced in each pass: 1, 1, 2, 4, ... up to max_pass_samples.
+	std::vector<int> pass_schedule() const {
+		std::vector<int> passes;
+		int remaining = std::max(1, samples_per_pixel);
+		int size = 1;
+		while (remaining > 0) {
+			passes.push_back(std::min(size, remaining));
+			remaining -= passes.back();
+			if (passes.size() > 1) size = std::min(2 * size, max_pass_samples);
+		}
+		return passes;
+	}
+
+	// Traces `samples` samples for every pixel of a tile into `pass`, splatting
+	// each into every pixel the filter reaches. Returns the number of camera
+	// rays traced.
+	uint64_t render_tile(const hittable& world, const accumulation_buffer& image, int tile, int samples, tile_pass& pass) const {
+		int x0, y0, x1, y1;
+		image.tile_bounds(tile, x0, y0, x1, y1);
+
+		int margin = image.tile_margin();
+		int block = image.block_size();
+		bool with_aovs = image.has_aovs();
+
+		pass.sums.assign(size_t(block) * block, color(0, 0, 0));
+		pass.weights.assign(size_t(block) * block, 0.0);
+		pass.aovs.clear();
+
+		double wx[2 * tile_size + 1], wy[2 * tile_size + 1];
+
+		for (int j = y0; j < y1; j++) {
+			for (int i = x0; i < x1; i++) {
+				size_t center = size_t(j - y0 + margin) * block + (i - x0 + margin);
+				aov_sample pixel_aovs;
+
+				for (int sample = 0; sample < samples; sample++) {
+					aov_sample first_hit;
+					auto offset = sample_square();
+					ray r = get_ray(i, j, offset);
+					color sample_color;
+					if (spectral) {
+						spectral_path path{ wavelengths::sample(random_double()) };
+						sample_color = path.lambda.to_rgb(ray_color(r, max_depth, world, camera_cone(), path, light_vertex(), with_aovs ? &first_hit : nullptr));
+					}
+					else {
+						rgb_path path;
+						sample_color = ray_color(r, max_depth, world, camera_cone(), path, light_vertex(), with_aovs ? &first_hit : nullptr);
+					}
+					if (with_aovs) pixel_aovs += first_hit;
+
+					if (filter.type == filter_box) {
+						pass.sums[center] += sample_color;
+						pass.weights[center] += 1;
+						continue;
+					}
+
+					// The sample sits at `offset` from this pixel's center, so at
+					// offset - d from the center of the pixel d away.
+					for (int d = -margin; d <= margin; d++) {
+						wx[d + margin] = filter.evaluate(offset.x() - d);
+						wy[d + margin] = filter.evaluate(offset.y() - d);
+					}
+					for (int dy = -margin; dy <= margin; dy++) {
+						for (int dx = -margin; dx <= margin; dx++) {
+							double w = wx[dx + margin] * wy[dy + margin];
+							if (w == 0) continue;
+							size_t k = center + std::ptrdiff_t(dy) * block + dx;
+							pass.sums[k] += w * sample_color;
+							pass.weights[k] += w;
+						}
+					}
+				}
+
+				if (with_aovs) pass.aovs.push_back(pixel_aovs);
+			}
+		}
+
+		return uint64_t(x1 - x0) * (y1 - y0) * samples;
+	}
+
+	void print_status(const render_status& status) const {
+		std::ostringstream oss;
+		oss << "\rPass " << status.passes_done << "/" << status.pass_count
+			<< ", " << status.samples_done << " of " << status.samples_per_pixel << " spp, "
+			<< std::fixed << std::setprecision(2) << status.rays_per_second / 1e6 << " Mrays/s, "
+			<< "ETA " << int(status.eta_seconds + 0.5) << "s";
+		std::string output = oss.str();
+		output.resize(80, ' ');
+		std::clog << output << std::flush;
+	}
+
+	// Rewrites the preview image and its status file. Each is written to a
+	// temporary file and renamed into place, so a viewer polling them never
+	// reads a half-written file.
+	bool write_preview(const accumulation_buffer& buffer, const render_status& status) const {
+		std::vector<color> pixels;
+		buffer.resolve(pixels);
+
+		std::ostringstream image;
+		write_ppm(image, image_width, image_height, pixels, grade, true);
+
+		std::ostringstream json;
+		json << "{\n"
+			<< "  \"passes_done\": " << status.passes_done << ",\n"
+			<< "  \"pass_count\": " << status.pass_count << ",\n"
+			<< "  \"samples_done\": " << status.samples_done << ",\n"
+			<< "  \"samples_per_pixel\": " << status.samples_per_pixel << ",\n"
+			<< "  \"seconds\": " << status.seconds << ",\n"
+			<< "  \"rays_per_second\": " << status.rays_per_second << ",\n"
+			<< "  \"eta_seconds\": " << status.eta_seconds << ",\n"
+			<< "  \"finished\": " << (status.finished ? "true" : "false") << "\n"
+			<< "}\n";
+
+		if (!replace_file(preview_path, image.str()) || !replace_file(preview_path + ".json", json.str())) {
+			std::cerr << "ERROR: Could not write preview '" << preview_path << "'.\n";
+			return false;
+		}
+		return true;
+	}
+
+	unsigned int tile_seed(int tile) const {
+		// murmur3 finalizer over the base seed and the tile index
+		unsigned int z = seed + 0x9e3779b9u * unsigned(tile + 1);
+		z = (z ^ (z >> 16)) * 0x85ebca6bu;
+		z = (z ^ (z >> 13)) * 0xc2b2ae35u;
+		return z ^ (z >> 16);
+	}
+
+	// A ray through pixel (i, j) at `offset` from its center, in pixels.
+	ray get_ray(int i, int j, const vec3& offset) const {
 		auto pixel_sample = pixel00_loc
 			+ ((i + offset.x()) * pixel_delta_u)
 			+ ((j + offset.y()) * pixel_delta_v);
@@ -133,29 +507,172 @@ private:
 		return center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
 	}
 
-	color ray_color(const ray& r, int depth, const hittable& world) const {
+	// How wide a ray's share of the pixel is as it travels: `width` where it
+	// starts, growing by `spread` per unit of distance. Texture lookups use
+	// this to pick a mip level. This tracks a cone rather than full ray
+	// differentials, which is enough to choose how blurry a lookup may be.
+	struct ray_cone {
+		double width;
+		double spread;
+	};
+
+	ray_cone camera_cone() const {
+		return ray_cone{ 0, pixel_delta_u.length() / focus_dist };
+	}
+
+	// What a path carries and how materials act on it: RGB, or the radiance
+	// at the path's wavelengths. ray_color is written once for both.
+	struct rgb_path {
+		using radiance = color;
+
+		radiance convert(const color& c) const { return c; }
+		static double brightest(const color& c) { return std::fmax(c.x(), std::fmax(c.y(), c.z())); }
+
+		bool scatter(const material& mat, const ray& r, const hit_record& rec, color& attenuation, ray& scattered) {
+			return mat.scatter(r, rec, attenuation, scattered);
+		}
+	};
+
+	struct spectral_path {
+		using radiance = spectrum;
+		wavelengths lambda;
+
+		radiance convert(const color& c) const { return lambda.from_rgb(c); }
+		static double brightest(const spectrum& s) { return s.max_value(); }
+
+		bool scatter(const material& mat, const ray& r, const hit_record& rec, spectrum& attenuation, ray& scattered) {
+			return mat.scatter_spectral(r, rec, lambda, attenuation, scattered);
+		}
+	};
+
+	// Where a path last sampled a light directly, so the light it then hits
+	// by scattering can be weighed against that.
+	struct light_vertex {
+		bool sampled = false;
+		point3 p;
+		vec3 normal;          // Zero in a medium
+		double scatter_pdf;   // Of the direction the path went on in
+	};
+
+	// `first_hit`, if given, receives the AOVs of where this ray lands.
+	template <typename Path>
+	typename Path::radiance ray_color(const ray& r, int depth, const hittable& world, ray_cone cone, Path& path,
+									  const light_vertex& from, aov_sample* first_hit = nullptr) const {
+		using radiance = typename Path::radiance;
+
 		if (depth <= 0) {
-			return color(0, 0, 0);
+			RTW_STAT(paths_killed_by_depth);
+			return radiance();
 		}
 
+		RTW_STAT(rays_by_depth[std::min(max_depth - depth, render_counters::depth_bins - 1)]);
+
 		hit_record rec;
 
 		if (!world.hit(r, interval(0.001, infinity), rec)) {
-			return background;
+			RTW_STAT(paths_escaped);
+			if (!environment) {
+				if (first_hit) *first_hit = aov_sample{ background, vec3(0, 0, 0), 0 };
+				return path.convert(background);
+			}
+
+			auto sky = environment.value(r.direction());
+			if (first_hit) *first_hit = aov_sample{ sky, vec3(0, 0, 0), 0 };
+			if (from.sampled && environment_pick > 0)
+				sky *= power_heuristic(from.scatter_pdf, environment_pick * environment.pdf(r.direction()));
+			return path.convert(sky);
 		}
 
-		ray scattered;
-		color attentuation;
+		// The cone's width where it meets the surface, stretched by grazing angles
+		auto distance = rec.t * r.direction().length();
+		cone.width += cone.spread * distance;
+		auto cosine = std::fabs(dot(rec.normal, r.direction())) / r.direction().length();
+		rec.footprint = cone.width / std::sqrt(std::fmax(cosine, 0.05)) * rec.uv_density;
+
+		if (first_hit) *first_hit = aov_sample{ rec.mat->albedo(rec), rec.normal, distance };
 
-		color color_from_emission = rec.mat->emitted(rec.u, rec.v, rec.p);
+		ray scattered;
+		radiance attentuation;
+
+		radiance color_from_emission;
+		if (rec.mat->is_emissive()) {
+			color_from_emission = path.convert(rec.mat->emitted(rec.u, rec.v, rec.p));
+			if (from.sampled) {
+				auto light_pdf = (1 - environment_pick) * lights.pdf(from.p, from.normal, r.time(), rec);
+				if (light_pdf > 0) color_from_emission *= power_heuristic(from.scatter_pdf, light_pdf);
+			}
+		}
 
-		if (!rec.mat->scatter(r, rec, attentuation, scattered))
+		if (!path.scatter(*rec.mat, r, rec, attentuation, scattered)) {
+			RTW_STAT(paths_absorbed);
 			return color_from_emission;
-		
-		color color_from_scatter = attentuation * ray_color(scattered, depth - 1, world);
+		}
+
+		radiance color_from_lights;
+		light_vertex here;
+		if (rec.mat->is_diffuse() && (!lights.empty() || environment_pick > 0)) {
+			color value;
+			here.sampled = rec.mat->evaluate(r, rec, scattered.direction(), value, here.scatter_pdf);
+			here.p = rec.p;
+			here.normal = rec.mat->is_volumetric() ? vec3(0, 0, 0) : rec.normal;
+			color_from_lights = light_sample_color(r, rec, here.normal, world, path);
+		}
+
+		radiance color_from_scatter = color_from_lights + attentuation * ray_color(scattered, depth - 1, world,
+			ray_cone{ cone.width, cone.spread + rec.mat->footprint_spread() }, path, here);
+
+		// Clamp everything a camera ray gathers past its first hit, so lights
+		// seen directly keep their full brightness.
+		if (sample_clamp > 0 && depth == max_depth) {
+			auto brightest = Path::brightest(color_from_scatter);
+			if (brightest > sample_clamp) color_from_scatter *= sample_clamp / brightest;
+		}
 
 		return color_from_emission + color_from_scatter;
 	}
+
+	// The light reaching `rec` straight from one light picked by the light
+	// BVH, or from the environment, weighted against the material having
+	// scattered toward it.
+	template <typename Path>
+	typename Path::radiance light_sample_color(const ray& r, const hit_record& rec, const vec3& normal, const hittable& world, Path& path) const {
+		using radiance = typename Path::radiance;
+
+		bool to_environment = environment_pick >= 1 || (environment_pick > 0 && random_double() < environment_pick);
+		vec3 to_light;
+		double light_pdf, dist;
+		color emission;
+		if (to_environment) {
+			if (!environment.sample(random_double(), random_double(), to_light, light_pdf)) return radiance();
+			light_pdf *= environment_pick;
+			emission = environment.value(to_light);
+			dist = infinity;
+		}
+		else {
+			light_sample s;
+			if (!lights.sample(rec.p, normal, r.time(), s)) return radiance();
+			to_light = s.p - rec.p;
+			light_pdf = s.pdf * (1 - environment_pick);
+			emission = s.emission;
+			dist = to_light.length();
+		}
+
+		color value;
+		double scatter_pdf;
+		if (!rec.mat->evaluate(r, rec, to_light, value, scatter_pdf) || scatter_pdf <= 0) return radiance();
+
+		// A surface in the way shadows it; a medium dims it by what gets through
+		RTW_STAT(shadow_rays);
+		auto direction = to_environment ? to_light : to_light / dist;
+		double transmitted = world.transmittance(ray(rec.p, direction, r.time()), interval(0.001, dist - 0.001));
+		if (transmitted <= 0) return radiance();
+
+		return path.convert(transmitted * power_heuristic(light_pdf, scatter_pdf) / light_pdf * value) * path.convert(emission);
+	}
+
+	static double power_heuristic(double pdf, double other_pdf) {
+		return pdf * pdf / (pdf * pdf + other_pdf * other_pdf);
+	}
 };
 
 #endif
@@ -0,0 +1,220 @@
+#ifndef DENOISE_H
+#define DENOISE_H
+
+#include "aov.h"
+#include "rtweekend.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// Denoiser
+//
+// Edge-avoiding a-trous wavelet filter (Dammertz et al., "Edge-Avoiding
+// A-Trous Wavelet Transform for fast Global Illumination Filtering", 2010).
+// Each iteration applies a 5x5 B3-spline kernel whose taps are spread
+// 2^iteration pixels apart, so five iterations cover a 61x61 footprint for
+// the cost of 125 taps. Every tap is weighted down where the AOVs say it lies
+// across an edge: a different normal, depth or albedo, or (with a threshold
+// that halves every iteration) a different color.
+//
+// The filter runs on irradiance, i.e. color divided by first-hit albedo, and
+// multiplies the albedo back in at the end, so texture detail is kept sharp
+// instead of being blurred along with the noise.
+//
+// The image is held as padded float planes, one per channel, so the inner
+// loop over a row is branch-free and contiguous and the compiler can
+// vectorize it. Rows are split between the shared pool's threads.
+
+struct denoise_settings {
+	int iterations      = 5;
+	float sigma_color   = 1.0f;  // Color difference, on values compressed by x / (1 + x)
+	float sigma_normal  = 0.1f;  // Normal difference, 1 - cos(angle)
+	float sigma_depth   = 0.05f; // Depth difference relative to the depth
+	float sigma_albedo  = 0.1f;
+	int thread_count    = 0;     // 0 uses every hardware thread
+};
+
+class atrous_denoiser {
+public:
+	atrous_denoiser(const denoise_settings& settings) : settings(settings) {}
+
+	// Filters `image` (linear, width * height, row-major) guided by `aovs` in
+	// the same layout, leaving the result in `result`.
+	void denoise(const std::vector<color>& image, const std::vector<aov_sample>& aovs, int image_width, int image_height, std::vector<color>& result) {
+		width = image_width;
+		height = image_height;
+		pad = 2 << std::max(0, settings.iterations - 1);
+		stride = width + 2 * pad;
+
+		for (auto& p : color_planes) p.assign(plane_size(), 0.0f);
+		for (auto& p : next_planes) p.assign(plane_size(), 0.0f);
+		for (auto& p : albedo_planes) p.assign(plane_size(), 0.0f);
+		for (auto& p : normal_planes) p.assign(plane_size(), 0.0f);
+		depth_plane.assign(plane_size(), 0.0f);
+
+		for (int j = 0; j < height; j++) {
+			for (int i = 0; i < width; i++) {
+				const auto& a = aovs[size_t(j) * width + i];
+				const auto& c = image[size_t(j) * width + i];
+				size_t k = index(i, j);
+				for (int ch = 0; ch < 3; ch++) {
+					albedo_planes[ch][k] = float(a.albedo[ch]);
+					normal_planes[ch][k] = float(a.normal[ch]);
+					color_planes[ch][k] = float(c[ch] / (a.albedo[ch] + albedo_epsilon));
+				}
+				depth_plane[k] = float(a.depth);
+			}
+		}
+
+		for (auto& p : albedo_planes) fill_border(p);
+		for (auto& p : normal_planes) fill_border(p);
+		fill_border(depth_plane);
+
+		for (int iteration = 0; iteration < settings.iterations; iteration++) {
+			for (auto& p : color_planes) fill_border(p);
+			run_rows([&](int row) { filter_row(row, 1 << iteration, iteration); });
+			std::swap(color_planes, next_planes);
+		}
+
+		result.resize(size_t(width) * height);
+		for (int j = 0; j < height; j++) {
+			for (int i = 0; i < width; i++) {
+				size_t k = index(i, j);
+				const auto& a = aovs[size_t(j) * width + i];
+				result[size_t(j) * width + i] = color(
+					color_planes[0][k] * (a.albedo[0] + albedo_epsilon),
+					color_planes[1][k] * (a.albedo[1] + albedo_epsilon),
+					color_planes[2][k] * (a.albedo[2] + albedo_epsilon));
+			}
+		}
+	}
+
+private:
+	denoise_settings settings;
+	int width = 0;
+	int height = 0;
+	int pad = 0;
+	int stride = 0;
+
+	std::vector<float> color_planes[3];
+	std::vector<float> next_planes[3];
+	std::vector<float> albedo_planes[3];
+	std::vector<float> normal_planes[3];
+	std::vector<float> depth_plane;
+
+	static constexpr double albedo_epsilon = 0.01;
+
+	size_t plane_size() const { return size_t(stride) * (height + 2 * pad); }
+	size_t index(int i, int j) const { return size_t(j + pad) * stride + (i + pad); }
+
+	// Repeats the edge pixels into the padding, so taps past the image border
+	// read the nearest pixel inside it.
+	void fill_border(std::vector<float>& plane) const {
+		for (int j = -pad; j < height + pad; j++) {
+			int sj = std::min(std::max(j, 0), height - 1);
+			float* row = &plane[size_t(j + pad) * stride];
+			const float* src = &plane[size_t(sj + pad) * stride];
+			for (int i = 0; i < pad; i++) row[i] = src[pad];
+			if (j != sj) for (int i = pad; i < pad + width; i++) row[i] = src[i];
+			for (int i = pad + width; i < stride; i++) row[i] = src[pad + width - 1];
+		}
+	}
+
+	template <typename Row>
+	void run_rows(const Row& row_function) const {
+		int threads = settings.thread_count > 0 ? settings.thread_count : int(std::thread::hardware_concurrency());
+		threads = std::max(1, std::min(threads, height));
+
+		std::atomic<int> next_row(0);
+		auto worker = [&]() {
+			for (int row = next_row++; row < height; row = next_row++)
+				row_function(row);
+		};
+
+		auto& pool = thread_pool::shared();
+		pool.start(threads, worker);
+		pool.wait();
+	}
+
+	void filter_row(int j, int step, int iteration) {
+		static const float kernel[5] = { 1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16 };
+
+		float sigma_c = settings.sigma_color / float(1 << iteration);
+		float inv_color = 1.0f / (sigma_c * sigma_c);
+		float inv_normal = 1.0f / settings.sigma_normal;
+		float inv_depth = 1.0f / (settings.sigma_depth * settings.sigma_depth);
+		float inv_albedo = 1.0f / (settings.sigma_albedo * settings.sigma_albedo);
+
+		std::vector<float> sum_r(width, 0.0f), sum_g(width, 0.0f), sum_b(width, 0.0f), weights(width, 0.0f);
+
+		size_t center = index(0, j);
+		const float* cr = &color_planes[0][center];
+		const float* cg = &color_planes[1][center];
+		const float* cb = &color_planes[2][center];
+		const float* ar = &albedo_planes[0][center];
+		const float* ag = &albedo_planes[1][center];
+		const float* ab = &albedo_planes[2][center];
+		const float* nx = &normal_planes[0][center];
+		const float* ny = &normal_planes[1][center];
+		const float* nz = &normal_planes[2][center];
+		const float* d = &depth_plane[center];
+
+		for (int ky = -2; ky <= 2; ky++) {
+			for (int kx = -2; kx <= 2; kx++) {
+				float h = kernel[ky + 2] * kernel[kx + 2];
+				std::ptrdiff_t offset = std::ptrdiff_t(ky * step) * stride + kx * step;
+
+				const float* qr = cr + offset;
+				const float* qg = cg + offset;
+				const float* qb = cb + offset;
+				const float* qar = ar + offset;
+				const float* qag = ag + offset;
+				const float* qab = ab + offset;
+				const float* qnx = nx + offset;
+				const float* qny = ny + offset;
+				const float* qnz = nz + offset;
+				const float* qd = d + offset;
+
+				for (int i = 0; i < width; i++) {
+					float dr = qr[i] / (1 + qr[i]) - cr[i] / (1 + cr[i]);
+					float dg = qg[i] / (1 + qg[i]) - cg[i] / (1 + cg[i]);
+					float db = qb[i] / (1 + qb[i]) - cb[i] / (1 + cb[i]);
+					float color_distance = dr * dr + dg * dg + db * db;
+
+					float normal_distance = std::max(0.0f, 1.0f - (nx[i] * qnx[i] + ny[i] * qny[i] + nz[i] * qnz[i]));
+
+					// Misses have zero depth, so this also keeps background and geometry apart
+					float depth_difference = (qd[i] - d[i]) / (d[i] + 1e-3f);
+					float depth_distance = depth_difference * depth_difference;
+
+					float da_r = qar[i] - ar[i], da_g = qag[i] - ag[i], da_b = qab[i] - ab[i];
+					float albedo_distance = da_r * da_r + da_g * da_g + da_b * da_b;
+
+					float w = h * std::exp(-(color_distance * inv_color + normal_distance * inv_normal
+						+ depth_distance * inv_depth + albedo_distance * inv_albedo));
+
+					sum_r[i] += w * qr[i];
+					sum_g[i] += w * qg[i];
+					sum_b[i] += w * qb[i];
+					weights[i] += w;
+				}
+			}
+		}
+
+		float* out_r = &next_planes[0][center];
+		float* out_g = &next_planes[1][center];
+		float* out_b = &next_planes[2][center];
+		for (int i = 0; i < width; i++) {
+			// The center tap always has weight kernel[2]^2, so this never divides by zero
+			float inv = 1.0f / weights[i];
+			out_r[i] = sum_r[i] * inv;
+			out_g[i] = sum_g[i] * inv;
+			out_b[i] = sum_b[i] * inv;
+		}
+	}
+};
+
+#endif // !DENOISE_H
@@ -2,6 +2,8 @@
 #define DISK_H
 
 #include "hittable.h"
+#include "light.h"
+#include "material.h"
 
 class disk : public hittable {
 public:
@@ -12,6 +14,7 @@ public:
 		normal = unit_vector(n);
 		D = dot(normal, Q);
 		w = n / dot(n, n);
+		uv_density = 1 / std::sqrt(n.length());
 
 		set_bounding_box();
 	}
@@ -24,8 +27,17 @@ public:
 
 	aabb bounding_box() const override { return bbox; }
 
+	void gather_lights(std::vector<light_source>& lights) const override {
+		if (!mat->is_emissive()) return;
+		auto light = light_source::flat(light_source::ellipse_shape, this, mat.get(), Q, r * u, r * v);
+		light.uv_u = vec3(r, 0, 0);
+		light.uv_v = vec3(0, r, 0);
+		lights.push_back(light);
+	}
+
 	bool hit(const ray& r, interval ray_t, hit_record& rec) const override
 	{
+		RTW_STAT(primitive_tests[stat_disk]);
 		auto denom = dot(normal, r.direction());
 
 		if (std::fabs(denom) < 1e-8) return false;
@@ -42,8 +54,10 @@ public:
 
 		rec.t = t;
 		rec.p = intersection;
-		rec.mat = mat;
+		rec.mat = mat.get();
+		rec.object = this;
 		rec.set_face_normal(r, normal);
+		rec.uv_density = uv_density;
 
 		return true;
 	}
@@ -66,6 +80,7 @@ private:
 	double r;
 	vec3 normal;
 	double D;
+	double uv_density; // u and v run along the edge vectors, so one uv unit covers |u x v|
 	aabb bbox;
 
 	shared_ptr<material> mat;
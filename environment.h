@@ -0,0 +1,189 @@
+#ifndef ENVIRONMENT_H
+#define ENVIRONMENT_H
+
+#include "rtweekend.h"
+#include "rtw_stb_image.h"
+
+#include <algorithm>
+#include <vector>
+
+// Environment Map
+//
+// An equirectangular HDR image of everything around the scene, seen by any
+// ray that misses it. Up (+y) is the top row, and u runs around the horizon
+// as it does on a sphere (sphere::get_sphere_uv).
+//
+// A sunny sky gets nearly all its light from a few texels, which a diffuse
+// bounce only finds by chance. So the map also keeps a piecewise-constant
+// distribution over its texels, proportional to their luminance times
+// sin(theta), the area of sphere each row covers: a marginal CDF picks a
+// row, that row's CDF a texel in it. Directions toward the sun are then
+// picked about as often as it contributes light.
+
+class environment_map {
+public:
+	// Loads the image at `filename` (.hdr, or any image stb_image reads).
+	// Returns null, with the reason on std::cerr, if that fails.
+	static shared_ptr<environment_map> load(const std::string& filename) {
+		auto image = make_shared<rtw_image>(filename.c_str(), true);
+		if (image->width() == 0 || image->height() == 0) return nullptr;
+		return make_shared<environment_map>(image);
+	}
+
+	explicit environment_map(shared_ptr<rtw_image> image)
+		: image(image), width(image->width()), height(image->height())
+	{
+		row_cdfs.resize(size_t(height) * (width + 1));
+		row_sums.resize(height);
+		marginal_cdf.resize(height + 1);
+
+		for (int row = 0; row < height; row++) {
+			double sin_theta = std::sin(pi * (row + 0.5) / height);
+			double* cdf = &row_cdfs[size_t(row) * (width + 1)];
+			cdf[0] = 0;
+			for (int col = 0; col < width; col++)
+				cdf[col + 1] = cdf[col] + luminance(texel(col, row)) * sin_theta;
+			row_sums[row] = cdf[width];
+			marginal_cdf[row + 1] = marginal_cdf[row] + row_sums[row];
+		}
+		total = marginal_cdf[height];
+	}
+
+	// The radiance arriving from `direction`, which need not be unit length
+	color value(const vec3& direction) const {
+		double u, t;
+		to_image(unit_vector(direction), u, t);
+		return texel(column(u), row(t));
+	}
+
+	// A direction toward the map, from two uniform numbers, and its density
+	// per unit solid angle.
+	bool sample(double r1, double r2, vec3& direction, double& pdf) const {
+		double u, t;
+		if (total > 0) {
+			int r = pick(marginal_cdf.data(), height, r1 * total);
+			t = (r + offset(marginal_cdf.data(), r, r1 * total)) / height;
+
+			const double* cdf = &row_cdfs[size_t(r) * (width + 1)];
+			int c = pick(cdf, width, r2 * row_sums[r]);
+			u = (c + offset(cdf, c, r2 * row_sums[r])) / width;
+		}
+		else {
+			u = r1;
+			t = r2;
+		}
+
+		double theta = pi * t, phi = 2 * pi * u;
+		double sin_theta = std::sin(theta);
+		direction = vec3(-sin_theta * std::cos(phi), std::cos(theta), sin_theta * std::sin(phi));
+		pdf = image_pdf(u, t, sin_theta);
+		return pdf > 0;
+	}
+
+	// The density with which sample() picks `direction`
+	double pdf(const vec3& direction) const {
+		auto d = unit_vector(direction);
+		double u, t;
+		to_image(d, u, t);
+		return image_pdf(u, t, std::sqrt(std::fmax(0.0, 1 - d.y() * d.y())));
+	}
+
+private:
+	shared_ptr<rtw_image> image;
+	int width, height;
+	std::vector<double> row_cdfs;      // Per row, width + 1 running sums
+	std::vector<double> row_sums;
+	std::vector<double> marginal_cdf;  // height + 1 running sums of row_sums
+	double total = 0;
+
+	color texel(int col, int row) const {
+		auto pixel = image->float_pixel_data(col, row);
+		return color(pixel[0], pixel[1], pixel[2]);
+	}
+
+	int column(double u) const { return std::min(int(u * width), width - 1); }
+	int row(double t) const { return std::min(int(t * height), height - 1); }
+
+	static double luminance(const color& c) {
+		return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+	}
+
+	// u around the horizon as on a sphere, t from the top row down, both in [0, 1]
+	static void to_image(const vec3& d, double& u, double& t) {
+		u = (std::atan2(-d.z(), d.x()) + pi) / (2 * pi);
+		t = std::acos(std::fmax(-1.0, std::fmin(1.0, d.y()))) / pi;
+	}
+
+	// The bin of `cdf`, of `count` bins, that `value` falls in, skipping empty ones
+	static int pick(const double* cdf, int count, double value) {
+		int bin = int(std::upper_bound(cdf, cdf + count + 1, value) - cdf) - 1;
+		bin = std::max(0, std::min(bin, count - 1));
+		while (bin > 0 && cdf[bin + 1] == cdf[bin]) bin--;
+		while (bin < count - 1 && cdf[bin + 1] == cdf[bin]) bin++;
+		return bin;
+	}
+
+	// Where in `bin` `value` falls, from 0 to just under 1, so the point
+	// stays in the bin pdf() finds for it.
+	static double offset(const double* cdf, int bin, double value) {
+		double f = (value - cdf[bin]) / (cdf[bin + 1] - cdf[bin]);
+		return std::fmax(0.0, std::fmin(f, 0.999999));
+	}
+
+	// The density over the unit square of the image, turned into one per
+	// unit solid angle: the image covers 2 pi * pi of (phi, theta), and
+	// each of those covers sin(theta) of solid angle.
+	double image_pdf(double u, double t, double sin_theta) const {
+		if (sin_theta <= 0) return 0;
+		double density = 1;
+		if (total > 0) {
+			int r = row(t), c = column(u);
+			const double* cdf = &row_cdfs[size_t(r) * (width + 1)];
+			density = (cdf[c + 1] - cdf[c]) / total * width * height;
+		}
+		return density / (2 * pi * pi * sin_theta);
+	}
+};
+
+// An environment map as a scene lights with it: brightened by `intensity`
+// and turned by `rotation` degrees about +y.
+class environment_light {
+public:
+	shared_ptr<environment_map> map;
+	double intensity = 1;
+	double rotation = 0;
+
+	environment_light() {}
+
+	environment_light(shared_ptr<environment_map> map, double intensity, double rotation)
+		: map(map), intensity(intensity), rotation(rotation) {}
+
+	explicit operator bool() const { return map != nullptr; }
+
+	color value(const vec3& direction) const {
+		return intensity * map->value(to_map(direction));
+	}
+
+	bool sample(double r1, double r2, vec3& direction, double& pdf) const {
+		vec3 d;
+		if (!map->sample(r1, r2, d, pdf)) return false;
+		direction = from_map(d);
+		return true;
+	}
+
+	double pdf(const vec3& direction) const {
+		return map->pdf(to_map(direction));
+	}
+
+private:
+	vec3 to_map(const vec3& d) const { return turn(d, -rotation); }
+	vec3 from_map(const vec3& d) const { return turn(d, rotation); }
+
+	static vec3 turn(const vec3& d, double angle) {
+		if (angle == 0) return d;
+		double c = std::cos(degrees_to_radians(angle)), s = std::sin(degrees_to_radians(angle));
+		return vec3(c * d.x() + s * d.z(), d.y(), -s * d.x() + c * d.z());
+	}
+};
+
+#endif // !ENVIRONMENT_H
@@ -0,0 +1,153 @@
+#ifndef FLAT_TEXTURE_H
+#define FLAT_TEXTURE_H
+
+#include "texture.h"
+
+#include <vector>
+
+// Flattened Textures
+//
+// Textures form a graph: a checker holds two more textures, and every
+// material color is a texture, even a constant one. Evaluating one through
+// texture::value is a chain of virtual calls. A flat_texture compiles the
+// graph once into an array of nodes and evaluates it with a switch, calling
+// the leaf textures it knows non-virtually so they can be inlined.
+//
+// Constants are folded on the way: a solid color becomes a value stored in
+// the node, a checker of two constants keeps both colors inline, and a
+// checker whose two sides are the same color is just that color. A texture
+// that ends up constant costs one branch to evaluate. Checkers that nest
+// other checkers are followed in a loop rather than by recursion.
+//
+// Texture kinds the compiler does not know are still called virtually.
+
+class flat_texture {
+public:
+	flat_texture() : flat_texture(color(0, 0, 0)) {}
+
+	flat_texture(const color& c) {
+		nodes.push_back(constant_node(c));
+	}
+
+	// Compiles `tex`. The nodes point into the graph, which must outlive them.
+	flat_texture(const texture& tex) {
+		compile(tex);
+	}
+
+	// True if the texture is the same everywhere; constant() is then its color.
+	bool is_constant() const { return nodes[0].kind == node_constant; }
+	const color& constant() const { return nodes[0].a; }
+
+	color value(double u, double v, const point3& p, double footprint) const {
+		if (is_constant()) return nodes[0].a;
+		return evaluate(u, v, p, footprint);
+	}
+
+	size_t node_count() const { return nodes.size(); }
+
+private:
+	enum node_kind {
+		node_constant,         // a
+		node_checker_constant, // a where even, b where odd
+		node_checker,          // Continue at node `even` or `odd`
+		node_image,
+		node_noise,
+		node_virtual           // Any other texture, through texture::value
+	};
+
+	struct node {
+		node_kind kind;
+		int even = 0;
+		int odd = 0;
+		double inv_scale = 0;
+		color a, b;
+		const texture* source = nullptr;
+	};
+
+	std::vector<node> nodes; // The root first
+
+	static node constant_node(const color& c) {
+		node n;
+		n.kind = node_constant;
+		n.a = c;
+		return n;
+	}
+
+	// Same cells as checker_texture, with a floor that is not a library call
+	static bool is_even(const node& n, const point3& p) {
+		auto x = floor_int(n.inv_scale * p.x());
+		auto y = floor_int(n.inv_scale * p.y());
+		auto z = floor_int(n.inv_scale * p.z());
+		return (x + y + z) % 2 == 0;
+	}
+
+	// Appends the node for `tex`, and those of anything it holds, and
+	// returns its index.
+	int compile(const texture& tex) {
+		int index = int(nodes.size());
+		nodes.emplace_back();
+
+		node n;
+		if (auto solid = dynamic_cast<const solid_color*>(&tex)) {
+			n = constant_node(solid->albedo);
+		}
+		else if (auto checker = dynamic_cast<const checker_texture*>(&tex)) {
+			int even = compile(*checker->even);
+			int odd = compile(*checker->odd);
+			const auto& e = nodes[even];
+			const auto& o = nodes[odd];
+
+			if (e.kind == node_constant && o.kind == node_constant) {
+				n = constant_node(e.a);
+				if (e.a.x() != o.a.x() || e.a.y() != o.a.y() || e.a.z() != o.a.z()) {
+					n.kind = node_checker_constant;
+					n.b = o.a;
+				}
+				nodes.resize(index + 1); // The two constants now live in this node
+			}
+			else {
+				n.kind = node_checker;
+				n.even = even;
+				n.odd = odd;
+			}
+			n.inv_scale = checker->inv_scale;
+		}
+		else if (dynamic_cast<const image_texture*>(&tex)) {
+			n.kind = node_image;
+		}
+		else if (dynamic_cast<const noise_texture*>(&tex)) {
+			n.kind = node_noise;
+		}
+		else {
+			n.kind = node_virtual;
+		}
+
+		if (n.source == nullptr) n.source = &tex;
+		nodes[index] = n;
+		return index;
+	}
+
+	color evaluate(double u, double v, const point3& p, double footprint) const {
+		int index = 0;
+		while (true) {
+			const auto& n = nodes[index];
+			switch (n.kind) {
+			case node_constant:
+				return n.a;
+			case node_checker_constant:
+				return is_even(n, p) ? n.a : n.b;
+			case node_checker:
+				index = is_even(n, p) ? n.even : n.odd;
+				break;
+			case node_image:
+				return static_cast<const image_texture*>(n.source)->image_texture::value(u, v, p, footprint);
+			case node_noise:
+				return static_cast<const noise_texture*>(n.source)->noise_texture::value(u, v, p, footprint);
+			default:
+				return n.source->value(u, v, p, footprint);
+			}
+		}
+	}
+};
+
+#endif // !FLAT_TEXTURE_H
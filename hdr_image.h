@@ -0,0 +1,199 @@
+#ifndef HDR_IMAGE_H
+#define HDR_IMAGE_H
+
+#include "rtweekend.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// HDR Images
+//
+// Renders finish as a linear, unclamped framebuffer. Turning that into 8-bit
+// pixels is a separate grading step: exposure, then a tone mapping operator to
+// bring highlights into range, then the sRGB transfer curve. Since the linear
+// image can be saved as a PFM and graded again later, changing the look of a
+// frame takes milliseconds instead of a new render.
+
+enum tone_map_operator {
+	tone_map_clamp,     // Values above 1 are clipped
+	tone_map_reinhard,  // x / (1 + x)
+	tone_map_aces,      // Narkowicz's fit of the ACES filmic curve
+	tone_map_filmic     // Hable's Uncharted 2 curve
+};
+
+inline bool parse_tone_map(const std::string& name, tone_map_operator& op) {
+	if (name == "clamp") op = tone_map_clamp;
+	else if (name == "reinhard") op = tone_map_reinhard;
+	else if (name == "aces") op = tone_map_aces;
+	else if (name == "filmic") op = tone_map_filmic;
+	else return false;
+	return true;
+}
+
+class image_grade {
+public:
+	double exposure = 0; // In stops; every +1 doubles the brightness
+	tone_map_operator tone_map = tone_map_clamp;
+
+	// Grades a linear image into interleaved 8-bit sRGB.
+	void apply(const std::vector<color>& pixels, std::vector<unsigned char>& bytes) const {
+		bytes.resize(pixels.size() * 3);
+
+		// Work through the image in blocks of float channels, so each loop
+		// below is a straight run over contiguous floats the compiler can vectorize.
+		const size_t block = 1024;
+		float values[block * 3];
+
+		float scale = float(std::pow(2.0, exposure));
+		if (tone_map == tone_map_aces) scale *= 0.6f; // The fit expects this pre-exposure
+		if (tone_map == tone_map_filmic) scale *= 2.0f; // Hable's exposure bias
+
+		const auto& lut = srgb_lut();
+		const float lut_scale = float(lut_size - 1);
+
+		for (size_t start = 0; start < pixels.size(); start += block) {
+			size_t count = std::min(block, pixels.size() - start) * 3;
+
+			for (size_t k = 0; k < count; k += 3) {
+				const auto& pixel = pixels[start + k / 3];
+				values[k + 0] = finite(float(pixel.x()) * scale);
+				values[k + 1] = finite(float(pixel.y()) * scale);
+				values[k + 2] = finite(float(pixel.z()) * scale);
+			}
+
+			switch (tone_map) {
+			case tone_map_clamp:
+				break;
+			case tone_map_reinhard:
+				for (size_t k = 0; k < count; k++)
+					values[k] = values[k] / (1.0f + values[k]);
+				break;
+			case tone_map_aces:
+				for (size_t k = 0; k < count; k++) {
+					float x = values[k];
+					values[k] = (x * (2.51f * x + 0.03f)) / (x * (2.43f * x + 0.59f) + 0.14f);
+				}
+				break;
+			case tone_map_filmic: {
+				const float white_scale = 1.0f / hable(11.2f);
+				for (size_t k = 0; k < count; k++)
+					values[k] = hable(values[k]) * white_scale;
+				break;
+			}
+			}
+
+			for (size_t k = 0; k < count; k++) {
+				float x = values[k] > 0.0f ? std::min(values[k], 1.0f) : 0.0f; // NaN compares false
+				bytes[start * 3 + k] = lut[int(x * lut_scale + 0.5f)];
+			}
+		}
+	}
+
+private:
+	static const int lut_size = 16384;
+
+	// NaN and negative values go to black, and anything past half-float
+	// range, infinity included, to its top, where every tone curve is
+	// already white. The curves would otherwise turn infinity into NaN, and
+	// Reinhard's would turn values below -1 white.
+	static float finite(float x) {
+		return x > 0.0f ? std::min(x, 65504.0f) : 0.0f; // NaN compares false
+	}
+
+	static float hable(float x) {
+		const float a = 0.15f, b = 0.50f, c = 0.10f, d = 0.20f, e = 0.02f, f = 0.30f;
+		return ((x * (a * x + c * b) + d * e) / (x * (a * x + b) + d * f)) - e / f;
+	}
+
+	// The sRGB transfer curve, tabulated over [0, 1] straight to bytes.
+	static const std::vector<unsigned char>& srgb_lut() {
+		static const std::vector<unsigned char> lut = []() {
+			std::vector<unsigned char> table(lut_size);
+			for (int i = 0; i < lut_size; i++) {
+				double x = double(i) / (lut_size - 1);
+				double s = x <= 0.0031308 ? 12.92 * x : 1.055 * std::pow(x, 1.0 / 2.4) - 0.055;
+				table[i] = (unsigned char)(std::min(255.0, 256.0 * s));
+			}
+			return table;
+		}();
+		return lut;
+	}
+};
+
+// Writes a graded image as PPM, as text (P3) or binary (P6). Binary is much
+// smaller and faster, which matters for previews written during a render.
+inline void write_ppm(std::ostream& out, int width, int height, const std::vector<color>& pixels, const image_grade& grade, bool binary) {
+	std::vector<unsigned char> bytes;
+	grade.apply(pixels, bytes);
+
+	out << (binary ? "P6" : "P3") << '\n' << width << ' ' << height << "\n255\n";
+
+	if (binary) {
+		out.write(reinterpret_cast<const char*>(bytes.data()), std::streamsize(bytes.size()));
+		return;
+	}
+
+	for (size_t k = 0; k < bytes.size(); k += 3)
+		out << int(bytes[k]) << ' ' << int(bytes[k + 1]) << ' ' << int(bytes[k + 2]) << '\n';
+}
+
+// Portable Float Map: a PPM-like header followed by raw 32-bit floats, rows
+// from bottom to top. A negative scale in the header means little-endian.
+inline bool write_pfm(const std::string& filename, int width, int height, const std::vector<color>& pixels) {
+	std::ofstream out(filename, std::ios::binary);
+	if (!out) {
+		std::cerr << "ERROR: Could not open '" << filename << "' for writing.\n";
+		return false;
+	}
+
+	uint16_t probe = 1;
+	bool little_endian = *reinterpret_cast<unsigned char*>(&probe) == 1;
+	out << "PF\n" << width << ' ' << height << '\n' << (little_endian ? "-1.0" : "1.0") << '\n';
+
+	std::vector<float> row(size_t(width) * 3);
+	for (int j = height - 1; j >= 0; j--) {
+		for (int i = 0; i < width; i++)
+			for (int c = 0; c < 3; c++)
+				row[size_t(i) * 3 + c] = float(pixels[size_t(j) * width + i][c]);
+		out.write(reinterpret_cast<const char*>(row.data()), std::streamsize(row.size() * sizeof(float)));
+	}
+	return bool(out);
+}
+
+inline bool read_pfm(const std::string& filename, int& width, int& height, std::vector<color>& pixels) {
+	std::ifstream in(filename, std::ios::binary);
+	std::string magic;
+	double scale = 0;
+	if (!(in >> magic >> width >> height >> scale) || magic != "PF" || width <= 0 || height <= 0) {
+		std::cerr << "ERROR: '" << filename << "' is not a color PFM image.\n";
+		return false;
+	}
+	in.get(); // The single whitespace character before the data
+
+	uint16_t probe = 1;
+	bool little_endian = *reinterpret_cast<unsigned char*>(&probe) == 1;
+	bool swap = (scale < 0) != little_endian;
+
+	pixels.assign(size_t(width) * height, color(0, 0, 0));
+	std::vector<float> row(size_t(width) * 3);
+	for (int j = height - 1; j >= 0; j--) {
+		if (!in.read(reinterpret_cast<char*>(row.data()), std::streamsize(row.size() * sizeof(float)))) {
+			std::cerr << "ERROR: '" << filename << "' is truncated.\n";
+			return false;
+		}
+		for (size_t k = 0; k < row.size(); k++) {
+			if (swap) {
+				unsigned char* b = reinterpret_cast<unsigned char*>(&row[k]);
+				std::swap(b[0], b[3]);
+				std::swap(b[1], b[2]);
+			}
+			pixels[size_t(j) * width + k / 3][int(k % 3)] = row[k];
+		}
+	}
+	return true;
+}
+
+#endif // !HDR_IMAGE_H
@@ -4,17 +4,35 @@
 #include "aabb.h"
 #include "rtweekend.h"
 
+#include <algorithm>
+#include <vector>
+
+class hittable;
+class light_source;
 class material;
 
 class hit_record {
 public:
 	point3 p;
 	vec3 normal;
-	shared_ptr<material> mat;
+	const material* mat; // Non-owning; the hit object keeps its material alive
 	double t;
 	double u;
 	double v;
 	bool front_face;
+	int face = 0; // Which face was hit; only set by primitives with several (see oriented_box::face_id)
+
+	// The primitive that was hit, for matching hits on lights to the lights
+	// the renderer samples (light.h). Set by the primitives that can be lights,
+	// and by instances, translate and rotate_y to themselves, since what they
+	// hit is a moved copy.
+	const hittable* object = nullptr;
+
+	// For texture filtering: sqrt(uv area / surface area) around the hit, set
+	// by the primitive, and how wide the shaded area is in uv units, set by
+	// the renderer from the ray's footprint.
+	double uv_density = 0;
+	double footprint = 0;
 
 	void set_face_normal(const ray& r, const vec3& outward_normal) {
 		// Sets hit record normal vector
@@ -32,8 +50,50 @@ public:
 	virtual bool hit(const ray& r, interval ray_t, hit_record& rec) const = 0;
 
 	virtual aabb bounding_box() const = 0;
+
+	// Whether the object moves while the shutter is open, over ray times in
+	// [0, 1]. bounding_box() then covers its whole path.
+	virtual bool moving() const { return false; }
+
+	// Fills boxes[0..segments] with bounds at times i / segments such that
+	// in between, the object stays inside the linear blend of the two
+	// boxes either side. A BVH blends them by each ray's time to bound
+	// moving objects about as tightly as still ones.
+	virtual void motion_bounds(int segments, aabb* boxes) const {
+		for (int i = 0; i <= segments; i++) boxes[i] = bounding_box();
+	}
+
+	// Adds the emitters among this object's primitives to `lights`, for the
+	// renderer to sample directly. Groups pass the call on to what they hold;
+	// instances do not, and lights inside them are only found by chance.
+	virtual void gather_lights(std::vector<light_source>& lights) const {}
+
+	// The fraction of light along `r` within `ray_t` that gets through, for
+	// shadow rays. Surfaces block it all; media (medium.h) let through an
+	// estimate of their transmittance, and groups multiply what they hold.
+	virtual double transmittance(const ray& r, interval ray_t) const {
+		hit_record rec;
+		return hit(r, ray_t, rec) ? 0 : 1;
+	}
 };
 
+// The box at `time` from boxes at times i / segments, as filled in by
+// hittable::motion_bounds.
+inline aabb motion_box_at(const aabb* boxes, int segments, double time) {
+	double s = time * segments;
+	int i = s <= 0 ? 0 : s >= segments ? segments - 1 : int(s);
+	double f = s - i;
+	const aabb& a = boxes[i];
+	const aabb& b = boxes[i + 1];
+
+	// Both ends are padded already, so the blend needs no padding.
+	aabb box;
+	box.x = interval(a.x.min + f * (b.x.min - a.x.min), a.x.max + f * (b.x.max - a.x.max));
+	box.y = interval(a.y.min + f * (b.y.min - a.y.min), a.y.max + f * (b.y.max - a.y.max));
+	box.z = interval(a.z.min + f * (b.z.min - a.z.min), a.z.max + f * (b.z.max - a.z.max));
+	return box;
+}
+
 class translate : public hittable {
 public:
 	translate(shared_ptr<hittable> object, const vec3& offset) : object(object), offset(offset) {
@@ -48,11 +108,25 @@ public:
 
 		rec.p += offset;
 
+		// Like instances, a moved copy that gather_lights() does not report
+		rec.object = this;
+
 		return true;
 	}
 
+	double transmittance(const ray& r, interval ray_t) const override {
+		return object->transmittance(ray(r.origin() - offset, r.direction(), r.time()), ray_t);
+	}
+
 	aabb bounding_box() const override { return bbox; }
 
+	bool moving() const override { return object->moving(); }
+
+	void motion_bounds(int segments, aabb* boxes) const override {
+		object->motion_bounds(segments, boxes);
+		for (int i = 0; i <= segments; i++) boxes[i] = boxes[i] + offset;
+	}
+
 private:
 	vec3 offset;
 	shared_ptr<hittable> object;
@@ -97,21 +171,7 @@ public:
 
 
 	bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-		auto origin = point3(
-			(cos_theta * r.origin().x()) - (sin_theta * r.origin().z()),
-			r.origin().y(),
-			(sin_theta * r.origin().x()) + (cos_theta * r.origin().z())
-		);
-
-		auto direction = vec3(
-			(cos_theta * r.direction().x()) - (sin_theta * r.direction().z()),
-			r.direction().y(),
-			(sin_theta * r.direction().x()) + (cos_theta * r.direction().z())
-		);
-
-		ray rotated_r(origin, direction, r.time());
-
-		if (!object->hit(rotated_r, ray_t, rec)) return false;
+		if (!object->hit(rotated(r), ray_t, rec)) return false;
 
 		rec.p = point3(
 			(cos_theta * rec.p.x()) + (sin_theta * rec.p.z()),
@@ -125,15 +185,39 @@ public:
 			(-sin_theta * rec.normal.x()) + (cos_theta * rec.normal.z())
 		);
 
+		// As in translate
+		rec.object = this;
+
 		return true;
 	}
 
+	double transmittance(const ray& r, interval ray_t) const override {
+		return object->transmittance(rotated(r), ray_t);
+	}
+
 	aabb bounding_box() const override { return bbox; }
 
 private:
 	shared_ptr<hittable> object;
 	double sin_theta, cos_theta;
 	aabb bbox;
+
+	// `r` in the object's frame
+	ray rotated(const ray& r) const {
+		auto origin = point3(
+			(cos_theta * r.origin().x()) - (sin_theta * r.origin().z()),
+			r.origin().y(),
+			(sin_theta * r.origin().x()) + (cos_theta * r.origin().z())
+		);
+
+		auto direction = vec3(
+			(cos_theta * r.direction().x()) - (sin_theta * r.direction().z()),
+			r.direction().y(),
+			(sin_theta * r.direction().x()) + (cos_theta * r.direction().z())
+		);
+
+		return ray(origin, direction, r.time());
+	}
 };
 
 #endif
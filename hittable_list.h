@@ -15,11 +15,12 @@ public:
 	hittable_list() {}
 	hittable_list(shared_ptr<hittable> object) { add(object); }
 
-	void clear() { objects.clear(); }
+	void clear() { objects.clear(); any_moving = false; }
 
 	void add(shared_ptr<hittable> object) {
 		objects.push_back(object);
 		bbox = aabb(bbox, object->bounding_box());
+		any_moving = any_moving || object->moving();
 	}
 
 	bool hit(const ray& r, interval ray_t, hit_record& rec)const override {
@@ -40,8 +41,34 @@ public:
 
 	aabb bounding_box() const override { return bbox; }
 
+	bool moving() const override { return any_moving; }
+
+	void motion_bounds(int segments, aabb* boxes) const override {
+		for (int i = 0; i <= segments; i++) boxes[i] = aabb::empty;
+
+		std::vector<aabb> object_boxes(segments + 1);
+		for (const auto& object : objects) {
+			object->motion_bounds(segments, object_boxes.data());
+			for (int i = 0; i <= segments; i++) boxes[i] = aabb(boxes[i], object_boxes[i]);
+		}
+	}
+
+	void gather_lights(std::vector<light_source>& lights) const override {
+		for (const auto& object : objects) object->gather_lights(lights);
+	}
+
+	double transmittance(const ray& r, interval ray_t) const override {
+		double transmitted = 1;
+		for (const auto& object : objects) {
+			transmitted *= object->transmittance(r, ray_t);
+			if (transmitted <= 0) break;
+		}
+		return transmitted;
+	}
+
 private:
 	aabb bbox;
+	bool any_moving = false;
 };
 
 #endif // ! HITTABLE_LIST_H
@@ -0,0 +1,85 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "bvh.h"
+#include "hittable.h"
+#include "transform.h"
+
+// Two-level Acceleration Structure
+//
+// Geometry is built once into a bottom-level BVH (BLAS) in its own object
+// space. Each instance only stores a pointer to that shared BLAS and an
+// affine object-to-world transform, so repeating an asset costs a few hundred
+// bytes rather than a copy of its geometry. A top-level BVH (TLAS) is then an
+// ordinary bvh_node built over the instances; rebuilding it after moving
+// instances never touches the BLASes.
+
+class instance : public hittable {
+public:
+	instance(shared_ptr<hittable> object, const transform& object_to_world)
+		: object(object), object_to_world(object_to_world), world_to_object(object_to_world.inverse())
+	{
+		bbox = object_to_world.apply(object->bounding_box());
+
+		// Texture density only has one number for every direction, so
+		// non-uniform scales get their average
+		uv_scale = 1 / std::cbrt(std::fabs(object_to_world.determinant()));
+	}
+
+	bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+		// The object space direction is deliberately left unnormalized so that
+		// hit distances stay valid in world space.
+		ray object_r(
+			world_to_object.apply_point(r.origin()),
+			world_to_object.apply_vector(r.direction()),
+			r.time()
+		);
+
+		if (!object->hit(object_r, ray_t, rec))
+			return false;
+
+		// Normals transform by the inverse transpose. Facing is preserved since
+		// dot(M*d, M^-T*n) == dot(d, n).
+		rec.p = object_to_world.apply_point(rec.p);
+		rec.normal = unit_vector(world_to_object.apply_transposed(rec.normal));
+		rec.uv_density *= uv_scale;
+
+		// The lights gathered for sampling sit where the object is placed
+		// untransformed; this copy of them is not one of those.
+		rec.object = this;
+
+		return true;
+	}
+
+	double transmittance(const ray& r, interval ray_t) const override {
+		ray object_r(world_to_object.apply_point(r.origin()), world_to_object.apply_vector(r.direction()), r.time());
+		return object->transmittance(object_r, ray_t);
+	}
+
+	aabb bounding_box() const override { return bbox; }
+
+	bool moving() const override { return object->moving(); }
+
+	void motion_bounds(int segments, aabb* boxes) const override {
+		// The box of a transformed box is linear in the original's bounds, so
+		// blending commutes with the transform.
+		object->motion_bounds(segments, boxes);
+		for (int i = 0; i <= segments; i++) boxes[i] = object_to_world.apply(boxes[i]);
+	}
+
+private:
+	shared_ptr<hittable> object;
+	transform object_to_world;
+	transform world_to_object;
+	double uv_scale;
+	aabb bbox;
+};
+
+// Builds a bottom-level BVH over a group of objects, ready to be instanced.
+// A single object needs no BVH and is returned as it is.
+inline shared_ptr<hittable> make_blas(const hittable_list& objects) {
+	if (objects.objects.size() == 1) return objects.objects[0];
+	return make_shared<bvh_node>(objects);
+}
+
+#endif // !INSTANCE_H
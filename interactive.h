@@ -0,0 +1,225 @@
+#ifndef INTERACTIVE_H
+#define INTERACTIVE_H
+
+#include "camera.h"
+#include "hittable.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+	#include <fcntl.h>
+	#include <io.h>
+#endif
+
+// Interactive Preview
+//
+// A fast feedback loop for laying out a scene. Each view is first traced at
+// reduced resolution with one sample per pixel, upscaled and sent out as a
+// frame, then traced again at full resolution, sending a frame after every
+// progressive pass until it reaches the camera's samples_per_pixel.
+//
+// The reduction adapts to keep that first frame within `frame_budget`: it
+// starts at 1/4 and is halved or doubled (between 1/1 and 1/16) after each
+// view depending on how long the last first frame took.
+//
+// Camera changes are read from stdin, one per line:
+//
+//     lookfrom <x> <y> <z>
+//     lookat <x> <y> <z>
+//     vfov <degrees>
+//     quit
+//
+// A change cancels the view being traced and starts the new one at once. At
+// the end of input the last view is refined to completion before returning.
+//
+// Frames are binary PPMs, either written one after another to stdout when
+// `frames_path` is "-" (e.g. for `ffplay -f image2pipe -c:v ppm -i -`), or
+// as frame_00000.ppm, frame_00001.ppm, ... in the `frames_path` directory.
+
+class interactive_preview {
+public:
+	std::string frames_path = "-";
+	double frame_budget = 0.1; // Seconds allowed for the first frame of a view
+
+	bool run(const hittable& world, const camera& base) {
+#ifdef _WIN32
+		if (frames_path == "-") _setmode(_fileno(stdout), _O_BINARY);
+#endif
+		grade = base.grade;
+		current.lookfrom = base.lookfrom;
+		current.lookat = base.lookat;
+		current.vfov = base.vfov;
+
+		std::thread reader([this]() { read_commands(); });
+
+		int rendered = -1;
+		bool ok = true;
+
+		while (ok) {
+			view v;
+			{
+				std::unique_lock<std::mutex> lock(view_mutex);
+				view_changed.wait(lock, [&]() { return version != rendered || input_closed; });
+				if (quit || version == rendered) break;
+				v = current;
+				rendered = version;
+			}
+
+			auto superseded = [&]() {
+				std::lock_guard<std::mutex> lock(view_mutex);
+				return quit || version != rendered;
+			};
+
+			camera cam = base;
+			cam.lookfrom = v.lookfrom;
+			cam.lookat = v.lookat;
+			cam.vfov = v.vfov;
+			cam.show_progress = false;
+			cam.preview_path.clear();
+
+			int width = cam.image_width;
+			int height = std::max(1, int(cam.image_width / cam.aspect_ratio));
+
+			// Reduced resolution, one sample per pixel
+			auto start = std::chrono::steady_clock::now();
+
+			camera coarse = cam;
+			coarse.image_width = std::max(1, width / divisor);
+			coarse.samples_per_pixel = 1;
+
+			accumulation_buffer buffer;
+			if (!coarse.render_progressive(world, buffer, [&](const accumulation_buffer&, const camera::render_status&) {
+				return !superseded();
+			}, 0.005)) continue;
+
+			std::vector<color> pixels;
+			buffer.resolve(pixels);
+			ok = write_frame(upscale(pixels, buffer.image_width(), buffer.image_height(), width, height), width, height);
+
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			std::clog << "View " << rendered << ": first frame in " << int(seconds * 1000 + 0.5)
+					  << " ms at 1/" << divisor << " resolution" << std::endl;
+
+			if (seconds > frame_budget && divisor < 16) divisor *= 2;
+			else if (seconds < frame_budget / 4 && divisor > 1) divisor /= 2;
+
+			// Full resolution, refined pass by pass
+			int frames_sent = 0;
+			cam.render_progressive(world, buffer, [&](const accumulation_buffer& b, const camera::render_status& status) {
+				if (ok && status.passes_done > frames_sent) {
+					b.resolve(pixels);
+					ok = write_frame(pixels, width, height);
+					frames_sent = status.passes_done;
+				}
+				return ok && !superseded();
+			}, 0.02);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(view_mutex);
+			quit = true;
+		}
+		// The reader only stops at the end of input or on "quit"
+		if (reader.joinable()) {
+			if (ok) reader.join();
+			else reader.detach();
+		}
+		return ok;
+	}
+
+private:
+	struct view {
+		point3 lookfrom;
+		point3 lookat;
+		double vfov = 90;
+	};
+
+	std::mutex view_mutex;
+	std::condition_variable view_changed;
+	view current;         // Guarded by view_mutex, as are the three below
+	int version = 0;
+	bool input_closed = false;
+	bool quit = false;
+
+	image_grade grade;
+	int divisor = 4;
+	int frame_index = 0;
+
+	void read_commands() {
+		std::string line;
+		while (std::getline(std::cin, line)) {
+			std::istringstream in(line);
+			std::string command;
+			if (!(in >> command)) continue;
+
+			std::unique_lock<std::mutex> lock(view_mutex);
+			view v = current;
+			double x, y, z;
+
+			if (command == "quit") {
+				quit = true;
+				break;
+			}
+			else if (command == "lookfrom" && (in >> x >> y >> z)) v.lookfrom = point3(x, y, z);
+			else if (command == "lookat" && (in >> x >> y >> z)) v.lookat = point3(x, y, z);
+			else if (command == "vfov" && (in >> x) && x > 0 && x < 180) v.vfov = x;
+			else {
+				std::cerr << "ERROR: Unknown preview command '" << line << "'.\n";
+				continue;
+			}
+
+			current = v;
+			version++;
+			lock.unlock();
+			view_changed.notify_one();
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(view_mutex);
+			input_closed = true;
+		}
+		view_changed.notify_one();
+	}
+
+	static std::vector<color> upscale(const std::vector<color>& pixels, int w, int h, int width, int height) {
+		std::vector<color> result(size_t(width) * height);
+		for (int j = 0; j < height; j++) {
+			int sj = std::min(h - 1, j * h / height);
+			for (int i = 0; i < width; i++)
+				result[size_t(j) * width + i] = pixels[size_t(sj) * w + std::min(w - 1, i * w / width)];
+		}
+		return result;
+	}
+
+	bool write_frame(const std::vector<color>& pixels, int width, int height) {
+		if (frames_path == "-") {
+			write_ppm(std::cout, width, height, pixels, grade, true);
+			std::cout.flush();
+			frame_index++;
+			return bool(std::cout);
+		}
+
+		char name[32];
+		std::snprintf(name, sizeof(name), "frame_%05d.ppm", frame_index++);
+		auto last = frames_path.back();
+		auto filename = frames_path + ((last == '/' || last == '\\') ? "" : "/") + name;
+
+		std::ofstream out(filename, std::ios::binary);
+		if (!out) {
+			std::cerr << "ERROR: Could not write frame '" << filename << "'.\n";
+			return false;
+		}
+		write_ppm(out, width, height, pixels, grade, true);
+		return true;
+	}
+};
+
+#endif // !INTERACTIVE_H
@@ -0,0 +1,180 @@
+#ifndef LIGHT_H
+#define LIGHT_H
+
+#include "hittable.h"
+
+class material;
+
+// A point picked on a light, as seen from the point being shaded.
+struct light_sample {
+	point3 p;
+	vec3 normal;      // Unit, on the light's outward side
+	double u, v;      // For the light's emission texture
+	double pdf;       // Per unit solid angle at the shaded point
+	color emission;   // Filled in by light_bvh
+};
+
+// One emitter that can be sampled directly: a sphere, or a flat
+// parallelogram, triangle or ellipse. Primitives with an emissive material
+// describe themselves as these through hittable::gather_lights(). Lights
+// emit from both sides, as diffuse_light does everywhere else.
+class light_source {
+public:
+	enum shape_kind { sphere_shape, parallelogram_shape, triangle_shape, ellipse_shape };
+
+	shape_kind shape;
+	const hittable* object;  // The primitive, as its hits report it in hit_record::object
+	const material* mat;
+
+	// Flat shapes are Q + a*u + b*v over (a, b) in the unit square, in the
+	// triangle a, b >= 0, a + b <= 1, or in the unit disk. Their emission
+	// texture is looked up at uv_origin + a*uv_u + b*uv_v.
+	point3 Q;
+	vec3 u, v, normal;
+	vec3 uv_origin, uv_u = vec3(1, 0, 0), uv_v = vec3(0, 1, 0);
+
+	// Spheres
+	ray center;
+	double radius = 0;
+
+	static light_source sphere(const hittable* object, const material* mat, const ray& center, double radius) {
+		light_source l(sphere_shape, object, mat);
+		l.center = center;
+		l.radius = radius;
+		return l;
+	}
+
+	static light_source flat(shape_kind shape, const hittable* object, const material* mat, const point3& Q, const vec3& u, const vec3& v) {
+		light_source l(shape, object, mat);
+		l.Q = Q;
+		l.u = u;
+		l.v = v;
+		l.normal = unit_vector(cross(u, v));
+		return l;
+	}
+
+	double area() const {
+		switch (shape) {
+			case sphere_shape:        return 4 * pi * radius * radius;
+			case parallelogram_shape: return cross(u, v).length();
+			case triangle_shape:      return 0.5 * cross(u, v).length();
+			default:                  return pi * cross(u, v).length();
+		}
+	}
+
+	aabb bounds() const {
+		if (shape == sphere_shape) {
+			auto rvec = vec3(radius, radius, radius);
+			return aabb(aabb(center.at(0) - rvec, center.at(0) + rvec), aabb(center.at(1) - rvec, center.at(1) + rvec));
+		}
+		if (shape == ellipse_shape) return aabb(aabb(Q - u - v, Q + u + v), aabb(Q + u - v, Q - u + v));
+		if (shape == triangle_shape) return aabb(aabb(Q, Q + u), aabb(Q, Q + v));
+		return aabb(aabb(Q, Q + u + v), aabb(Q + u, Q + v));
+	}
+
+	// A point on the light that `ref` can see, from two uniform numbers.
+	// Spheres are sampled over the cone they fill as seen from `ref`, flat
+	// shapes uniformly by area. Returns false if the light cannot be seen.
+	bool sample(const point3& ref, double time, double r1, double r2, light_sample& s) const {
+		if (shape == sphere_shape) {
+			auto c = center.at(time);
+			auto to_center = c - ref;
+			double d2 = to_center.length_squared();
+			double sin2_max = radius * radius / d2;
+			if (sin2_max >= 1) return sample_area(ref, c, r1, r2, s);
+
+			// Uniform over the cone, then onto the near side of the sphere
+			double cos_max = std::sqrt(1 - sin2_max);
+			double one_minus_cos_max = sin2_max / (1 + cos_max);
+			double cos_theta = 1 - r1 * one_minus_cos_max;
+			double sin_theta = std::sqrt(std::fmax(0.0, 1 - cos_theta * cos_theta));
+			double phi = 2 * pi * r2;
+
+			double d = std::sqrt(d2);
+			auto w = to_center / d;
+			vec3 a = std::fabs(w.x()) > 0.9 ? vec3(0, 1, 0) : vec3(1, 0, 0);
+			auto t1 = unit_vector(cross(w, a));
+			auto t2 = cross(w, t1);
+			auto direction = sin_theta * std::cos(phi) * t1 + sin_theta * std::sin(phi) * t2 + cos_theta * w;
+
+			double along = d * cos_theta - std::sqrt(std::fmax(0.0, radius * radius - d2 * sin_theta * sin_theta));
+			s.p = ref + along * direction;
+			s.normal = (s.p - c) / radius;
+			sphere_uv(s.normal, s.u, s.v);
+			s.pdf = 1 / (2 * pi * one_minus_cos_max);
+			return true;
+		}
+
+		double a, b;
+		if (shape == parallelogram_shape) {
+			a = r1;
+			b = r2;
+		}
+		else if (shape == triangle_shape) {
+			double root = std::sqrt(r1);
+			a = root * (1 - r2);
+			b = root * r2;
+		}
+		else {
+			double radial = std::sqrt(r1), phi = 2 * pi * r2;
+			a = radial * std::cos(phi);
+			b = radial * std::sin(phi);
+		}
+
+		s.p = Q + a * u + b * v;
+		s.normal = normal;
+		auto uv = uv_origin + a * uv_u + b * uv_v;
+		s.u = uv.x();
+		s.v = uv.y();
+		s.pdf = solid_angle_pdf(ref, s.p, s.normal, area());
+		return s.pdf > 0;
+	}
+
+	// The density with which sample() picks `p`, a point on the light, as
+	// seen from `ref`.
+	double pdf(const point3& ref, double time, const point3& p) const {
+		if (shape == sphere_shape) {
+			auto c = center.at(time);
+			double sin2_max = radius * radius / (c - ref).length_squared();
+			if (sin2_max >= 1) return solid_angle_pdf(ref, p, (p - c) / radius, area());
+			double one_minus_cos_max = sin2_max / (1 + std::sqrt(1 - sin2_max));
+			return 1 / (2 * pi * one_minus_cos_max);
+		}
+		return solid_angle_pdf(ref, p, normal, area());
+	}
+
+private:
+	light_source(shape_kind shape, const hittable* object, const material* mat)
+		: shape(shape), object(object), mat(mat) {}
+
+	// From inside a sphere all of it is visible, so pick by area.
+	bool sample_area(const point3& ref, const point3& c, double r1, double r2, light_sample& s) const {
+		double z = 1 - 2 * r1;
+		double ring = std::sqrt(std::fmax(0.0, 1 - z * z));
+		double phi = 2 * pi * r2;
+		s.normal = vec3(ring * std::cos(phi), ring * std::sin(phi), z);
+		s.p = c + radius * s.normal;
+		sphere_uv(s.normal, s.u, s.v);
+		s.pdf = solid_angle_pdf(ref, s.p, s.normal, area());
+		return s.pdf > 0;
+	}
+
+	// A uniform density over `area` turned into one per unit solid angle at `ref`
+	static double solid_angle_pdf(const point3& ref, const point3& p, const vec3& n, double area) {
+		auto to_light = p - ref;
+		double distance_squared = to_light.length_squared();
+		double cosine = std::fabs(dot(n, to_light)) / std::sqrt(distance_squared);
+		if (cosine <= 0 || area <= 0) return 0;
+		return distance_squared / (cosine * area);
+	}
+
+	// As sphere::get_sphere_uv
+	static void sphere_uv(const vec3& n, double& u, double& v) {
+		auto theta = std::acos(-n.y());
+		auto phi = std::atan2(-n.z(), n.x()) + pi;
+		u = phi / (2 * pi);
+		v = theta / pi;
+	}
+};
+
+#endif // !LIGHT_H
@@ -0,0 +1,405 @@
+#ifndef LIGHT_BVH_H
+#define LIGHT_BVH_H
+
+#include "bvh.h"
+#include "light.h"
+#include "material.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Light BVH
+//
+// To light a point the renderer picks one emitter and traces a shadow ray
+// toward it. Picking uniformly wastes most samples once a scene has many
+// lights, since few of them matter at any one point. Instead the lights are
+// kept in a binary tree, each node summarizing the lights below it by their
+// bounds, total power, and a cone around the directions they face. From
+// the shaded point, each node's contribution can be bounded from above;
+// sampling walks down from the root, choosing between the two children in
+// proportion to those bounds, and arrives at one light with a known
+// probability after O(log n) steps. Near and bright lights get most of the
+// samples, wherever they are, so noise stays about flat as lights are added
+// (Conty Estevez and Kulla, "Importance Sampling of Many Lights with
+// Adaptive Tree Splitting"; the bounds and build follow pbrt-v4).
+//
+// The probability of having picked a given light, which multiple importance
+// sampling needs when a path hits that light by chance, takes the same walk
+// guided by a bit trail stored per light.
+
+// What a light, or a group of them, looks like from afar.
+struct light_bounds {
+	aabb box = aabb::empty;
+	double phi = 0;            // Emitted power
+	vec3 w = vec3(0, 0, 1);    // Axis of the cone holding every normal
+	double cos_theta_o = 1;    // Half the cone's angle
+	double cos_theta_e = 0;    // How far past its normal a light emits; 90 degrees for diffuse ones
+	bool two_sided = false;
+
+	// An upper bound on how much these lights can contribute at `p`, facing
+	// `n` (zero in a medium), up to a common factor.
+	double importance(const point3& p, const vec3& n) const {
+		auto pc = point3((box.x.min + box.x.max) / 2, (box.y.min + box.y.max) / 2, (box.z.min + box.z.max) / 2);
+		auto diagonal = vec3(box.x.size(), box.y.size(), box.z.size());
+
+		// Closer than the box is large, the distance stops meaning much.
+		auto d2 = std::fmax((p - pc).length_squared(), diagonal.length() / 2);
+
+		// The angle between the axis and p, less the cone's spread and the
+		// angle the box fills as seen from p, is the smallest angle any light
+		// in here can make with the direction to p.
+		auto wi = unit_vector(p - pc);
+		double cos_w = dot(w, wi);
+		if (two_sided) cos_w = std::fabs(cos_w);
+		double sin_w = safe_sqrt(1 - cos_w * cos_w);
+
+		double cos_b = bounding_cos(p, pc, diagonal.length() / 2);
+		double sin_b = safe_sqrt(1 - cos_b * cos_b);
+
+		double sin_o = safe_sqrt(1 - cos_theta_o * cos_theta_o);
+		double cos_x = cos_sub_clamped(sin_w, cos_w, sin_o, cos_theta_o);
+		double sin_x = sin_sub_clamped(sin_w, cos_w, sin_o, cos_theta_o);
+		double cos_p = cos_sub_clamped(sin_x, cos_x, sin_b, cos_b);
+		if (cos_p <= cos_theta_e) return 0;
+
+		double result = phi * cos_p / d2;
+
+		// And at a surface, the best cosine any of them can have there
+		if (n.x() != 0 || n.y() != 0 || n.z() != 0) {
+			double cos_i = std::fabs(dot(wi, n));
+			double sin_i = safe_sqrt(1 - cos_i * cos_i);
+			result *= cos_sub_clamped(sin_i, cos_i, sin_b, cos_b);
+		}
+		return std::fmax(result, 0.0);
+	}
+
+	static light_bounds merge(const light_bounds& a, light_bounds b) {
+		if (a.phi == 0) return b;
+		if (b.phi == 0) return a;
+
+		// Facing either way, a two-sided light is the same light.
+		if (a.two_sided && b.two_sided && dot(a.w, b.w) < 0) b.w = -b.w;
+
+		light_bounds result;
+		result.box = aabb(a.box, b.box);
+		result.phi = a.phi + b.phi;
+		result.cos_theta_e = std::fmin(a.cos_theta_e, b.cos_theta_e);
+		result.two_sided = a.two_sided || b.two_sided;
+		merge_cones(a.w, a.cos_theta_o, b.w, b.cos_theta_o, result.w, result.cos_theta_o);
+		return result;
+	}
+
+private:
+	static double safe_sqrt(double x) { return std::sqrt(std::fmax(0.0, x)); }
+
+	// cos(max(0, a - b)) and sin(max(0, a - b)) from the sines and cosines
+	static double cos_sub_clamped(double sin_a, double cos_a, double sin_b, double cos_b) {
+		if (cos_a > cos_b) return 1;
+		return cos_a * cos_b + sin_a * sin_b;
+	}
+
+	static double sin_sub_clamped(double sin_a, double cos_a, double sin_b, double cos_b) {
+		if (cos_a > cos_b) return 0;
+		return sin_a * cos_b - cos_a * sin_b;
+	}
+
+	// The cosine of the angle the box's bounding sphere fills as seen from p;
+	// -1 from inside it.
+	static double bounding_cos(const point3& p, const point3& center, double radius) {
+		double d2 = (p - center).length_squared();
+		if (d2 < radius * radius) return -1;
+		return safe_sqrt(1 - radius * radius / d2);
+	}
+
+	// The smallest cone holding cones (wa, cos_a) and (wb, cos_b)
+	static void merge_cones(const vec3& wa, double cos_a, const vec3& wb, double cos_b, vec3& w, double& cos_o) {
+		double theta_a = std::acos(std::fmax(-1.0, std::fmin(1.0, cos_a)));
+		double theta_b = std::acos(std::fmax(-1.0, std::fmin(1.0, cos_b)));
+		double theta_d = std::acos(std::fmax(-1.0, std::fmin(1.0, dot(wa, wb))));
+
+		if (std::fmin(theta_d + theta_b, pi) <= theta_a) { w = wa; cos_o = cos_a; return; }
+		if (std::fmin(theta_d + theta_a, pi) <= theta_b) { w = wb; cos_o = cos_b; return; }
+
+		double theta_o = (theta_a + theta_d + theta_b) / 2;
+		auto axis = cross(wa, wb);
+		if (theta_o >= pi || axis.length_squared() == 0) {
+			w = wa;
+			cos_o = -1;
+			return;
+		}
+
+		// Turn wa toward wb until the cone just reaches past both
+		double theta_r = theta_o - theta_a;
+		auto k = unit_vector(axis);
+		w = std::cos(theta_r) * wa + std::sin(theta_r) * cross(k, wa);
+		cos_o = std::cos(theta_o);
+	}
+};
+
+class light_bvh {
+public:
+	light_bvh() {}
+
+	// Collects the lights in `world` and builds the tree over them.
+	explicit light_bvh(const hittable& world) {
+		world.gather_lights(lights);
+
+		// Where each primitive's lights start; primitives with several give
+		// one per face, in the order of hit_record::face.
+		for (size_t i = 0; i < lights.size(); i++) {
+			auto it = by_object.find(lights[i].object);
+			if (it == by_object.end()) by_object[lights[i].object] = object_lights{ i, 1 };
+			else it->second.count++;
+		}
+
+		std::vector<build_item> items;
+		for (size_t i = 0; i < lights.size(); i++) {
+			auto b = bounds_of(lights[i]);
+			if (b.phi > 0) items.push_back(build_item{ b, i });
+		}
+
+		trails.assign(lights.size(), 0);
+		in_tree.assign(lights.size(), 0);
+		if (!items.empty()) build(items, 0, items.size(), 0, 0);
+	}
+
+	bool empty() const { return nodes.empty(); }
+
+	size_t size() const { return lights.size(); }
+
+	// Picks a light by its importance at `p` (facing `n`, zero in a medium)
+	// and a point on it. The sample's pdf includes the chance of the pick.
+	bool sample(const point3& p, const vec3& n, double time, light_sample& s) const {
+		if (nodes.empty()) return false;
+
+		double pmf = 1;
+		size_t index = 0;
+		while (!nodes[index].leaf) {
+			size_t first = index + 1, second = nodes[index].second;
+			double i0 = nodes[first].bounds.importance(p, n);
+			double i1 = nodes[second].bounds.importance(p, n);
+			if (i0 <= 0 && i1 <= 0) return false;
+
+			double p0 = i0 / (i0 + i1);
+			if (random_double() < p0) {
+				index = first;
+				pmf *= p0;
+			}
+			else {
+				index = second;
+				pmf *= 1 - p0;
+			}
+		}
+
+		const auto& leaf = nodes[index];
+		size_t pick = leaf.light_count > 1 ? std::min(size_t(random_double() * leaf.light_count), leaf.light_count - 1) : 0;
+		const auto& light = lights[leaf_lights[leaf.first_light + pick]];
+		if (!light.sample(p, time, random_double(), random_double(), s)) return false;
+		s.pdf *= pmf / leaf.light_count;
+		s.emission = light.mat->emitted(s.u, s.v, s.p);
+		return true;
+	}
+
+	// The density with which sample() would have picked the point `rec`
+	// hit, as seen from `p`; zero if it is not on a light this samples.
+	double pdf(const point3& p, const vec3& n, double time, const hit_record& rec) const {
+		if (nodes.empty()) return 0;
+		auto it = by_object.find(rec.object);
+		if (it == by_object.end()) return 0;
+
+		size_t light = it->second.first + (it->second.count > 1 ? size_t(rec.face) : 0);
+		if (!in_tree[light]) return 0;
+
+		double pmf = 1;
+		size_t index = 0;
+		uint64_t trail = trails[light];
+		while (!nodes[index].leaf) {
+			size_t first = index + 1, second = nodes[index].second;
+			double i0 = nodes[first].bounds.importance(p, n);
+			double i1 = nodes[second].bounds.importance(p, n);
+			if (i0 <= 0 && i1 <= 0) return 0;
+
+			if (trail & 1) {
+				pmf *= i1 / (i0 + i1);
+				index = second;
+			}
+			else {
+				pmf *= i0 / (i0 + i1);
+				index = first;
+			}
+			trail >>= 1;
+		}
+
+		return pmf / nodes[index].light_count * lights[light].pdf(p, time, rec.p);
+	}
+
+private:
+	struct node {
+		light_bounds bounds;
+		size_t second = 0;       // Interior: the second child; the first follows the node
+		size_t first_light = 0;  // Leaf: where its lights start in leaf_lights
+		size_t light_count = 0;  // Leaf: how many; only more than one at max_depth
+		bool leaf = false;
+	};
+
+	struct build_item {
+		light_bounds bounds;
+		size_t light;
+	};
+
+	struct object_lights {
+		size_t first;
+		size_t count;
+	};
+
+	std::vector<light_source> lights;
+	std::vector<node> nodes;
+	std::vector<size_t> leaf_lights; // Each leaf's lights, picked from uniformly
+	std::vector<uint64_t> trails;  // Per light, bit i set if the way down turns to the second child at depth i
+	std::vector<char> in_tree;     // Lights without power are left out
+	std::unordered_map<const hittable*, object_lights> by_object;
+
+	static const int buckets = 12;
+	static const int max_depth = 64;
+
+	static light_bounds bounds_of(const light_source& light) {
+		light_bounds b;
+		b.box = light.bounds();
+
+		// Emitted power, from the brightest channel averaged over the emission texture
+		double radiance = 0;
+		const int steps = 4;
+		auto centroid = point3((b.box.x.min + b.box.x.max) / 2, (b.box.y.min + b.box.y.max) / 2, (b.box.z.min + b.box.z.max) / 2);
+		for (int i = 0; i < steps; i++) {
+			for (int j = 0; j < steps; j++) {
+				auto uv = light.uv_origin + ((i + 0.5) / steps) * light.uv_u + ((j + 0.5) / steps) * light.uv_v;
+				auto c = light.mat->emitted(uv.x(), uv.y(), centroid);
+				radiance += std::fmax(c.x(), std::fmax(c.y(), c.z()));
+			}
+		}
+		radiance /= steps * steps;
+
+		// Flat lights shine from both faces; a sphere's normals point everywhere.
+		b.phi = pi * radiance * light.area();
+		if (light.shape == light_source::sphere_shape) {
+			b.cos_theta_o = -1;
+		}
+		else {
+			b.phi *= 2;
+			b.w = light.normal;
+			b.two_sided = true;
+		}
+		return b;
+	}
+
+	// pbrt's surface area orientation heuristic: the cost of a node grows with
+	// its power, its area, and how widely it emits.
+	static double split_cost(const light_bounds& b, const light_bounds& parent, int axis) {
+		double theta_o = std::acos(std::fmax(-1.0, std::fmin(1.0, b.cos_theta_o)));
+		double theta_e = std::acos(std::fmax(-1.0, std::fmin(1.0, b.cos_theta_e)));
+		double theta_w = std::fmin(theta_o + theta_e, pi);
+		double sin_o = std::sqrt(std::fmax(0.0, 1 - b.cos_theta_o * b.cos_theta_o));
+		double m_omega = 2 * pi * (1 - b.cos_theta_o)
+					   + pi / 2 * (2 * theta_w * sin_o - std::cos(theta_o - 2 * theta_w) - 2 * theta_o * sin_o + b.cos_theta_o);
+
+		// Long thin nodes split across their length are penalized
+		const auto& box = parent.box;
+		double longest = std::fmax(box.x.size(), std::fmax(box.y.size(), box.z.size()));
+		double kr = longest / std::fmax(box.axis_interval(axis).size(), 1e-12);
+		return b.phi * m_omega * kr * bvh_detail::surface_area(b.box);
+	}
+
+	static double centroid(const light_bounds& b, int axis) {
+		const auto& extent = b.box.axis_interval(axis);
+		return (extent.min + extent.max) / 2;
+	}
+
+	size_t build(std::vector<build_item>& items, size_t begin, size_t end, uint64_t trail, int depth) {
+		size_t index = nodes.size();
+		nodes.push_back(node());
+
+		// A trail has one bit per level, so a branch that gets this deep ends
+		// in a leaf holding every light left rather than going on.
+		if (end - begin == 1 || depth == max_depth) {
+			auto& n = nodes[index];
+			n.first_light = leaf_lights.size();
+			n.light_count = end - begin;
+			n.leaf = true;
+			for (size_t i = begin; i < end; i++) {
+				n.bounds = light_bounds::merge(n.bounds, items[i].bounds);
+				leaf_lights.push_back(items[i].light);
+				trails[items[i].light] = trail;
+				in_tree[items[i].light] = 1;
+			}
+			return index;
+		}
+
+		light_bounds all;
+		aabb centroids = aabb::empty;
+		for (size_t i = begin; i < end; i++) {
+			all = light_bounds::merge(all, items[i].bounds);
+			auto c = point3(centroid(items[i].bounds, 0), centroid(items[i].bounds, 1), centroid(items[i].bounds, 2));
+			centroids = aabb(centroids, aabb(c, c));
+		}
+
+		// The cheapest split between buckets along any axis
+		double best_cost = infinity;
+		int best_axis = -1, best_bucket = -1;
+		for (int axis = 0; axis < 3 && depth < max_depth - 8; axis++) {
+			const auto& extent = centroids.axis_interval(axis);
+			if (extent.size() <= 0) continue;
+
+			light_bounds bucket_bounds[buckets];
+			for (size_t i = begin; i < end; i++) {
+				auto& bucket = bucket_bounds[bucket_of(items[i].bounds, axis, extent)];
+				bucket = light_bounds::merge(bucket, items[i].bounds);
+			}
+
+			for (int split = 0; split < buckets - 1; split++) {
+				light_bounds below, above;
+				for (int k = 0; k <= split; k++) below = light_bounds::merge(below, bucket_bounds[k]);
+				for (int k = split + 1; k < buckets; k++) above = light_bounds::merge(above, bucket_bounds[k]);
+				if (below.phi == 0 || above.phi == 0) continue;
+
+				double cost = split_cost(below, all, axis) + split_cost(above, all, axis);
+				if (cost < best_cost) {
+					best_cost = cost;
+					best_axis = axis;
+					best_bucket = split;
+				}
+			}
+		}
+
+		// Without a useful split, or deep in a lopsided tree, halve the list.
+		size_t mid;
+		if (best_axis >= 0) {
+			const auto& extent = centroids.axis_interval(best_axis);
+			mid = std::partition(items.begin() + begin, items.begin() + end, [&](const build_item& item) {
+				return bucket_of(item.bounds, best_axis, extent) <= best_bucket;
+			}) - items.begin();
+		}
+		else {
+			int axis = centroids.longest_axis();
+			mid = (begin + end) / 2;
+			std::nth_element(items.begin() + begin, items.begin() + mid, items.begin() + end, [&](const build_item& a, const build_item& b) {
+				return centroid(a.bounds, axis) < centroid(b.bounds, axis);
+			});
+		}
+
+		build(items, begin, mid, trail, depth + 1);
+		size_t second = build(items, mid, end, trail | (uint64_t(1) << depth), depth + 1);
+
+		nodes[index].bounds = all;
+		nodes[index].second = second;
+		return index;
+	}
+
+	static int bucket_of(const light_bounds& b, int axis, const interval& extent) {
+		int bucket = int(buckets * (centroid(b, axis) - extent.min) / extent.size());
+		return std::min(std::max(bucket, 0), buckets - 1);
+	}
+};
+
+#endif // !LIGHT_BVH_H
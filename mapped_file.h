@@ -0,0 +1,102 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstdint>
+#include <string>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+	#ifndef WIN32_LEAN_AND_MEAN
+		#define WIN32_LEAN_AND_MEAN
+	#endif
+	#ifndef NOMINMAX
+		#define NOMINMAX
+	#endif
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <unistd.h>
+#endif
+
+// Read-only Memory-mapped File
+//
+// Pages are faulted in by the OS on first touch, so opening even a very large
+// file is close to free and unused parts of it are never read from disk.
+
+class mapped_file {
+public:
+	mapped_file(const std::string& filename) {
+#ifdef _WIN32
+		file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+						   OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE) return;
+
+		LARGE_INTEGER file_size;
+		if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) return;
+
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping == nullptr) return;
+
+		auto view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (view == nullptr) return;
+
+		bytes = static_cast<const unsigned char*>(view);
+		length = size_t(file_size.QuadPart);
+#else
+		int fd = open(filename.c_str(), O_RDONLY);
+		if (fd < 0) return;
+
+		struct stat info;
+		if (fstat(fd, &info) == 0 && info.st_size > 0) {
+			auto view = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+			if (view != MAP_FAILED) {
+				bytes = static_cast<const unsigned char*>(view);
+				length = size_t(info.st_size);
+			}
+		}
+
+		// The mapping stays valid after the descriptor is closed.
+		close(fd);
+#endif
+	}
+
+	~mapped_file() {
+#ifdef _WIN32
+		if (bytes) UnmapViewOfFile(bytes);
+		if (mapping) CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+		if (bytes) munmap(const_cast<unsigned char*>(bytes), length);
+#endif
+	}
+
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+
+	bool is_open() const { return bytes != nullptr; }
+
+	const unsigned char* data() const { return bytes; }
+	size_t size() const { return length; }
+
+	// The size and modification time of a file, which the caches built from
+	// it record to notice when it changes.
+	static bool stamp(const std::string& filename, uint64_t& size, int64_t& mtime) {
+		struct stat info;
+		if (stat(filename.c_str(), &info) != 0) return false;
+		size = uint64_t(info.st_size);
+		mtime = int64_t(info.st_mtime);
+		return true;
+	}
+
+private:
+	const unsigned char* bytes = nullptr;
+	size_t               length = 0;
+
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#endif
+};
+
+#endif // !MAPPED_FILE_H
@@ -1,7 +1,10 @@
 #ifndef MATERIAL_H
 #define MATERIAL_H
 
+#include "flat_texture.h"
 #include "hittable.h"
+#include "shading_batch.h"
+#include "spectrum.h"
 #include "texture.h"
 
 class material {
@@ -15,14 +18,120 @@ public:
 	virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const{
 		return false;
 	}
+
+	// scatter() for a path that carries the wavelengths `lambda` (spectrum.h).
+	// Only materials whose behavior depends on the wavelength override this;
+	// the rest scatter as in RGB and have their attenuation converted.
+	virtual bool scatter_spectral(const ray& r_in, const hit_record& rec, wavelengths& lambda, spectrum& attenuation, ray& scattered) const {
+		color rgb;
+		bool scatters = scatter(r_in, rec, rgb, scattered);
+		if (scatters) attenuation = lambda.from_rgb(rgb);
+		return scatters;
+	}
+
+	// Scatters hits [begin, end) of `hits`, which all landed on this material,
+	// into the same entries of `out`, using each hit's two random numbers.
+	// The materials here override this with loops that vectorize; any other
+	// material is shaded one hit at a time through scatter().
+	virtual void scatter_batch(const hit_batch& hits, size_t begin, size_t end, scatter_batch_result& out) const {
+		for (size_t k = begin; k < end; k++) {
+			ray r_in, scattered;
+			hit_record rec;
+			color attenuation;
+			hits.get(k, r_in, rec);
+			rec.mat = this;
+			out.scattered[k] = scatter(r_in, rec, attenuation, scattered);
+			out.dir_x[k] = scattered.direction().x();
+			out.dir_y[k] = scattered.direction().y();
+			out.dir_z[k] = scattered.direction().z();
+			out.attenuation_r[k] = attenuation.x();
+			out.attenuation_g[k] = attenuation.y();
+			out.attenuation_b[k] = attenuation.z();
+		}
+	}
+
+	// For sampling lights directly: the fraction of light arriving from
+	// `direction` that leaves back along `r_in` (the BSDF times the cosine),
+	// and the density with which scatter() picks that direction. Only
+	// diffuse materials implement this; false means the renderer should not
+	// sample lights here at all.
+	virtual bool evaluate(const ray& r_in, const hit_record& rec, const vec3& direction, color& value, double& pdf) const {
+		return false;
+	}
+
+	// Surface color at a hit, without any lighting. Only used for the albedo AOV.
+	virtual color albedo(const hit_record& rec) const {
+		return color(0, 0, 0);
+	}
+
+	// Whether emitted() can return anything but black. The renderer skips the
+	// call for the rest.
+	bool is_emissive() const {
+		return emissive;
+	}
+
+	// How much a bounce off this material widens the footprint of the ray
+	// that leaves it, in radians, for texture filtering further down the path.
+	// Mirrors and glass keep what they show sharp; rough surfaces blur it.
+	double footprint_spread() const {
+		return spread;
+	}
+
+	// Whether evaluate() works here, so direct light sampling pays off.
+	bool is_diffuse() const {
+		return diffuse;
+	}
+
+	// Whether hits are scattering points in a medium, which take light from
+	// every direction rather than from one side of a surface.
+	bool is_volumetric() const {
+		return volumetric;
+	}
+
+protected:
+	// Plain fields rather than virtual calls, since every hit asks for them
+	bool emissive = false;
+	double spread = 0;
+	bool diffuse = false;
+	bool volumetric = false;
+
+	// Writes the attenuation of hits [begin, end) from `surface`; a constant
+	// surface is a plain fill.
+	static void batch_attenuation(const flat_texture& surface, const hit_batch& hits, size_t begin, size_t end, scatter_batch_result& out) {
+		if (surface.is_constant()) {
+			const color& c = surface.constant();
+			for (size_t k = begin; k < end; k++) {
+				out.attenuation_r[k] = c.x();
+				out.attenuation_g[k] = c.y();
+				out.attenuation_b[k] = c.z();
+			}
+			return;
+		}
+		for (size_t k = begin; k < end; k++) {
+			auto c = surface.value(hits.u[k], hits.v[k], hits.point(k), hits.footprint[k]);
+			out.attenuation_r[k] = c.x();
+			out.attenuation_g[k] = c.y();
+			out.attenuation_b[k] = c.z();
+		}
+	}
 };
 
 class lambertian : public material {
 public:
-	lambertian(const color& albedo) : tex(make_shared<solid_color>(albedo)) {}
-	lambertian(shared_ptr<texture> tex) : tex(tex) {}
+	lambertian(const color& albedo) : tex(make_shared<solid_color>(albedo)), surface(albedo) {
+		// Roughly the width of the cosine lobe; what a diffuse bounce sees only
+		// matters averaged over many rays, so a coarse mip level is enough.
+		spread = 0.5;
+		diffuse = true;
+	}
+
+	lambertian(shared_ptr<texture> tex) : tex(tex), surface(*tex) {
+		spread = 0.5;
+		diffuse = true;
+	}
 
 	bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
+		RTW_STAT(scatter_calls[stat_lambertian]);
 		auto scatter_direction = rec.normal + random_unit_vector();
 
 		// Catch degenerate scattter direction
@@ -30,38 +139,131 @@ public:
 			scatter_direction = rec.normal;
 
 		scattered = ray(rec.p, scatter_direction, r_in.time());
-		attenuation = tex->value(rec.u, rec.v, rec.p);
+		attenuation = surface.value(rec.u, rec.v, rec.p, rec.footprint);
 		return true;
 	}
 
+	// scatter() picks directions by cosine, so the density is cos / pi.
+	bool evaluate(const ray& r_in, const hit_record& rec, const vec3& direction, color& value, double& pdf) const override {
+		double cosine = dot(rec.normal, direction) / direction.length();
+		if (cosine <= 0) {
+			value = color(0, 0, 0);
+			pdf = 0;
+			return true;
+		}
+		pdf = cosine / pi;
+		value = pdf * surface.value(rec.u, rec.v, rec.p, rec.footprint);
+		return true;
+	}
+
+	// The normal plus a uniform point on the unit sphere, as above, with the
+	// sphere point from the hit's random numbers instead of a rejection loop.
+	void scatter_batch(const hit_batch& hits, size_t begin, size_t end, scatter_batch_result& out) const override {
+		batch_directions(hits.data(), out.data(), begin, end);
+		batch_attenuation(surface, hits, begin, end, out);
+	}
+
+	color albedo(const hit_record& rec) const override {
+		return surface.value(rec.u, rec.v, rec.p, rec.footprint);
+	}
+
 private:
 	shared_ptr<texture> tex;
+	flat_texture surface; // tex, compiled
+
+	// The arrays come in as parameters so their restrict qualifiers hold and
+	// the loop vectorizes.
+	static void batch_directions(hit_batch::arrays in, scatter_batch_result::arrays out, size_t begin, size_t end) {
+		for (size_t k = begin; k < end; k++) {
+			double sx, sy, sz;
+			shading_batch_detail::unit_sphere(in.random0[k], in.random1[k], sx, sy, sz);
+			double nx = in.normal_x[k], ny = in.normal_y[k], nz = in.normal_z[k];
+			double dx = nx + sx, dy = ny + sy, dz = nz + sz;
+
+			bool degenerate = (std::fabs(dx) < 1e-8) & (std::fabs(dy) < 1e-8) & (std::fabs(dz) < 1e-8);
+			out.dir_x[k] = degenerate ? nx : dx;
+			out.dir_y[k] = degenerate ? ny : dy;
+			out.dir_z[k] = degenerate ? nz : dz;
+			out.scattered[k] = 1;
+		}
+	}
 };
 
 class metal : public material {
 public:
-	metal(const color& albedo, double roughness) : tex(make_shared<solid_color>(albedo)), roughness(roughness < 1 ? roughness : 1) {}
-	metal(shared_ptr<texture> tex, double roughness) : tex(tex) {}
+	metal(const color& albedo, double roughness)
+		: tex(make_shared<solid_color>(albedo)), surface(albedo), roughness(roughness < 1 ? roughness : 1)
+	{
+		spread = this->roughness;
+	}
+
+	metal(shared_ptr<texture> tex, double roughness)
+		: tex(tex), surface(*tex), roughness(roughness < 1 ? roughness : 1)
+	{
+		spread = this->roughness;
+	}
 
 	bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
+		RTW_STAT(scatter_calls[stat_metal]);
 		vec3 reflected = reflect(r_in.direction(), rec.normal);
 		reflected = unit_vector(reflected) + (roughness * random_unit_vector());
 		scattered = ray(rec.p, reflected, r_in.time());
-		attenuation = tex->value(rec.u, rec.v, rec.p);
+		attenuation = surface.value(rec.u, rec.v, rec.p, rec.footprint);
 		return (dot(scattered.direction(), rec.normal) > 0);
 	}
 
+	void scatter_batch(const hit_batch& hits, size_t begin, size_t end, scatter_batch_result& out) const override {
+		batch_directions(hits.data(), out.data(), begin, end, roughness);
+		batch_attenuation(surface, hits, begin, end, out);
+	}
+
+	color albedo(const hit_record& rec) const override {
+		return surface.value(rec.u, rec.v, rec.p, rec.footprint);
+	}
+
 private:
 	shared_ptr<texture> tex;
-	color albedo;
+	flat_texture surface; // tex, compiled
 	double roughness;
+
+	static void batch_directions(hit_batch::arrays in, scatter_batch_result::arrays out, size_t begin, size_t end, double roughness) {
+		for (size_t k = begin; k < end; k++) {
+			double nx = in.normal_x[k], ny = in.normal_y[k], nz = in.normal_z[k];
+			double dx = in.dir_x[k], dy = in.dir_y[k], dz = in.dir_z[k];
+
+			// Reflect, normalize, then blur by the roughness
+			double d_n = dx * nx + dy * ny + dz * nz;
+			double rx = dx - 2 * d_n * nx, ry = dy - 2 * d_n * ny, rz = dz - 2 * d_n * nz;
+			double inv_length = 1 / std::sqrt(rx * rx + ry * ry + rz * rz);
+
+			double sx, sy, sz;
+			shading_batch_detail::unit_sphere(in.random0[k], in.random1[k], sx, sy, sz);
+			rx = rx * inv_length + roughness * sx;
+			ry = ry * inv_length + roughness * sy;
+			rz = rz * inv_length + roughness * sz;
+
+			out.dir_x[k] = rx;
+			out.dir_y[k] = ry;
+			out.dir_z[k] = rz;
+			out.scattered[k] = rx * nx + ry * ny + rz * nz > 0;
+		}
+	}
 };
 
 class dielectric : public material {
 public:
 	dielectric(double refraction_index) : refraction_index(refraction_index) {}
 
+	// Glass whose index falls with the wavelength, by Cauchy's equation
+	// n = A + B / lambda^2, with `refraction_index` its index at 589.3 nm (the
+	// sodium D line that glass catalogs quote) and `cauchy_b` B in square
+	// micrometers: about 0.0042 for crown glass, 0.01 or more for dense flint.
+	// RGB renders use the index at 589.3 nm; spectral ones split white light.
+	dielectric(double refraction_index, double cauchy_b)
+		: refraction_index(refraction_index), cauchy_b(cauchy_b) {}
+
 	bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override{
+		RTW_STAT(scatter_calls[stat_dielectric]);
 		attenuation = color(1.0, 1.0, 1.0);
 		double ri = rec.front_face ? (1.0 / refraction_index) : refraction_index;
 
@@ -83,27 +285,196 @@ public:
 		return true;
 	}
 
+	// The hero wavelength picks reflection or refraction. A reflection goes
+	// the same way for every wavelength, weighted by how each one's Fresnel
+	// term compares to the hero's; a dispersive refraction bends each
+	// wavelength differently, so the path keeps only the hero.
+	bool scatter_spectral(const ray& r_in, const hit_record& rec, wavelengths& lambda, spectrum& attenuation, ray& scattered) const override {
+		if (cauchy_b == 0) {
+			color rgb;
+			scatter(r_in, rec, rgb, scattered);
+			attenuation = spectrum(1);
+			return true;
+		}
+
+		RTW_STAT(scatter_calls[stat_dielectric]);
+		vec3 unit_direction = unit_vector(r_in.direction());
+		double cos_theta = std::fmin(dot(-unit_direction, rec.normal), 1.0);
+		double sin_theta = std::sqrt(1.0 - cos_theta * cos_theta);
+
+		// Fresnel reflectance at every wavelength, 1 where it cannot refract
+		double ri[spectrum::count];
+		spectrum fresnel;
+		for (int i = 0; i < spectrum::count; i++) {
+			double n = index_at(lambda.lambda[i]);
+			ri[i] = rec.front_face ? (1.0 / n) : n;
+			fresnel[i] = ri[i] * sin_theta > 1.0 ? 1.0 : reflectance(cos_theta, ri[i]);
+		}
+
+		vec3 direction;
+		if (fresnel[0] > random_double()) {
+			direction = reflect(unit_direction, rec.normal);
+			attenuation = (1 / fresnel[0]) * fresnel;
+		}
+		else {
+			// Each wavelength would have left with probability 1 - fresnel; the
+			// hero did, so its own terms cancel
+			direction = refract(unit_direction, rec.normal, ri[0]);
+			attenuation = lambda.hero_weight();
+		}
+
+		scattered = ray(rec.p, direction, r_in.time());
+		return true;
+	}
+
+	// Both the reflected and the refracted direction are computed for every
+	// hit, and the Fresnel test picks one.
+	void scatter_batch(const hit_batch& hits, size_t begin, size_t end, scatter_batch_result& out) const override {
+		batch_directions(hits.data(), out.data(), begin, end, refraction_index);
+	}
+
+	color albedo(const hit_record& rec) const override {
+		return color(1, 1, 1);
+	}
+
 private:
 	double refraction_index;
+	double cauchy_b = 0;
+
+	// Index of refraction at `lambda` nm
+	double index_at(double lambda) const {
+		double micrometers = lambda * 0.001;
+		return refraction_index + cauchy_b * (1 / (micrometers * micrometers) - 1 / (0.5893 * 0.5893));
+	}
 
 	static double reflectance(double cosine, double refraction_index) {
 		auto r0 = (1 - refraction_index) / (1 + refraction_index);
 		r0 = r0 * r0;
 		return r0 + (1 - r0) * std::pow(1 - cosine, 5);
 	}
+
+	static void batch_directions(hit_batch::arrays in, scatter_batch_result::arrays out, size_t begin, size_t end, double refraction_index) {
+		const double inside = refraction_index, outside = 1.0 / refraction_index;
+		for (size_t k = begin; k < end; k++) {
+			double nx = in.normal_x[k], ny = in.normal_y[k], nz = in.normal_z[k];
+			double dx = in.dir_x[k], dy = in.dir_y[k], dz = in.dir_z[k];
+			double inv_length = 1 / std::sqrt(dx * dx + dy * dy + dz * dz);
+			dx *= inv_length;
+			dy *= inv_length;
+			dz *= inv_length;
+
+			double ri = shading_batch_detail::blend(in.front_face[k] != 0, outside, inside);
+			double d_n = dx * nx + dy * ny + dz * nz;
+			double cos_theta = -d_n;
+
+			// reflect()
+			double rx = dx - 2 * d_n * nx, ry = dy - 2 * d_n * ny, rz = dz - 2 * d_n * nz;
+
+			// refract()
+			double px = ri * (dx + cos_theta * nx), py = ri * (dy + cos_theta * ny), pz = ri * (dz + cos_theta * nz);
+			double parallel = -std::sqrt(std::fabs(1.0 - (px * px + py * py + pz * pz)));
+			double tx = px + parallel * nx, ty = py + parallel * ny, tz = pz + parallel * nz;
+
+			// ri * sin_theta > 1, squared so it needs no square root
+			bool cannot_refract = ri * ri * (1.0 - cos_theta * cos_theta) > 1.0;
+			bool reflects = cannot_refract | (shading_batch_detail::reflectance(cos_theta, ri) > in.random0[k]);
+			out.dir_x[k] = shading_batch_detail::blend(reflects, rx, tx);
+			out.dir_y[k] = shading_batch_detail::blend(reflects, ry, ty);
+			out.dir_z[k] = shading_batch_detail::blend(reflects, rz, tz);
+			out.attenuation_r[k] = 1;
+			out.attenuation_g[k] = 1;
+			out.attenuation_b[k] = 1;
+			out.scattered[k] = 1;
+		}
+	}
 };
 
 class diffuse_light : public material {
 public:
-	diffuse_light(shared_ptr<texture> tex) : tex(tex) {}
-	diffuse_light(const color& emit) : tex(make_shared<solid_color>(emit)) {}
+	diffuse_light(shared_ptr<texture> tex) : tex(tex), emission(*tex) {
+		emissive = true;
+	}
+
+	diffuse_light(const color& emit) : tex(make_shared<solid_color>(emit)), emission(emit) {
+		emissive = true;
+	}
 
 	color emitted(double u, double v, const point3& p) const override {
-		return tex->value(u, v, p);
+		return emission.value(u, v, p, 0);
+	}
+
+	bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
+		RTW_STAT(scatter_calls[stat_diffuse_light]);
+		return false;
+	}
+
+	void scatter_batch(const hit_batch& hits, size_t begin, size_t end, scatter_batch_result& out) const override {
+		for (size_t k = begin; k < end; k++)
+			out.scattered[k] = 0;
+	}
+
+	color albedo(const hit_record& rec) const override {
+		auto c = emission.value(rec.u, rec.v, rec.p, rec.footprint);
+		return color(std::fmin(c.x(), 1.0), std::fmin(c.y(), 1.0), std::fmin(c.z(), 1.0));
 	}
 
 private:
 	shared_ptr<texture> tex;
+	flat_texture emission; // tex, compiled
+};
+
+// Scatters equally in every direction. This is the phase function of the
+// media in medium.h, whose scattering events carry it.
+class isotropic : public material {
+public:
+	isotropic(const color& albedo) : tex(make_shared<solid_color>(albedo)), surface(albedo) {
+		spread = 1;
+		diffuse = true;
+		volumetric = true;
+	}
+
+	isotropic(shared_ptr<texture> tex) : tex(tex), surface(*tex) {
+		spread = 1;
+		diffuse = true;
+		volumetric = true;
+	}
+
+	bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
+		RTW_STAT(scatter_calls[stat_isotropic]);
+		scattered = ray(rec.p, random_unit_vector(), r_in.time());
+		attenuation = surface.value(rec.u, rec.v, rec.p, rec.footprint);
+		return true;
+	}
+
+	bool evaluate(const ray& r_in, const hit_record& rec, const vec3& direction, color& value, double& pdf) const override {
+		pdf = 1 / (4 * pi);
+		value = pdf * surface.value(rec.u, rec.v, rec.p, rec.footprint);
+		return true;
+	}
+
+	void scatter_batch(const hit_batch& hits, size_t begin, size_t end, scatter_batch_result& out) const override {
+		batch_directions(hits.data(), out.data(), begin, end);
+		batch_attenuation(surface, hits, begin, end, out);
+	}
+
+	color albedo(const hit_record& rec) const override {
+		return surface.value(rec.u, rec.v, rec.p, rec.footprint);
+	}
+
+private:
+	shared_ptr<texture> tex;
+	flat_texture surface; // tex, compiled
+
+	static void batch_directions(hit_batch::arrays in, scatter_batch_result::arrays out, size_t begin, size_t end) {
+		for (size_t k = begin; k < end; k++) {
+			double x, y, z;
+			shading_batch_detail::unit_sphere(in.random0[k], in.random1[k], x, y, z);
+			out.dir_x[k] = x;
+			out.dir_y[k] = y;
+			out.dir_z[k] = z;
+			out.scattered[k] = 1;
+		}
+	}
 };
 
 #endif
@@ -0,0 +1,321 @@
+#ifndef MEDIUM_H
+#define MEDIUM_H
+
+#include "hittable.h"
+#include "material.h"
+#include "perlin.h"
+#include "trilinear_grid.h"
+
+#include <algorithm>
+#include <vector>
+
+// Participating Media
+//
+// Smoke, fog and other volumes that scatter light throughout. A medium is a
+// hittable whose hit is a point inside it where the ray scatters, drawn at
+// random along the ray; a ray that gets through without scattering misses
+// it and goes on to whatever lies behind. The point carries an isotropic
+// material, so the renderer handles it like any other bounce.
+//
+// In a homogeneous medium the distance to the next scattering event follows
+// an exponential distribution and is drawn directly, with one random number
+// per ray. A heterogeneous medium uses delta tracking: tentative collisions
+// are drawn against a majorant, a density at least as high as the real one,
+// and each is accepted with probability density / majorant. The majorant is
+// kept per block of the density grid and the ray steps from block to block,
+// so it crosses empty blocks without any collisions and thin ones with few.
+//
+// transmittance() gives how much light gets through a segment without
+// scattering, exactly for a homogeneous medium and by ratio tracking for a
+// heterogeneous one. Shadow rays use it, so a light behind smoke is dimmed
+// smoothly rather than either seen or blocked.
+//
+// Densities are per unit of length in the medium's own space, so scaling a
+// medium through an instance also scales how thick it looks.
+
+class medium : public hittable {
+protected:
+	shared_ptr<material> phase_function;
+
+	medium(const color& albedo) : phase_function(make_shared<isotropic>(albedo)) {}
+
+	// A scattering event at `t` along `r`. The normal faces back along the
+	// ray, which keeps the renderer's footprint and AOV code happy; an
+	// isotropic medium does not use it.
+	void scatter_at(const ray& r, double t, hit_record& rec) const {
+		rec.t = t;
+		rec.p = r.at(t);
+		rec.normal = -unit_vector(r.direction());
+		rec.front_face = true;
+		rec.u = 0;
+		rec.v = 0;
+		rec.uv_density = 0;
+		rec.mat = phase_function.get();
+	}
+
+	// The distance to the next collision in a medium of `density`
+	static double free_flight(double density) {
+		return -std::log(1 - random_double()) / density;
+	}
+};
+
+// A medium of the same density everywhere inside a closed boundary.
+class constant_medium : public medium {
+public:
+	constant_medium(shared_ptr<hittable> boundary, double density, const color& albedo)
+		: medium(albedo), boundary(boundary), density(density), bbox(boundary->bounding_box()) {}
+
+	// Fills a box. The ray is clipped to it with one slab test instead of
+	// two intersections with a boundary, which makes fog filling a room
+	// cheap.
+	constant_medium(const aabb& box, double density, const color& albedo)
+		: medium(albedo), density(density), bbox(box) {}
+
+	bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+		interval inside;
+		if (!span(r, ray_t, inside)) return false;
+
+		double ray_length = r.direction().length();
+		double distance_inside_boundary = (inside.max - inside.min) * ray_length;
+		double hit_distance = free_flight(density);
+		if (hit_distance >= distance_inside_boundary) return false;
+
+		scatter_at(r, inside.min + hit_distance / ray_length, rec);
+		return true;
+	}
+
+	double transmittance(const ray& r, interval ray_t) const override {
+		interval inside;
+		if (!span(r, ray_t, inside)) return 1;
+		return std::exp(-density * (inside.max - inside.min) * r.direction().length());
+	}
+
+	aabb bounding_box() const override { return bbox; }
+
+private:
+	shared_ptr<hittable> boundary; // Null when the medium is just its box
+	double density;
+	aabb bbox;
+
+	// The part of `ray_t` inside the medium, if any
+	bool span(const ray& r, interval ray_t, interval& inside) const {
+		if (!boundary) {
+			inside = ray_t;
+			return bbox.clip(r, inside);
+		}
+
+		hit_record rec1, rec2;
+		if (!boundary->hit(r, interval::universe, rec1)) return false;
+		if (!boundary->hit(r, interval(rec1.t + 0.0001, infinity), rec2)) return false;
+
+		inside = interval(std::fmax(rec1.t, ray_t.min), std::fmin(rec2.t, ray_t.max));
+		if (inside.min < 0) inside.min = 0;
+		return inside.min < inside.max;
+	}
+};
+
+// Densities sampled at the corners of a regular grid of cells over a box and
+// looked up with trilinear interpolation (trilinear_grid.h), together with
+// the highest density in each block of cells.
+class density_grid {
+public:
+	// How many cells a majorant block spans along each axis
+	static const int block_cells = 8;
+
+	// `resolution` samples along the box's longest side and proportionally
+	// fewer along the others, all zero until fill() is called.
+	density_grid(const aabb& box, int resolution)
+		: box(box), grid(point3(box.x.min, box.y.min, box.z.min), point3(box.x.max, box.y.max, box.z.max), std::max(resolution, 2))
+	{
+		for (int a = 0; a < 3; a++)
+			blocks[a] = (grid.cells(a) + block_cells - 1) / block_cells;
+		majorants.assign(size_t(blocks[0]) * blocks[1] * blocks[2], 0.0f);
+	}
+
+	const aabb& bounds() const { return box; }
+
+	// Sets every sample to `density(p)` at its position and updates the
+	// majorants. Runs on the render threads.
+	template <typename Density>
+	void fill(const Density& density) {
+		grid.fill([&](const point3& p) { return std::max(0.0, density(p)); });
+		update_majorants();
+	}
+
+	// Trilinear lookup; zero outside the box.
+	double density(const point3& p) const {
+		float value;
+		return grid.lookup(p, value) ? value : 0;
+	}
+
+	// Walks the blocks `r` crosses within `ray_t`, in order, calling
+	// `visit(t_enter, t_exit, majorant)` for each until it returns true.
+	// Returns whether it did.
+	template <typename Visit>
+	bool march(const ray& r, interval ray_t, const Visit& visit) const {
+		if (!box.clip(r, ray_t)) return false;
+
+		// In units of blocks from the grid's origin
+		double block_size = grid.spacing() * block_cells;
+		vec3 o = (r.origin() - grid.origin()) / block_size;
+		vec3 d = r.direction() / block_size;
+
+		int block[3], step[3];
+		double next[3], delta[3];
+		for (int a = 0; a < 3; a++) {
+			double start = o[a] + ray_t.min * d[a];
+			block[a] = std::min(std::max(int(start), 0), blocks[a] - 1);
+			if (d[a] > 0) {
+				step[a] = 1;
+				next[a] = (block[a] + 1 - o[a]) / d[a];
+				delta[a] = 1 / d[a];
+			}
+			else if (d[a] < 0) {
+				step[a] = -1;
+				next[a] = (block[a] - o[a]) / d[a];
+				delta[a] = -1 / d[a];
+			}
+			else {
+				step[a] = 0;
+				next[a] = infinity;
+				delta[a] = infinity;
+			}
+		}
+
+		double t = ray_t.min;
+		while (true) {
+			int axis = next[0] < next[1] ? (next[0] < next[2] ? 0 : 2) : (next[1] < next[2] ? 1 : 2);
+			double t_exit = std::min(next[axis], ray_t.max);
+
+			double majorant = majorants[(size_t(block[2]) * blocks[1] + block[1]) * blocks[0] + block[0]];
+			if (visit(t, t_exit, majorant)) return true;
+
+			if (t_exit >= ray_t.max) return false;
+			block[axis] += step[axis];
+			if (block[axis] < 0 || block[axis] >= blocks[axis]) return false;
+			t = t_exit;
+			next[axis] += delta[axis];
+		}
+	}
+
+	// Samples and blocks, for reporting
+	size_t sample_count() const { return grid.sample_count(); }
+	size_t block_count() const { return majorants.size(); }
+
+	// How many blocks hold no density at all
+	size_t empty_blocks() const {
+		return size_t(std::count(majorants.begin(), majorants.end(), 0.0f));
+	}
+
+private:
+	aabb box;
+	trilinear_grid grid;
+	int blocks[3] = { 0, 0, 0 }; // Majorant blocks along each axis
+	std::vector<float> majorants;
+
+	// Interpolation never exceeds the samples around a cell, so a block's
+	// majorant is the largest sample on or inside its corners.
+	void update_majorants() {
+		for (int bz = 0; bz < blocks[2]; bz++) {
+			for (int by = 0; by < blocks[1]; by++) {
+				for (int bx = 0; bx < blocks[0]; bx++) {
+					float highest = 0;
+					int k1 = std::min((bz + 1) * block_cells, grid.cells(2));
+					int j1 = std::min((by + 1) * block_cells, grid.cells(1));
+					int i1 = std::min((bx + 1) * block_cells, grid.cells(0));
+					for (int k = bz * block_cells; k <= k1; k++)
+						for (int j = by * block_cells; j <= j1; j++)
+							for (int i = bx * block_cells; i <= i1; i++)
+								highest = std::max(highest, grid.sample(i, j, k));
+					majorants[(size_t(bz) * blocks[1] + by) * blocks[0] + bx] = highest;
+				}
+			}
+		}
+	}
+};
+
+// Perlin turbulence over `box`, scaled by `density`, as a density grid of
+// `resolution` samples along the longest side. Smoke, clouds and the like.
+inline shared_ptr<density_grid> noise_density(const aabb& box, int resolution, double density, double scale) {
+	auto grid = make_shared<density_grid>(box, resolution);
+	perlin noise;
+	grid->fill([&](const point3& p) { return density * noise.turb(scale * p, 7); });
+	return grid;
+}
+
+// A medium whose density varies over a grid: a density_grid, or a
+// sparse_grid (sparse_grid.h) for large volumes that are mostly empty. Any
+// type with bounds(), density() and march() like theirs will do. Outside the
+// grid's box the medium is empty.
+template <typename Grid>
+class grid_medium : public medium {
+public:
+	// The grid's values times `density_scale` are the density, so one grid
+	// can be shared by media of different thickness.
+	grid_medium(shared_ptr<Grid> grid, const color& albedo, double density_scale = 1)
+		: medium(albedo), grid(grid), density_scale(density_scale) {}
+
+	// Delta tracking. The optical depth to the next tentative collision is
+	// drawn once and used up block by block, so crossing a block costs no
+	// random numbers or logarithms.
+	bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+		double ray_length = r.direction().length();
+		double depth = free_flight(1);
+		double t_hit = 0;
+
+		bool scattered = grid->march(r, ray_t, [&](double t, double t_exit, double majorant) {
+			majorant *= density_scale;
+			double density_per_t = majorant * ray_length;
+			while (true) {
+				double segment = density_per_t * (t_exit - t);
+				if (depth >= segment) {
+					depth -= segment;
+					return false;
+				}
+				t += depth / density_per_t;
+				if (random_double() * majorant < density_scale * grid->density(r.at(t))) {
+					t_hit = t;
+					return true;
+				}
+				depth = free_flight(1);
+			}
+		});
+
+		if (!scattered) return false;
+		scatter_at(r, t_hit, rec);
+		return true;
+	}
+
+	// Ratio tracking: every tentative collision lets through the fraction of
+	// the majorant that is not real density.
+	double transmittance(const ray& r, interval ray_t) const override {
+		double ray_length = r.direction().length();
+		double depth = free_flight(1);
+		double transmitted = 1;
+
+		grid->march(r, ray_t, [&](double t, double t_exit, double majorant) {
+			majorant *= density_scale;
+			double density_per_t = majorant * ray_length;
+			while (true) {
+				double segment = density_per_t * (t_exit - t);
+				if (depth >= segment) {
+					depth -= segment;
+					return false;
+				}
+				t += depth / density_per_t;
+				transmitted *= 1 - density_scale * grid->density(r.at(t)) / majorant;
+				depth = free_flight(1);
+			}
+		});
+
+		return transmitted;
+	}
+
+	aabb bounding_box() const override { return grid->bounds(); }
+
+private:
+	shared_ptr<Grid> grid;
+	double density_scale;
+};
+
+#endif // !MEDIUM_H
@@ -0,0 +1,249 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include "mapped_file.h"
+#include "mesh_loader.h"
+
+#include <cstdio>
+
+// Binary Mesh Cache
+//
+// Parsing a large OBJ/PLY and building its BVH dominates startup, so the
+// result is written next to the source file as a flat, position-independent
+// image: a fixed header followed by 64-byte aligned sections for positions,
+// normals, uvs, indices and BVH nodes, referenced by file offsets only. On the
+// next run the cache is memory-mapped and the mesh traces straight out of the
+// mapped pages, with nothing to parse or rebuild.
+//
+// The cache stores native-endian data and records the size and modification
+// time of its source; it is silently rebuilt whenever either changes. The
+// indices and BVH are checked once, when the cache is written, and the header
+// carries a checksum, so mapping it only reads the header and never touches
+// the data pages until rays do.
+
+struct mesh_cache_header {
+	char     magic[8];
+	uint32_t version;
+	uint32_t endian_tag;
+	uint64_t source_size;
+	int64_t  source_mtime;
+	uint32_t flags;
+	uint32_t header_checksum;  // Of this header with this field zero
+	uint64_t vertex_count;
+	uint64_t triangle_count;
+	uint64_t node_count;
+	uint64_t positions_offset;
+	uint64_t normals_offset;
+	uint64_t uvs_offset;
+	uint64_t indices_offset;
+	uint64_t nodes_offset;
+};
+
+namespace mesh_cache_detail {
+	const char     magic[8]     = { 'R', 'T', 'W', 'M', 'E', 'S', 'H', '\0' };
+	const uint32_t version      = 2;
+	const uint32_t endian_tag   = 0x01020304;
+	const uint64_t alignment    = 64;
+
+	const uint32_t has_normals    = 1u << 0;
+	const uint32_t has_uvs        = 1u << 1;
+	const uint32_t smooth_normals = 1u << 2;
+	const uint32_t validated      = 1u << 3;  // The writer checked the mesh with mesh_is_valid
+
+	inline uint64_t align(uint64_t offset) {
+		return (offset + alignment - 1) & ~(alignment - 1);
+	}
+
+	inline bool source_stamp(const std::string& filename, uint64_t& size, int64_t& mtime) {
+		return mapped_file::stamp(filename, size, mtime);
+	}
+
+	// FNV-1a over the header, skipping the checksum itself
+	inline uint32_t checksum(mesh_cache_header header) {
+		header.header_checksum = 0;
+		const auto* bytes = reinterpret_cast<const unsigned char*>(&header);
+		uint32_t hash = 2166136261u;
+		for (size_t i = 0; i < sizeof(header); i++)
+			hash = (hash ^ bytes[i]) * 16777619u;
+		return hash;
+	}
+
+	inline bool section_fits(uint64_t offset, uint64_t bytes, size_t file_size) {
+		return offset % 4 == 0 && offset <= file_size && bytes <= file_size - offset;
+	}
+
+	// Whether every index names a vertex and the BVH is a tree that
+	// triangle_mesh::hit can walk: each interior node's second child lies
+	// past its first, leaves stay within the triangles, and no path is deeper
+	// than the traversal stack.
+	inline bool mesh_is_valid(const mesh_view& view) {
+		for (size_t i = 0; i < 3 * view.triangle_count; i++)
+			if (view.indices[i] >= view.vertex_count) return false;
+
+		if (view.node_count == 0) return true;
+
+		struct pending { uint64_t node; int depth; };
+		std::vector<pending> stack = { { 0, 0 } };
+		size_t visited = 0;
+		while (!stack.empty()) {
+			auto p = stack.back();
+			stack.pop_back();
+			if (++visited > view.node_count || p.depth >= 64) return false;
+
+			const auto& node = view.nodes[p.node];
+			if (node.count > 0) {
+				if (uint64_t(node.offset) + node.count > view.triangle_count) return false;
+				continue;
+			}
+			if (p.node + 1 >= view.node_count || node.offset <= p.node + 1 || node.offset >= view.node_count)
+				return false;
+			stack.push_back({ node.offset, p.depth + 1 });
+			stack.push_back({ p.node + 1, p.depth + 1 });
+		}
+		return true;
+	}
+}
+
+inline bool write_mesh_cache(const std::string& cache_filename, const triangle_mesh& mesh,
+							 uint64_t source_size, int64_t source_mtime, uint32_t extra_flags = 0)
+{
+	using namespace mesh_cache_detail;
+	const auto& view = mesh.view();
+	if (!mesh_is_valid(view)) return false;
+
+	mesh_cache_header header = {};
+	std::memcpy(header.magic, magic, sizeof(magic));
+	header.version        = version;
+	header.endian_tag     = endian_tag;
+	header.source_size    = source_size;
+	header.source_mtime   = source_mtime;
+	header.flags          = extra_flags
+						  | validated
+						  | (view.normals ? has_normals : 0)
+						  | (view.uvs ? has_uvs : 0);
+	header.vertex_count   = view.vertex_count;
+	header.triangle_count = view.triangle_count;
+	header.node_count     = view.node_count;
+
+	struct section { const void* data; uint64_t bytes; uint64_t* offset; };
+	section sections[] = {
+		{ view.positions, 3 * sizeof(float) * view.vertex_count,     &header.positions_offset },
+		{ view.normals,   view.normals ? 3 * sizeof(float) * view.vertex_count : 0, &header.normals_offset },
+		{ view.uvs,       view.uvs ? 2 * sizeof(float) * view.vertex_count : 0,     &header.uvs_offset },
+		{ view.indices,   3 * sizeof(uint32_t) * view.triangle_count, &header.indices_offset },
+		{ view.nodes,     sizeof(mesh_bvh_node) * view.node_count,   &header.nodes_offset },
+	};
+
+	uint64_t offset = align(sizeof(header));
+	for (auto& s : sections) {
+		*s.offset = offset;
+		offset = align(offset + s.bytes);
+	}
+	header.header_checksum = checksum(header);
+
+	// Write to a temporary file first so a crash never leaves a torn cache.
+	auto temp_filename = cache_filename + ".tmp";
+	{
+		std::ofstream out(temp_filename, std::ios::binary | std::ios::trunc);
+		if (!out) return false;
+
+		static const char padding[alignment] = {};
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		uint64_t written = sizeof(header);
+
+		for (const auto& s : sections) {
+			out.write(padding, std::streamsize(*s.offset - written));
+			if (s.bytes > 0) out.write(static_cast<const char*>(s.data), std::streamsize(s.bytes));
+			written = *s.offset + s.bytes;
+		}
+
+		if (!out) {
+			out.close();
+			std::remove(temp_filename.c_str());
+			return false;
+		}
+	}
+
+	std::remove(cache_filename.c_str());
+	return std::rename(temp_filename.c_str(), cache_filename.c_str()) == 0;
+}
+
+// Maps a cache file and wraps it in a triangle_mesh. Returns null if the file
+// is missing, malformed, or was built from a different version of the source.
+inline shared_ptr<triangle_mesh> map_mesh_cache(const std::string& cache_filename, shared_ptr<material> mat,
+												uint64_t source_size, int64_t source_mtime, uint32_t extra_flags = 0)
+{
+	using namespace mesh_cache_detail;
+
+	auto file = make_shared<mapped_file>(cache_filename);
+	if (!file->is_open() || file->size() < sizeof(mesh_cache_header)) return nullptr;
+
+	mesh_cache_header header;
+	std::memcpy(&header, file->data(), sizeof(header));
+
+	if (std::memcmp(header.magic, magic, sizeof(magic)) != 0
+		|| header.version != version
+		|| header.endian_tag != endian_tag
+		|| header.header_checksum != checksum(header)
+		|| (header.flags & validated) == 0
+		|| header.source_size != source_size
+		|| header.source_mtime != source_mtime
+		|| (header.flags & smooth_normals) != (extra_flags & smooth_normals))
+		return nullptr;
+
+	// No count can exceed the file's size in bytes, which also keeps the
+	// section sizes below from overflowing.
+	auto size = file->size();
+	if (header.vertex_count > size || header.triangle_count > size || header.node_count > size
+		|| header.triangle_count > UINT32_MAX)
+		return nullptr;
+
+	bool normals = (header.flags & has_normals) != 0;
+	bool uvs = (header.flags & has_uvs) != 0;
+
+	if (!section_fits(header.positions_offset, 3 * sizeof(float) * header.vertex_count, size)
+		|| (normals && !section_fits(header.normals_offset, 3 * sizeof(float) * header.vertex_count, size))
+		|| (uvs && !section_fits(header.uvs_offset, 2 * sizeof(float) * header.vertex_count, size))
+		|| !section_fits(header.indices_offset, 3 * sizeof(uint32_t) * header.triangle_count, size)
+		|| !section_fits(header.nodes_offset, sizeof(mesh_bvh_node) * header.node_count, size))
+		return nullptr;
+
+	auto base = file->data();
+
+	mesh_view view;
+	view.positions      = reinterpret_cast<const float*>(base + header.positions_offset);
+	view.normals        = normals ? reinterpret_cast<const float*>(base + header.normals_offset) : nullptr;
+	view.uvs            = uvs ? reinterpret_cast<const float*>(base + header.uvs_offset) : nullptr;
+	view.indices        = reinterpret_cast<const uint32_t*>(base + header.indices_offset);
+	view.nodes          = reinterpret_cast<const mesh_bvh_node*>(base + header.nodes_offset);
+	view.vertex_count   = size_t(header.vertex_count);
+	view.triangle_count = size_t(header.triangle_count);
+	view.node_count     = size_t(header.node_count);
+
+	return make_shared<triangle_mesh>(view, file, mat);
+}
+
+// Like load_mesh, but goes through a "<filename>.rtwmesh" cache alongside the
+// source. A missing or stale cache is rebuilt after loading the source.
+inline shared_ptr<triangle_mesh> load_mesh_cached(const std::string& filename, shared_ptr<material> mat, bool smooth_normals = true) {
+	using namespace mesh_cache_detail;
+
+	uint64_t source_size;
+	int64_t source_mtime;
+	if (!source_stamp(filename, source_size, source_mtime))
+		return load_mesh(filename, mat, smooth_normals);
+
+	auto cache_filename = filename + ".rtwmesh";
+	uint32_t flags = smooth_normals ? mesh_cache_detail::smooth_normals : 0;
+
+	if (auto cached = map_mesh_cache(cache_filename, mat, source_size, source_mtime, flags))
+		return cached;
+
+	auto mesh = load_mesh(filename, mat, smooth_normals);
+	if (mesh && !write_mesh_cache(cache_filename, *mesh, source_size, source_mtime, flags))
+		std::clog << "WARNING: Could not write mesh cache '" << cache_filename << "'.\n";
+
+	return mesh;
+}
+
+#endif // !MESH_CACHE_H
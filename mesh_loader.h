@@ -0,0 +1,429 @@
+#ifndef MESH_LOADER_H
+#define MESH_LOADER_H
+
+#include "triangle_mesh.h"
+
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+
+// Mesh Loading
+//
+// Both loaders stream their input instead of reading whole files, so the only
+// memory that grows with model size is the mesh being built. Faces with more
+// than three vertices are fan triangulated.
+
+namespace mesh_loader_detail {
+
+	// Resolves a 1-based (or negative, relative) OBJ index to a 0-based one.
+	inline long resolve_obj_index(long index, size_t count) {
+		return index < 0 ? long(count) + index : index - 1;
+	}
+
+	struct obj_corner {
+		long v, vt, vn;
+
+		bool operator==(const obj_corner& other) const {
+			return v == other.v && vt == other.vt && vn == other.vn;
+		}
+	};
+
+	struct obj_corner_hash {
+		size_t operator()(const obj_corner& c) const {
+			auto h = std::hash<long>()(c.v);
+			h ^= std::hash<long>()(c.vt) + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+			h ^= std::hash<long>()(c.vn) + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+			return h;
+		}
+	};
+
+	// Parses "v", "v/vt", "v//vn" or "v/vt/vn". Missing entries are set to -1.
+	inline bool parse_obj_corner(const char*& s, size_t v_count, size_t vt_count, size_t vn_count, obj_corner& c) {
+		char* end;
+		long v = std::strtol(s, &end, 10);
+		if (end == s) return false;
+		s = end;
+
+		c.v = resolve_obj_index(v, v_count);
+		c.vt = c.vn = -1;
+
+		if (*s == '/') {
+			s++;
+			if (*s != '/') {
+				long vt = std::strtol(s, &end, 10);
+				if (end != s) c.vt = resolve_obj_index(vt, vt_count);
+				s = end;
+			}
+			if (*s == '/') {
+				s++;
+				long vn = std::strtol(s, &end, 10);
+				if (end != s) c.vn = resolve_obj_index(vn, vn_count);
+				s = end;
+			}
+		}
+
+		return c.v >= 0 && size_t(c.v) < v_count;
+	}
+
+	inline const char* skip_space(const char* s) {
+		while (*s == ' ' || *s == '\t') s++;
+		return s;
+	}
+
+	enum class ply_type { int8, uint8, int16, uint16, int32, uint32, float32, float64 };
+
+	inline bool parse_ply_type(const std::string& name, ply_type& type) {
+		if (name == "char"   || name == "int8")    { type = ply_type::int8;    return true; }
+		if (name == "uchar"  || name == "uint8")   { type = ply_type::uint8;   return true; }
+		if (name == "short"  || name == "int16")   { type = ply_type::int16;   return true; }
+		if (name == "ushort" || name == "uint16")  { type = ply_type::uint16;  return true; }
+		if (name == "int"    || name == "int32")   { type = ply_type::int32;   return true; }
+		if (name == "uint"   || name == "uint32")  { type = ply_type::uint32;  return true; }
+		if (name == "float"  || name == "float32") { type = ply_type::float32; return true; }
+		if (name == "double" || name == "float64") { type = ply_type::float64; return true; }
+		return false;
+	}
+
+	inline int ply_type_size(ply_type type) {
+		switch (type) {
+			case ply_type::int8:  case ply_type::uint8:  return 1;
+			case ply_type::int16: case ply_type::uint16: return 2;
+			case ply_type::int32: case ply_type::uint32: case ply_type::float32: return 4;
+			default: return 8;
+		}
+	}
+
+	struct ply_property {
+		std::string name;
+		ply_type type;
+		bool is_list = false;
+		ply_type count_type = ply_type::uint8;
+	};
+
+	struct ply_element {
+		std::string name;
+		size_t count = 0;
+		std::vector<ply_property> properties;
+	};
+
+	enum class ply_format { ascii, binary_little_endian, binary_big_endian };
+
+	class ply_reader {
+	public:
+		ply_reader(std::istream& in, ply_format format) : in(in), format(format) {
+			uint16_t probe = 1;
+			unsigned char first;
+			std::memcpy(&first, &probe, 1);
+			swap_bytes = (format == ply_format::binary_big_endian) == (first == 1);
+		}
+
+		double read(ply_type type) {
+			if (format == ply_format::ascii) {
+				double value = 0;
+				in >> value;
+				return value;
+			}
+
+			unsigned char bytes[8];
+			int size = ply_type_size(type);
+			in.read(reinterpret_cast<char*>(bytes), size);
+			if (swap_bytes) std::reverse(bytes, bytes + size);
+
+			switch (type) {
+				case ply_type::int8:    { int8_t v;   std::memcpy(&v, bytes, 1); return v; }
+				case ply_type::uint8:   { uint8_t v;  std::memcpy(&v, bytes, 1); return v; }
+				case ply_type::int16:   { int16_t v;  std::memcpy(&v, bytes, 2); return v; }
+				case ply_type::uint16:  { uint16_t v; std::memcpy(&v, bytes, 2); return v; }
+				case ply_type::int32:   { int32_t v;  std::memcpy(&v, bytes, 4); return v; }
+				case ply_type::uint32:  { uint32_t v; std::memcpy(&v, bytes, 4); return v; }
+				case ply_type::float32: { float v;    std::memcpy(&v, bytes, 4); return v; }
+				default:                { double v;   std::memcpy(&v, bytes, 8); return v; }
+			}
+		}
+
+		bool good() const { return bool(in); }
+
+	private:
+		std::istream& in;
+		ply_format format;
+		bool swap_bytes;
+	};
+}
+
+inline bool load_obj(const std::string& filename, mesh_data& mesh) {
+	using namespace mesh_loader_detail;
+
+	std::ifstream in(filename);
+	if (!in) return false;
+
+	mesh = mesh_data();
+
+	// Raw attribute streams. Positions are used directly while faces reference
+	// positions only; from the first corner with a uv or normal on, each
+	// distinct v/vt/vn triple becomes a vertex.
+	std::vector<float> raw_positions, raw_uvs, raw_normals;
+	std::unordered_map<obj_corner, uint32_t, obj_corner_hash> corner_map;
+	bool unify_corners = false;
+
+	std::vector<uint32_t> face;
+	std::string line;
+
+	// Appends vertex `index`'s value of one attribute to `stream`. A stream
+	// starts with the first corner that has the attribute, with zeros for
+	// the vertices before it.
+	auto add_attribute = [](std::vector<float>& stream, const std::vector<float>& raw, long ref, size_t width, uint32_t index) {
+		bool has = ref >= 0 && size_t(ref) < raw.size() / width;
+		if (!has && stream.empty()) return;
+		stream.resize(index * width, 0.0f);
+		if (has) stream.insert(stream.end(), &raw[width * ref], &raw[width * ref] + width);
+		else stream.insert(stream.end(), width, 0.0f);
+	};
+
+	auto corner_index = [&](const obj_corner& c) -> uint32_t {
+		if (!unify_corners) return uint32_t(c.v);
+
+		auto found = corner_map.find(c);
+		if (found != corner_map.end()) return found->second;
+
+		auto index = uint32_t(mesh.positions.size() / 3);
+		corner_map.emplace(c, index);
+		mesh.positions.insert(mesh.positions.end(), &raw_positions[3 * c.v], &raw_positions[3 * c.v] + 3);
+		add_attribute(mesh.normals, raw_normals, c.vn, 3, index);
+		add_attribute(mesh.uvs, raw_uvs, c.vt, 2, index);
+		return index;
+	};
+
+	// Turns the position indices used so far into vertices of their own
+	auto start_unifying = [&]() {
+		unify_corners = true;
+		auto unified = [&](uint32_t& i) { i = corner_index(obj_corner{ long(i), -1, -1 }); };
+		for (auto& i : mesh.indices) unified(i);
+		for (auto& i : face) unified(i);
+	};
+
+	while (std::getline(in, line)) {
+		const char* s = skip_space(line.c_str());
+		char* end;
+
+		if (s[0] == 'v' && (s[1] == ' ' || s[1] == '\t')) {
+			s += 2;
+			for (int i = 0; i < 3; i++) {
+				raw_positions.push_back(std::strtof(s, &end));
+				s = end;
+			}
+		}
+		else if (s[0] == 'v' && s[1] == 't') {
+			s += 2;
+			for (int i = 0; i < 2; i++) {
+				raw_uvs.push_back(std::strtof(s, &end));
+				s = end;
+			}
+		}
+		else if (s[0] == 'v' && s[1] == 'n') {
+			s += 2;
+			for (int i = 0; i < 3; i++) {
+				raw_normals.push_back(std::strtof(s, &end));
+				s = end;
+			}
+		}
+		else if (s[0] == 'f' && (s[1] == ' ' || s[1] == '\t')) {
+			s += 2;
+			face.clear();
+
+			obj_corner c;
+			while (*(s = skip_space(s)) != '\0' && *s != '\r') {
+				if (!parse_obj_corner(s, raw_positions.size() / 3, raw_uvs.size() / 2, raw_normals.size() / 3, c)) {
+					std::cerr << "ERROR: Malformed face in '" << filename << "'.\n";
+					return false;
+				}
+
+				if (!unify_corners && (c.vt >= 0 || c.vn >= 0)) start_unifying();
+
+				face.push_back(corner_index(c));
+			}
+
+			for (size_t i = 2; i < face.size(); i++)
+				mesh.indices.insert(mesh.indices.end(), { face[0], face[i - 1], face[i] });
+		}
+	}
+
+	if (!unify_corners) mesh.positions.swap(raw_positions);
+
+	// Drop attribute streams that do not cover every vertex.
+	if (mesh.normals.size() != mesh.positions.size()) mesh.normals.clear();
+	if (mesh.uvs.size() != 2 * mesh.vertex_count()) mesh.uvs.clear();
+
+	return true;
+}
+
+inline bool load_ply(const std::string& filename, mesh_data& mesh) {
+	using namespace mesh_loader_detail;
+
+	std::ifstream in(filename, std::ios::binary);
+	if (!in) return false;
+
+	mesh = mesh_data();
+
+	// Header
+	std::string line, word;
+	std::getline(in, line);
+	if (line.compare(0, 3, "ply") != 0) {
+		std::cerr << "ERROR: '" << filename << "' is not a PLY file.\n";
+		return false;
+	}
+
+	ply_format format = ply_format::ascii;
+	std::vector<ply_element> elements;
+
+	while (std::getline(in, line)) {
+		if (!line.empty() && line.back() == '\r') line.pop_back();
+		std::istringstream header(line);
+		header >> word;
+
+		if (word == "format") {
+			header >> word;
+			if (word == "binary_little_endian") format = ply_format::binary_little_endian;
+			else if (word == "binary_big_endian") format = ply_format::binary_big_endian;
+		}
+		else if (word == "element") {
+			ply_element element;
+			header >> element.name >> element.count;
+			elements.push_back(element);
+		}
+		else if (word == "property" && !elements.empty()) {
+			ply_property property;
+			std::string type_name;
+			header >> type_name;
+
+			if (type_name == "list") {
+				std::string count_name;
+				header >> count_name >> type_name;
+				property.is_list = true;
+				if (!parse_ply_type(count_name, property.count_type)) return false;
+			}
+			if (!parse_ply_type(type_name, property.type)) {
+				std::cerr << "ERROR: Unknown PLY property type '" << type_name << "'.\n";
+				return false;
+			}
+			header >> property.name;
+			elements.back().properties.push_back(property);
+		}
+		else if (word == "end_header") {
+			break;
+		}
+	}
+
+	// Body
+	ply_reader reader(in, format);
+	std::vector<double> row;
+	std::vector<uint32_t> face;
+
+	for (const auto& element : elements) {
+		const auto& props = element.properties;
+		bool is_vertex = element.name == "vertex";
+		bool is_face = element.name == "face";
+
+		int px = -1, py = -1, pz = -1, nx = -1, ny = -1, nz = -1, tu = -1, tv = -1;
+		for (int i = 0; i < int(props.size()); i++) {
+			const auto& n = props[i].name;
+			if (n == "x") px = i;
+			else if (n == "y") py = i;
+			else if (n == "z") pz = i;
+			else if (n == "nx") nx = i;
+			else if (n == "ny") ny = i;
+			else if (n == "nz") nz = i;
+			else if (n == "u" || n == "s" || n == "texture_u") tu = i;
+			else if (n == "v" || n == "t" || n == "texture_v") tv = i;
+		}
+
+		bool has_normals = is_vertex && nx >= 0 && ny >= 0 && nz >= 0;
+		bool has_uvs = is_vertex && tu >= 0 && tv >= 0;
+
+		if (is_vertex) {
+			if (px < 0 || py < 0 || pz < 0) {
+				std::cerr << "ERROR: PLY vertices in '" << filename << "' have no position.\n";
+				return false;
+			}
+			mesh.positions.reserve(3 * element.count);
+			if (has_normals) mesh.normals.reserve(3 * element.count);
+			if (has_uvs) mesh.uvs.reserve(2 * element.count);
+		}
+
+		row.resize(props.size());
+
+		for (size_t e = 0; e < element.count; e++) {
+			for (size_t p = 0; p < props.size(); p++) {
+				const auto& prop = props[p];
+				if (!prop.is_list) {
+					row[p] = reader.read(prop.type);
+					continue;
+				}
+
+				auto count = size_t(reader.read(prop.count_type));
+				bool is_indices = is_face && (prop.name == "vertex_indices" || prop.name == "vertex_index");
+				face.clear();
+				for (size_t i = 0; i < count; i++) {
+					auto value = reader.read(prop.type);
+					if (is_indices) face.push_back(uint32_t(value));
+				}
+
+				for (size_t i = 2; i < face.size(); i++)
+					mesh.indices.insert(mesh.indices.end(), { face[0], face[i - 1], face[i] });
+			}
+
+			if (is_vertex) {
+				mesh.positions.insert(mesh.positions.end(), { float(row[px]), float(row[py]), float(row[pz]) });
+				if (has_normals) mesh.normals.insert(mesh.normals.end(), { float(row[nx]), float(row[ny]), float(row[nz]) });
+				if (has_uvs) mesh.uvs.insert(mesh.uvs.end(), { float(row[tu]), float(row[tv]) });
+			}
+		}
+
+		if (!reader.good()) {
+			std::cerr << "ERROR: Unexpected end of PLY file '" << filename << "'.\n";
+			return false;
+		}
+	}
+
+	auto vertex_count = uint32_t(mesh.vertex_count());
+	for (auto index : mesh.indices) {
+		if (index >= vertex_count) {
+			std::cerr << "ERROR: PLY face in '" << filename << "' references a missing vertex.\n";
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Loads an .obj or .ply file into a triangle_mesh. Vertex normals are derived
+// from the faces when the file has none and `smooth_normals` is set.
+inline shared_ptr<triangle_mesh> load_mesh(const std::string& filename, shared_ptr<material> mat, bool smooth_normals = true) {
+	mesh_data mesh;
+
+	auto ext_pos = filename.find_last_of('.');
+	auto extension = ext_pos == std::string::npos ? std::string() : filename.substr(ext_pos + 1);
+	for (auto& ch : extension) ch = char(std::tolower(ch));
+
+	bool loaded = false;
+	if (extension == "obj") loaded = load_obj(filename, mesh);
+	else if (extension == "ply") loaded = load_ply(filename, mesh);
+	else {
+		std::cerr << "ERROR: Unsupported mesh format '" << filename << "'.\n";
+		return nullptr;
+	}
+
+	if (!loaded) {
+		std::cerr << "ERROR: Could not load mesh file '" << filename << "'.\n";
+		return nullptr;
+	}
+
+	if (smooth_normals && mesh.normals.empty())
+		mesh.compute_vertex_normals();
+
+	return make_shared<triangle_mesh>(std::move(mesh), mat);
+}
+
+#endif // !MESH_LOADER_H
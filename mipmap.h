@@ -0,0 +1,257 @@
+#ifndef MIPMAP_H
+#define MIPMAP_H
+
+#include "rtweekend.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Mip-mapped Images
+//
+// An image and its chain of half-size copies down to 1x1, so a lookup that
+// covers many texels can read one prefiltered texel from a smaller level
+// instead of aliasing on the full-resolution one. Coarser levels are also
+// much smaller, so rays that only need a blurry answer (most bounce rays)
+// touch far less memory.
+//
+// Every level is stored in blocks of 4x4 RGBA8 texels, 64 bytes each, which
+// is one cache line. A bilinear lookup mostly reads one or two lines, where
+// row-major storage would need two rows that are a whole image width apart.
+//
+// The filtering itself is written against any source of texels, so images
+// streamed in tiles (texture_cache.h) filter exactly like those held here.
+
+enum texture_filter {
+	texture_nearest,   // The nearest full-resolution texel, no filtering
+	texture_bilinear,  // The four nearest texels of the level matching the footprint
+	texture_trilinear  // Bilinear on the two nearest levels, blended
+};
+
+inline bool parse_texture_filter(const std::string& name, texture_filter& filter) {
+	if (name == "nearest") filter = texture_nearest;
+	else if (name == "bilinear") filter = texture_bilinear;
+	else if (name == "trilinear") filter = texture_trilinear;
+	else return false;
+	return true;
+}
+
+namespace mipmap_detail {
+	inline uint32_t pack(unsigned r, unsigned g, unsigned b) {
+		return r | (g << 8) | (b << 16) | (255u << 24);
+	}
+
+	inline color unpack(uint32_t t) {
+		const double scale = 1.0 / 255.0;
+		return color(scale * (t & 255), scale * ((t >> 8) & 255), scale * ((t >> 16) & 255));
+	}
+
+	// Interleaved 8-bit RGB rows to packed texels.
+	inline std::vector<uint32_t> pack_rgb(const unsigned char* rgb, int width, int height) {
+		std::vector<uint32_t> pixels(size_t(width) * height);
+		for (size_t k = 0; k < pixels.size(); k++)
+			pixels[k] = pack(rgb[3 * k], rgb[3 * k + 1], rgb[3 * k + 2]);
+		return pixels;
+	}
+
+	// Box filter to half size. An odd last row or column is folded into its
+	// neighbor, so every source pixel counts.
+	inline std::vector<uint32_t> downsample(const std::vector<uint32_t>& pixels, int width, int height) {
+		int w = std::max(1, width / 2);
+		int h = std::max(1, height / 2);
+		std::vector<uint32_t> result(size_t(w) * h);
+
+		for (int j = 0; j < h; j++) {
+			int y0 = std::min(2 * j, height - 1);
+			int y1 = (j == h - 1) ? height - 1 : 2 * j + 1;
+			for (int i = 0; i < w; i++) {
+				int x0 = std::min(2 * i, width - 1);
+				int x1 = (i == w - 1) ? width - 1 : 2 * i + 1;
+
+				unsigned sum[3] = { 0, 0, 0 };
+				int count = 0;
+				for (int y = y0; y <= y1; y++) {
+					for (int x = x0; x <= x1; x++) {
+						uint32_t t = pixels[size_t(y) * width + x];
+						for (int c = 0; c < 3; c++) sum[c] += (t >> (8 * c)) & 255;
+						count++;
+					}
+				}
+				result[size_t(j) * w + i] = pack((sum[0] + count / 2) / count, (sum[1] + count / 2) / count, (sum[2] + count / 2) / count);
+			}
+		}
+		return result;
+	}
+
+	// Within 0.09 of log2(x), from the bits of a float; plenty to pick a level.
+	inline float fast_log2(float x) {
+		uint32_t bits;
+		std::memcpy(&bits, &x, sizeof(bits));
+		return float(bits) * (1.0f / (1 << 23)) - 127;
+	}
+
+	// Filtered on the packed texels with 8-bit weights, red and blue sharing
+	// one multiply and green the other, as texture units do. Returns the
+	// color scaled by 255 * 256.
+	//
+	// `Source` provides level_width(l), level_height(l) and
+	// fetch(l, xa, ya, xb, yb, texels), which reads the texels at (xa, ya),
+	// (xb, ya), (xa, yb) and (xb, yb); xb and yb are at most one more.
+	template <typename Source>
+	void bilinear(const Source& source, int level, double u, double v, uint32_t& red_blue, uint32_t& green) {
+		int width = source.level_width(level);
+		int height = source.level_height(level);
+		float x = float(u * width) - 0.5f;
+		float y = float(v * height) - 0.5f;
+		int x0 = floor_int(x);
+		int y0 = floor_int(y);
+		uint32_t fx = uint32_t((x - x0) * 256);
+		uint32_t fy = uint32_t((y - y0) * 256);
+
+		int xa = std::max(x0, 0), xb = std::min(x0 + 1, width - 1);
+		int ya = std::max(y0, 0), yb = std::min(y0 + 1, height - 1);
+
+		uint32_t t[4];
+		source.fetch(level, xa, ya, xb, yb, t);
+
+		// The weights sum to 256, so no lane can carry into the next
+		uint32_t w00 = ((256 - fx) * (256 - fy)) >> 8;
+		uint32_t w10 = (fx * (256 - fy)) >> 8;
+		uint32_t w01 = ((256 - fx) * fy) >> 8;
+		uint32_t w11 = 256 - w00 - w10 - w01;
+
+		const uint32_t lanes = 0x00ff00ff;
+		red_blue = (t[0] & lanes) * w00 + (t[1] & lanes) * w10 + (t[2] & lanes) * w01 + (t[3] & lanes) * w11;
+		green = ((t[0] >> 8) & 255) * w00 + ((t[1] >> 8) & 255) * w10 + ((t[2] >> 8) & 255) * w01 + ((t[3] >> 8) & 255) * w11;
+	}
+
+	template <typename Source>
+	color bilinear(const Source& source, int level, double u, double v) {
+		uint32_t red_blue, green;
+		bilinear(source, level, u, v, red_blue, green);
+		const double scale = 1.0 / (255.0 * 256.0);
+		return color(scale * (red_blue & 0xffff), scale * green, scale * (red_blue >> 16));
+	}
+
+	// The color around (u, v), both in [0, 1] with v pointing down the image,
+	// averaged over a square `footprint` uv units wide. Besides what bilinear()
+	// needs, `Source` provides level_count() and texel(l, i, j).
+	template <typename Source>
+	color sample(const Source& source, double u, double v, double footprint, texture_filter filter) {
+		if (filter == texture_nearest) {
+			int width = source.level_width(0), height = source.level_height(0);
+			int i = std::min(int(u * width), width - 1);
+			int j = std::min(int(v * height), height - 1);
+			return unpack(source.texel(0, i, j));
+		}
+
+		// Level where one texel is about as wide as the footprint
+		double texels = footprint * std::sqrt(double(source.level_width(0)) * source.level_height(0));
+		if (texels <= 1) return bilinear(source, 0, u, v);
+		int last = source.level_count() - 1;
+		double lod = std::min(double(fast_log2(float(texels))), double(last));
+
+		if (filter == texture_bilinear)
+			return bilinear(source, int(lod + 0.5), u, v);
+
+		int fine = int(lod);
+		double t = lod - fine;
+		if (t == 0 || fine >= last) return bilinear(source, fine, u, v);
+
+		uint32_t rb0, g0, rb1, g1;
+		bilinear(source, fine, u, v, rb0, g0);
+		bilinear(source, fine + 1, u, v, rb1, g1);
+		double scale = 1.0 / (255.0 * 256.0);
+		double s0 = (1 - t) * scale, s1 = t * scale;
+		return color(s0 * (rb0 & 0xffff) + s1 * (rb1 & 0xffff), s0 * g0 + s1 * g1, s0 * (rb0 >> 16) + s1 * (rb1 >> 16));
+	}
+}
+
+class mipmap {
+public:
+	mipmap() {}
+
+	// Builds the chain from interleaved 8-bit RGB rows, top row first.
+	mipmap(const unsigned char* rgb, int width, int height) {
+		if (rgb == nullptr || width <= 0 || height <= 0) return;
+
+		auto pixels = mipmap_detail::pack_rgb(rgb, width, height);
+		while (true) {
+			levels.push_back(make_level(pixels, width, height));
+			if (width == 1 && height == 1) break;
+			pixels = mipmap_detail::downsample(pixels, width, height);
+			width = std::max(1, width / 2);
+			height = std::max(1, height / 2);
+		}
+	}
+
+	bool empty() const { return levels.empty(); }
+	int width() const { return empty() ? 0 : levels[0].width; }
+	int height() const { return empty() ? 0 : levels[0].height; }
+
+	// Bytes held by all levels together.
+	size_t memory_size() const {
+		size_t bytes = 0;
+		for (const auto& l : levels) bytes += l.texels.size() * sizeof(uint32_t);
+		return bytes;
+	}
+
+	color sample(double u, double v, double footprint, texture_filter filter) const {
+		return mipmap_detail::sample(*this, u, v, footprint, filter);
+	}
+
+	// Texel access for mipmap_detail::sample
+	int level_count() const { return int(levels.size()); }
+	int level_width(int level) const { return levels[level].width; }
+	int level_height(int level) const { return levels[level].height; }
+
+	uint32_t texel(int level, int i, int j) const {
+		return levels[level].texel(i, j);
+	}
+
+	void fetch(int level, int xa, int ya, int xb, int yb, uint32_t* texels) const {
+		const auto& l = levels[level];
+		texels[0] = l.texel(xa, ya);
+		texels[1] = l.texel(xb, ya);
+		texels[2] = l.texel(xa, yb);
+		texels[3] = l.texel(xb, yb);
+	}
+
+private:
+	struct level {
+		int width = 0;
+		int height = 0;
+		int blocks_x = 0;
+		std::vector<uint32_t> texels; // 4x4 blocks, row-major over blocks and within each
+
+		uint32_t texel(int i, int j) const {
+			size_t block = size_t(j >> 2) * blocks_x + (i >> 2);
+			return texels[block * 16 + ((j & 3) << 2) + (i & 3)];
+		}
+	};
+
+	std::vector<level> levels; // Full resolution first
+
+	static level make_level(const std::vector<uint32_t>& pixels, int width, int height) {
+		level l;
+		l.width = width;
+		l.height = height;
+		l.blocks_x = (width + 3) / 4;
+		int blocks_y = (height + 3) / 4;
+		l.texels.assign(size_t(l.blocks_x) * blocks_y * 16, 0);
+
+		// Texels past the edge of the last blocks repeat the edge
+		for (int j = 0; j < blocks_y * 4; j++) {
+			for (int i = 0; i < l.blocks_x * 4; i++) {
+				size_t block = size_t(j >> 2) * l.blocks_x + (i >> 2);
+				l.texels[block * 16 + ((j & 3) << 2) + (i & 3)] =
+					pixels[size_t(std::min(j, height - 1)) * width + std::min(i, width - 1)];
+			}
+		}
+		return l;
+	}
+};
+
+#endif // !MIPMAP_H
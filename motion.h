@@ -0,0 +1,302 @@
+#ifndef MOTION_H
+#define MOTION_H
+
+#include "hittable.h"
+#include "transform.h"
+
+#include <algorithm>
+#include <vector>
+
+// Keyframed Motion
+//
+// An object moves by giving its object-to-world transform at a few times in
+// the shutter interval [0, 1]. In between, the transform is not blended
+// entry by entry, which would shrink a rotating object halfway through a
+// turn. Each keyframe is split into translation * rotation * stretch (pbrt's
+// polar decomposition), and those are blended separately: the translation
+// and stretch linearly, the rotation as a quaternion along the shortest
+// arc. Before the first keyframe and after the last the object holds still.
+
+class quaternion {
+public:
+	double w, x, y, z;
+
+	quaternion() : w(1), x(0), y(0), z(0) {}
+	quaternion(double w, double x, double y, double z) : w(w), x(x), y(y), z(z) {}
+
+	// The rotation in the linear part of `r`, which must be orthonormal
+	// with a positive determinant.
+	static quaternion from_rotation(const transform& r) {
+		const auto& m = r.m;
+		double trace = m[0][0] + m[1][1] + m[2][2];
+		if (trace > 0) {
+			double s = 2 * std::sqrt(trace + 1);
+			return quaternion(s / 4, (m[2][1] - m[1][2]) / s, (m[0][2] - m[2][0]) / s, (m[1][0] - m[0][1]) / s);
+		}
+		if (m[0][0] > m[1][1] && m[0][0] > m[2][2]) {
+			double s = 2 * std::sqrt(1 + m[0][0] - m[1][1] - m[2][2]);
+			return quaternion((m[2][1] - m[1][2]) / s, s / 4, (m[0][1] + m[1][0]) / s, (m[0][2] + m[2][0]) / s);
+		}
+		if (m[1][1] > m[2][2]) {
+			double s = 2 * std::sqrt(1 + m[1][1] - m[0][0] - m[2][2]);
+			return quaternion((m[0][2] - m[2][0]) / s, (m[0][1] + m[1][0]) / s, s / 4, (m[1][2] + m[2][1]) / s);
+		}
+		double s = 2 * std::sqrt(1 + m[2][2] - m[0][0] - m[1][1]);
+		return quaternion((m[1][0] - m[0][1]) / s, (m[0][2] + m[2][0]) / s, (m[1][2] + m[2][1]) / s, s / 4);
+	}
+
+	// The rotation as a transform. Assumes unit length.
+	transform to_transform() const {
+		transform r;
+		r.m[0][0] = 1 - 2 * (y * y + z * z);
+		r.m[0][1] = 2 * (x * y - w * z);
+		r.m[0][2] = 2 * (x * z + w * y);
+		r.m[1][0] = 2 * (x * y + w * z);
+		r.m[1][1] = 1 - 2 * (x * x + z * z);
+		r.m[1][2] = 2 * (y * z - w * x);
+		r.m[2][0] = 2 * (x * z - w * y);
+		r.m[2][1] = 2 * (y * z + w * x);
+		r.m[2][2] = 1 - 2 * (x * x + y * y);
+		return r;
+	}
+
+	// Spherical interpolation from `a` to `b`, the short way around.
+	static quaternion slerp(const quaternion& a, quaternion b, double t) {
+		double cos_theta = a.w * b.w + a.x * b.x + a.y * b.y + a.z * b.z;
+		if (cos_theta < 0) {
+			b = quaternion(-b.w, -b.x, -b.y, -b.z);
+			cos_theta = -cos_theta;
+		}
+
+		// Nearly parallel: the arc is a line, and dividing by its sine is not safe.
+		double wa = 1 - t, wb = t;
+		if (cos_theta < 0.9995) {
+			double theta = std::acos(cos_theta);
+			double inv_sin = 1 / std::sin(theta);
+			wa = std::sin((1 - t) * theta) * inv_sin;
+			wb = std::sin(t * theta) * inv_sin;
+		}
+
+		quaternion q(wa * a.w + wb * b.w, wa * a.x + wb * b.x, wa * a.y + wb * b.y, wa * a.z + wb * b.z);
+		double inv_length = 1 / std::sqrt(q.w * q.w + q.x * q.x + q.y * q.y + q.z * q.z);
+		return quaternion(q.w * inv_length, q.x * inv_length, q.y * inv_length, q.z * inv_length);
+	}
+};
+
+class keyframed_transform {
+public:
+	keyframed_transform() {}
+	explicit keyframed_transform(const transform& still) { add(0, still); }
+
+	// Adds the transform at `time`, replacing any already given for it.
+	void add(double time, const transform& t) {
+		auto it = std::lower_bound(keys.begin(), keys.end(), time,
+			[](const keyframe& k, double time) { return k.time < time; });
+		if (it != keys.end() && it->time == time) *it = decompose(time, t);
+		else keys.insert(it, decompose(time, t));
+	}
+
+	size_t size() const { return keys.size(); }
+
+	transform at(double time) const {
+		if (keys.empty()) return transform();
+		if (time <= keys.front().time) return keys.front().compose();
+		if (time >= keys.back().time) return keys.back().compose();
+
+		size_t i = 1;
+		while (keys[i].time < time) i++;
+		const keyframe& a = keys[i - 1];
+		const keyframe& b = keys[i];
+		double f = (time - a.time) / (b.time - a.time);
+
+		keyframe k;
+		k.translation = a.translation + f * (b.translation - a.translation);
+		k.rotation = quaternion::slerp(a.rotation, b.rotation, f);
+		for (int row = 0; row < 3; row++)
+			for (int col = 0; col < 3; col++)
+				k.stretch.m[row][col] = a.stretch.m[row][col] + f * (b.stretch.m[row][col] - a.stretch.m[row][col]);
+		return k.compose();
+	}
+
+private:
+	struct keyframe {
+		double time = 0;
+		vec3 translation;
+		quaternion rotation;
+		transform stretch; // Scale and shear, with no translation
+
+		transform compose() const {
+			return transform::translation(translation) * rotation.to_transform() * stretch;
+		}
+	};
+
+	std::vector<keyframe> keys;
+
+	static keyframe decompose(double time, const transform& t) {
+		keyframe k;
+		k.time = time;
+		k.translation = vec3(t.m[0][3], t.m[1][3], t.m[2][3]);
+
+		transform linear = t;
+		linear.m[0][3] = linear.m[1][3] = linear.m[2][3] = 0;
+
+		// The nearest rotation to the linear part: averaging a matrix with its
+		// inverse transpose converges to it quickly.
+		transform r = linear;
+		for (int iteration = 0; iteration < 100; iteration++) {
+			transform inv = r.inverse();
+			double change = 0;
+			for (int row = 0; row < 3; row++) {
+				for (int col = 0; col < 3; col++) {
+					double next = 0.5 * (r.m[row][col] + inv.m[col][row]);
+					change = std::fmax(change, std::fabs(next - r.m[row][col]));
+					r.m[row][col] = next;
+				}
+			}
+			if (change < 1e-12) break;
+		}
+
+		// A mirroring transform leaves a reflection, which no quaternion can
+		// represent; hand the sign to the stretch instead.
+		if (r.determinant() < 0) {
+			for (int row = 0; row < 3; row++)
+				for (int col = 0; col < 3; col++)
+					r.m[row][col] = -r.m[row][col];
+		}
+
+		k.rotation = quaternion::from_rotation(r);
+
+		// linear = r * stretch, and r is orthonormal, so stretch = r^T * linear.
+		for (int row = 0; row < 3; row++)
+			for (int col = 0; col < 3; col++)
+				k.stretch.m[row][col] = r.m[0][row] * linear.m[0][col] + r.m[1][row] * linear.m[1][col] + r.m[2][row] * linear.m[2][col];
+
+		return k;
+	}
+};
+
+// An instance whose transform follows keyframes, so that any object, or a
+// whole BLAS, can move, turn and deform while the shutter is open.
+class motion_instance : public hittable {
+public:
+	motion_instance(shared_ptr<hittable> object, const keyframed_transform& object_to_world)
+		: object(object), object_to_world(object_to_world)
+	{
+		fit_bounds(own_segments, boxes);
+		bbox = aabb::empty;
+		for (const auto& box : boxes) bbox = aabb(bbox, box);
+	}
+
+	bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+		// Most rays miss; reject them before paying for the transform.
+		if (!motion_box_at(boxes, own_segments, r.time()).hit(r, ray_t))
+			return false;
+
+		auto to_world = object_to_world.at(r.time());
+		auto to_object = to_world.inverse();
+
+		ray object_r(to_object.apply_point(r.origin()), to_object.apply_vector(r.direction()), r.time());
+
+		if (!object->hit(object_r, ray_t, rec))
+			return false;
+
+		// As in instance
+		rec.p = to_world.apply_point(rec.p);
+		rec.normal = unit_vector(to_object.apply_transposed(rec.normal));
+		rec.uv_density /= std::cbrt(std::fabs(to_world.determinant()));
+		rec.object = this;
+
+		return true;
+	}
+
+	double transmittance(const ray& r, interval ray_t) const override {
+		if (!motion_box_at(boxes, own_segments, r.time()).hit(r, ray_t))
+			return 1;
+
+		auto to_object = object_to_world.at(r.time()).inverse();
+		ray object_r(to_object.apply_point(r.origin()), to_object.apply_vector(r.direction()), r.time());
+		return object->transmittance(object_r, ray_t);
+	}
+
+	aabb bounding_box() const override { return bbox; }
+
+	bool moving() const override { return object_to_world.size() > 1 || object->moving(); }
+
+	void motion_bounds(int segments, aabb* boxes) const override {
+		if (segments == own_segments) std::copy(this->boxes, this->boxes + own_segments + 1, boxes);
+		else fit_bounds(segments, boxes);
+	}
+
+private:
+	static const int own_segments = 8;
+
+	shared_ptr<hittable> object;
+	keyframed_transform object_to_world;
+	aabb boxes[own_segments + 1];
+	aabb bbox;
+
+	void fit_bounds(int segments, aabb* result) const {
+		// The object stays inside its box in object space, and the box's
+		// corners follow smooth curves. Sample each segment densely, then
+		// place each face of the bounds on a line that stays outside every
+		// sample, and pad by how far the curves stray from straight between
+		// samples.
+		const int samples = 16;
+		auto object_box = object->bounding_box();
+		for (int i = 0; i <= segments; i++) result[i] = aabb::empty;
+
+		for (int segment = 0; segment < segments; segment++) {
+			double t0 = double(segment) / segments;
+			double t1 = double(segment + 1) / segments;
+
+			point3 corners[samples + 1][8];
+			double lo[samples + 1][3], hi[samples + 1][3];
+			for (int s = 0; s <= samples; s++) {
+				auto xform = object_to_world.at(t0 + (t1 - t0) * s / samples);
+				for (int c = 0; c < 8; c++) {
+					corners[s][c] = xform.apply_point(point3(
+						(c & 1) ? object_box.x.max : object_box.x.min,
+						(c & 2) ? object_box.y.max : object_box.y.min,
+						(c & 4) ? object_box.z.max : object_box.z.min));
+				}
+				for (int axis = 0; axis < 3; axis++) {
+					lo[s][axis] = infinity;
+					hi[s][axis] = -infinity;
+					for (int c = 0; c < 8; c++) {
+						lo[s][axis] = std::fmin(lo[s][axis], corners[s][c][axis]);
+						hi[s][axis] = std::fmax(hi[s][axis], corners[s][c][axis]);
+					}
+				}
+			}
+
+			// Between samples a curve strays from its chord by about an eighth
+			// of its second difference; the whole difference leaves a margin.
+			double pad = 0;
+			for (int s = 1; s < samples; s++)
+				for (int c = 0; c < 8; c++)
+					pad = std::fmax(pad, (corners[s - 1][c] - 2 * corners[s][c] + corners[s + 1][c]).length());
+
+			interval ends[2][3];
+			for (int axis = 0; axis < 3; axis++) {
+				double lo0 = lo[0][axis], lo1 = lo[samples][axis];
+				double hi0 = hi[0][axis], hi1 = hi[samples][axis];
+				double below = 0, above = 0;
+				for (int s = 1; s < samples; s++) {
+					double f = double(s) / samples;
+					below = std::fmax(below, lo0 + f * (lo1 - lo0) - lo[s][axis]);
+					above = std::fmax(above, hi[s][axis] - (hi0 + f * (hi1 - hi0)));
+				}
+				ends[0][axis] = interval(lo0 - below - pad, hi0 + above + pad);
+				ends[1][axis] = interval(lo1 - below - pad, hi1 + above + pad);
+			}
+
+			// Segments share their end boxes; the union keeps both fits valid.
+			for (int e = 0; e < 2; e++) {
+				aabb box(ends[e][0], ends[e][1], ends[e][2]);
+				result[segment + e] = aabb(result[segment + e], box);
+			}
+		}
+	}
+};
+
+#endif // !MOTION_H
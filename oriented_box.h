@@ -0,0 +1,172 @@
+#ifndef ORIENTED_BOX_H
+#define ORIENTED_BOX_H
+
+#include "hittable.h"
+#include "light.h"
+#include "material.h"
+#include "transform.h"
+
+#include <array>
+
+// A box with its own object-to-world transform, so it can be turned, scaled
+// and sheared without an instance around it. A ray is moved into the box's
+// frame once and tested against all three slabs there, where box() would
+// test six separate quads behind a BVH and an instance.
+//
+// Faces are numbered as box() has always built its quads, and their uvs run
+// the same way, so textures land where they did.
+class oriented_box : public hittable {
+public:
+	enum face_id { front, right, back, left, top, bottom, face_count };
+
+	oriented_box(const point3& a, const point3& b, shared_ptr<material> mat)
+		: oriented_box(a, b, transform(), mat) {}
+
+	oriented_box(const point3& a, const point3& b, const transform& object_to_world, shared_ptr<material> mat)
+		: oriented_box(a, b, object_to_world, same_material(mat)) {}
+
+	// `face_materials` are indexed by face_id.
+	oriented_box(const point3& a, const point3& b, const transform& object_to_world,
+				 const std::array<shared_ptr<material>, face_count>& face_materials)
+		: object_to_world(object_to_world), world_to_object(object_to_world.inverse()), materials(face_materials)
+	{
+		lo = point3(std::fmin(a.x(), b.x()), std::fmin(a.y(), b.y()), std::fmin(a.z(), b.z()));
+		hi = point3(std::fmax(a.x(), b.x()), std::fmax(a.y(), b.y()), std::fmax(a.z(), b.z()));
+		for (int axis = 0; axis < 3; axis++) inv_size[axis] = 1 / (hi[axis] - lo[axis]);
+
+		bbox = object_to_world.apply(aabb(lo, hi));
+
+		// Per face, the world normal and, as for a quad, 1 / sqrt(world area)
+		auto size = hi - lo;
+		for (int axis = 0; axis < 3; axis++) {
+			vec3 n, e1, e2;
+			n[axis] = 1;
+			e1[(axis + 1) % 3] = size[(axis + 1) % 3];
+			e2[(axis + 2) % 3] = size[(axis + 2) % 3];
+
+			auto world_n = unit_vector(world_to_object.apply_transposed(n));
+			auto area = cross(object_to_world.apply_vector(e1), object_to_world.apply_vector(e2)).length();
+			for (int side = 0; side < 2; side++) {
+				int face = face_of(axis, side == 1);
+				normals[face] = side ? world_n : -world_n;
+				uv_densities[face] = 1 / std::sqrt(area);
+			}
+		}
+	}
+
+	// This box moved by `t` after its own transform. A scene collapses an
+	// instance of a box into one of these.
+	shared_ptr<oriented_box> transformed(const transform& t) const {
+		return make_shared<oriented_box>(lo, hi, t * object_to_world, materials);
+	}
+
+	bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+		RTW_STAT(primitive_tests[stat_box]);
+
+		// As in instance, the direction stays unnormalized so t is the same
+		// in both frames.
+		point3 o = world_to_object.apply_point(r.origin());
+		vec3 d = world_to_object.apply_vector(r.direction());
+
+		double t_near = ray_t.min, t_far = ray_t.max;
+		int near_axis = -1, far_axis = -1;
+		for (int axis = 0; axis < 3; axis++) {
+			double inv_d = 1 / d[axis];
+			double t0 = (lo[axis] - o[axis]) * inv_d;
+			double t1 = (hi[axis] - o[axis]) * inv_d;
+			if (t0 > t1) std::swap(t0, t1);
+
+			if (t0 > t_near) { t_near = t0; near_axis = axis; }
+			if (t1 < t_far) { t_far = t1; far_axis = axis; }
+			if (t_far <= t_near) return false;
+		}
+
+		// From outside the ray hits where it enters; from inside, where it
+		// leaves.
+		double t;
+		int face;
+		if (near_axis >= 0) {
+			t = t_near;
+			face = face_of(near_axis, d[near_axis] < 0);
+		}
+		else if (far_axis >= 0) {
+			t = t_far;
+			face = face_of(far_axis, d[far_axis] > 0);
+		}
+		else return false;
+
+		auto p = o + t * d;
+		double qx = (p.x() - lo.x()) * inv_size[0];
+		double qy = (p.y() - lo.y()) * inv_size[1];
+		double qz = (p.z() - lo.z()) * inv_size[2];
+		switch (face) {
+			case front:  rec.u = qx;     rec.v = qy;     break;
+			case right:  rec.u = 1 - qz; rec.v = qy;     break;
+			case back:   rec.u = 1 - qx; rec.v = qy;     break;
+			case left:   rec.u = qz;     rec.v = qy;     break;
+			case top:    rec.u = qx;     rec.v = 1 - qz; break;
+			default:     rec.u = qx;     rec.v = qz;     break;
+		}
+
+		rec.t = t;
+		rec.p = r.at(t);
+		rec.mat = materials[face].get();
+		rec.object = this;
+		rec.face = face;
+		rec.set_face_normal(r, normals[face]);
+		rec.uv_density = uv_densities[face];
+
+		return true;
+	}
+
+	aabb bounding_box() const override { return bbox; }
+
+	// All six faces, in face_id order, once any of them emits; the others
+	// carry no power and are never picked.
+	void gather_lights(std::vector<light_source>& lights) const override {
+		bool emissive = false;
+		for (const auto& mat : materials) emissive = emissive || mat->is_emissive();
+		if (!emissive) return;
+
+		// The quads box() builds
+		auto dx = vec3(hi.x() - lo.x(), 0, 0);
+		auto dy = vec3(0, hi.y() - lo.y(), 0);
+		auto dz = vec3(0, 0, hi.z() - lo.z());
+		const point3 corners[face_count] = {
+			point3(lo.x(), lo.y(), hi.z()), point3(hi.x(), lo.y(), hi.z()), point3(hi.x(), lo.y(), lo.z()),
+			point3(lo.x(), lo.y(), lo.z()), point3(lo.x(), hi.y(), hi.z()), lo
+		};
+		const vec3 edges[face_count][2] = { { dx, dy }, { -dz, dy }, { -dx, dy }, { dz, dy }, { dx, -dz }, { dx, dz } };
+
+		for (int face = 0; face < face_count; face++) {
+			lights.push_back(light_source::flat(light_source::parallelogram_shape, this, materials[face].get(),
+				object_to_world.apply_point(corners[face]),
+				object_to_world.apply_vector(edges[face][0]),
+				object_to_world.apply_vector(edges[face][1])));
+		}
+	}
+
+private:
+	point3 lo, hi;
+	vec3 inv_size;
+	transform object_to_world;
+	transform world_to_object;
+	vec3 normals[face_count];
+	double uv_densities[face_count];
+	std::array<shared_ptr<material>, face_count> materials;
+	aabb bbox;
+
+	// The face on the min or max side of the box along `axis`
+	static int face_of(int axis, bool max_side) {
+		static const int faces[3][2] = { { left, right }, { bottom, top }, { back, front } };
+		return faces[axis][max_side];
+	}
+
+	static std::array<shared_ptr<material>, face_count> same_material(shared_ptr<material> mat) {
+		std::array<shared_ptr<material>, face_count> result;
+		result.fill(mat);
+		return result;
+	}
+};
+
+#endif // !ORIENTED_BOX_H
@@ -2,12 +2,26 @@
 #define PERLIN_H
 
 #include "rtweekend.h"
+#include "trilinear_grid.h"
+
+#include <cstdint>
+
+// Perlin Noise
+//
+// Gradients are kept as three packed float tables and the permutations as
+// bytes, so the whole lattice fits in about 4 KB of cache. Each octave is a
+// short run of float math with no dependency on the others, so the CPU
+// overlaps the octaves of a turb() call. For surfaces shaded many times, a
+// baked_turbulence grid replaces the octaves with a single trilinear lookup.
 
 class perlin {
 public:
 	perlin() {
 		for (int i = 0; i < point_count; i++) {
-			rand_vec[i] = unit_vector(vec3::random(-1, 1));
+			auto g = unit_vector(vec3::random(-1, 1));
+			gradient_x[i] = float(g.x());
+			gradient_y[i] = float(g.y());
+			gradient_z[i] = float(g.z());
 		}
 
 		perlin_generate_perm(perm_x);
@@ -16,25 +30,35 @@ public:
 	}
 
 	double noise(const point3& p) const {
-		auto u = p.x() - std::floor(p.x());
-		auto v = p.y() - std::floor(p.y());
-		auto w = p.z() - std::floor(p.z());
-
-		auto i = int(std::floor(p.x()));
-		auto j = int(std::floor(p.y()));
-		auto k = int(std::floor(p.z()));
-		vec3 c[2][2][2];
-
-		for (int di = 0; di < 2; di++)
-			for (int dj = 0; dj < 2; dj++)
-				for (int dk = 0; dk < 2; dk++)
-					c[di][dj][dk] = rand_vec[
-						perm_x[(i + di) & 255] ^
-						perm_y[(j + dj) & 255] ^
-						perm_z[(k + dk) & 255]
-					];
-
-		return perlin_interp(c, u, v, w);
+		int i = floor_int(p.x()), j = floor_int(p.y()), k = floor_int(p.z());
+		float u = float(p.x() - i), v = float(p.y() - j), w = float(p.z() - k);
+
+		int px0 = perm_x[i & 255], px1 = perm_x[(i + 1) & 255];
+		int py0 = perm_y[j & 255], py1 = perm_y[(j + 1) & 255];
+		int pz0 = perm_z[k & 255], pz1 = perm_z[(k + 1) & 255];
+
+		// Gradient at each corner dotted with the offset from it
+		auto corner = [&](int g, float dx, float dy, float dz) {
+			return gradient_x[g] * dx + gradient_y[g] * dy + gradient_z[g] * dz;
+		};
+		float n000 = corner(px0 ^ py0 ^ pz0, u, v, w);
+		float n001 = corner(px0 ^ py0 ^ pz1, u, v, w - 1);
+		float n010 = corner(px0 ^ py1 ^ pz0, u, v - 1, w);
+		float n011 = corner(px0 ^ py1 ^ pz1, u, v - 1, w - 1);
+		float n100 = corner(px1 ^ py0 ^ pz0, u - 1, v, w);
+		float n101 = corner(px1 ^ py0 ^ pz1, u - 1, v, w - 1);
+		float n110 = corner(px1 ^ py1 ^ pz0, u - 1, v - 1, w);
+		float n111 = corner(px1 ^ py1 ^ pz1, u - 1, v - 1, w - 1);
+
+		// Hermite-smoothed trilinear interpolation, as nested lerps
+		float su = u * u * (3 - 2 * u), sv = v * v * (3 - 2 * v), sw = w * w * (3 - 2 * w);
+		float n00 = n000 + sw * (n001 - n000);
+		float n01 = n010 + sw * (n011 - n010);
+		float n10 = n100 + sw * (n101 - n100);
+		float n11 = n110 + sw * (n111 - n110);
+		float n0 = n00 + sv * (n01 - n00);
+		float n1 = n10 + sv * (n11 - n10);
+		return n0 + su * (n1 - n0);
 	}
 
 	double turb(const point3& p, int depth) const {
@@ -42,6 +66,7 @@ public:
 		auto temp_p = p;
 		auto weight = 1.0;
 
+		// The octaves do not depend on each other, so their work overlaps
 		for (int i = 0; i < depth; i++) {
 			accum += weight * noise(temp_p);
 			weight *= 0.5;
@@ -53,16 +78,22 @@ public:
 
 private:
 	static const int point_count = 256;
-	vec3 rand_vec[point_count];
-	int perm_x[point_count];
-	int perm_y[point_count];
-	int perm_z[point_count];
-
-	static void perlin_generate_perm(int* p) {
+	float gradient_x[point_count];
+	float gradient_y[point_count];
+	float gradient_z[point_count];
+	uint8_t perm_x[point_count];
+	uint8_t perm_y[point_count];
+	uint8_t perm_z[point_count];
+
+	static void perlin_generate_perm(uint8_t* perm) {
+		int p[point_count];
 		for (int i = 0; i < point_count; i++)
 			p[i] = i;
 
 		permute(p, point_count);
+
+		for (int i = 0; i < point_count; i++)
+			perm[i] = uint8_t(p[i]);
 	}
 
 	static void permute(int* p, int n) {
@@ -73,24 +104,33 @@ private:
 			p[target] = tmp;
 		}
 	}
+};
 
-	static double perlin_interp(vec3 c[2][2][2], double u, double v, double w) {
-		auto uu = u * u * (3 - 2 * u);
-		auto vv = v * v * (3 - 2 * v);
-		auto ww = w * w * (3 - 2 * w);
-		auto accum = 0.0;
-		for (int i = 0; i < 2; i++)
-			for (int j = 0; j < 2; j++)
-				for (int k = 0; k < 2; k++) {
-					vec3 weight_v(u - i, v - j, w - k);
-					accum += (i * uu + (1 - i) * (1 - uu))
-						* (j * vv + (1 - j) * (1 - vv))
-						* (k * ww + (1 - k) * (1 - ww))
-						* dot(c[i][j][k], weight_v);
-				}
-
-		return accum;
+// Turbulence sampled on a regular grid over a box and looked up with
+// trilinear interpolation: one cache-friendly gather of eight floats instead
+// of evaluating every octave. Detail finer than the grid spacing is smoothed
+// away, so the resolution trades memory and bake time against sharpness.
+class baked_turbulence {
+public:
+	bool empty() const { return grid.empty(); }
+
+	// Samples turb(p, depth) over [min, max], with `resolution` samples along
+	// the box's longest side and proportionally fewer along the others.
+	void bake(const perlin& noise, int depth, const point3& min, const point3& max, int resolution) {
+		grid = trilinear_grid(min, max, resolution);
+		grid.fill([&](const point3& p) { return noise.turb(p, depth); });
+	}
+
+	// False if `p` lies outside the baked box.
+	bool lookup(const point3& p, double& turbulence) const {
+		float value;
+		if (!grid.lookup(p, value)) return false;
+		turbulence = value;
+		return true;
 	}
+
+private:
+	trilinear_grid grid;
 };
 
 #endif // !PERLIN_H
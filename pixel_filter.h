@@ -0,0 +1,85 @@
+#ifndef PIXEL_FILTER_H
+#define PIXEL_FILTER_H
+
+#include "rtweekend.h"
+
+#include <cmath>
+#include <string>
+
+// Pixel Reconstruction Filters
+//
+// How much a sample at offset (dx, dy) from a pixel's center counts towards
+// that pixel. The box filter keeps each sample inside its own pixel, which is
+// the plain average the renderer has always used. The wider filters share a
+// sample between neighboring pixels, weighted by distance, which trades a
+// little sharpness for much less aliasing and noise. All of them are
+// separable: weight(dx, dy) = evaluate(dx) * evaluate(dy).
+
+enum pixel_filter_type {
+	filter_box,
+	filter_gaussian,
+	filter_mitchell,
+	filter_blackman_harris
+};
+
+class pixel_filter {
+public:
+	pixel_filter_type type = filter_box;
+	double radius = 0.5; // In pixels
+
+	pixel_filter() {}
+	pixel_filter(pixel_filter_type type) : type(type), radius(default_radius(type)) {}
+
+	static double default_radius(pixel_filter_type type) {
+		switch (type) {
+		case filter_gaussian: return 1.5;
+		case filter_mitchell: return 2.0;
+		case filter_blackman_harris: return 2.0;
+		default: return 0.5;
+		}
+	}
+
+	static bool parse(const std::string& name, pixel_filter_type& type) {
+		if (name == "box") type = filter_box;
+		else if (name == "gaussian") type = filter_gaussian;
+		else if (name == "mitchell") type = filter_mitchell;
+		else if (name == "blackman_harris") type = filter_blackman_harris;
+		else return false;
+		return true;
+	}
+
+	// Pixels a sample can reach on each side of its own.
+	int margin() const { return type == filter_box ? 0 : int(std::ceil(radius - 0.5)); }
+
+	double evaluate(double x) const {
+		x = std::fabs(x);
+		if (x >= radius) return 0;
+
+		switch (type) {
+		case filter_gaussian: {
+			// Shifted down so it reaches zero at the radius instead of being cut off
+			const double alpha = 2.0;
+			return std::exp(-alpha * x * x) - std::exp(-alpha * radius * radius);
+		}
+		case filter_mitchell:
+			return mitchell(2 * x / radius);
+		case filter_blackman_harris: {
+			double t = 2 * pi * (x + radius) / (2 * radius);
+			return 0.35875 - 0.48829 * std::cos(t) + 0.14128 * std::cos(2 * t) - 0.01168 * std::cos(3 * t);
+		}
+		default:
+			return 1;
+		}
+	}
+
+private:
+	// Mitchell-Netravali with B = C = 1/3, over [0, 2]
+	static double mitchell(double x) {
+		const double b = 1.0 / 3, c = 1.0 / 3;
+		if (x < 1)
+			return ((12 - 9 * b - 6 * c) * x * x * x + (-18 + 12 * b + 6 * c) * x * x + (6 - 2 * b)) / 6;
+		return ((-b - 6 * c) * x * x * x + (6 * b + 30 * c) * x * x + (-12 * b - 48 * c) * x + (8 * b + 24 * c)) / 6;
+	}
+};
+
+#endif // !PIXEL_FILTER_H
@@ -5,6 +5,8 @@
 #include "quad.h"
 #include "triangle.h"
 #include "disk.h"
+#include "oriented_box.h"
+#include "triangle_mesh.h"
 
 
 #endif
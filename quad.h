@@ -3,6 +3,8 @@
 
 #include "hittable.h"
 #include "hittable_list.h"
+#include "light.h"
+#include "material.h"
 
 class quad : public hittable {
 public:
@@ -13,6 +15,7 @@ public:
 		normal = unit_vector(n);
 		D = dot(normal, Q);
 		w = n / dot(n, n);
+		uv_density = 1 / std::sqrt(n.length());
 
 		set_bounding_box();
 	}
@@ -25,8 +28,13 @@ public:
 
 	aabb bounding_box() const override { return bbox; }
 
+	void gather_lights(std::vector<light_source>& lights) const override {
+		if (mat->is_emissive()) lights.push_back(light_source::flat(light_source::parallelogram_shape, this, mat.get(), Q, u, v));
+	}
+
 	bool hit(const ray& r, interval ray_t, hit_record& rec) const override 
 	{
+		RTW_STAT(primitive_tests[stat_quad]);
 		auto denom = dot(normal, r.direction());
 
 		if (std::fabs(denom) < 1e-8) return false;
@@ -43,8 +51,10 @@ public:
 
 		rec.t = t;
 		rec.p = intersection;
-		rec.mat = mat;
+		rec.mat = mat.get();
+		rec.object = this;
 		rec.set_face_normal(r, normal);
+		rec.uv_density = uv_density;
 
 		return true;
 	}
@@ -65,6 +75,7 @@ private:
 	vec3 u, v, w;
 	vec3 normal;
 	double D;
+	double uv_density; // u and v run along the edge vectors, so one uv unit covers |u x v|
 	aabb bbox;
 
 	shared_ptr<material> mat;
@@ -0,0 +1,328 @@
+#ifndef RENDER_DAEMON_H
+#define RENDER_DAEMON_H
+
+#include "hdr_image.h"
+#include "scene_cache.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+	#ifndef WIN32_LEAN_AND_MEAN
+		#define WIN32_LEAN_AND_MEAN
+	#endif
+	#ifndef NOMINMAX
+		#define NOMINMAX
+	#endif
+	#include <windows.h>
+#else
+	#include <dirent.h>
+	#include <sys/stat.h>
+#endif
+
+// Render Daemon
+//
+// Renders jobs dropped into a directory, one after another, for as long as it
+// runs. Between jobs it keeps the render threads, the scenes it has loaded
+// (with their BVHs) and their images and meshes, so a batch of frames of the
+// same scene only pays for loading it once. See scene_cache.h for how changed
+// files are noticed.
+//
+// A job is a text file ending in ".job", in the same format as scene files:
+//
+//     render scene=shots/cornell.scene output=frames/0042.ppm
+//     camera samples_per_pixel=64 lookfrom=278,278,-800
+//
+//   render  scene or builtin, output, [hdr] [seed] [threads] [denoise=0]
+//   camera  any camera parameter of a scene file, applied over the scene's
+//
+// Relative paths are taken from the job directory. Jobs run in name order. A
+// job is claimed by renaming it to "<name>.running", so several daemons can
+// share a directory, and afterwards renamed to "<name>.done" or, with its
+// errors appended as comments, "<name>.failed".
+//
+// The daemon's state, the job in progress and running totals are kept in
+// "daemon.json" in the directory. Putting a file named "stop" there makes the
+// daemon exit once no jobs are left.
+
+class render_daemon {
+public:
+	std::string directory;
+	double poll_interval = 0.25;  // Seconds between looks at an idle directory
+	int thread_count = 0;         // For jobs that do not say; 0 uses every hardware thread
+
+	bool run() {
+		if (!is_directory(directory)) {
+			std::cerr << "ERROR: Job directory '" << directory << "' does not exist.\n";
+			return false;
+		}
+
+		started = std::chrono::steady_clock::now();
+
+		// Start the render threads now rather than in the first job
+		int threads = thread_count > 0 ? thread_count : int(std::thread::hardware_concurrency());
+		thread_pool::shared().start(threads, []() {});
+		thread_pool::shared().wait();
+
+		std::clog << "Watching '" << directory << "' for jobs" << std::endl;
+		write_status("idle");
+
+		while (true) {
+			auto jobs = pending_jobs();
+			for (const auto& name : jobs)
+				run_job(name);
+
+			if (!jobs.empty()) {
+				write_status("idle");
+				continue;
+			}
+
+			auto stop_file = path("stop");
+			if (std::ifstream(stop_file)) {
+				std::remove(stop_file.c_str());
+				break;
+			}
+			std::this_thread::sleep_for(std::chrono::duration<double>(poll_interval));
+		}
+
+		write_status("stopped");
+		std::clog << "Stopped after " << jobs_done << " jobs (" << jobs_failed << " failed)" << std::endl;
+		return true;
+	}
+
+private:
+	scene_cache cache;
+	std::chrono::steady_clock::time_point started;
+
+	// Totals for daemon.json
+	size_t jobs_done = 0;
+	size_t jobs_failed = 0;
+	double overhead_seconds = 0;  // Job time spent outside the render itself
+
+	// The job in progress
+	std::string job_name;
+	camera::render_status progress;
+	std::chrono::steady_clock::time_point last_status;
+
+	std::string path(const std::string& name) const {
+		auto last = directory.back();
+		return directory + ((last == '/' || last == '\\') ? "" : "/") + name;
+	}
+
+	std::string job_path(const std::string& file) const {
+		bool absolute = !file.empty() && (file[0] == '/' || file[0] == '\\' || file.find(':') != std::string::npos);
+		return absolute ? file : path(file);
+	}
+
+	static bool ends_with(const std::string& text, const std::string& suffix) {
+		return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+	}
+
+	static bool is_directory(const std::string& name) {
+#ifdef _WIN32
+		DWORD attributes = GetFileAttributesA(name.c_str());
+		return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else
+		struct stat info;
+		return stat(name.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+#endif
+	}
+
+	// Names of the waiting jobs, in order.
+	std::vector<std::string> pending_jobs() const {
+		std::vector<std::string> names;
+#ifdef _WIN32
+		WIN32_FIND_DATAA found;
+		HANDLE search = FindFirstFileA(path("*.job").c_str(), &found);
+		if (search != INVALID_HANDLE_VALUE) {
+			do {
+				if (!(found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) names.push_back(found.cFileName);
+			} while (FindNextFileA(search, &found));
+			FindClose(search);
+		}
+#else
+		if (DIR* dir = opendir(directory.c_str())) {
+			while (dirent* item = readdir(dir))
+				names.push_back(item->d_name);
+			closedir(dir);
+		}
+#endif
+		names.erase(std::remove_if(names.begin(), names.end(),
+			[](const std::string& name) { return !ends_with(name, ".job"); }), names.end());
+		std::sort(names.begin(), names.end());
+		return names;
+	}
+
+	void run_job(const std::string& name) {
+		auto running = path(name + ".running");
+		if (std::rename(path(name).c_str(), running.c_str()) != 0) return; // Another daemon took it
+
+		auto start = std::chrono::steady_clock::now();
+		job_name = name;
+		progress = camera::render_status();
+		write_status("rendering");
+
+		// Keep this job's errors to put in its .failed file
+		std::ostringstream errors;
+		auto console = std::cerr.rdbuf(errors.rdbuf());
+		bool reused = false;
+		bool ok = render_job(running, reused);
+		std::cerr.rdbuf(console);
+		std::cerr << errors.str();
+
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		overhead_seconds += std::max(0.0, seconds - progress.seconds);
+
+		if (!ok) {
+			std::ofstream log(running, std::ios::app);
+			std::istringstream lines(errors.str());
+			std::string line;
+			log << "\n";
+			while (std::getline(lines, line))
+				log << "# " << line << "\n";
+		}
+
+		auto finished = path(name + (ok ? ".done" : ".failed"));
+		std::remove(finished.c_str());
+		std::rename(running.c_str(), finished.c_str());
+
+		(ok ? jobs_done : jobs_failed)++;
+		job_name.clear();
+
+		std::ostringstream report;
+		report << name << ": " << (ok ? "done" : "FAILED") << " in " << std::fixed << std::setprecision(3)
+			   << seconds << " s" << (reused ? ", scene reused" : "");
+		std::clog << report.str() << std::endl;
+	}
+
+	bool render_job(const std::string& job_file, bool& reused) {
+		using namespace scene_file_detail;
+
+		std::ifstream in(job_file);
+		params render, settings;
+		bool has_render = false;
+		std::string text;
+		int line = 0;
+
+		auto fail = [&](const std::string& message) {
+			std::cerr << "ERROR: " << job_name << ":" << line << ": " << message << "\n";
+			return false;
+		};
+
+		while (std::getline(in, text)) {
+			line++;
+			auto hash = text.find('#');
+			if (hash != std::string::npos) text.erase(hash);
+
+			std::string keyword, name, error;
+			params p;
+			if (!split_directive(text, keyword, name, p, error)) return fail(error);
+			if (keyword.empty()) continue;
+			if (!name.empty()) return fail("unexpected '" + name + "'");
+
+			if (keyword == "render") {
+				render = p;
+				has_render = true;
+			}
+			else if (keyword == "camera") {
+				for (const auto& kv : p.values) settings.values[kv.first] = kv.second;
+			}
+			else return fail("unknown directive '" + keyword + "'");
+		}
+		if (!has_render) return fail("missing 'render' directive");
+
+		if (render.has("scene") == render.has("builtin")) return fail("'render' needs either 'scene' or 'builtin'");
+		auto output = job_path(render.get_string("output"));
+		auto hdr = render.has("hdr") ? job_path(render.get_string("hdr")) : std::string();
+		auto seed = unsigned(render.get_int("seed", 0));
+		auto threads = render.get_int("threads", thread_count);
+		auto builtin = render.has("builtin") ? render.get_string("builtin") : std::string();
+		auto scene_file = render.has("scene") ? job_path(render.get_string("scene")) : std::string();
+		bool denoise = render.get_bool("denoise", false);
+		if (!render.error().empty()) return fail(render.error());
+		if (!render.unused_key().empty()) return fail("unknown parameter '" + render.unused_key() + "' for 'render'");
+
+		scene s;
+		size_t reuses = cache.scene_reuses;
+		if (!builtin.empty()) {
+			if (!cache.builtin(builtin, seed, s)) return fail("unknown built-in scene '" + builtin + "'");
+		}
+		else if (!cache.load(scene_file, s)) {
+			return false;
+		}
+		reused = cache.scene_reuses != reuses;
+
+		s.cam.seed = seed;
+		s.cam.thread_count = threads;
+		s.cam.denoise = s.cam.denoise || denoise;
+
+		camera_settings(settings, s.cam);
+		if (!settings.error().empty()) return fail(settings.error());
+		if (!settings.unused_key().empty()) return fail("unknown parameter '" + settings.unused_key() + "' for 'camera'");
+
+		s.cam.show_progress = false;
+		s.cam.preview_path.clear();
+		s.cam.on_progress = [this](const camera::render_status& status) {
+			progress = status;
+			auto now = std::chrono::steady_clock::now();
+			if (std::chrono::duration<double>(now - last_status).count() >= 1.0) write_status("rendering");
+		};
+
+		std::ofstream out(output, std::ios::binary);
+		if (!out) {
+			std::cerr << "ERROR: Could not open output file '" << output << "'.\n";
+			return false;
+		}
+		s.render(out);
+		if (!out.flush()) {
+			std::cerr << "ERROR: Could not write output file '" << output << "'.\n";
+			return false;
+		}
+
+		int height = int(s.cam.framebuffer.size() / s.cam.image_width);
+		return hdr.empty() || write_pfm(hdr, s.cam.image_width, height, s.cam.framebuffer);
+	}
+
+	static std::string quoted(const std::string& text) {
+		std::string result = "\"";
+		for (char c : text) {
+			if (c == '"' || c == '\\') result += '\\';
+			result += c;
+		}
+		return result + "\"";
+	}
+
+	void write_status(const char* state) {
+		last_status = std::chrono::steady_clock::now();
+		size_t jobs = jobs_done + jobs_failed;
+
+		std::ostringstream json;
+		json << "{\n"
+			<< "  \"state\": \"" << state << "\",\n"
+			<< "  \"job\": " << quoted(job_name) << ",\n"
+			<< "  \"samples_done\": " << progress.samples_done << ",\n"
+			<< "  \"samples_per_pixel\": " << progress.samples_per_pixel << ",\n"
+			<< "  \"rays_per_second\": " << progress.rays_per_second << ",\n"
+			<< "  \"eta_seconds\": " << progress.eta_seconds << ",\n"
+			<< "  \"jobs_done\": " << jobs_done << ",\n"
+			<< "  \"jobs_failed\": " << jobs_failed << ",\n"
+			<< "  \"scenes_loaded\": " << cache.scene_loads << ",\n"
+			<< "  \"scenes_reused\": " << cache.scene_reuses << ",\n"
+			<< "  \"average_overhead_ms\": " << (jobs > 0 ? 1000 * overhead_seconds / jobs : 0.0) << ",\n"
+			<< "  \"uptime_seconds\": " << std::chrono::duration<double>(last_status - started).count() << "\n"
+			<< "}\n";
+
+		if (!camera::replace_file(path("daemon.json"), json.str()))
+			std::cerr << "ERROR: Could not write '" << path("daemon.json") << "'.\n";
+	}
+};
+
+#endif // !RENDER_DAEMON_H
@@ -10,26 +10,20 @@
 #include "external/stb_image.h"
 
 #include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <string>
+#include <vector>
 
 class rtw_image {
 public:
 	rtw_image() {}
 
-	rtw_image(const char* image_filename) {
-		auto filename = std::string(image_filename);
-		auto imagedir = get_env("RTW_IMAGES");
-
-		// Search in some likely locations.
-		if (!imagedir.empty() && load(std::string(imagedir) + "/" + image_filename)) return;
-		if (load(filename)) return;
-		if (load("images/" + filename)) return;
-		if (load("../images/" + filename)) return;
-		if (load("../../images/" + filename)) return;
-		if (load("../../../images/" + filename)) return;
-		if (load("../../../../images/" + filename)) return;
-		if (load("../../../../../images/" + filename)) return;
-		if (load("../../../../../../images/" + filename)) return;
+	// With `high_dynamic_range`, the image keeps its linear values as floats,
+	// past 1 included, for float_pixel_data(); pixel_data() then has none.
+	rtw_image(const char* image_filename, bool high_dynamic_range = false) : hdr(high_dynamic_range) {
+		for (const auto& candidate : search_paths(image_filename))
+			if (load(candidate)) return;
 
 		std::cerr << "ERROR: Could not load image file '" << image_filename << "'.\n";
 	}
@@ -39,18 +33,38 @@ public:
 		stbi_image_free(fdata);
 	}
 
+	// Where the constructor would find `image_filename`, or empty if nowhere.
+	static std::string find(const char* image_filename) {
+		for (const auto& candidate : search_paths(image_filename))
+			if (std::ifstream(candidate)) return candidate;
+		return "";
+	}
+
 	bool load(const std::string& filename) {
 		auto n = bytes_per_pixel;
-		fdata = stbi_loadf(filename.c_str(), &image_width, &image_height, &n, bytes_per_pixel);
-		if (fdata == nullptr) return false;
+		float* loaded = stbi_loadf(filename.c_str(), &image_width, &image_height, &n, bytes_per_pixel);
+		if (loaded == nullptr) return false;
 
+		delete[] bdata;
+		bdata = nullptr;
+		stbi_image_free(fdata);
+		fdata = nullptr;
 		bytes_per_scanline = image_width * bytes_per_pixel;
-		convert_to_bytes();
+
+		if (hdr) {
+			fdata = loaded;
+			return true;
+		}
+
+		// Otherwise the floats are only a staging buffer; keeping them as well
+		// as the bytes would cost 12 more bytes per texel for nothing.
+		convert_to_bytes(loaded);
+		stbi_image_free(loaded);
 		return true;
 	}
 
-	int width() const { return (fdata == nullptr) ? 0 : image_width; }
-	int height() const { return (fdata == nullptr) ? 0 : image_height; }
+	int width() const { return (bdata == nullptr && fdata == nullptr) ? 0 : image_width; }
+	int height() const { return (bdata == nullptr && fdata == nullptr) ? 0 : image_height; }
 
 	const unsigned char* pixel_data(int x, int y) const {
 		static unsigned char magenta[] = { 255, 0, 255 };
@@ -61,10 +75,21 @@ public:
 		return bdata + y * bytes_per_scanline + x * bytes_per_pixel;
 	}
 
+	// Linear RGB, only for images loaded with high_dynamic_range.
+	const float* float_pixel_data(int x, int y) const {
+		static float magenta[] = { 1, 0, 1 };
+		if (fdata == nullptr) return magenta;
+		x = clamp(x, 0, image_width);
+		y = clamp(y, 0, image_height);
+
+		return fdata + y * bytes_per_scanline + x * bytes_per_pixel;
+	}
+
 private: 
 	const int      bytes_per_pixel = 3;
-	float*         fdata = nullptr;
 	unsigned char* bdata = nullptr;
+	float*         fdata = nullptr;
+	bool           hdr = false;
 	int            image_width = 0;
 	int            image_height = 0;
 	int            bytes_per_scanline = 0;
@@ -82,17 +107,30 @@ private:
 		return static_cast<unsigned char>(256.0 * value);
 	}
 
-	void convert_to_bytes() {
-		int total_bytes = image_width * image_height * bytes_per_pixel;
+	void convert_to_bytes(const float* fdata) {
+		size_t total_bytes = size_t(image_width) * image_height * bytes_per_pixel;
 		bdata = new unsigned char[total_bytes];
 
 		auto* bptr = bdata;
 		auto* fptr = fdata;
-		for (auto i = 0; i < total_bytes; i++, fptr++, bptr++)
+		for (size_t i = 0; i < total_bytes; i++, fptr++, bptr++)
 			*bptr = float_to_byte(*fptr);
 	}
 
-	std::string get_env(const char* name) {
+	// Some likely locations, in the order they are tried.
+	static std::vector<std::string> search_paths(const std::string& filename) {
+		std::vector<std::string> paths;
+		auto imagedir = get_env("RTW_IMAGES");
+		if (!imagedir.empty()) paths.push_back(imagedir + "/" + filename);
+		paths.push_back(filename);
+
+		std::string prefix = "images/";
+		for (int up = 0; up <= 6; up++, prefix = "../" + prefix)
+			paths.push_back(prefix + filename);
+		return paths;
+	}
+
+	static std::string get_env(const char* name) {
 		char* buffer = nullptr;
 		size_t size = 0;
 		if (_dupenv_s(&buffer, &size, name) == 0 && buffer != nullptr) {
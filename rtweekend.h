@@ -7,6 +7,7 @@
 #include <sstream>
 #include <limits>
 #include <memory>
+#include <random>
 
 // C++ std using
 using std::make_shared;
@@ -21,8 +22,25 @@ inline double degrees_to_radians(double degrees) {
 	return degrees * pi / 180.0;
 }
 
+// std::floor is a library call on plain x86-64; this compiles to a few instructions.
+inline int floor_int(double x) {
+	int i = int(x);
+	return i - (x < i);
+}
+
+// Each thread owns its own generator so render threads never share state.
+inline std::mt19937& random_engine() {
+	thread_local std::mt19937 engine(std::random_device{}());
+	return engine;
+}
+
+inline void seed_random(unsigned int seed) {
+	random_engine().seed(seed);
+}
+
 inline double random_double() {
-	return std::rand() / (RAND_MAX + 1.0);
+	// 32-bit generator output mapped onto [0, 1)
+	return random_engine()() * (1.0 / 4294967296.0);
 }
 
 inline double random_double(double min, double max) {
@@ -38,6 +56,7 @@ inline int random_int(int min, int max) {
 #include "color.h"
 #include "interval.h"
 #include "ray.h"
+#include "stats.h"
 #include "vec3.h"
 
 #endif // !RTWEEKEND_H
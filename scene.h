@@ -0,0 +1,18 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "camera.h"
+#include "hittable_list.h"
+
+// A renderable scene: the world to trace and the camera to trace it with.
+
+class scene {
+public:
+	hittable_list world;
+	camera cam;
+
+	void render() { cam.render(world); }
+	void render(std::ostream& out) { cam.render(world, out); }
+};
+
+#endif // !SCENE_H
@@ -0,0 +1,210 @@
+#ifndef SCENE_CACHE_H
+#define SCENE_CACHE_H
+
+#include "scene.h"
+#include "scene_file.h"
+#include "scenes.h"
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+// Scene Cache
+//
+// Keeps loaded scenes, images, meshes and volumes between renders in one
+// process. A scene whose file, and every file it references, are unchanged
+// since it was loaded is handed out again as it is, BVH and all, so only the
+// camera is new. When a scene file does change, the images, meshes and
+// volumes it still shares with its last version are reused rather than read
+// again.
+//
+// Files are recognized by path, size and modification time. Up to
+// `max_scenes` scenes are kept, dropping the least recently used; images,
+// meshes and volumes go once no kept scene uses them.
+
+class scene_cache : public scene_assets {
+public:
+	size_t max_scenes = 16;
+
+	size_t scene_loads = 0;  // Scenes read from their file or built
+	size_t scene_reuses = 0; // Scenes handed out again unchanged
+
+	// Fills `s` with the scene in `filename`.
+	bool load(const std::string& filename, scene& s) {
+		auto key = "file:" + filename;
+		if (auto cached = find(key)) {
+			s = cached->loaded;
+			scene_reuses++;
+			return true;
+		}
+
+		entry e;
+		e.key = key;
+		if (!stamp(filename, e.files)) {
+			std::cerr << "ERROR: Could not open scene file '" << filename << "'.\n";
+			return false;
+		}
+
+		touched = &e.files;
+		bool ok = load_scene(filename, e.loaded, *this);
+		touched = nullptr;
+		if (!ok) return false;
+
+		scene_loads++;
+		s = e.loaded;
+		insert(std::move(e));
+		return true;
+	}
+
+	// Fills `s` with a built-in scene. Those that place objects at random are
+	// cached per seed.
+	bool builtin(const std::string& name, unsigned int seed, scene& s) {
+		auto key = "builtin:" + name + ":" + std::to_string(seed);
+		if (auto cached = find(key)) {
+			s = cached->loaded;
+			scene_reuses++;
+			return true;
+		}
+
+		entry e;
+		e.key = key;
+		seed_random(seed);
+		if (!builtin_scene(name, e.loaded)) return false;
+
+		scene_loads++;
+		s = e.loaded;
+		insert(std::move(e));
+		return true;
+	}
+
+	shared_ptr<texture> image(const std::string& file, texture_filter filter) override {
+		auto& cached = images[file + ":" + std::to_string(int(filter))];
+		if (!refresh(file, cached.stamp) || !cached.asset)
+			cached.asset = scene_assets::image(file, filter);
+		return cached.asset;
+	}
+
+	// A cached mesh is shared under a new material by wrapping its buffers,
+	// which keeps the original alive for as long as the wrapper.
+	shared_ptr<hittable> mesh(const std::string& file, shared_ptr<material> mat, bool smooth, bool cached) override {
+		auto& entry = meshes[file + (smooth ? ":smooth" : ":flat")];
+		if (!refresh(file, entry.stamp) || !entry.asset) {
+			auto loaded = scene_assets::mesh(file, mat, smooth, cached);
+			entry.asset = std::dynamic_pointer_cast<triangle_mesh>(loaded);
+			if (!entry.asset) return loaded;
+		}
+		return make_shared<triangle_mesh>(entry.asset->view(), entry.asset, mat);
+	}
+
+	shared_ptr<sparse_grid> volume(const std::string& file) override {
+		auto& cached = volumes[file];
+		if (!refresh(file, cached.stamp) || !cached.asset)
+			cached.asset = scene_assets::volume(file);
+		return cached.asset;
+	}
+
+	shared_ptr<environment_map> environment(const std::string& file) override {
+		auto& cached = environments[file];
+		if (!refresh(file, cached.stamp) || !cached.asset)
+			cached.asset = scene_assets::environment(file);
+		return cached.asset;
+	}
+
+	size_t scene_count() const { return scenes.size(); }
+	size_t image_count() const { return images.size(); }
+	size_t mesh_count() const { return meshes.size(); }
+	size_t volume_count() const { return volumes.size(); }
+
+private:
+	struct file_stamp {
+		std::string path;
+		uint64_t size = 0;
+		int64_t mtime = 0;
+	};
+
+	struct entry {
+		std::string key;
+		std::vector<file_stamp> files; // The scene file first, then everything it read
+		scene loaded;
+	};
+
+	template <typename T>
+	struct asset {
+		file_stamp stamp;
+		shared_ptr<T> asset;
+	};
+
+	std::list<entry> scenes; // Most recently used first
+	std::map<std::string, asset<texture>> images;
+	std::map<std::string, asset<triangle_mesh>> meshes;
+	std::map<std::string, asset<sparse_grid>> volumes;
+	std::map<std::string, asset<environment_map>> environments;
+	std::vector<file_stamp>* touched = nullptr; // Files read by the scene being loaded
+
+	static bool stamp(const std::string& path, std::vector<file_stamp>& files) {
+		file_stamp s;
+		s.path = path;
+		// Images may be found elsewhere by the loader; those keep a zero stamp
+		bool found = mesh_cache_detail::source_stamp(path, s.size, s.mtime);
+		files.push_back(s);
+		return found;
+	}
+
+	static bool unchanged(const file_stamp& s) {
+		uint64_t size = 0;
+		int64_t mtime = 0;
+		mesh_cache_detail::source_stamp(s.path, size, mtime);
+		return size == s.size && mtime == s.mtime;
+	}
+
+	// Records that the scene being loaded reads `path`, and returns whether
+	// `cached` still describes the file, updating it if not.
+	bool refresh(const std::string& path, file_stamp& cached) {
+		std::vector<file_stamp> now;
+		stamp(path, now);
+		if (touched) touched->push_back(now[0]);
+
+		bool same = cached.path == path && cached.size == now[0].size && cached.mtime == now[0].mtime;
+		cached = now[0];
+		return same;
+	}
+
+	const entry* find(const std::string& key) {
+		for (auto it = scenes.begin(); it != scenes.end(); ++it) {
+			if (it->key != key) continue;
+
+			bool current = true;
+			for (const auto& f : it->files)
+				current = current && unchanged(f);
+
+			if (!current) {
+				scenes.erase(it);
+				return nullptr;
+			}
+
+			scenes.splice(scenes.begin(), scenes, it);
+			return &scenes.front();
+		}
+		return nullptr;
+	}
+
+	void insert(entry e) {
+		scenes.push_front(std::move(e));
+		if (scenes.size() <= max_scenes) return;
+
+		scenes.pop_back();
+
+		// Whatever only the cache still holds belongs to no kept scene
+		for (auto it = images.begin(); it != images.end();)
+			it = it->second.asset.use_count() <= 1 ? images.erase(it) : std::next(it);
+		for (auto it = meshes.begin(); it != meshes.end();)
+			it = it->second.asset.use_count() <= 1 ? meshes.erase(it) : std::next(it);
+		for (auto it = volumes.begin(); it != volumes.end();)
+			it = it->second.asset.use_count() <= 1 ? volumes.erase(it) : std::next(it);
+		for (auto it = environments.begin(); it != environments.end();)
+			it = it->second.asset.use_count() <= 1 ? environments.erase(it) : std::next(it);
+	}
+};
+
+#endif // !SCENE_CACHE_H
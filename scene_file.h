@@ -0,0 +1,633 @@
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include "bvh.h"
+#include "environment.h"
+#include "instance.h"
+#include "material.h"
+#include "medium.h"
+#include "mesh_cache.h"
+#include "motion.h"
+#include "primitives.h"
+#include "scene.h"
+#include "sparse_grid.h"
+#include "texture.h"
+
+#include <fstream>
+#include <map>
+#include <set>
+#include <string>
+
+// Scene Files
+//
+// A scene file is plain text, one directive per line. Each directive is a
+// keyword, an optional name, and then key=value parameters. Vectors and
+// colors are written as comma separated triples. '#' starts a comment.
+//
+//     camera image_width=600 samples_per_pixel=200 vfov=40 lookfrom=278,278,-800 lookat=278,278,0
+//
+//     texture  checks  type=checker scale=0.32 even=0.2,0.3,0.1 odd=0.9,0.9,0.9
+//     material ground  type=lambertian albedo=checks
+//     material glass   type=dielectric ior=1.5
+//
+//     sphere center=0,-1000,0 radius=1000 material=ground
+//     box    min=0,0,0 max=165,330,165 material=white rotate_y=15 translate=265,0,295
+//     mesh   file=bunny.obj material=white scale=100
+//
+//     group unit_box
+//         box min=0,0,0 max=1,1,1 material=white
+//     end
+//     instance group=unit_box scale=165 rotate_y=-18 translate=130,0,65
+//
+// Directives:
+//   camera    aspect_ratio image_width samples_per_pixel max_depth background
+//             vfov lookfrom lookat vup defocus_angle focus_dist
+//             exposure tonemap (clamp, reinhard, aces or filmic)
+//             filter (box, gaussian, mitchell, blackman_harris) filter_radius
+//             sample_clamp spectral sample_lights
+//   environment file [intensity] [rotate_y]
+//             (an equirectangular HDR image around the scene, up at the top,
+//             in place of the camera's background; it lights the scene and
+//             is sampled like the lights, so a small sun converges quickly)
+//   texture   <name> type=solid    color
+//                    type=checker  scale even odd   (colors or texture names)
+//                    type=image    file [filter]
+//                                  (nearest, bilinear or trilinear, the
+//                                  default, which blurs by the ray footprint)
+//                    type=noise    scale [bake bake_min bake_max]
+//                                  (bake: precompute the turbulence over the
+//                                  box at that many samples along its longest
+//                                  side, which is much faster to shade)
+//   material  <name> type=lambertian    albedo         (color or texture name)
+//                    type=metal         albedo roughness
+//                    type=dielectric    ior [cauchy_b]
+//                                       (cauchy_b: dispersion in um^2, e.g.
+//                                       0.0042 for crown glass; needs spectral)
+//                    type=diffuse_light emit
+//   sphere    center [center2] radius material
+//   quad      Q u v material
+//   triangle  Q u v material
+//   disk      Q u v radius material
+//   box       min max material [material_front material_back material_left
+//             material_right material_top material_bottom]
+//             (front is the +z face, back -z, left -x, right +x, top +y
+//             and bottom -y; any not given take material)
+//   mesh      file material [smooth=1] [cache=1]
+//   medium    min max density albedo [noise resolution threshold]
+//             (smoke or fog filling the box; with noise, the density varies
+//             as Perlin turbulence at that scale, baked at `resolution`
+//             samples along the longest side, default 64; with threshold,
+//             only turbulence above it counts and the grid is stored
+//             sparsely, for large mostly empty volumes)
+//   medium    file density albedo
+//             (a sparse voxel grid from a .rtwvol file, see sparse_grid.h,
+//             its values scaled by density)
+//   medium    group density albedo
+//             (fills the inside of a group, which must be closed)
+//   group     <name> ... end     Builds the enclosed objects into a shared BLAS
+//   instance  group
+//
+// Any object or instance also accepts scale (number or triple), rotate_x,
+// rotate_y, rotate_z (degrees) and translate, applied in that order. Any of
+// these suffixed with @time sets it for a keyframe at that time in the
+// shutter interval [0, 1], where unsuffixed values give the rest of that
+// keyframe and the keyframe at time 0:
+//
+//     instance group=unit_box scale=165 translate=130,0,65 rotate_y@1=90 translate@1=230,0,65
+//
+// The whole world is built into a BVH once the file has been read.
+
+// Where a scene file's images, meshes, volumes and environments come from. This
+// loads them from disk every time; a cache can override it to share them between loads.
+class scene_assets {
+public:
+	virtual ~scene_assets() = default;
+
+	virtual shared_ptr<texture> image(const std::string& file, texture_filter filter) {
+		return make_shared<image_texture>(file.c_str(), filter);
+	}
+
+	virtual shared_ptr<hittable> mesh(const std::string& file, shared_ptr<material> mat, bool smooth, bool cached) {
+		if (cached) return load_mesh_cached(file, mat, smooth);
+		return load_mesh(file, mat, smooth);
+	}
+
+	virtual shared_ptr<sparse_grid> volume(const std::string& file) {
+		return sparse_grid::load(file);
+	}
+
+	virtual shared_ptr<environment_map> environment(const std::string& file) {
+		return environment_map::load(file);
+	}
+};
+
+namespace scene_file_detail {
+
+	class params {
+	public:
+		std::map<std::string, std::string> values;
+
+		bool has(const std::string& key) const { return values.count(key) != 0; }
+
+		std::string get_string(const std::string& key) {
+			used.insert(key);
+			auto it = values.find(key);
+			if (it == values.end()) {
+				fail("missing parameter '" + key + "'");
+				return "";
+			}
+			return it->second;
+		}
+
+		double get_double(const std::string& key) {
+			auto text = get_string(key);
+			return parse_double(key, text);
+		}
+
+		double get_double(const std::string& key, double fallback) {
+			return has(key) ? get_double(key) : fallback;
+		}
+
+		int get_int(const std::string& key, int fallback) {
+			if (!has(key)) return fallback;
+			auto text = get_string(key);
+			double value = parse_double(key, text);
+			if (!(value == std::floor(value) && std::fabs(value) <= std::numeric_limits<int>::max())) {
+				fail("'" + key + "' is not an integer: " + text);
+				return fallback;
+			}
+			return int(value);
+		}
+
+		bool get_bool(const std::string& key, bool fallback) {
+			return has(key) ? get_double(key) != 0 : fallback;
+		}
+
+		vec3 get_vec3(const std::string& key) {
+			auto text = get_string(key);
+			vec3 v;
+			if (!parse_vec3(text, v)) fail("'" + key + "' is not a vector: " + text);
+			return v;
+		}
+
+		vec3 get_vec3(const std::string& key, const vec3& fallback) {
+			return has(key) ? get_vec3(key) : fallback;
+		}
+
+		static bool parse_vec3(const std::string& text, vec3& v) {
+			std::istringstream in(text);
+			char comma1 = 0, comma2 = 0;
+			double x, y, z;
+			if (!(in >> x >> comma1 >> y >> comma2 >> z) || comma1 != ',' || comma2 != ',') return false;
+			if (in.peek() != EOF) return false;
+			v = vec3(x, y, z);
+			return true;
+		}
+
+		// Returns the first unknown key, or an empty string.
+		std::string unused_key() const {
+			for (const auto& kv : values)
+				if (!used.count(kv.first)) return kv.first;
+			return "";
+		}
+
+		const std::string& error() const { return first_error; }
+
+		void fail(const std::string& message) {
+			if (first_error.empty()) first_error = message;
+		}
+
+	private:
+		std::set<std::string> used;
+		std::string first_error;
+
+		double parse_double(const std::string& key, const std::string& text) {
+			char* end = nullptr;
+			double value = std::strtod(text.c_str(), &end);
+			if (text.empty() || *end != '\0') fail("'" + key + "' is not a number: " + text);
+			return value;
+		}
+	};
+
+	// Splits one line (without its comment) into keyword, optional name and
+	// parameters. Blank lines leave the keyword empty.
+	inline bool split_directive(const std::string& text, std::string& keyword, std::string& name, params& p, std::string& error) {
+		std::istringstream tokens(text);
+		keyword.clear();
+		name.clear();
+		if (!(tokens >> keyword)) return true;
+
+		std::string token;
+		while (tokens >> token) {
+			auto eq = token.find('=');
+			if (eq == std::string::npos) {
+				if (!name.empty()) {
+					error = "unexpected '" + token + "'";
+					return false;
+				}
+				name = token;
+			}
+			else {
+				p.values[token.substr(0, eq)] = token.substr(eq + 1);
+			}
+		}
+		return true;
+	}
+
+	// The parameters of a 'camera' directive. Anything not given keeps its value.
+	inline void camera_settings(params& p, camera& cam) {
+		cam.aspect_ratio      = p.get_double("aspect_ratio", cam.aspect_ratio);
+		cam.image_width       = p.get_int("image_width", cam.image_width);
+		cam.samples_per_pixel = p.get_int("samples_per_pixel", cam.samples_per_pixel);
+		cam.max_depth         = p.get_int("max_depth", cam.max_depth);
+		cam.background        = p.get_vec3("background", cam.background);
+		cam.vfov              = p.get_double("vfov", cam.vfov);
+		cam.lookfrom          = p.get_vec3("lookfrom", cam.lookfrom);
+		cam.lookat            = p.get_vec3("lookat", cam.lookat);
+		cam.vup               = p.get_vec3("vup", cam.vup);
+		cam.defocus_angle     = p.get_double("defocus_angle", cam.defocus_angle);
+		cam.focus_dist        = p.get_double("focus_dist", cam.focus_dist);
+		cam.grade.exposure    = p.get_double("exposure", cam.grade.exposure);
+
+		if (p.has("tonemap") && !parse_tone_map(p.get_string("tonemap"), cam.grade.tone_map))
+			p.fail("unknown tone mapping operator '" + p.get_string("tonemap") + "'");
+
+		pixel_filter_type filter_type = filter_box;
+		if (p.has("filter")) {
+			if (pixel_filter::parse(p.get_string("filter"), filter_type)) cam.filter = pixel_filter(filter_type);
+			else p.fail("unknown pixel filter '" + p.get_string("filter") + "'");
+		}
+		cam.filter.radius = p.get_double("filter_radius", cam.filter.radius);
+		cam.sample_clamp  = p.get_double("sample_clamp", cam.sample_clamp);
+		cam.spectral      = p.get_bool("spectral", cam.spectral);
+		cam.sample_lights = p.get_bool("sample_lights", cam.sample_lights);
+
+		if (!(cam.aspect_ratio > 0)) p.fail("'aspect_ratio' must be positive");
+		if (cam.image_width <= 0) p.fail("'image_width' must be positive");
+		if (cam.samples_per_pixel <= 0) p.fail("'samples_per_pixel' must be positive");
+		if (cam.max_depth <= 0) p.fail("'max_depth' must be positive");
+	}
+
+	class parser {
+	public:
+		parser(const std::string& filename, scene& s, scene_assets& assets) : filename(filename), s(s), assets(assets) {
+			auto slash = filename.find_last_of("/\\");
+			directory = slash == std::string::npos ? "" : filename.substr(0, slash + 1);
+		}
+
+		bool parse(std::istream& in) {
+			std::string text;
+			while (std::getline(in, text)) {
+				line++;
+
+				auto hash = text.find('#');
+				if (hash != std::string::npos) text.erase(hash);
+
+				std::string keyword, name, error;
+				params p;
+				if (!split_directive(text, keyword, name, p, error)) return fail(error);
+				if (keyword.empty()) continue;
+
+				if (!directive(keyword, name, p)) return false;
+			}
+
+			if (!group_name.empty())
+				return fail("group '" + group_name + "' is missing its 'end'");
+
+			if (!world.objects.empty())
+				s.world = hittable_list(make_shared<bvh_node>(world));
+
+			return true;
+		}
+
+	private:
+		std::string filename;
+		std::string directory;
+		scene& s;
+		scene_assets& assets;
+		int line = 0;
+
+		hittable_list world;
+		hittable_list group;
+		std::string group_name;
+
+		std::map<std::string, shared_ptr<texture>> textures;
+		std::map<std::string, shared_ptr<material>> materials;
+		std::map<std::string, shared_ptr<hittable>> groups;
+
+		bool fail(const std::string& message) const {
+			std::cerr << "ERROR: " << filename << ":" << line << ": " << message << "\n";
+			return false;
+		}
+
+		bool directive(const std::string& keyword, const std::string& name, params& p) {
+			bool named = keyword == "texture" || keyword == "material" || keyword == "group";
+			if (named && name.empty()) return fail("'" + keyword + "' needs a name");
+			if (!named && !name.empty()) return fail("unexpected '" + name + "'");
+
+			if (keyword == "end") {
+				if (group_name.empty()) return fail("'end' without 'group'");
+				if (group.objects.empty()) return fail("group '" + group_name + "' is empty");
+				groups[group_name] = make_blas(group);
+				group.clear();
+				group_name.clear();
+				return true;
+			}
+
+			if (keyword == "group") {
+				if (!group_name.empty()) return fail("groups cannot be nested");
+				group_name = name;
+				return true;
+			}
+
+			if (keyword == "camera") camera_settings(p, s.cam);
+			else if (keyword == "environment") environment_directive(p);
+			else if (keyword == "texture") textures[name] = texture_directive(p);
+			else if (keyword == "material") materials[name] = material_directive(p);
+			else {
+				auto object = object_directive(keyword, p);
+				if (object) {
+					object = apply_transform(object, p);
+					(group_name.empty() ? world : group).add(object);
+				}
+				else if (p.error().empty()) {
+					return fail("unknown directive '" + keyword + "'");
+				}
+			}
+
+			if (!p.error().empty()) return fail(p.error());
+
+			auto unknown = p.unused_key();
+			if (!unknown.empty()) return fail("unknown parameter '" + unknown + "' for '" + keyword + "'");
+
+			return true;
+		}
+
+		void environment_directive(params& p) {
+			auto file = resolve_path(p.get_string("file"));
+			auto intensity = p.get_double("intensity", 1);
+			auto rotation = p.get_double("rotate_y", 0);
+			if (!p.error().empty()) return;
+
+			auto map = assets.environment(file);
+			if (!map) p.fail("could not load environment '" + file + "'");
+			else s.cam.environment = environment_light(map, intensity, rotation);
+		}
+
+		// A parameter that is either a literal color or the name of a texture.
+		shared_ptr<texture> texture_param(params& p, const std::string& key) {
+			auto text = p.get_string(key);
+			vec3 c;
+			if (params::parse_vec3(text, c)) return make_shared<solid_color>(c);
+
+			auto it = textures.find(text);
+			if (it == textures.end()) {
+				p.fail("unknown texture '" + text + "'");
+				return make_shared<solid_color>(color(1, 0, 1));
+			}
+			return it->second;
+		}
+
+		shared_ptr<texture> texture_directive(params& p) {
+			auto type = p.get_string("type");
+
+			if (type == "solid") return make_shared<solid_color>(p.get_vec3("color"));
+			if (type == "checker") {
+				auto scale = p.get_double("scale");
+				auto even = texture_param(p, "even");
+				auto odd = texture_param(p, "odd");
+				return make_shared<checker_texture>(scale, even, odd);
+			}
+			if (type == "image") {
+				auto file = resolve_path(p.get_string("file"));
+				auto filter = texture_trilinear;
+				if (p.has("filter") && !parse_texture_filter(p.get_string("filter"), filter))
+					p.fail("unknown texture filter '" + p.get_string("filter") + "'");
+				return assets.image(file, filter);
+			}
+			if (type == "noise") {
+				auto noise = make_shared<noise_texture>(p.get_double("scale"));
+				if (p.has("bake")) {
+					auto resolution = p.get_int("bake", 0);
+					auto min = p.get_vec3("bake_min");
+					auto max = p.get_vec3("bake_max");
+					if (p.error().empty()) noise->bake(min, max, resolution);
+				}
+				return noise;
+			}
+
+			p.fail("unknown texture type '" + type + "'");
+			return nullptr;
+		}
+
+		shared_ptr<material> material_directive(params& p) {
+			auto type = p.get_string("type");
+
+			if (type == "lambertian") return make_shared<lambertian>(texture_param(p, "albedo"));
+			if (type == "metal") {
+				auto albedo = texture_param(p, "albedo");
+				return make_shared<metal>(albedo, p.get_double("roughness", 0));
+			}
+			if (type == "dielectric") return make_shared<dielectric>(p.get_double("ior"), p.get_double("cauchy_b", 0));
+			if (type == "diffuse_light") return make_shared<diffuse_light>(texture_param(p, "emit"));
+
+			p.fail("unknown material type '" + type + "'");
+			return nullptr;
+		}
+
+		shared_ptr<material> material_param(params& p, const std::string& key = "material") {
+			auto name = p.get_string(key);
+			auto it = materials.find(name);
+			if (it == materials.end()) {
+				if (!name.empty()) p.fail("unknown material '" + name + "'");
+				return make_shared<lambertian>(color(1, 0, 1));
+			}
+			return it->second;
+		}
+
+		// Returns null for unknown keywords.
+		shared_ptr<hittable> object_directive(const std::string& keyword, params& p) {
+			if (keyword == "sphere") {
+				auto center = p.get_vec3("center");
+				auto radius = p.get_double("radius");
+				auto mat = material_param(p);
+				if (p.has("center2")) return make_shared<sphere>(center, p.get_vec3("center2"), radius, mat);
+				return make_shared<sphere>(center, radius, mat);
+			}
+			if (keyword == "quad" || keyword == "triangle" || keyword == "disk") {
+				auto Q = p.get_vec3("Q");
+				auto u = p.get_vec3("u");
+				auto v = p.get_vec3("v");
+				if (keyword == "disk") {
+					auto radius = p.get_double("radius");
+					return make_shared<disk>(Q, u, v, radius, material_param(p));
+				}
+				if (keyword == "triangle") return make_shared<triangle>(Q, u, v, material_param(p));
+				return make_shared<quad>(Q, u, v, material_param(p));
+			}
+			if (keyword == "box") {
+				auto a = p.get_vec3("min");
+				auto b = p.get_vec3("max");
+
+				// Each face takes material_<face> if given, and material otherwise.
+				static const char* face_names[oriented_box::face_count] = { "front", "right", "back", "left", "top", "bottom" };
+				std::array<shared_ptr<material>, oriented_box::face_count> faces;
+				shared_ptr<material> mat;
+				for (int face = 0; face < oriented_box::face_count; face++) {
+					auto key = std::string("material_") + face_names[face];
+					if (p.has(key)) faces[face] = material_param(p, key);
+					else {
+						if (!mat) mat = material_param(p);
+						faces[face] = mat;
+					}
+				}
+				return make_shared<oriented_box>(a, b, transform(), faces);
+			}
+			if (keyword == "mesh") {
+				auto file = resolve_path(p.get_string("file"));
+				auto mat = material_param(p);
+				auto smooth = p.get_bool("smooth", true);
+				auto cached = p.get_bool("cache", true);
+				if (!p.error().empty()) return nullptr;
+
+				auto mesh = assets.mesh(file, mat, smooth, cached);
+				if (!mesh) p.fail("could not load mesh '" + file + "'");
+				return mesh;
+			}
+			if (keyword == "medium") return medium_directive(p);
+			if (keyword == "instance") {
+				auto name = p.get_string("group");
+				auto it = groups.find(name);
+				if (it == groups.end()) {
+					if (!name.empty()) p.fail("unknown group '" + name + "'");
+					return nullptr;
+				}
+				return it->second;
+			}
+			return nullptr;
+		}
+
+		shared_ptr<hittable> medium_directive(params& p) {
+			auto density = p.get_double("density");
+			auto albedo = p.get_vec3("albedo");
+
+			if (p.has("group")) {
+				auto name = p.get_string("group");
+				auto it = groups.find(name);
+				if (it == groups.end()) {
+					p.fail("unknown group '" + name + "'");
+					return nullptr;
+				}
+				return make_shared<constant_medium>(it->second, density, albedo);
+			}
+
+			if (p.has("file")) {
+				auto file = resolve_path(p.get_string("file"));
+				if (!p.error().empty()) return nullptr;
+				auto grid = assets.volume(file);
+				if (!grid) {
+					p.fail("could not load volume '" + file + "'");
+					return nullptr;
+				}
+				return make_shared<grid_medium<sparse_grid>>(grid, albedo, density);
+			}
+
+			aabb box(p.get_vec3("min"), p.get_vec3("max"));
+			if (p.has("noise")) {
+				auto scale = p.get_double("noise");
+				auto resolution = p.get_int("resolution", 64);
+				if (p.has("threshold")) {
+					auto threshold = p.get_double("threshold");
+					if (!p.error().empty()) return nullptr;
+					return make_shared<grid_medium<sparse_grid>>(sparse_noise_density(box, resolution, density, scale, threshold), albedo);
+				}
+				if (!p.error().empty()) return nullptr;
+				return make_shared<grid_medium<density_grid>>(noise_density(box, resolution, density, scale), albedo);
+			}
+			return make_shared<constant_medium>(box, density, albedo);
+		}
+
+		shared_ptr<hittable> apply_transform(shared_ptr<hittable> object, params& p) {
+			std::set<std::string> keyframes; // The "@time" suffixes in use
+			for (const auto& kv : p.values) {
+				auto at = kv.first.find('@');
+				if (at != std::string::npos) keyframes.insert(kv.first.substr(at));
+			}
+
+			if (keyframes.empty()) {
+				if (!p.has("scale") && !p.has("rotate_x") && !p.has("rotate_y") && !p.has("rotate_z") && !p.has("translate"))
+					return object;
+
+				// A box takes the transform into its own, which saves an instance.
+				auto xform = transform_param(p, "");
+				if (auto box = std::dynamic_pointer_cast<oriented_box>(object)) return box->transformed(xform);
+				return make_shared<instance>(object, xform);
+			}
+
+			keyframed_transform motion(transform_param(p, ""));
+			for (const auto& suffix : keyframes) {
+				char* end = nullptr;
+				double time = std::strtod(suffix.c_str() + 1, &end);
+				if (suffix.size() == 1 || *end != '\0') {
+					p.fail("'" + suffix.substr(1) + "' is not a time");
+					return object;
+				}
+				motion.add(time, transform_param(p, suffix));
+			}
+			return make_shared<motion_instance>(object, motion);
+		}
+
+		// The transform from scale, rotate_x/y/z and translate, taking each with
+		// `suffix` where that is given.
+		transform transform_param(params& p, const std::string& suffix) {
+			auto key = [&](const std::string& name) { return p.has(name + suffix) ? name + suffix : name; };
+
+			transform xform;
+			if (p.has(key("scale"))) {
+				// One number scales uniformly
+				vec3 s;
+				if (!params::parse_vec3(p.get_string(key("scale")), s)) {
+					double uniform = p.get_double(key("scale"));
+					s = vec3(uniform, uniform, uniform);
+				}
+				if (s.x() == 0 || s.y() == 0 || s.z() == 0) p.fail("'" + key("scale") + "' must not be zero");
+				xform = transform::scaling(s);
+			}
+			if (p.has(key("rotate_x"))) xform = transform::rotation(vec3(1, 0, 0), p.get_double(key("rotate_x"))) * xform;
+			if (p.has(key("rotate_y"))) xform = transform::rotation(vec3(0, 1, 0), p.get_double(key("rotate_y"))) * xform;
+			if (p.has(key("rotate_z"))) xform = transform::rotation(vec3(0, 0, 1), p.get_double(key("rotate_z"))) * xform;
+			if (p.has(key("translate"))) xform = transform::translation(p.get_vec3(key("translate"))) * xform;
+			return xform;
+		}
+
+		std::string resolve_path(const std::string& file) const {
+			// Relative paths are looked up next to the scene file first.
+			bool absolute = !file.empty() && (file[0] == '/' || file[0] == '\\' || file.find(':') != std::string::npos);
+			if (absolute || directory.empty()) return file;
+
+			auto candidate = directory + file;
+			if (std::ifstream(candidate)) return candidate;
+			return file;
+		}
+	};
+}
+
+// Reads a scene file into `s`, taking its images and meshes from `assets`.
+// Errors are reported to std::cerr.
+inline bool load_scene(const std::string& filename, scene& s, scene_assets& assets) {
+	std::ifstream in(filename);
+	if (!in) {
+		std::cerr << "ERROR: Could not open scene file '" << filename << "'.\n";
+		return false;
+	}
+
+	scene_file_detail::parser p(filename, s, assets);
+	return p.parse(in);
+}
+
+inline bool load_scene(const std::string& filename, scene& s) {
+	scene_assets assets;
+	return load_scene(filename, s, assets);
+}
+
+#endif // !SCENE_FILE_H
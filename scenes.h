@@ -0,0 +1,306 @@
+#ifndef SCENES_H
+#define SCENES_H
+
+#include "bvh.h"
+#include "instance.h"
+#include "material.h"
+#include "medium.h"
+#include "primitives.h"
+#include "scene.h"
+#include "texture.h"
+
+#include <string>
+
+// Built-in Scenes
+//
+// Each function fills in the world and the camera settings of a scene. They
+// are kept in code, alongside the scene files, because some of them are
+// procedurally generated.
+
+inline void bouncing_spheres(scene& s) {
+	auto& world = s.world;
+	auto& cam = s.cam;
+
+	// World
+
+	auto checker = make_shared<checker_texture>(0.32, color(0.2, 0.3, 0.1), color(0.9, 0.9, 0.9));
+	world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(checker)));
+
+	for (int a = -11; a < 11; a++) {
+		for (int b = -11; b < 11; b++) {
+			auto choose_mat = random_double();
+			point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
+
+			if ((center - point3(4, 0.2, 0)).length() > 0.9) {
+				shared_ptr<material> sphere_material;
+
+				if (choose_mat < 0.8) {
+					// diffuse material
+					auto albedo = color::random() * color::random();
+					sphere_material = make_shared<lambertian>(albedo);
+					auto center2 = center + vec3(0, random_double(0, .5), 0);
+					world.add(make_shared<sphere>(center, center2, 0.2, sphere_material));
+				}
+				else if (choose_mat < 0.95) {
+					// metal material
+					auto albedo = color::random(0.5, 1);
+					auto roughness = random_double(0, 0.5);
+					sphere_material = make_shared<metal>(albedo, roughness);
+					world.add(make_shared<sphere>(center, 0.2, sphere_material));
+				}
+				else {
+					// glass
+					sphere_material = make_shared<dielectric>(1.5);
+					world.add(make_shared<sphere>(center, 0.2, sphere_material));
+				}
+			}
+		}
+	}
+
+	auto material1 = make_shared<dielectric>(1.5);
+	world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
+
+	auto material2 = make_shared<noise_texture>(10);
+	world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, make_shared<lambertian>(material2)));
+
+	auto e_tex = make_shared<image_texture>("earthmap.jpg");
+	auto material3 = make_shared<metal>(e_tex, 0.5);
+	world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material3));
+
+	world = hittable_list(make_shared<bvh_node>(world));
+
+	cam.aspect_ratio = 16.0 / 9.0;
+	cam.image_width = 800;
+	cam.samples_per_pixel = 50;
+	cam.max_depth = 50;
+	cam.background = color(0.70, 0.80, 1.00);
+
+	cam.vfov = 20;
+	cam.lookfrom = point3(13, 2, 3);
+	cam.lookat = point3(0, 0, 0);
+	cam.vup = point3(0, 1, 0);
+
+	cam.defocus_angle = 0.6;
+	cam.focus_dist = 10.0;
+}
+
+inline void quads(scene& s) {
+	auto& world = s.world;
+	auto& cam = s.cam;
+
+	// Materials
+	auto left_red = make_shared<lambertian>(color(1.0, 0.2, 0.2));
+	auto back_green = make_shared<lambertian>(color(0.2, 1.0, 0.2));
+	auto right_blue = make_shared<lambertian>(color(0.2, 0.2, 1.0));
+	auto upper_orange = make_shared<lambertian>(color(1.0, 0.5, 0.2));
+	auto lower_teal = make_shared<lambertian>(color(0.2, 0.8, 0.8));
+
+	world.add(make_shared<quad>(point3(-3, -2, 5), vec3(0, 0, -4), vec3(0, 4, 0), left_red));
+	world.add(make_shared<disk>(point3(0, 0, 0), vec3(4, 0, 0), vec3(0, 4, 0), 0.5, back_green));
+	world.add(make_shared<quad>(point3(3, -2, 1), vec3(0, 0, 4), vec3(0, 4, 0), right_blue));
+	world.add(make_shared<quad>(point3(-2, 3, 1), vec3(4, 0, 0), vec3(0, 0, 4), upper_orange));
+	world.add(make_shared<triangle>(point3(-2, -3, 5), vec3(4, 0, 0), vec3(0, 0, -4), lower_teal));
+
+	cam.aspect_ratio = 1.0;
+	cam.image_width = 400;
+	cam.samples_per_pixel = 100;
+	cam.max_depth = 50;
+	cam.background = color(0.70, 0.80, 1.00);
+
+	cam.vfov = 80;
+	cam.lookfrom = point3(3, 3, 9);
+	cam.lookat = point3(0, 0, 0);
+	cam.vup = vec3(0, 1, 0);
+
+	cam.defocus_angle = 0;
+}
+
+inline void earth(scene& s) {
+	auto& world = s.world;
+	auto& cam = s.cam;
+
+	auto earth_texture = make_shared<image_texture>("earthmap.jpg");
+	auto earth_surface = make_shared<lambertian>(earth_texture);
+	auto globe = make_shared<sphere>(point3(0, 0, 0), 2, earth_surface);
+	world.add(globe);
+
+	cam.aspect_ratio = 16.0 / 9.0;
+	cam.image_width = 400;
+	cam.samples_per_pixel = 100;
+	cam.max_depth = 50;
+	cam.background = color(0.70, 0.80, 1.00);
+
+	cam.vfov = 20;
+	cam.lookfrom = point3(0, 0, 12);
+	cam.lookat = point3(0, 0, 0);
+	cam.vup = vec3(0, 1, 0);
+
+	cam.defocus_angle = 0;
+}
+
+inline void perlin_spheres(scene& s) {
+	auto& world = s.world;
+	auto& cam = s.cam;
+
+	auto pertext = make_shared<noise_texture>(4.3);
+	world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(pertext)));
+	world.add(make_shared<sphere>(point3(0, 2, 0), 2, make_shared<lambertian>(pertext)));
+
+	cam.aspect_ratio = 16.0 / 9.0;
+	cam.image_width = 400;
+	cam.samples_per_pixel = 100;
+	cam.max_depth = 50;
+	cam.background = color(0.70, 0.80, 1.00);
+
+	cam.vfov = 20;
+	cam.lookfrom = point3(13, 2, 3);
+	cam.lookat = point3(0, 0, 0);
+	cam.vup = vec3(0, 1, 0);
+
+	cam.defocus_angle = 0;
+}
+
+inline void simple_light(scene& s) {
+	auto& world = s.world;
+	auto& cam = s.cam;
+
+	auto pertex = make_shared<noise_texture>(4);
+	world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(pertex)));
+	world.add(make_shared<sphere>(point3(0, 2, 0), 2, make_shared<lambertian>(pertex)));
+
+	auto diffLight = make_shared<diffuse_light>(color(4, 4, 4));
+	auto diffLight2 = make_shared<diffuse_light>(color(3, 5, 3));
+	auto diffLight3 = make_shared<diffuse_light>(color(3, 3, 6));
+	world.add(make_shared<sphere>(point3(0, 7, 0), 1, diffLight3));
+	world.add(make_shared<quad>(point3(3, 1, -2), vec3(2, 0, 0), vec3(0, 2, 0), diffLight));
+	world.add(make_shared<sphere>(point3(3, 1, 5), 0.2, diffLight2));
+
+
+	cam.aspect_ratio = 16.0 / 9.0;
+	cam.image_width = 400;
+	cam.samples_per_pixel = 500;
+	cam.max_depth = 50;
+	cam.background = color(0, 0, 0);
+
+	cam.vfov = 20;
+	cam.lookfrom = point3(26, 3, 6);
+	cam.lookat = point3(0, 2, 0);
+	cam.vup = vec3(0, 0, 0);
+
+	cam.defocus_angle = 0;
+}
+
+inline void cornell_box(scene& s) {
+	auto& world = s.world;
+	auto& cam = s.cam;
+
+	auto red = make_shared<lambertian>(color(0.65, 0.05, 0.05));
+	auto white = make_shared<lambertian>(color(0.73, 0.73, 0.73));
+	auto green = make_shared<lambertian>(color(0.12, 0.45, 0.15));
+	auto light = make_shared<diffuse_light>(color(15, 15, 15));
+
+	world.add(make_shared<quad>(point3(555, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), green));
+	world.add(make_shared<quad>(point3(0, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), red));
+	world.add(make_shared<quad>(point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), light));
+	world.add(make_shared<quad>(point3(0, 0, 0), vec3(555, 0, 0), vec3(0, 0, 555), white));
+	world.add(make_shared<quad>(point3(555, 555, 555), vec3(-555, 0, 0), vec3(0, 0, -555), white));
+	world.add(make_shared<quad>(point3(0, 0, 555), vec3(555, 0, 0), vec3(0, 555, 0), white));
+
+	// Both boxes are unit cubes carrying their own transforms.
+	auto box1 = transform::translation(vec3(265, 0, 295))
+			  * transform::rotation_y(15)
+			  * transform::scaling(vec3(165, 330, 165));
+	world.add(make_shared<oriented_box>(point3(0, 0, 0), point3(1, 1, 1), box1, white));
+
+	/*
+	auto box2 = transform::translation(vec3(130, 0, 65))
+			  * transform::rotation_y(-18)
+			  * transform::scaling(165);
+	world.add(make_shared<oriented_box>(point3(0, 0, 0), point3(1, 1, 1), box2, white));
+	*/
+
+	auto glass = make_shared<dielectric>(1.53);
+	world.add(make_shared<sphere>(point3(150, 84, 120), 84, glass));
+
+	world = hittable_list(make_shared<bvh_node>(world));
+
+	cam.aspect_ratio = 1.0;
+	cam.image_width = 600;
+	cam.samples_per_pixel = 10000;
+	cam.max_depth = 50;
+	cam.background = color(0, 0, 0);
+
+	cam.vfov = 40;
+	cam.lookfrom = point3(278, 278, -800);
+	cam.lookat = point3(278, 278, 0);
+	cam.vup = vec3(0, 1, 0);
+
+	cam.defocus_angle = 0;
+}
+
+// The Cornell box with its two boxes turned to smoke: dark smoke of even
+// density in the tall one, and white smoke shaped by Perlin noise where the
+// short one would stand.
+inline void cornell_smoke(scene& s) {
+	auto& world = s.world;
+	auto& cam = s.cam;
+
+	auto red = make_shared<lambertian>(color(0.65, 0.05, 0.05));
+	auto white = make_shared<lambertian>(color(0.73, 0.73, 0.73));
+	auto green = make_shared<lambertian>(color(0.12, 0.45, 0.15));
+	auto light = make_shared<diffuse_light>(color(7, 7, 7));
+
+	world.add(make_shared<quad>(point3(555, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), green));
+	world.add(make_shared<quad>(point3(0, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), red));
+	world.add(make_shared<quad>(point3(113, 554, 127), vec3(330, 0, 0), vec3(0, 0, 305), light));
+	world.add(make_shared<quad>(point3(0, 555, 0), vec3(555, 0, 0), vec3(0, 0, 555), white));
+	world.add(make_shared<quad>(point3(0, 0, 0), vec3(555, 0, 0), vec3(0, 0, 555), white));
+	world.add(make_shared<quad>(point3(0, 0, 555), vec3(555, 0, 0), vec3(0, 555, 0), white));
+
+	auto box1 = transform::translation(vec3(265, 0, 295))
+			  * transform::rotation_y(15)
+			  * transform::scaling(vec3(165, 330, 165));
+	world.add(make_shared<constant_medium>(make_shared<oriented_box>(point3(0, 0, 0), point3(1, 1, 1), box1, white), 0.01, color(0, 0, 0)));
+
+	auto smoke = noise_density(aabb(point3(130, 0, 65), point3(295, 165, 230)), 64, 0.1, 0.03);
+	world.add(make_shared<grid_medium<density_grid>>(smoke, color(1, 1, 1)));
+
+	world = hittable_list(make_shared<bvh_node>(world));
+
+	cam.aspect_ratio = 1.0;
+	cam.image_width = 600;
+	cam.samples_per_pixel = 200;
+	cam.max_depth = 50;
+	cam.background = color(0, 0, 0);
+
+	cam.vfov = 40;
+	cam.lookfrom = point3(278, 278, -800);
+	cam.lookat = point3(278, 278, 0);
+	cam.vup = vec3(0, 1, 0);
+
+	cam.defocus_angle = 0;
+}
+
+// Looks up a built-in scene by name. Returns false if there is no such scene.
+inline bool builtin_scene(const std::string& name, scene& s) {
+	struct entry { const char* name; void (*build)(scene&); };
+	static const entry scenes[] = {
+		{ "bouncing_spheres", bouncing_spheres },
+		{ "quads",            quads },
+		{ "earth",            earth },
+		{ "perlin_spheres",   perlin_spheres },
+		{ "simple_light",     simple_light },
+		{ "cornell_box",      cornell_box },
+		{ "cornell_smoke",    cornell_smoke },
+	};
+
+	for (const auto& e : scenes) {
+		if (name == e.name) {
+			e.build(s);
+			return true;
+		}
+	}
+	return false;
+}
+
+#endif // !SCENES_H
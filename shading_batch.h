@@ -0,0 +1,185 @@
+#ifndef SHADING_BATCH_H
+#define SHADING_BATCH_H
+
+#include "hittable.h"
+
+#include <algorithm>
+#include <vector>
+
+// Shading Batches
+//
+// Many hits on the same material, stored as structure-of-arrays so that
+// material::scatter_batch can shade them in one call with plain loops over
+// arrays of doubles, which the compiler turns into SIMD code. An integrator
+// that sorts its hits by material gathers each group into a hit_batch, draws
+// its random numbers, and gets every scattered ray back in a
+// scatter_batch_result.
+//
+// The loops never branch per hit: where the scalar code would pick between
+// two answers (reflect or refract, a degenerate direction), both are computed
+// and one is selected, so every lane does the same work.
+
+class hit_batch {
+public:
+	// Incoming ray direction, not necessarily of unit length
+	std::vector<double> dir_x, dir_y, dir_z;
+	// Outward-facing normal against the ray, as in hit_record
+	std::vector<double> normal_x, normal_y, normal_z;
+	std::vector<double> p_x, p_y, p_z;
+	std::vector<double> u, v, footprint, time;
+	std::vector<unsigned char> front_face;
+
+	// Two uniform numbers in [0, 1) per hit, from draw_random(); enough for
+	// every material's scatter_batch
+	std::vector<double> random0, random1;
+
+	size_t size() const { return dir_x.size(); }
+
+	void resize(size_t n) {
+		for (auto* a : { &dir_x, &dir_y, &dir_z, &normal_x, &normal_y, &normal_z,
+		                 &p_x, &p_y, &p_z, &u, &v, &footprint, &time, &random0, &random1 })
+			a->resize(n);
+		front_face.resize(n);
+	}
+
+	// Stores hit `k` of the batch.
+	void set(size_t k, const ray& r, const hit_record& rec) {
+		dir_x[k] = r.direction().x(); dir_y[k] = r.direction().y(); dir_z[k] = r.direction().z();
+		normal_x[k] = rec.normal.x(); normal_y[k] = rec.normal.y(); normal_z[k] = rec.normal.z();
+		p_x[k] = rec.p.x(); p_y[k] = rec.p.y(); p_z[k] = rec.p.z();
+		u[k] = rec.u;
+		v[k] = rec.v;
+		footprint[k] = rec.footprint;
+		time[k] = r.time();
+		front_face[k] = rec.front_face;
+	}
+
+	// The ray and hit record of hit `k`, for code that shades one at a time.
+	void get(size_t k, ray& r, hit_record& rec) const {
+		r = ray(point(k), vec3(dir_x[k], dir_y[k], dir_z[k]), time[k]);
+		rec.p = point(k);
+		rec.normal = vec3(normal_x[k], normal_y[k], normal_z[k]);
+		rec.u = u[k];
+		rec.v = v[k];
+		rec.footprint = footprint[k];
+		rec.front_face = front_face[k] != 0;
+	}
+
+	point3 point(size_t k) const { return point3(p_x[k], p_y[k], p_z[k]); }
+
+	// The arrays as plain pointers, for the shading loops. Read through the
+	// vectors, every array's address is reloaded after each store to the
+	// output, and the loops do not vectorize.
+	struct arrays {
+		const double* __restrict dir_x;
+		const double* __restrict dir_y;
+		const double* __restrict dir_z;
+		const double* __restrict normal_x;
+		const double* __restrict normal_y;
+		const double* __restrict normal_z;
+		const unsigned char* __restrict front_face;
+		const double* __restrict random0;
+		const double* __restrict random1;
+	};
+
+	arrays data() const {
+		return arrays{ dir_x.data(), dir_y.data(), dir_z.data(), normal_x.data(), normal_y.data(), normal_z.data(),
+		               front_face.data(), random0.data(), random1.data() };
+	}
+
+	// Fills random0 and random1. The generator is sequential, so this runs
+	// before the shading loops rather than inside them.
+	void draw_random() {
+		for (size_t k = 0; k < size(); k++) {
+			random0[k] = random_double();
+			random1[k] = random_double();
+		}
+	}
+};
+
+class scatter_batch_result {
+public:
+	std::vector<double> dir_x, dir_y, dir_z;
+	std::vector<double> attenuation_r, attenuation_g, attenuation_b;
+	std::vector<unsigned char> scattered; // 0 where the path ends
+
+	size_t size() const { return dir_x.size(); }
+
+	void resize(size_t n) {
+		for (auto* a : { &dir_x, &dir_y, &dir_z, &attenuation_r, &attenuation_g, &attenuation_b })
+			a->resize(n);
+		scattered.resize(n);
+	}
+
+	struct arrays {
+		double* __restrict dir_x;
+		double* __restrict dir_y;
+		double* __restrict dir_z;
+		double* __restrict attenuation_r;
+		double* __restrict attenuation_g;
+		double* __restrict attenuation_b;
+		unsigned char* __restrict scattered;
+	};
+
+	arrays data() {
+		return arrays{ dir_x.data(), dir_y.data(), dir_z.data(),
+		               attenuation_r.data(), attenuation_g.data(), attenuation_b.data(), scattered.data() };
+	}
+
+	// The ray leaving hit `k` of `hits`, if scattered[k] is set.
+	ray scattered_ray(const hit_batch& hits, size_t k) const {
+		return ray(hits.point(k), vec3(dir_x[k], dir_y[k], dir_z[k]), hits.time[k]);
+	}
+
+	color attenuation(size_t k) const {
+		return color(attenuation_r[k], attenuation_g[k], attenuation_b[k]);
+	}
+};
+
+namespace shading_batch_detail {
+	// The sine and cosine of 2 pi t, for t in [0, 1), to within 1e-9. These
+	// are short polynomials, where std::sin and std::cos are library calls
+	// that keep a loop from vectorizing.
+	inline void sincos_turn(double t, double& s, double& c) {
+		// Half the angle, moved into [-pi/2, pi/2) where the series converge fast
+		double h = pi * (t - 0.5);
+		double h2 = h * h;
+		double sh = h * (1 + h2 * (-1.0 / 6 + h2 * (1.0 / 120 + h2 * (-1.0 / 5040 + h2 * (1.0 / 362880
+			+ h2 * (-1.0 / 39916800 + h2 * (1.0 / 6227020800.0)))))));
+		double ch = 1 + h2 * (-1.0 / 2 + h2 * (1.0 / 24 + h2 * (-1.0 / 720 + h2 * (1.0 / 40320
+			+ h2 * (-1.0 / 3628800 + h2 * (1.0 / 479001600 + h2 * (-1.0 / 87178291200.0)))))));
+
+		// Double it back to 2 pi t - pi, whose sine and cosine are the negated ones
+		s = -2 * sh * ch;
+		c = sh * sh - ch * ch;
+	}
+
+	// A uniform point on the unit sphere from two uniform numbers, without
+	// the rejection loop of random_unit_vector.
+	inline void unit_sphere(double r0, double r1, double& x, double& y, double& z) {
+		z = 1 - 2 * r0;
+		double radius = std::sqrt(std::max(0.0, 1 - z * z));
+		double s, c;
+		sincos_turn(r1, s, c);
+		x = radius * c;
+		y = radius * s;
+	}
+
+	// `a` where `pick` is set and `b` elsewhere, as arithmetic. A plain ?:
+	// can come out as a branch, and a loop with a branch does not vectorize.
+	inline double blend(bool pick, double a, double b) {
+		double weight = pick ? 1.0 : 0.0;
+		return b + weight * (a - b);
+	}
+
+	// Schlick's approximation, with the fifth power as multiplies.
+	inline double reflectance(double cosine, double refraction_index) {
+		double r0 = (1 - refraction_index) / (1 + refraction_index);
+		r0 = r0 * r0;
+		double m = 1 - cosine;
+		double m2 = m * m;
+		return r0 + (1 - r0) * (m2 * m2 * m);
+	}
+}
+
+#endif // !SHADING_BATCH_H
@@ -0,0 +1,464 @@
+#ifndef SPARSE_GRID_H
+#define SPARSE_GRID_H
+
+#include "aabb.h"
+#include "perlin.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Sparse Voxel Grids
+//
+// Density stored only where there is any, for smoke and clouds far too large
+// to hold as a dense grid. Voxels come in leaves of 8x8x8, and leaves in
+// tiles of 8x8x8 leaves, so a tile spans 64 voxels along each side. The grid
+// keeps one index per tile of its box, and a tile the index of each of its
+// leaves; empty tiles and leaves are absent. Memory grows with the occupied
+// leaves (2 KB each) rather than with the box.
+//
+// Every tile, and every leaf slot in a tile, also stores its majorant: the
+// highest density anywhere in it. march() steps a ray through the tiles
+// with a DDA, skips the empty ones whole, and steps through the leaves of
+// the others with a second DDA, so delta tracking (grid_medium in medium.h)
+// only ever sees occupied leaves. Tracing cost follows the occupied voxels,
+// not the size of the box.
+//
+// As in density_grid, a voxel's value sits at its integer coordinates and
+// lookups interpolate trilinearly between the eight around them.
+//
+// Grids are stored in .rtwvol files: a sparse_grid_header, then for each
+// leaf its leaf coordinates (voxel coordinates / 8) as three int32s and its
+// 512 values as floats, x fastest. The data is native-endian.
+
+struct sparse_grid_header {
+	char     magic[8];
+	uint32_t version;
+	uint32_t endian_tag;
+	int32_t  size[3];    // Voxels along each axis
+	uint32_t leaf_count;
+	double   origin[3];  // World position of voxel (0, 0, 0)
+	double   voxel_size;
+};
+
+namespace sparse_grid_detail {
+	const char     magic[8]   = { 'R', 'T', 'W', 'V', 'O', 'L', '\0', '\0' };
+	const uint32_t version    = 1;
+	const uint32_t endian_tag = 0x01020304;
+
+	// Steps a ray, given in voxel units, through the cells of a grid whose
+	// cells are `cell_size` voxels wide, from cell `lo` up to but not
+	// including `hi` along each axis.
+	struct dda {
+		int cell[3];
+		int step[3];
+		int lo[3];
+		int hi[3];
+		double next[3];  // Where the ray crosses into the next cell along each axis
+		double delta[3]; // How far apart those crossings are
+		double t;        // Where the ray entered the current cell
+		double t_exit;   // Where it leaves it
+		double t_end;
+		int axis;        // The axis it leaves the cell along
+
+		dda(const vec3& o, const vec3& d, double t_start, double t_end, double cell_size, const int* lo_cell, const int* hi_cell)
+			: t(t_start), t_end(t_end)
+		{
+			for (int a = 0; a < 3; a++) {
+				lo[a] = lo_cell[a];
+				hi[a] = hi_cell[a];
+				cell[a] = std::min(std::max(floor_int((o[a] + t_start * d[a]) / cell_size), lo[a]), hi[a] - 1);
+				if (d[a] > 0) {
+					step[a] = 1;
+					next[a] = ((cell[a] + 1) * cell_size - o[a]) / d[a];
+					delta[a] = cell_size / d[a];
+				}
+				else if (d[a] < 0) {
+					step[a] = -1;
+					next[a] = (cell[a] * cell_size - o[a]) / d[a];
+					delta[a] = -cell_size / d[a];
+				}
+				else {
+					step[a] = 0;
+					next[a] = infinity;
+					delta[a] = infinity;
+				}
+			}
+			find_exit();
+		}
+
+		// Moves to the next cell. Returns false once the ray is past t_end or
+		// out of the cells.
+		bool advance() {
+			if (t_exit >= t_end) return false;
+			t = t_exit;
+			cell[axis] += step[axis];
+			if (cell[axis] < lo[axis] || cell[axis] >= hi[axis]) return false;
+			next[axis] += delta[axis];
+			find_exit();
+			return true;
+		}
+
+	private:
+		void find_exit() {
+			axis = next[0] < next[1] ? (next[0] < next[2] ? 0 : 2) : (next[1] < next[2] ? 1 : 2);
+			t_exit = std::min(next[axis], t_end);
+		}
+	};
+}
+
+class sparse_grid {
+public:
+	static const int leaf_size = 8;                     // Voxels along a leaf
+	static const int tile_leaves = 8;                   // Leaves along a tile
+	static const int tile_size = leaf_size * tile_leaves;
+	static const int leaf_voxels = leaf_size * leaf_size * leaf_size;
+
+	// An empty grid of `nx` by `ny` by `nz` voxels, `voxel_size` apart, with
+	// voxel (0, 0, 0) at `origin`.
+	sparse_grid(const point3& origin, double voxel_size, int nx, int ny, int nz)
+		: origin(origin), voxel_size(voxel_size), inv_voxel_size(1 / voxel_size)
+	{
+		size[0] = std::max(nx, 1);
+		size[1] = std::max(ny, 1);
+		size[2] = std::max(nz, 1);
+		for (int a = 0; a < 3; a++) {
+			leaves[a] = (size[a] + leaf_size - 1) / leaf_size;
+			tiles_count[a] = (leaves[a] + tile_leaves - 1) / tile_leaves;
+		}
+		tile_index.assign(size_t(tiles_count[0]) * tiles_count[1] * tiles_count[2], -1);
+		box = aabb(origin, origin + voxel_size * vec3(size[0] - 1, size[1] - 1, size[2] - 1));
+	}
+
+	const aabb& bounds() const { return box; }
+	int voxels(int axis) const { return size[axis]; }
+
+	size_t leaf_count() const { return values.size() / leaf_voxels; }
+	size_t tile_count() const { return tiles.size(); }
+
+	// Bytes held by the grid
+	size_t memory_size() const {
+		return values.size() * sizeof(float) + tiles.size() * sizeof(tile) + tile_index.size() * sizeof(int32_t);
+	}
+
+	// Sets the 512 voxels of the leaf at leaf coordinates (lx, ly, lz), x
+	// fastest. Call finish() once every leaf is in.
+	void set_leaf(int lx, int ly, int lz, const float* leaf_values) {
+		auto& t = tiles[make_tile(lx / tile_leaves, ly / tile_leaves, lz / tile_leaves)];
+		auto& slot = t.leaves[slot_of(lx, ly, lz)];
+		if (slot < 0) {
+			slot = int32_t(leaf_count());
+			values.resize(values.size() + leaf_voxels);
+		}
+		std::memcpy(&values[size_t(slot) * leaf_voxels], leaf_values, sizeof(float) * leaf_voxels);
+	}
+
+	// Computes the majorants from the leaves.
+	void finish() {
+		for (auto& t : tiles) {
+			std::fill(std::begin(t.majorants), std::end(t.majorants), 0.0f);
+			t.majorant = 0;
+		}
+
+		// A lookup in a leaf's slot also reads the first voxels of the leaves
+		// above it along each axis, so a leaf's highest value bounds its own
+		// slot and the slots below it. Those may have no leaf or even no tile.
+		size_t tile_total = tiles.size();
+		for (size_t ti = 0; ti < tile_total; ti++) {
+			for (int s = 0; s < tile_leaves * tile_leaves * tile_leaves; s++) {
+				int32_t leaf = tiles[ti].leaves[s];
+				if (leaf < 0) continue;
+				const float* v = &values[size_t(leaf) * leaf_voxels];
+				float highest = *std::max_element(v, v + leaf_voxels);
+				if (highest <= 0) continue;
+
+				int lx = tiles[ti].x * tile_leaves + s % tile_leaves;
+				int ly = tiles[ti].y * tile_leaves + (s / tile_leaves) % tile_leaves;
+				int lz = tiles[ti].z * tile_leaves + s / (tile_leaves * tile_leaves);
+				for (int dz = -1; dz <= 0; dz++)
+					for (int dy = -1; dy <= 0; dy++)
+						for (int dx = -1; dx <= 0; dx++)
+							raise_majorant(lx + dx, ly + dy, lz + dz, highest);
+			}
+		}
+	}
+
+	// Trilinear lookup; zero outside the box and in empty leaves.
+	double density(const point3& p) const {
+		double x = (p.x() - origin.x()) * inv_voxel_size;
+		double y = (p.y() - origin.y()) * inv_voxel_size;
+		double z = (p.z() - origin.z()) * inv_voxel_size;
+		if (!(x >= 0 && y >= 0 && z >= 0 && x <= size[0] - 1 && y <= size[1] - 1 && z <= size[2] - 1)) return 0;
+
+		int i = int(x), j = int(y), k = int(z);
+		float fx = float(x - i), fy = float(y - j), fz = float(z - k);
+
+		float c[8];
+		const int last = leaf_size - 1;
+		if ((i & last) != last && (j & last) != last && (k & last) != last) {
+			// All eight in one leaf
+			const float* leaf = find_leaf(unsigned(i) / leaf_size, unsigned(j) / leaf_size, unsigned(k) / leaf_size);
+			if (!leaf) return 0;
+			const float* v = leaf + ((k & last) * leaf_size + (j & last)) * leaf_size + (i & last);
+			const int row = leaf_size, slice = leaf_size * leaf_size;
+			c[0] = v[0];           c[1] = v[1];
+			c[2] = v[row];         c[3] = v[row + 1];
+			c[4] = v[slice];       c[5] = v[slice + 1];
+			c[6] = v[slice + row]; c[7] = v[slice + row + 1];
+		}
+		else {
+			// The eight straddle two to eight leaves, each looked up once: corner
+			// n shares its leaf with corner n & cross, which comes no later.
+			int cross = ((i & last) == last) | ((j & last) == last) << 1 | ((k & last) == last) << 2;
+			const float* leaf[8];
+			for (int n = 0; n < 8; n++) {
+				int m = n & cross;
+				int ci = i + (n & 1), cj = j + ((n >> 1) & 1), ck = k + (n >> 2);
+				if (m == n) leaf[n] = ci < size[0] && cj < size[1] && ck < size[2] ? find_leaf(unsigned(ci) / leaf_size, unsigned(cj) / leaf_size, unsigned(ck) / leaf_size) : nullptr;
+				else leaf[n] = leaf[m];
+				c[n] = leaf[n] ? leaf[n][((ck & last) * leaf_size + (cj & last)) * leaf_size + (ci & last)] : 0.0f;
+			}
+		}
+
+		float c00 = c[0] + fx * (c[1] - c[0]);
+		float c10 = c[2] + fx * (c[3] - c[2]);
+		float c01 = c[4] + fx * (c[5] - c[4]);
+		float c11 = c[6] + fx * (c[7] - c[6]);
+		float c0 = c00 + fy * (c10 - c00);
+		float c1 = c01 + fy * (c11 - c01);
+		return c0 + fz * (c1 - c0);
+	}
+
+	// The value of voxel (i, j, k), zero where there is no leaf.
+	float voxel(int i, int j, int k) const {
+		if (i < 0 || j < 0 || k < 0 || i >= size[0] || j >= size[1] || k >= size[2]) return 0;
+		const float* leaf = find_leaf(unsigned(i) / leaf_size, unsigned(j) / leaf_size, unsigned(k) / leaf_size);
+		if (!leaf) return 0;
+		const int last = leaf_size - 1;
+		return leaf[((k & last) * leaf_size + (j & last)) * leaf_size + (i & last)];
+	}
+
+	// Walks the occupied leaves `r` crosses within `ray_t`, in order, calling
+	// `visit(t_enter, t_exit, majorant)` for each until it returns true.
+	// Returns whether it did.
+	template <typename Visit>
+	bool march(const ray& r, interval ray_t, const Visit& visit) const {
+		using sparse_grid_detail::dda;
+		if (!box.clip(r, ray_t)) return false;
+
+		vec3 o = (r.origin() - origin) * inv_voxel_size;
+		vec3 d = r.direction() * inv_voxel_size;
+
+		const int zero[3] = { 0, 0, 0 };
+		dda tile_walk(o, d, ray_t.min, ray_t.max, tile_size, zero, tiles_count);
+		do {
+			int32_t ti = tile_index[(size_t(tile_walk.cell[2]) * tiles_count[1] + tile_walk.cell[1]) * tiles_count[0] + tile_walk.cell[0]];
+			if (ti < 0 || tiles[ti].majorant <= 0) continue;
+
+			const tile& t = tiles[ti];
+			int lo[3], hi[3];
+			for (int a = 0; a < 3; a++) {
+				lo[a] = tile_walk.cell[a] * tile_leaves;
+				hi[a] = std::min(lo[a] + tile_leaves, leaves[a]);
+			}
+
+			dda leaf_walk(o, d, tile_walk.t, tile_walk.t_exit, leaf_size, lo, hi);
+			do {
+				float majorant = t.majorants[slot_of(leaf_walk.cell[0], leaf_walk.cell[1], leaf_walk.cell[2])];
+				if (majorant > 0 && visit(leaf_walk.t, leaf_walk.t_exit, double(majorant))) return true;
+			} while (leaf_walk.advance());
+		} while (tile_walk.advance());
+
+		return false;
+	}
+
+	// Writes the grid as a .rtwvol file.
+	bool save(const std::string& filename) const {
+		using namespace sparse_grid_detail;
+
+		sparse_grid_header header = {};
+		std::memcpy(header.magic, magic, sizeof(magic));
+		header.version = version;
+		header.endian_tag = endian_tag;
+		for (int a = 0; a < 3; a++) {
+			header.size[a] = size[a];
+			header.origin[a] = origin[a];
+		}
+		header.leaf_count = uint32_t(leaf_count());
+		header.voxel_size = voxel_size;
+
+		std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+		if (!out) return false;
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+		for (const auto& t : tiles) {
+			for (int s = 0; s < tile_leaves * tile_leaves * tile_leaves; s++) {
+				if (t.leaves[s] < 0) continue;
+				int32_t coords[3] = {
+					t.x * tile_leaves + s % tile_leaves,
+					t.y * tile_leaves + (s / tile_leaves) % tile_leaves,
+					t.z * tile_leaves + s / (tile_leaves * tile_leaves)
+				};
+				out.write(reinterpret_cast<const char*>(coords), sizeof(coords));
+				out.write(reinterpret_cast<const char*>(&values[size_t(t.leaves[s]) * leaf_voxels]), sizeof(float) * leaf_voxels);
+			}
+		}
+		return bool(out);
+	}
+
+	// Reads a .rtwvol file. Returns null, after reporting why, if it cannot.
+	static shared_ptr<sparse_grid> load(const std::string& filename) {
+		using namespace sparse_grid_detail;
+
+		std::ifstream in(filename, std::ios::binary);
+		if (!in) {
+			std::cerr << "ERROR: Could not open volume '" << filename << "'.\n";
+			return nullptr;
+		}
+
+		sparse_grid_header header;
+		if (!in.read(reinterpret_cast<char*>(&header), sizeof(header))
+			|| std::memcmp(header.magic, magic, sizeof(magic)) != 0
+			|| header.version != version
+			|| header.endian_tag != endian_tag
+			|| header.size[0] <= 0 || header.size[1] <= 0 || header.size[2] <= 0
+			|| !(header.voxel_size > 0)) {
+			std::cerr << "ERROR: '" << filename << "' is not a volume this version can read.\n";
+			return nullptr;
+		}
+
+		auto grid = make_shared<sparse_grid>(point3(header.origin[0], header.origin[1], header.origin[2]),
+			header.voxel_size, header.size[0], header.size[1], header.size[2]);
+
+		int32_t coords[3];
+		std::vector<float> leaf(leaf_voxels);
+		for (uint32_t n = 0; n < header.leaf_count; n++) {
+			if (!in.read(reinterpret_cast<char*>(coords), sizeof(coords))
+				|| !in.read(reinterpret_cast<char*>(leaf.data()), sizeof(float) * leaf_voxels)) {
+				std::cerr << "ERROR: Volume '" << filename << "' is truncated.\n";
+				return nullptr;
+			}
+			for (int a = 0; a < 3; a++) {
+				if (coords[a] < 0 || coords[a] >= grid->leaves[a]) {
+					std::cerr << "ERROR: Volume '" << filename << "' has a leaf outside its grid.\n";
+					return nullptr;
+				}
+			}
+			grid->set_leaf(coords[0], coords[1], coords[2], leaf.data());
+		}
+
+		grid->finish();
+		return grid;
+	}
+
+private:
+	struct tile {
+		int x, y, z; // Tile coordinates
+		float majorant = 0;
+		int32_t leaves[tile_leaves * tile_leaves * tile_leaves];
+		float majorants[tile_leaves * tile_leaves * tile_leaves];
+	};
+
+	point3 origin;
+	double voxel_size;
+	double inv_voxel_size;
+	aabb box;
+	int size[3];        // Voxels along each axis
+	int leaves[3];      // Leaves along each axis
+	int tiles_count[3]; // Tiles along each axis
+
+	std::vector<int32_t> tile_index; // Over every tile of the box, x fastest; -1 where absent
+	std::vector<tile> tiles;
+	std::vector<float> values;       // 512 per leaf
+
+	static int slot_of(int lx, int ly, int lz) {
+		const int m = tile_leaves - 1;
+		return ((lz & m) * tile_leaves + (ly & m)) * tile_leaves + (lx & m);
+	}
+
+	int32_t& index_of_tile(int tx, int ty, int tz) {
+		return tile_index[(size_t(tz) * tiles_count[1] + ty) * tiles_count[0] + tx];
+	}
+
+	int32_t make_tile(int tx, int ty, int tz) {
+		auto& index = index_of_tile(tx, ty, tz);
+		if (index < 0) {
+			index = int32_t(tiles.size());
+			tile t;
+			t.x = tx;
+			t.y = ty;
+			t.z = tz;
+			std::fill(std::begin(t.leaves), std::end(t.leaves), -1);
+			std::fill(std::begin(t.majorants), std::end(t.majorants), 0.0f);
+			tiles.push_back(t);
+		}
+		return index;
+	}
+
+	void raise_majorant(int lx, int ly, int lz, float value) {
+		if (lx < 0 || ly < 0 || lz < 0) return;
+		auto& t = tiles[make_tile(lx / tile_leaves, ly / tile_leaves, lz / tile_leaves)];
+		auto& m = t.majorants[slot_of(lx, ly, lz)];
+		m = std::max(m, value);
+		t.majorant = std::max(t.majorant, value);
+	}
+
+	// Leaf coordinates are never negative here, so the divisions are shifts.
+	const float* find_leaf(unsigned lx, unsigned ly, unsigned lz) const {
+		int32_t ti = tile_index[(size_t(lz / tile_leaves) * tiles_count[1] + ly / tile_leaves) * tiles_count[0] + lx / tile_leaves];
+		if (ti < 0) return nullptr;
+		int32_t leaf = tiles[ti].leaves[slot_of(lx, ly, lz)];
+		return leaf < 0 ? nullptr : &values[size_t(leaf) * leaf_voxels];
+	}
+};
+
+// Perlin turbulence over `box` where it rises above `threshold`, as
+// density * (turbulence - threshold), in a sparse grid with `resolution`
+// voxels along the box's longest side. Leaves that come out empty are never
+// stored, so the threshold decides how much memory the volume takes.
+inline shared_ptr<sparse_grid> sparse_noise_density(const aabb& box, int resolution, double density, double scale, double threshold) {
+	const int n = sparse_grid::leaf_size;
+	double longest = std::max(box.x.size(), std::max(box.y.size(), box.z.size()));
+	double spacing = longest / std::max(resolution - 1, 1);
+	point3 origin(box.x.min, box.y.min, box.z.min);
+
+	int size[3], leaves[3];
+	for (int a = 0; a < 3; a++) {
+		size[a] = std::max(2, int(std::ceil(box.axis_interval(a).size() / spacing)) + 1);
+		leaves[a] = (size[a] + n - 1) / n;
+	}
+	auto grid = make_shared<sparse_grid>(origin, spacing, size[0], size[1], size[2]);
+
+	perlin noise;
+	std::mutex mutex;
+	thread_pool::shared().for_each(leaves[2], [&](int lz) {
+		std::vector<float> leaf(sparse_grid::leaf_voxels);
+		for (int ly = 0; ly < leaves[1]; ly++) {
+			for (int lx = 0; lx < leaves[0]; lx++) {
+				bool occupied = false;
+				for (int v = 0; v < sparse_grid::leaf_voxels; v++) {
+					int i = lx * n + v % n, j = ly * n + (v / n) % n, k = lz * n + v / (n * n);
+					double d = 0;
+					if (i < size[0] && j < size[1] && k < size[2])
+						d = density * (noise.turb(scale * (origin + spacing * vec3(i, j, k)), 7) - threshold);
+					leaf[v] = float(std::max(d, 0.0));
+					occupied = occupied || d > 0;
+				}
+				if (occupied) {
+					std::lock_guard<std::mutex> lock(mutex);
+					grid->set_leaf(lx, ly, lz, leaf.data());
+				}
+			}
+		}
+	});
+
+	grid->finish();
+	return grid;
+}
+
+#endif // !SPARSE_GRID_H
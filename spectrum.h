@@ -0,0 +1,222 @@
+#ifndef SPECTRUM_H
+#define SPECTRUM_H
+
+#include "rtweekend.h"
+
+#include <algorithm>
+
+// Spectral Rendering
+//
+// In spectral mode a path carries light at four wavelengths at once rather
+// than as RGB. The first, the hero wavelength, is drawn for each camera
+// sample and the other three are drawn from the same number shifted by
+// quarters, wrapping around, so each of the four follows the same
+// distribution on its own. One path then estimates four wavelengths for the
+// price of one (Wilkie et al., "Hero Wavelength Spectral Sampling"). The
+// distribution favors the wavelengths the eye is most sensitive to, which
+// keeps the noise in hue down.
+//
+// All four travel together until something depends on the wavelength, such
+// as refraction through a dispersive dielectric. There the path follows the
+// hero's direction and drops the other three, with the hero weighted by four
+// to make up for them.
+//
+// Scene colors stay RGB. They are turned into spectra with Smits' method
+// ("An RGB to Spectrum Conversion for Reflectances"), and at the film the
+// four samples are weighed by the CIE matching functions and converted to
+// linear sRGB. A spectrum of 1 everywhere averages out to exactly (1, 1, 1),
+// so a scene without dispersion renders close to the colors of RGB mode,
+// with some extra noise in hue.
+
+const double lambda_min = 360; // nm
+const double lambda_max = 830;
+
+// Radiance or throughput at the four wavelengths of a path. Every operation
+// is a loop over the four, which the compiler turns into vector code.
+class spectrum {
+public:
+	static const int count = 4;
+	double e[count];
+
+	spectrum() : e{ 0, 0, 0, 0 } {}
+	explicit spectrum(double v) : e{ v, v, v, v } {}
+
+	double operator[](int i) const { return e[i]; }
+	double& operator[](int i) { return e[i]; }
+
+	spectrum& operator+=(const spectrum& s) {
+		for (int i = 0; i < count; i++) e[i] += s.e[i];
+		return *this;
+	}
+
+	spectrum& operator*=(double t) {
+		for (int i = 0; i < count; i++) e[i] *= t;
+		return *this;
+	}
+
+	double max_value() const {
+		return std::max(std::max(e[0], e[1]), std::max(e[2], e[3]));
+	}
+};
+
+inline spectrum operator+(spectrum a, const spectrum& b) {
+	return a += b;
+}
+
+inline spectrum operator*(const spectrum& a, const spectrum& b) {
+	spectrum result;
+	for (int i = 0; i < spectrum::count; i++) result.e[i] = a.e[i] * b.e[i];
+	return result;
+}
+
+inline spectrum operator*(double t, spectrum s) {
+	return s *= t;
+}
+
+namespace spectrum_detail {
+	// Smits' basis spectra, in ten bins of 34 nm from 380 to 720 nm
+	const int bins = 10;
+	const double bin_start = 380, bin_width = 34;
+
+	const double white[bins]   = { 1.0000, 1.0000, 0.9999, 0.9993, 0.9992, 0.9998, 1.0000, 1.0000, 1.0000, 1.0000 };
+	const double cyan[bins]    = { 0.9710, 0.9426, 1.0007, 1.0007, 1.0007, 1.0007, 0.1564, 0.0000, 0.0000, 0.0000 };
+	const double magenta[bins] = { 1.0000, 1.0000, 0.9685, 0.2229, 0.0000, 0.0458, 0.8369, 1.0000, 1.0000, 0.9959 };
+	const double yellow[bins]  = { 0.0001, 0.0000, 0.1088, 0.6651, 1.0000, 1.0000, 0.9996, 0.9586, 0.9685, 0.9840 };
+	const double red[bins]     = { 0.1012, 0.0515, 0.0000, 0.0000, 0.0000, 0.0000, 0.8325, 1.0149, 1.0149, 1.0149 };
+	const double green[bins]   = { 0.0000, 0.0000, 0.0273, 0.7937, 1.0000, 0.9418, 0.1719, 0.0000, 0.0000, 0.0025 };
+	const double blue[bins]    = { 1.0000, 1.0000, 0.8916, 0.3323, 0.0000, 0.0000, 0.0003, 0.0369, 0.0483, 0.0496 };
+
+	// A piecewise Gaussian with different widths on either side of its peak
+	inline double lobe(double lambda, double mean, double below, double above) {
+		double t = (lambda - mean) / (lambda < mean ? below : above);
+		return std::exp(-0.5 * t * t);
+	}
+
+	// The CIE 1931 color matching functions, as fitted by Wyman, Sloan and
+	// Shirley, "Simple Analytic Approximations to the CIE XYZ Color Matching
+	// Functions"
+	inline double cie_x(double lambda) {
+		return 1.056 * lobe(lambda, 599.8, 37.9, 31.0) + 0.362 * lobe(lambda, 442.0, 16.0, 26.7)
+			- 0.065 * lobe(lambda, 501.1, 20.4, 26.2);
+	}
+
+	inline double cie_y(double lambda) {
+		return 0.821 * lobe(lambda, 568.8, 46.9, 40.5) + 0.286 * lobe(lambda, 530.9, 16.3, 31.1);
+	}
+
+	inline double cie_z(double lambda) {
+		return 1.217 * lobe(lambda, 437.0, 11.8, 36.0) + 0.681 * lobe(lambda, 459.0, 26.0, 13.8);
+	}
+
+	// Linear sRGB of the matching functions at `lambda`
+	inline color rgb_matching(double lambda) {
+		double x = cie_x(lambda), y = cie_y(lambda), z = cie_z(lambda);
+		return color(
+			 3.2404542 * x - 1.5371385 * y - 0.4985314 * z,
+			-0.9692660 * x + 1.8760108 * y + 0.0415560 * z,
+			 0.0556434 * x - 0.2040259 * y + 1.0572252 * z);
+	}
+
+	// What a spectrum of 1 everywhere integrates to, per channel. Dividing by
+	// it makes that spectrum white.
+	inline const color& white_rgb() {
+		static const color white = []() {
+			const int steps = 4700;
+			double step = (lambda_max - lambda_min) / steps;
+			color sum(0, 0, 0);
+			for (int i = 0; i < steps; i++)
+				sum += rgb_matching(lambda_min + (i + 0.5) * step);
+			return step * sum;
+		}();
+		return white;
+	}
+
+	// A wavelength in [lambda_min, lambda_max] with density visible_pdf(),
+	// roughly the eye's response (from pbrt-v4)
+	inline double sample_visible(double u) {
+		return 538 - 138.888889 * std::atanh(0.85691062 - 1.82750197 * u);
+	}
+
+	inline double visible_pdf(double lambda) {
+		double c = std::cosh(0.0072 * (lambda - 538));
+		return 0.0039398042 / (c * c);
+	}
+}
+
+// The wavelengths a path carries, in nm, hero first.
+class wavelengths {
+public:
+	double lambda[spectrum::count];
+	double pdf[spectrum::count];
+
+	// Set once the path has followed the hero alone; the others then carry
+	// nothing.
+	bool hero_only = false;
+
+	// The hero from `u` in [0, 1), the others from u plus a quarter, a half
+	// and three quarters.
+	static wavelengths sample(double u) {
+		wavelengths w;
+		for (int i = 0; i < spectrum::count; i++) {
+			double t = u + double(i) / spectrum::count;
+			if (t >= 1) t -= 1;
+			w.lambda[i] = spectrum_detail::sample_visible(t);
+			w.pdf[i] = spectrum_detail::visible_pdf(w.lambda[i]);
+		}
+		return w;
+	}
+
+	// Drops every wavelength but the hero, which then stands in for all four.
+	spectrum hero_weight() {
+		spectrum weight;
+		weight[0] = hero_only ? 1 : spectrum::count;
+		hero_only = true;
+		return weight;
+	}
+
+	// The spectrum Smits' method gives `c`, at these wavelengths. Works for
+	// any non-negative color, not just reflectances.
+	spectrum from_rgb(const color& c) const {
+		using namespace spectrum_detail;
+		double r = c.x(), g = c.y(), b = c.z();
+
+		// White up to the smallest channel, then the two-channel color up to
+		// the middle one, then the largest channel alone
+		const double *second_basis, *third_basis;
+		double base, second, third;
+		if (r <= g && r <= b) {
+			base = r;
+			if (g <= b) { second_basis = cyan;  second = g - r; third_basis = blue;  third = b - g; }
+			else        { second_basis = cyan;  second = b - r; third_basis = green; third = g - b; }
+		}
+		else if (g <= r && g <= b) {
+			base = g;
+			if (r <= b) { second_basis = magenta; second = r - g; third_basis = blue; third = b - r; }
+			else        { second_basis = magenta; second = b - g; third_basis = red;  third = r - b; }
+		}
+		else {
+			base = b;
+			if (r <= g) { second_basis = yellow; second = r - b; third_basis = green; third = g - r; }
+			else        { second_basis = yellow; second = g - b; third_basis = red;   third = r - g; }
+		}
+
+		spectrum s;
+		for (int i = 0; i < spectrum::count; i++) {
+			int bin = std::min(bins - 1, std::max(0, int((lambda[i] - bin_start) / bin_width)));
+			s[i] = base * white[bin] + second * second_basis[bin] + third * third_basis[bin];
+		}
+		return s;
+	}
+
+	// Linear sRGB of radiance `s` at these wavelengths: one sample of the
+	// integral of the spectrum against the matching functions.
+	color to_rgb(const spectrum& s) const {
+		color sum(0, 0, 0);
+		for (int i = 0; i < spectrum::count; i++)
+			sum += s[i] / pdf[i] * spectrum_detail::rgb_matching(lambda[i]);
+		const color& white = spectrum_detail::white_rgb();
+		return color(sum.x() / white.x(), sum.y() / white.y(), sum.z() / white.z()) / spectrum::count;
+	}
+};
+
+#endif // !SPECTRUM_H
@@ -1,6 +1,8 @@
 #ifndef SPHERE_H
 #define SPHERE_H
 
+#include "light.h"
+#include "material.h"
 #include "rtweekend.h"
 
 class sphere : public hittable {
@@ -23,6 +25,7 @@ public:
 	}
 
 	bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+		RTW_STAT(primitive_tests[stat_sphere]);
 		point3 current_center = center.at(r.time());
 		vec3 oc = current_center - r.origin();
 		auto a = r.direction().length_squared();
@@ -47,13 +50,35 @@ public:
 		vec3 outward_normal = (rec.p - current_center) / radius;
 		rec.set_face_normal(r, outward_normal);
 		get_sphere_uv(outward_normal, rec.u, rec.v);
-		rec.mat = mat;
+		rec.mat = mat.get();
+		rec.object = this;
+
+		// u spans 2*pi*r*sin(theta) and v spans pi*r. Texels crowd together
+		// toward the poles, but stay finite there.
+		auto sin_theta = std::sqrt(std::fmax(0.0001, 1 - outward_normal.y() * outward_normal.y()));
+		rec.uv_density = 1 / (pi * radius * std::sqrt(2 * sin_theta));
 
 		return true;
 	}
 
 	aabb bounding_box() const override { return bbox; }
 
+	bool moving() const override { return center.direction().length_squared() > 0; }
+
+	void motion_bounds(int segments, aabb* boxes) const override {
+		// The center moves in a straight line, so the boxes at the ends of
+		// each segment blend into exact bounds in between.
+		auto rvec = vec3(radius, radius, radius);
+		for (int i = 0; i <= segments; i++) {
+			auto c = center.at(double(i) / segments);
+			boxes[i] = aabb(c - rvec, c + rvec);
+		}
+	}
+
+	void gather_lights(std::vector<light_source>& lights) const override {
+		if (mat->is_emissive()) lights.push_back(light_source::sphere(this, mat.get(), center, radius));
+	}
+
 private:
 	ray center;
 	double radius;
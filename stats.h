@@ -0,0 +1,184 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <ostream>
+
+// Render Statistics
+//
+// Counters are only compiled in when RTW_STATS is defined (on the compiler's
+// command line, for a counting build of the renderer or the benchmark).
+// Otherwise RTW_STAT expands to nothing and the hot paths are exactly as they
+// were.
+//
+// Each thread bumps its own thread_local counters, so there is no sharing on
+// the hot path. Render threads call rtw_stats::flush() when they finish to
+// merge their counts into the process-wide totals.
+
+enum stat_primitive {
+	stat_sphere,
+	stat_quad,
+	stat_triangle,
+	stat_disk,
+	stat_box,
+	stat_mesh_triangle,
+	stat_primitive_kinds
+};
+
+enum stat_material {
+	stat_lambertian,
+	stat_metal,
+	stat_dielectric,
+	stat_diffuse_light,
+	stat_isotropic,
+	stat_material_kinds
+};
+
+struct render_counters {
+	static const int depth_bins = 32; // The last bin collects every deeper bounce
+
+	uint64_t rays_by_depth[depth_bins]               = {};
+	uint64_t shadow_rays                             = 0; // Toward sampled lights
+	uint64_t bvh_node_visits                         = 0;
+	uint64_t aabb_tests                              = 0;
+	uint64_t primitive_tests[stat_primitive_kinds]   = {};
+	uint64_t scatter_calls[stat_material_kinds]      = {};
+	uint64_t paths_escaped                           = 0; // Missed everything
+	uint64_t paths_absorbed                          = 0; // Material did not scatter
+	uint64_t paths_killed_by_depth                   = 0; // Ran into max_depth
+
+	uint64_t primary_rays() const { return rays_by_depth[0]; }
+
+	uint64_t secondary_rays() const {
+		uint64_t sum = 0;
+		for (int i = 1; i < depth_bins; i++) sum += rays_by_depth[i];
+		return sum;
+	}
+
+	// Every ray that walked the BVH, the per-ray figures are over these
+	uint64_t traced_rays() const { return primary_rays() + secondary_rays() + shadow_rays; }
+
+	uint64_t total_primitive_tests() const {
+		uint64_t sum = 0;
+		for (auto n : primitive_tests) sum += n;
+		return sum;
+	}
+
+	void add(const render_counters& other) {
+		for (int i = 0; i < depth_bins; i++) rays_by_depth[i] += other.rays_by_depth[i];
+		for (int i = 0; i < stat_primitive_kinds; i++) primitive_tests[i] += other.primitive_tests[i];
+		for (int i = 0; i < stat_material_kinds; i++) scatter_calls[i] += other.scatter_calls[i];
+		shadow_rays           += other.shadow_rays;
+		bvh_node_visits       += other.bvh_node_visits;
+		aabb_tests            += other.aabb_tests;
+		paths_escaped         += other.paths_escaped;
+		paths_absorbed        += other.paths_absorbed;
+		paths_killed_by_depth += other.paths_killed_by_depth;
+	}
+};
+
+#ifdef RTW_STATS
+	#define RTW_STAT(counter) (++rtw_stats::local().counter)
+#else
+	#define RTW_STAT(counter) ((void)0)
+#endif
+
+namespace rtw_stats {
+
+	inline bool enabled() {
+#ifdef RTW_STATS
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	inline render_counters& local() {
+		thread_local render_counters counters;
+		return counters;
+	}
+
+	inline std::mutex& totals_mutex() {
+		static std::mutex m;
+		return m;
+	}
+
+	inline render_counters& totals() {
+		static render_counters t;
+		return t;
+	}
+
+	// Merges this thread's counters into the totals and clears them.
+	inline void flush() {
+#ifdef RTW_STATS
+		std::lock_guard<std::mutex> lock(totals_mutex());
+		totals().add(local());
+		local() = render_counters();
+#endif
+	}
+
+	// Flushes the calling thread and returns the merged totals.
+	inline render_counters collect() {
+		flush();
+		std::lock_guard<std::mutex> lock(totals_mutex());
+		return totals();
+	}
+
+	inline void reset() {
+		std::lock_guard<std::mutex> lock(totals_mutex());
+		totals() = render_counters();
+		local() = render_counters();
+	}
+
+	inline void print_report(std::ostream& out, const render_counters& c) {
+		static const char* primitive_names[stat_primitive_kinds] = { "sphere", "quad", "triangle", "disk", "box", "mesh triangle" };
+		static const char* material_names[stat_material_kinds] = { "lambertian", "metal", "dielectric", "diffuse_light", "isotropic" };
+
+		auto rays = double(c.traced_rays());
+		auto per_ray = [&](uint64_t n) { return rays > 0 ? double(n) / rays : 0.0; };
+		char line[128];
+
+		out << "Render statistics\n";
+		std::snprintf(line, sizeof(line), "  %-22s %14llu\n", "primary rays", (unsigned long long)c.primary_rays());
+		out << line;
+		std::snprintf(line, sizeof(line), "  %-22s %14llu\n", "secondary rays", (unsigned long long)c.secondary_rays());
+		out << line;
+		std::snprintf(line, sizeof(line), "  %-22s %14llu\n", "shadow rays", (unsigned long long)c.shadow_rays);
+		out << line;
+		std::snprintf(line, sizeof(line), "  %-22s %14llu  %8.2f per ray\n", "BVH node visits", (unsigned long long)c.bvh_node_visits, per_ray(c.bvh_node_visits));
+		out << line;
+		std::snprintf(line, sizeof(line), "  %-22s %14llu  %8.2f per ray\n", "AABB tests", (unsigned long long)c.aabb_tests, per_ray(c.aabb_tests));
+		out << line;
+
+		out << "  Primitive tests\n";
+		for (int i = 0; i < stat_primitive_kinds; i++) {
+			std::snprintf(line, sizeof(line), "    %-20s %14llu  %8.2f per ray\n", primitive_names[i], (unsigned long long)c.primitive_tests[i], per_ray(c.primitive_tests[i]));
+			out << line;
+		}
+
+		out << "  Scatter calls\n";
+		for (int i = 0; i < stat_material_kinds; i++) {
+			std::snprintf(line, sizeof(line), "    %-20s %14llu\n", material_names[i], (unsigned long long)c.scatter_calls[i]);
+			out << line;
+		}
+
+		out << "  Path terminations\n";
+		std::snprintf(line, sizeof(line), "    %-20s %14llu\n", "escaped", (unsigned long long)c.paths_escaped);
+		out << line;
+		std::snprintf(line, sizeof(line), "    %-20s %14llu\n", "absorbed", (unsigned long long)c.paths_absorbed);
+		out << line;
+		std::snprintf(line, sizeof(line), "    %-20s %14llu\n", "max_depth", (unsigned long long)c.paths_killed_by_depth);
+		out << line;
+
+		out << "  Rays by depth\n";
+		for (int i = 0; i < render_counters::depth_bins; i++) {
+			if (c.rays_by_depth[i] == 0) continue;
+			std::snprintf(line, sizeof(line), "    %s%-18d %14llu\n", i + 1 == render_counters::depth_bins ? ">=" : "  ", i, (unsigned long long)c.rays_by_depth[i]);
+			out << line;
+		}
+	}
+}
+
+#endif // !STATS_H
@@ -2,6 +2,8 @@
 #define TEXTURE_H
 
 #include "rtweekend.h"
+#include "mipmap.h"
+#include "texture_cache.h"
 #include "perlin.h"
 #include "rtw_stb_image.h"
 
@@ -9,7 +11,10 @@ class texture {
 public:
 	virtual ~texture() = default;
 
-	virtual color value(double u, double v, const point3& p) const = 0;
+	// The texture around (u, v) at p. `footprint` is how wide the area being
+	// shaded is in uv units, so an image can be filtered to match; 0 asks for
+	// the value at a single point.
+	virtual color value(double u, double v, const point3& p, double footprint) const = 0;
 };
 
 class solid_color : public texture {
@@ -18,11 +23,12 @@ public:
 
 	solid_color(double red, double green, double blue) : solid_color(color(red, green, blue)) {}
 
-	color value(double u, double v, const point3& p) const override {
+	color value(double u, double v, const point3& p, double footprint) const override {
 		return albedo;
 	}
 
 private:
+	friend class flat_texture;
 	color albedo;
 };
 
@@ -34,17 +40,18 @@ public:
 	checker_texture(double scale, const color& c1, const color& c2)
 		: checker_texture(scale, make_shared<solid_color>(c1), make_shared<solid_color>(c2)) {}
 
-	color value(double u, double v, const point3& p) const override {
+	color value(double u, double v, const point3& p, double footprint) const override {
 		auto xInteger = int(std::floor(inv_scale * p.x()));
 		auto yInteger = int(std::floor(inv_scale * p.y()));
 		auto zInteger = int(std::floor(inv_scale * p.z()));
 
 		bool isEven = (xInteger + yInteger + zInteger) % 2 == 0;
 
-		return isEven ? even->value(u, v, p) : odd->value(u, v, p);
+		return isEven ? even->value(u, v, p, footprint) : odd->value(u, v, p, footprint);
 	}
 
 private:
+	friend class flat_texture;
 	double inv_scale;
 	shared_ptr<texture> even;
 	shared_ptr<texture> odd;
@@ -52,36 +59,54 @@ private:
 
 class image_texture : public texture {
 public:
-	image_texture(const char* filename) : image(filename) { }
+	// Texels come from texture_cache::shared(), which shares them between
+	// textures of the same file and streams them when given a budget.
+	image_texture(const char* filename, texture_filter filter = texture_trilinear) : filter(filter) {
+		auto& cache = texture_cache::shared();
+		if (cache.streaming()) streamed = cache.streamed(filename);
+		if (!streamed) whole = cache.image(filename);
+	}
 
-	color value(double u, double v, const point3& p) const override {
-		if (image.height() <= 0) return color(0, 1, 1);
+	// True if the image did not load, and value() gives the cyan placeholder
+	bool empty() const { return !streamed && whole->empty(); }
 
+	color value(double u, double v, const point3& p, double footprint) const override {
 		u = interval(0, 1).clamp(u);
 		v = 1.0 - interval(0, 1).clamp(v);
 
-		auto i = int(u * image.width());
-		auto j = int(v * image.height());
-		auto pixel = image.pixel_data(i, j);
-
-		auto color_scale = 1.0 / 255.0;
-		return color(color_scale * pixel[0], color_scale * pixel[1], color_scale * pixel[2]);
+		if (streamed) return streamed->sample(u, v, footprint, filter);
+		if (whole->empty()) return color(0, 1, 1);
+		return whole->sample(u, v, footprint, filter);
 	}
 
 private:
-	rtw_image image;
+	shared_ptr<const mipmap> whole;
+	shared_ptr<const streamed_image> streamed;
+	texture_filter filter;
 };
 
 class noise_texture : public texture {
 public:
 	noise_texture(double scale) : scale(scale){}
 
-	color value(double u, double v, const point3& p) const override {
-		return color(0.5, 0.5, 0.5) * (1 + std::sin(scale * p.z() + 10 * noise.turb(p,7)));
+	// Precomputes the turbulence over the box [min, max], `resolution`
+	// samples along its longest side. Points inside it are then shaded from the
+	// grid at a fraction of the cost, softened to the grid spacing; points
+	// outside still evaluate the noise.
+	void bake(const point3& min, const point3& max, int resolution) {
+		baked.bake(noise, turbulence_depth, min, max, resolution);
+	}
+
+	color value(double u, double v, const point3& p, double footprint) const override {
+		double turbulence;
+		if (!baked.lookup(p, turbulence)) turbulence = noise.turb(p, turbulence_depth);
+		return color(0.5, 0.5, 0.5) * (1 + std::sin(scale * p.z() + 10 * turbulence));
 	}
 
 private:
+	static const int turbulence_depth = 7;
 	perlin noise;
+	baked_turbulence baked;
 	double scale;
 };
 
@@ -0,0 +1,442 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include "mapped_file.h"
+#include "mipmap.h"
+#include "rtw_stb_image.h"
+
+#include <atomic>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Texture Cache
+//
+// Where image textures get their texels. Each image is read once per path
+// and shared by every texture that names it.
+//
+// By default an image is kept whole in memory as a mipmap. With a budget set,
+// images are streamed instead. The first use of an image converts it to
+// "<image>.rtwtex" alongside the source, with each mip level cut into tiles of
+// 64x64 texels. After that, renders read only the tiles they touch, into a
+// fixed pool of tile slots that never grows past the budget. When the pool is
+// full, a clock sweep picks a tile that has not been used recently to make
+// room. Like the mesh cache, the file records the size and modification time
+// of its source and is rebuilt when either changes.
+//
+// Each tile repeats the first row and column of its neighbors, so the four
+// texels of a bilinear lookup always come from a single tile.
+//
+// Render threads read the slots without locking. Every slot has a version
+// that is odd while the slot is being refilled. A reader that sees the version
+// change under it reads again, so it never uses a tile that was evicted
+// half-way through the read.
+
+struct texture_cache_header {
+	char     magic[8];
+	uint32_t version;
+	uint32_t endian_tag;
+	uint64_t source_size;
+	int64_t  source_mtime;
+	uint32_t width;
+	uint32_t height;
+	uint32_t level_count;
+	uint32_t tile_size;
+	uint64_t tiles_offset;
+};
+
+namespace texture_cache_detail {
+	const char     magic[8]   = { 'R', 'T', 'W', 'T', 'E', 'X', '\0', '\0' };
+	const uint32_t version    = 1;
+	const uint32_t endian_tag = 0x01020304;
+	const uint64_t header_bytes = (sizeof(texture_cache_header) + 63) & ~uint64_t(63); // Tiles start 64-byte aligned
+
+	const int    tile_shift  = 6;
+	const int    tile_size   = 1 << tile_shift;             // Texels along a tile's side
+	const int    tile_stride = tile_size + 1;               // Plus the neighbors' first texels
+	const size_t tile_texels = size_t(tile_stride) * tile_stride;
+	const size_t tile_bytes  = (tile_texels * sizeof(uint32_t) + 63) & ~size_t(63); // 64-byte aligned
+
+	struct level_layout {
+		int width;
+		int height;
+		int tiles_x;
+		int tiles_y;
+		size_t first_tile; // Index of the level's first tile in the file
+	};
+
+	// Levels from full resolution down to 1x1, and where their tiles go.
+	inline std::vector<level_layout> layout(int width, int height) {
+		std::vector<level_layout> levels;
+		size_t tiles = 0;
+		while (true) {
+			level_layout l = { width, height, (width + tile_size - 1) / tile_size, (height + tile_size - 1) / tile_size, tiles };
+			tiles += size_t(l.tiles_x) * l.tiles_y;
+			levels.push_back(l);
+			if (width == 1 && height == 1) break;
+			width = std::max(1, width / 2);
+			height = std::max(1, height / 2);
+		}
+		return levels;
+	}
+
+	inline bool write_texture_cache(const std::string& cache_filename, const rtw_image& image,
+									uint64_t source_size, int64_t source_mtime)
+	{
+		int width = image.width(), height = image.height();
+		auto levels = layout(width, height);
+
+		texture_cache_header header = {};
+		std::memcpy(header.magic, magic, sizeof(magic));
+		header.version      = version;
+		header.endian_tag   = endian_tag;
+		header.source_size  = source_size;
+		header.source_mtime = source_mtime;
+		header.width        = uint32_t(width);
+		header.height       = uint32_t(height);
+		header.level_count  = uint32_t(levels.size());
+		header.tile_size    = uint32_t(tile_size);
+		header.tiles_offset = header_bytes;
+
+		// Write to a temporary file first so a crash never leaves a torn cache.
+		auto temp_filename = cache_filename + ".tmp";
+		{
+			std::ofstream out(temp_filename, std::ios::binary | std::ios::trunc);
+			if (!out) return false;
+
+			static const char padding[tile_bytes] = {};
+			out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			out.write(padding, std::streamsize(header.tiles_offset - sizeof(header)));
+
+			auto pixels = mipmap_detail::pack_rgb(image.pixel_data(0, 0), width, height);
+			std::vector<uint32_t> tile(tile_texels);
+
+			for (const auto& l : levels) {
+				for (int ty = 0; ty < l.tiles_y; ty++) {
+					for (int tx = 0; tx < l.tiles_x; tx++) {
+						// Texels past the edge of the image repeat the edge
+						for (int j = 0; j < tile_stride; j++) {
+							int y = std::min(ty * tile_size + j, l.height - 1);
+							for (int i = 0; i < tile_stride; i++) {
+								int x = std::min(tx * tile_size + i, l.width - 1);
+								tile[size_t(j) * tile_stride + i] = pixels[size_t(y) * l.width + x];
+							}
+						}
+						out.write(reinterpret_cast<const char*>(tile.data()), std::streamsize(tile_texels * sizeof(uint32_t)));
+						out.write(padding, std::streamsize(tile_bytes - tile_texels * sizeof(uint32_t)));
+					}
+				}
+				if (l.width > 1 || l.height > 1)
+					pixels = mipmap_detail::downsample(pixels, l.width, l.height);
+			}
+
+			if (!out) {
+				out.close();
+				std::remove(temp_filename.c_str());
+				return false;
+			}
+		}
+
+		std::remove(cache_filename.c_str());
+		return std::rename(temp_filename.c_str(), cache_filename.c_str()) == 0;
+	}
+}
+
+class streamed_image;
+
+class texture_cache {
+public:
+	// The cache every image texture uses.
+	static texture_cache& shared() {
+		static texture_cache cache;
+		return cache;
+	}
+
+	texture_cache() {}
+	texture_cache(const texture_cache&) = delete;
+	texture_cache& operator=(const texture_cache&) = delete;
+
+	// Bytes of tiles to keep in memory when streaming. 0 (the default) keeps
+	// every image whole in memory instead. Only images opened afterwards are
+	// affected, and the slot pool is sized by the first image streamed.
+	void set_budget(size_t bytes) { budget = bytes; }
+	bool streaming() const { return budget > 0; }
+
+	// A whole image, shared with any earlier caller for the same file. Empty
+	// if the file could not be read.
+	shared_ptr<const mipmap> image(const std::string& filename) {
+		auto path = rtw_image::find(filename.c_str());
+		auto key = path.empty() ? filename : path;
+
+		std::lock_guard<std::mutex> lock(registry_mutex);
+		if (auto found = images[key].lock()) return found;
+
+		rtw_image loaded(filename.c_str());
+		auto result = make_shared<const mipmap>(loaded.pixel_data(0, 0), loaded.width(), loaded.height());
+		if (!result->empty()) images[key] = result;
+		return result;
+	}
+
+	// A streamed image, shared like image(). Null if the file could not be
+	// read or its tile file could not be written.
+	shared_ptr<const streamed_image> streamed(const std::string& filename);
+
+	// Counters, for reports
+	std::atomic<uint64_t> tile_loads{ 0 };
+	std::atomic<uint64_t> tile_evictions{ 0 };
+	size_t resident_bytes() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		return resident;
+	}
+
+	// Reads four texels of a tile for streamed_image::fetch: the one at
+	// `offset` in the tile, the ones `dx` and `dy` texels on, and the one
+	// diagonally across. `entry` is the tile's slot index, -1 when it has
+	// none; `file` and `position` are where its texels are on disk.
+	void read(std::atomic<int>& entry, std::ifstream& file, uint64_t position,
+			  size_t offset, size_t dx, size_t dy, uint32_t* texels) {
+		while (true) {
+			int index = entry.load(std::memory_order_acquire);
+			if (index >= 0) {
+				auto& s = slots[index];
+				unsigned before = s.version.load(std::memory_order_acquire);
+				if (!(before & 1) && s.entry.load(std::memory_order_relaxed) == &entry) {
+					const auto* t = s.texels.get() + offset;
+					texels[0] = t[0].load(std::memory_order_relaxed);
+					texels[1] = t[dx].load(std::memory_order_relaxed);
+					texels[2] = t[dy].load(std::memory_order_relaxed);
+					texels[3] = t[dy + dx].load(std::memory_order_relaxed);
+					std::atomic_thread_fence(std::memory_order_acquire);
+
+					if (s.version.load(std::memory_order_relaxed) == before) {
+						if (!s.referenced.load(std::memory_order_relaxed))
+							s.referenced.store(true, std::memory_order_relaxed);
+						return;
+					}
+				}
+			}
+			load(entry, file, position);
+		}
+	}
+
+	// Drops the slots of tiles whose entries lie in [first, first + count),
+	// before the image that owns them goes away.
+	void forget(const std::atomic<int>* first, size_t count) {
+		std::lock_guard<std::mutex> lock(mutex);
+		for (int i = 0; i < slot_count; i++) {
+			auto* held = slots[i].entry.load(std::memory_order_relaxed);
+			if (held >= first && held < first + count) {
+				slots[i].entry.store(nullptr, std::memory_order_relaxed);
+				slots[i].referenced.store(false, std::memory_order_relaxed);
+			}
+		}
+	}
+
+private:
+	struct slot {
+		std::atomic<unsigned> version{ 0 };
+		std::atomic<std::atomic<int>*> entry{ nullptr }; // Entry of the tile held, if any
+		std::atomic<bool> referenced{ false };           // Read since the clock hand last passed
+		std::unique_ptr<std::atomic<uint32_t>[]> texels; // Allocated on first use
+	};
+
+	size_t budget = 0;
+
+	std::mutex registry_mutex;
+	std::map<std::string, std::weak_ptr<const mipmap>> images;
+	std::map<std::string, std::weak_ptr<const streamed_image>> streams;
+
+	// Guarded by mutex, except that readers use a slot's atomics
+	mutable std::mutex mutex;
+	std::unique_ptr<slot[]> slots;
+	int slot_count = 0;
+	int hand = 0;
+	size_t resident = 0;
+	std::vector<uint32_t> staging;
+
+	void load(std::atomic<int>& entry, std::ifstream& file, uint64_t position) {
+		using namespace texture_cache_detail;
+		std::lock_guard<std::mutex> lock(mutex);
+
+		// Another thread may have brought the tile in while this one waited
+		int index = entry.load(std::memory_order_relaxed);
+		if (index >= 0 && slots[index].entry.load(std::memory_order_relaxed) == &entry) return;
+
+		if (!slots) {
+			slot_count = int(std::max<size_t>(64, budget / tile_bytes));
+			slots.reset(new slot[slot_count]);
+			staging.resize(tile_texels);
+		}
+
+		// Read before evicting anything, so a failed read leaves the cache as it was
+		file.clear();
+		file.seekg(std::streamoff(position));
+		if (!file.read(reinterpret_cast<char*>(staging.data()), std::streamsize(tile_texels * sizeof(uint32_t)))) {
+			std::cerr << "ERROR: Could not read a texture tile; using magenta.\n";
+			std::fill(staging.begin(), staging.end(), mipmap_detail::pack(255, 0, 255));
+		}
+
+		index = next_victim();
+		auto& s = slots[index];
+		if (auto old = s.entry.load(std::memory_order_relaxed)) {
+			old->store(-1, std::memory_order_relaxed);
+			tile_evictions++;
+		}
+		if (!s.texels) {
+			s.texels.reset(new std::atomic<uint32_t>[tile_texels]);
+			resident += tile_bytes;
+		}
+
+		unsigned version = s.version.load(std::memory_order_relaxed);
+		s.version.store(version + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		for (size_t k = 0; k < tile_texels; k++)
+			s.texels[k].store(staging[k], std::memory_order_relaxed);
+		s.entry.store(&entry, std::memory_order_relaxed);
+		s.referenced.store(true, std::memory_order_relaxed);
+
+		s.version.store(version + 2, std::memory_order_release);
+		entry.store(index, std::memory_order_release);
+		tile_loads++;
+	}
+
+	// Clock sweep: passes over recently read slots once, clearing their mark.
+	int next_victim() {
+		while (true) {
+			int index = hand;
+			hand = (hand + 1) % slot_count;
+			auto& s = slots[index];
+			if (s.entry.load(std::memory_order_relaxed) == nullptr) return index;
+			if (!s.referenced.exchange(false, std::memory_order_relaxed)) return index;
+		}
+	}
+};
+
+// An image read tile by tile through a texture_cache. Filters like a mipmap.
+class streamed_image {
+public:
+	// Opens "<path>.rtwtex", writing it first if it is missing or stale.
+	// Returns null, with the reason on std::cerr, if neither works.
+	static shared_ptr<streamed_image> open(const std::string& path, texture_cache& cache) {
+		using namespace texture_cache_detail;
+
+		uint64_t source_size;
+		int64_t source_mtime;
+		if (!mapped_file::stamp(path, source_size, source_mtime)) {
+			std::cerr << "ERROR: Could not open image file '" << path << "'.\n";
+			return nullptr;
+		}
+
+		auto cache_filename = path + ".rtwtex";
+		auto result = shared_ptr<streamed_image>(new streamed_image(cache));
+		if (result->open_tiles(cache_filename, source_size, source_mtime)) return result;
+
+		rtw_image image(path.c_str());
+		if (image.width() == 0) return nullptr;
+
+		if (!write_texture_cache(cache_filename, image, source_size, source_mtime)
+			|| !result->open_tiles(cache_filename, source_size, source_mtime)) {
+			std::cerr << "ERROR: Could not write texture cache '" << cache_filename << "'.\n";
+			return nullptr;
+		}
+		return result;
+	}
+
+	~streamed_image() {
+		cache.forget(resident.get(), tile_count);
+	}
+
+	streamed_image(const streamed_image&) = delete;
+	streamed_image& operator=(const streamed_image&) = delete;
+
+	int width() const { return levels[0].width; }
+	int height() const { return levels[0].height; }
+
+	color sample(double u, double v, double footprint, texture_filter filter) const {
+		return mipmap_detail::sample(*this, u, v, footprint, filter);
+	}
+
+	// Texel access for mipmap_detail::sample
+	int level_count() const { return int(levels.size()); }
+	int level_width(int level) const { return levels[level].width; }
+	int level_height(int level) const { return levels[level].height; }
+
+	uint32_t texel(int level, int i, int j) const {
+		uint32_t texels[4];
+		fetch(level, i, j, i, j, texels);
+		return texels[0];
+	}
+
+	void fetch(int level, int xa, int ya, int xb, int yb, uint32_t* texels) const {
+		using namespace texture_cache_detail;
+		const auto& l = levels[level];
+		int tx = xa >> tile_shift, ty = ya >> tile_shift;
+		size_t tile = l.first_tile + size_t(ty) * l.tiles_x + tx;
+		size_t offset = size_t(ya - (ty << tile_shift)) * tile_stride + (xa - (tx << tile_shift));
+
+		cache.read(resident[tile], file, tiles_offset + tile * tile_bytes,
+				   offset, size_t(xb - xa), size_t(yb - ya) * tile_stride, texels);
+	}
+
+private:
+	texture_cache& cache;
+	std::vector<texture_cache_detail::level_layout> levels;
+	std::unique_ptr<std::atomic<int>[]> resident; // Slot of each tile, or -1
+	size_t tile_count = 0;
+	uint64_t tiles_offset = 0;
+	mutable std::ifstream file; // Only read under the cache's lock
+
+	streamed_image(texture_cache& cache) : cache(cache) {}
+
+	bool open_tiles(const std::string& cache_filename, uint64_t source_size, int64_t source_mtime) {
+		using namespace texture_cache_detail;
+
+		file.close();
+		file.open(cache_filename, std::ios::binary);
+		texture_cache_header header;
+		if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))) return false;
+
+		if (std::memcmp(header.magic, magic, sizeof(magic)) != 0
+			|| header.version != version
+			|| header.endian_tag != endian_tag
+			|| header.source_size != source_size
+			|| header.source_mtime != source_mtime
+			|| header.tile_size != uint32_t(tile_size)
+			|| header.width == 0 || header.height == 0)
+			return false;
+
+		levels = layout(int(header.width), int(header.height));
+		const auto& last = levels.back();
+		tile_count = last.first_tile + size_t(last.tiles_x) * last.tiles_y;
+		tiles_offset = header.tiles_offset;
+
+		// A truncated file would otherwise only show up as failed tile reads
+		file.seekg(0, std::ios::end);
+		if (header.level_count != levels.size() || uint64_t(file.tellg()) < tiles_offset + tile_count * tile_bytes)
+			return false;
+
+		resident.reset(new std::atomic<int>[tile_count]);
+		for (size_t t = 0; t < tile_count; t++) resident[t].store(-1, std::memory_order_relaxed);
+		return true;
+	}
+};
+
+inline shared_ptr<const streamed_image> texture_cache::streamed(const std::string& filename) {
+	auto path = rtw_image::find(filename.c_str());
+	if (path.empty()) {
+		std::cerr << "ERROR: Could not load image file '" << filename << "'.\n";
+		return nullptr;
+	}
+
+	std::lock_guard<std::mutex> lock(registry_mutex);
+	if (auto found = streams[path].lock()) return found;
+
+	auto result = streamed_image::open(path, *this);
+	if (result) streams[path] = result;
+	return result;
+}
+
+#endif // !TEXTURE_CACHE_H
@@ -0,0 +1,132 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Thread Pool
+//
+// Worker threads that live as long as the process, so a render does not start
+// and join a thread per core every time. This matters when many small frames
+// are rendered back to back, as in the render daemon or the interactive
+// preview. The pool grows to the largest batch it has been asked for and
+// never shrinks.
+//
+// A batch runs the same task on `count` workers at once; the task itself
+// hands out the work, e.g. from an atomic counter. One batch runs at a time,
+// and a batch started while another is running waits for it to be collected.
+// A task must not start a batch of its own.
+
+class thread_pool {
+public:
+	// The pool every render shares.
+	static thread_pool& shared() {
+		static thread_pool pool;
+		return pool;
+	}
+
+	thread_pool() {}
+	thread_pool(const thread_pool&) = delete;
+	thread_pool& operator=(const thread_pool&) = delete;
+
+	~thread_pool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (auto& worker : workers)
+			worker.join();
+	}
+
+	// Runs `work` on `count` workers and returns at once. Call wait() before
+	// anything the task refers to goes out of scope.
+	void start(int count, std::function<void()> work) {
+		std::unique_lock<std::mutex> lock(mutex);
+		idle.wait(lock, [&]() { return !active; });
+
+		count = std::max(1, count);
+		while (int(workers.size()) < count) {
+			int index = int(workers.size());
+			workers.emplace_back([this, index]() { worker_loop(index); });
+		}
+
+		task = std::move(work);
+		wanted = count;
+		running = count;
+		active = true;
+		generation++;
+
+		lock.unlock();
+		wake.notify_all();
+	}
+
+	// Blocks until every worker of the current batch has returned from it.
+	void wait() {
+		std::unique_lock<std::mutex> lock(mutex);
+		idle.wait(lock, [&]() { return running == 0; });
+		task = nullptr;
+		active = false;
+		lock.unlock();
+		idle.notify_all();
+	}
+
+	// Calls `body(i)` for every i in [0, count), handing the indices out one
+	// at a time to up to one worker per hardware thread, and returns once
+	// all are done. For filling grids and the like a slice at a time.
+	template <typename Body>
+	void for_each(int count, const Body& body) {
+		std::atomic<int> next(0);
+		auto worker = [&]() {
+			for (int i = next++; i < count; i = next++)
+				body(i);
+		};
+
+		start(std::min(count, int(std::thread::hardware_concurrency())), worker);
+		wait();
+	}
+
+	int size() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		return int(workers.size());
+	}
+
+private:
+	mutable std::mutex mutex;
+	std::condition_variable wake;  // Workers wait here for a new batch
+	std::condition_variable idle;  // wait() and start() wait here
+	std::vector<std::thread> workers;
+
+	// Guarded by mutex
+	std::function<void()> task;
+	unsigned generation = 0;  // Counts batches, so a worker runs each one once
+	int wanted = 0;           // Workers taking part in the current batch
+	int running = 0;          // Of those, how many have not returned yet
+	bool active = false;      // A batch was started and not yet waited for
+	bool stopping = false;
+
+	void worker_loop(int index) {
+		unsigned seen = 0;
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true) {
+			wake.wait(lock, [&]() { return stopping || generation != seen; });
+			if (stopping) return;
+			seen = generation;
+			if (index >= wanted) continue;
+
+			// The task stays put until running drops to zero, so it is safe to call unlocked
+			lock.unlock();
+			task();
+			lock.lock();
+
+			if (--running == 0) idle.notify_all();
+		}
+	}
+};
+
+#endif // !THREAD_POOL_H
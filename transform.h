@@ -0,0 +1,168 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "aabb.h"
+#include "rtweekend.h"
+
+// 3x4 Affine Transform
+//
+// The left 3x3 block is the linear part (rotation, scale, shear) and the
+// last column is the translation:
+//
+//     | m00 m01 m02 m03 |   | x |
+//     | m10 m11 m12 m13 | * | y |
+//     | m20 m21 m22 m23 |   | z |
+//                           | 1 |
+
+class transform {
+public:
+	double m[3][4];
+
+	transform() : m{ {1,0,0,0}, {0,1,0,0}, {0,0,1,0} } {}
+
+	static transform translation(const vec3& offset) {
+		transform t;
+		t.m[0][3] = offset.x();
+		t.m[1][3] = offset.y();
+		t.m[2][3] = offset.z();
+		return t;
+	}
+
+	static transform scaling(const vec3& s) {
+		transform t;
+		t.m[0][0] = s.x();
+		t.m[1][1] = s.y();
+		t.m[2][2] = s.z();
+		return t;
+	}
+
+	static transform scaling(double s) { return scaling(vec3(s, s, s)); }
+
+	static transform rotation(const vec3& axis, double angle_deg) {
+		// Rodrigues' rotation formula: R = cos*I + sin*[k]x + (1 - cos)*k*k^T
+		auto k = unit_vector(axis);
+		auto radians = degrees_to_radians(angle_deg);
+		auto c = std::cos(radians);
+		auto s = std::sin(radians);
+		auto t = 1 - c;
+
+		transform r;
+		r.m[0][0] = c + t * k.x() * k.x();
+		r.m[0][1] = t * k.x() * k.y() - s * k.z();
+		r.m[0][2] = t * k.x() * k.z() + s * k.y();
+		r.m[1][0] = t * k.y() * k.x() + s * k.z();
+		r.m[1][1] = c + t * k.y() * k.y();
+		r.m[1][2] = t * k.y() * k.z() - s * k.x();
+		r.m[2][0] = t * k.z() * k.x() - s * k.y();
+		r.m[2][1] = t * k.z() * k.y() + s * k.x();
+		r.m[2][2] = c + t * k.z() * k.z();
+		return r;
+	}
+
+	static transform rotation_y(double angle_deg) { return rotation(vec3(0, 1, 0), angle_deg); }
+
+	point3 apply_point(const point3& p) const {
+		return point3(
+			m[0][0] * p.x() + m[0][1] * p.y() + m[0][2] * p.z() + m[0][3],
+			m[1][0] * p.x() + m[1][1] * p.y() + m[1][2] * p.z() + m[1][3],
+			m[2][0] * p.x() + m[2][1] * p.y() + m[2][2] * p.z() + m[2][3]
+		);
+	}
+
+	vec3 apply_vector(const vec3& v) const {
+		return vec3(
+			m[0][0] * v.x() + m[0][1] * v.y() + m[0][2] * v.z(),
+			m[1][0] * v.x() + m[1][1] * v.y() + m[1][2] * v.z(),
+			m[2][0] * v.x() + m[2][1] * v.y() + m[2][2] * v.z()
+		);
+	}
+
+	vec3 apply_transposed(const vec3& v) const {
+		// Multiplies by the transpose of the linear part. Given the inverse of a
+		// transform, this is how normals are carried through the original.
+		return vec3(
+			m[0][0] * v.x() + m[1][0] * v.y() + m[2][0] * v.z(),
+			m[0][1] * v.x() + m[1][1] * v.y() + m[2][1] * v.z(),
+			m[0][2] * v.x() + m[1][2] * v.y() + m[2][2] * v.z()
+		);
+	}
+
+	aabb apply(const aabb& box) const {
+		// Transform all eight corners and take their extent.
+		point3 min(infinity, infinity, infinity);
+		point3 max(-infinity, -infinity, -infinity);
+
+		for (int i = 0; i < 2; i++) {
+			for (int j = 0; j < 2; j++) {
+				for (int k = 0; k < 2; k++) {
+					auto corner = apply_point(point3(
+						i ? box.x.max : box.x.min,
+						j ? box.y.max : box.y.min,
+						k ? box.z.max : box.z.min
+					));
+
+					for (int c = 0; c < 3; c++) {
+						min[c] = std::fmin(min[c], corner[c]);
+						max[c] = std::fmax(max[c], corner[c]);
+					}
+				}
+			}
+		}
+
+		return aabb(min, max);
+	}
+
+	// Volume scale of the linear part; negative for mirroring transforms.
+	double determinant() const {
+		return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+			 - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+			 + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+	}
+
+	transform inverse() const {
+		// Invert the linear part through its adjugate, then carry the
+		// translation through it: x = A^-1 * (y - t)
+		auto a = m[0][0], b = m[0][1], c = m[0][2];
+		auto d = m[1][0], e = m[1][1], f = m[1][2];
+		auto g = m[2][0], h = m[2][1], i = m[2][2];
+
+		auto A =  (e * i - f * h);
+		auto B = -(d * i - f * g);
+		auto C =  (d * h - e * g);
+
+		auto inv_det = 1.0 / (a * A + b * B + c * C);
+
+		transform r;
+		r.m[0][0] = A * inv_det;
+		r.m[0][1] = -(b * i - c * h) * inv_det;
+		r.m[0][2] =  (b * f - c * e) * inv_det;
+		r.m[1][0] = B * inv_det;
+		r.m[1][1] =  (a * i - c * g) * inv_det;
+		r.m[1][2] = -(a * f - c * d) * inv_det;
+		r.m[2][0] = C * inv_det;
+		r.m[2][1] = -(a * h - b * g) * inv_det;
+		r.m[2][2] =  (a * e - b * d) * inv_det;
+
+		auto t = r.apply_vector(vec3(m[0][3], m[1][3], m[2][3]));
+		r.m[0][3] = -t.x();
+		r.m[1][3] = -t.y();
+		r.m[2][3] = -t.z();
+		return r;
+	}
+};
+
+inline transform operator*(const transform& a, const transform& b) {
+	// Composition: (a * b) applies b first, then a.
+	transform r;
+	for (int row = 0; row < 3; row++) {
+		for (int col = 0; col < 4; col++) {
+			r.m[row][col] = a.m[row][0] * b.m[0][col]
+						  + a.m[row][1] * b.m[1][col]
+						  + a.m[row][2] * b.m[2][col]
+						  + (col == 3 ? a.m[row][3] : 0.0);
+		}
+	}
+	return r;
+}
+
+#endif // !TRANSFORM_H
@@ -2,6 +2,8 @@
 #define TRIANGLE_H
 
 #include "hittable.h"
+#include "light.h"
+#include "material.h"
 
 class triangle : public hittable {
 public:
@@ -12,6 +14,7 @@ public:
 		normal = unit_vector(n);
 		D = dot(normal, Q);
 		w = n / dot(n, n);
+		uv_density = 1 / std::sqrt(n.length());
 
 		set_bounding_box();
 	}
@@ -24,8 +27,13 @@ public:
 
 	aabb bounding_box() const override { return bbox; }
 
+	void gather_lights(std::vector<light_source>& lights) const override {
+		if (mat->is_emissive()) lights.push_back(light_source::flat(light_source::triangle_shape, this, mat.get(), Q, u, v));
+	}
+
 	bool hit(const ray& r, interval ray_t, hit_record& rec) const override
 	{
+		RTW_STAT(primitive_tests[stat_triangle]);
 		auto denom = dot(normal, r.direction());
 
 		if (std::fabs(denom) < 1e-8) return false;
@@ -42,8 +50,10 @@ public:
 
 		rec.t = t;
 		rec.p = intersection;
-		rec.mat = mat;
+		rec.mat = mat.get();
+		rec.object = this;
 		rec.set_face_normal(r, normal);
+		rec.uv_density = uv_density;
 
 		return true;
 	}
@@ -68,6 +78,7 @@ private:
 	vec3 u, v, w;
 	vec3 normal;
 	double D;
+	double uv_density; // u and v run along the edge vectors, so one uv unit covers |u x v|
 	aabb bbox;
 
 	shared_ptr<material> mat;
@@ -0,0 +1,389 @@
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include "hittable.h"
+#include "light.h"
+#include "material.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Indexed Triangle Mesh
+//
+// All triangles of a mesh share one set of vertex buffers and are referenced
+// by three 32-bit indices each, so a triangle costs 12 bytes plus its share
+// of the BVH instead of a whole heap allocated hittable. Positions, normals
+// and uvs are stored as packed floats. Normals and uvs are optional; when
+// present they are interpolated across each hit.
+
+class mesh_data {
+public:
+	std::vector<float>    positions; // x y z per vertex
+	std::vector<float>    normals;   // x y z per vertex, or empty
+	std::vector<float>    uvs;       // u v per vertex, or empty
+	std::vector<uint32_t> indices;   // three vertex indices per triangle
+
+	size_t vertex_count() const { return positions.size() / 3; }
+	size_t triangle_count() const { return indices.size() / 3; }
+
+	void compute_vertex_normals() {
+		// Area weighted average of the face normals around each vertex.
+		normals.assign(positions.size(), 0.0f);
+
+		for (size_t t = 0; t < indices.size(); t += 3) {
+			auto a = indices[t], b = indices[t + 1], c = indices[t + 2];
+			auto n = cross(position(b) - position(a), position(c) - position(a));
+			for (auto idx : { a, b, c }) {
+				normals[3 * idx + 0] += float(n.x());
+				normals[3 * idx + 1] += float(n.y());
+				normals[3 * idx + 2] += float(n.z());
+			}
+		}
+
+		for (size_t i = 0; i < normals.size(); i += 3) {
+			auto len = std::sqrt(normals[i] * normals[i] + normals[i + 1] * normals[i + 1] + normals[i + 2] * normals[i + 2]);
+			if (len > 0) {
+				normals[i + 0] /= len;
+				normals[i + 1] /= len;
+				normals[i + 2] /= len;
+			}
+		}
+	}
+
+	point3 position(uint32_t i) const {
+		return point3(positions[3 * i], positions[3 * i + 1], positions[3 * i + 2]);
+	}
+};
+
+// Flattened BVH node, 32 bytes. Interior nodes keep their left child directly
+// after themselves and store the right child index in `offset`. Leaves store
+// the first triangle of a contiguous run in `offset` and its length in `count`.
+struct mesh_bvh_node {
+	float    bmin[3];
+	uint32_t offset;
+	float    bmax[3];
+	uint32_t count;
+};
+
+// Read-only views over a mesh's buffers, wherever they live.
+struct mesh_view {
+	const float*         positions = nullptr;
+	const float*         normals   = nullptr; // may be null
+	const float*         uvs       = nullptr; // may be null
+	const uint32_t*      indices   = nullptr;
+	const mesh_bvh_node* nodes     = nullptr;
+	size_t               vertex_count   = 0;
+	size_t               triangle_count = 0;
+	size_t               node_count     = 0;
+};
+
+class triangle_mesh : public hittable {
+public:
+	triangle_mesh(mesh_data data, shared_ptr<material> mat) : storage(std::move(data)), mat(mat) {
+		build_bvh();
+
+		buffers.positions      = storage.positions.data();
+		buffers.normals        = storage.normals.empty() ? nullptr : storage.normals.data();
+		buffers.uvs            = storage.uvs.empty() ? nullptr : storage.uvs.data();
+		buffers.indices        = storage.indices.data();
+		buffers.nodes          = nodes_storage.data();
+		buffers.vertex_count   = storage.vertex_count();
+		buffers.triangle_count = storage.triangle_count();
+		buffers.node_count     = nodes_storage.size();
+		update_bounding_box();
+	}
+
+	// Wraps buffers and a prebuilt BVH owned elsewhere, e.g. a memory-mapped
+	// mesh cache. `backing` keeps that memory alive for the mesh's lifetime.
+	triangle_mesh(const mesh_view& view, shared_ptr<const void> backing, shared_ptr<material> mat)
+		: buffers(view), backing(backing), mat(mat)
+	{
+		update_bounding_box();
+	}
+
+	// The buffer views may point into this object, so it must never be copied.
+	triangle_mesh(const triangle_mesh&) = delete;
+	triangle_mesh& operator=(const triangle_mesh&) = delete;
+
+	bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+		if (buffers.node_count == 0) return false;
+
+		const vec3& o = r.origin();
+		const vec3& d = r.direction();
+		float orig[3] = { float(o.x()), float(o.y()), float(o.z()) };
+		float inv_dir[3] = { float(1.0 / d.x()), float(1.0 / d.y()), float(1.0 / d.z()) };
+
+		uint32_t hit_triangle = 0;
+		double hit_b1 = 0, hit_b2 = 0;
+		bool hit_anything = false;
+
+		uint32_t stack[64];
+		int stack_size = 0;
+		uint32_t node_index = 0;
+
+		while (true) {
+			const auto& node = buffers.nodes[node_index];
+			RTW_STAT(bvh_node_visits);
+			RTW_STAT(aabb_tests);
+
+			if (box_hit(node, orig, inv_dir, ray_t)) {
+				if (node.count > 0) {
+					for (uint32_t i = 0; i < node.count; i++) {
+						double t, b1, b2;
+						RTW_STAT(primitive_tests[stat_mesh_triangle]);
+						if (intersect(node.offset + i, r, ray_t, t, b1, b2)) {
+							ray_t.max = t;
+							hit_triangle = node.offset + i;
+							hit_b1 = b1;
+							hit_b2 = b2;
+							hit_anything = true;
+						}
+					}
+				}
+				else {
+					stack[stack_size++] = node.offset;
+					node_index = node_index + 1;
+					continue;
+				}
+			}
+
+			if (stack_size == 0) break;
+			node_index = stack[--stack_size];
+		}
+
+		if (!hit_anything) return false;
+
+		fill_hit_record(hit_triangle, r, ray_t.max, hit_b1, hit_b2, rec);
+		return true;
+	}
+
+	aabb bounding_box() const override { return bbox; }
+
+	size_t triangle_count() const { return buffers.triangle_count; }
+
+	// Every triangle, in index order, so a hit's face is its light.
+	void gather_lights(std::vector<light_source>& lights) const override {
+		if (!mat->is_emissive()) return;
+		for (uint32_t tri = 0; tri < buffers.triangle_count; tri++) {
+			const uint32_t* tri_indices = buffers.indices + 3 * size_t(tri);
+			auto p0 = vertex(tri_indices[0]);
+			auto light = light_source::flat(light_source::triangle_shape, this, mat.get(), p0, vertex(tri_indices[1]) - p0, vertex(tri_indices[2]) - p0);
+			if (buffers.uvs) {
+				auto uv = [&](int k) { return vec3(buffers.uvs[2 * tri_indices[k]], buffers.uvs[2 * tri_indices[k] + 1], 0); };
+				light.uv_origin = uv(0);
+				light.uv_u = uv(1) - uv(0);
+				light.uv_v = uv(2) - uv(0);
+			}
+			lights.push_back(light);
+		}
+	}
+
+	const mesh_view& view() const { return buffers; }
+
+private:
+	mesh_view buffers;
+	mesh_data storage;
+	std::vector<mesh_bvh_node> nodes_storage;
+	shared_ptr<const void> backing;
+	shared_ptr<material> mat;
+	aabb bbox;
+
+	static const uint32_t max_leaf_size = 4;
+
+	void update_bounding_box() {
+		if (buffers.node_count == 0) {
+			bbox = aabb::empty;
+			return;
+		}
+		const auto& root = buffers.nodes[0];
+		bbox = aabb(point3(root.bmin[0], root.bmin[1], root.bmin[2]), point3(root.bmax[0], root.bmax[1], root.bmax[2]));
+	}
+
+	point3 vertex(uint32_t i) const {
+		const float* p = buffers.positions + 3 * size_t(i);
+		return point3(p[0], p[1], p[2]);
+	}
+
+	static bool box_hit(const mesh_bvh_node& node, const float* orig, const float* inv_dir, const interval& ray_t) {
+		float tmin = float(ray_t.min);
+		float tmax = float(ray_t.max);
+
+		for (int axis = 0; axis < 3; axis++) {
+			float t0 = (node.bmin[axis] - orig[axis]) * inv_dir[axis];
+			float t1 = (node.bmax[axis] - orig[axis]) * inv_dir[axis];
+			if (t0 > t1) std::swap(t0, t1);
+
+			// Widen the far plane a little to absorb float rounding in the slab test.
+			t1 *= 1.0000004f;
+
+			// NaN (0 * inf) compares false and leaves the interval untouched.
+			if (t0 > tmin) tmin = t0;
+			if (t1 < tmax) tmax = t1;
+		}
+
+		return tmin <= tmax;
+	}
+
+	bool intersect(uint32_t tri, const ray& r, const interval& ray_t, double& t, double& b1, double& b2) const {
+		// Moller-Trumbore
+		const uint32_t* tri_indices = buffers.indices + 3 * size_t(tri);
+		auto p0 = vertex(tri_indices[0]);
+		auto e1 = vertex(tri_indices[1]) - p0;
+		auto e2 = vertex(tri_indices[2]) - p0;
+
+		auto pvec = cross(r.direction(), e2);
+		auto det = dot(e1, pvec);
+		if (det == 0) return false;
+
+		auto inv_det = 1.0 / det;
+		auto tvec = r.origin() - p0;
+		b1 = dot(tvec, pvec) * inv_det;
+		if (b1 < 0 || b1 > 1) return false;
+
+		auto qvec = cross(tvec, e1);
+		b2 = dot(r.direction(), qvec) * inv_det;
+		if (b2 < 0 || b1 + b2 > 1) return false;
+
+		t = dot(e2, qvec) * inv_det;
+		return ray_t.surrounds(t);
+	}
+
+	void fill_hit_record(uint32_t tri, const ray& r, double t, double b1, double b2, hit_record& rec) const {
+		const uint32_t* tri_indices = buffers.indices + 3 * size_t(tri);
+		auto i0 = tri_indices[0];
+		auto i1 = tri_indices[1];
+		auto i2 = tri_indices[2];
+		auto b0 = 1 - b1 - b2;
+
+		auto p0 = vertex(i0);
+		auto face = cross(vertex(i1) - p0, vertex(i2) - p0);
+		auto geometric_normal = unit_vector(face);
+
+		rec.t = t;
+		rec.p = r.at(t);
+		rec.mat = mat.get();
+		rec.object = this;
+		rec.face = int(tri);
+		rec.set_face_normal(r, geometric_normal);
+
+		if (buffers.normals) {
+			const float* normals = buffers.normals;
+			auto n = b0 * vec3(normals[3 * i0], normals[3 * i0 + 1], normals[3 * i0 + 2])
+				   + b1 * vec3(normals[3 * i1], normals[3 * i1 + 1], normals[3 * i1 + 2])
+				   + b2 * vec3(normals[3 * i2], normals[3 * i2 + 1], normals[3 * i2 + 2]);
+
+			// Keep the shading normal on the same side as the geometric one.
+			if (!n.near_zero()) {
+				n = unit_vector(n);
+				rec.normal = dot(n, rec.normal) < 0 ? -n : n;
+			}
+		}
+
+		if (buffers.uvs) {
+			const float* uvs = buffers.uvs;
+			rec.u = b0 * uvs[2 * i0] + b1 * uvs[2 * i1] + b2 * uvs[2 * i2];
+			rec.v = b0 * uvs[2 * i0 + 1] + b1 * uvs[2 * i1 + 1] + b2 * uvs[2 * i2 + 1];
+
+			// Twice the triangle's area in uv space, over twice its area in space
+			double du1 = uvs[2 * i1] - uvs[2 * i0], dv1 = uvs[2 * i1 + 1] - uvs[2 * i0 + 1];
+			double du2 = uvs[2 * i2] - uvs[2 * i0], dv2 = uvs[2 * i2 + 1] - uvs[2 * i0 + 1];
+			rec.uv_density = std::sqrt(std::fabs(du1 * dv2 - du2 * dv1) / face.length());
+		}
+		else {
+			rec.u = b1;
+			rec.v = b2;
+			rec.uv_density = 1 / std::sqrt(face.length());
+		}
+	}
+
+	void build_bvh() {
+		// Median split along the longest centroid axis. Triangles are reordered
+		// in place so every leaf references a contiguous run of the index buffer.
+		auto count = storage.triangle_count();
+		nodes_storage.clear();
+		if (count == 0) return;
+
+		std::vector<float> centroids(3 * count);
+		std::vector<float> tri_min(3 * count), tri_max(3 * count);
+		for (size_t t = 0; t < count; t++) {
+			for (int axis = 0; axis < 3; axis++) {
+				float a = storage.positions[3 * storage.indices[3 * t + 0] + axis];
+				float b = storage.positions[3 * storage.indices[3 * t + 1] + axis];
+				float c = storage.positions[3 * storage.indices[3 * t + 2] + axis];
+				tri_min[3 * t + axis] = std::min(a, std::min(b, c));
+				tri_max[3 * t + axis] = std::max(a, std::max(b, c));
+				centroids[3 * t + axis] = 0.5f * (tri_min[3 * t + axis] + tri_max[3 * t + axis]);
+			}
+		}
+
+		std::vector<uint32_t> order(count);
+		for (size_t t = 0; t < count; t++) order[t] = uint32_t(t);
+
+		nodes_storage.reserve(2 * count / max_leaf_size + 1);
+		build_node(order, 0, count, centroids, tri_min, tri_max);
+
+		// Apply the final triangle order to the index buffer.
+		std::vector<uint32_t> sorted(storage.indices.size());
+		for (size_t t = 0; t < count; t++) {
+			sorted[3 * t + 0] = storage.indices[3 * order[t] + 0];
+			sorted[3 * t + 1] = storage.indices[3 * order[t] + 1];
+			sorted[3 * t + 2] = storage.indices[3 * order[t] + 2];
+		}
+		storage.indices.swap(sorted);
+		nodes_storage.shrink_to_fit();
+	}
+
+	uint32_t build_node(std::vector<uint32_t>& order, size_t start, size_t end,
+						const std::vector<float>& centroids,
+						const std::vector<float>& tri_min, const std::vector<float>& tri_max)
+	{
+		auto node_index = uint32_t(nodes_storage.size());
+		nodes_storage.push_back(mesh_bvh_node());
+
+		mesh_bvh_node node;
+		float cmin[3], cmax[3];
+		for (int axis = 0; axis < 3; axis++) {
+			node.bmin[axis] = cmin[axis] = infinity;
+			node.bmax[axis] = cmax[axis] = -infinity;
+		}
+
+		for (size_t i = start; i < end; i++) {
+			auto t = order[i];
+			for (int axis = 0; axis < 3; axis++) {
+				node.bmin[axis] = std::min(node.bmin[axis], tri_min[3 * t + axis]);
+				node.bmax[axis] = std::max(node.bmax[axis], tri_max[3 * t + axis]);
+				cmin[axis] = std::min(cmin[axis], centroids[3 * t + axis]);
+				cmax[axis] = std::max(cmax[axis], centroids[3 * t + axis]);
+			}
+		}
+
+		int axis = 0;
+		for (int a = 1; a < 3; a++)
+			if (cmax[a] - cmin[a] > cmax[axis] - cmin[axis]) axis = a;
+
+		auto span = end - start;
+		if (span <= max_leaf_size) {
+			node.offset = uint32_t(start);
+			node.count = uint32_t(span);
+			nodes_storage[node_index] = node;
+			return node_index;
+		}
+
+		// Triangles whose centroids all coincide, e.g. a duplicated patch, are
+		// still halved by index rather than left in one huge leaf.
+		auto mid = start + span / 2;
+		if (cmax[axis] > cmin[axis]) {
+			std::nth_element(order.begin() + start, order.begin() + mid, order.begin() + end,
+				[&](uint32_t a, uint32_t b) { return centroids[3 * a + axis] < centroids[3 * b + axis]; });
+		}
+
+		build_node(order, start, mid, centroids, tri_min, tri_max);
+		node.offset = build_node(order, mid, end, centroids, tri_min, tri_max);
+		node.count = 0;
+		nodes_storage[node_index] = node;
+		return node_index;
+	}
+};
+
+#endif // !TRIANGLE_MESH_H
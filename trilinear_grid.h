@@ -0,0 +1,98 @@
+#ifndef TRILINEAR_GRID_H
+#define TRILINEAR_GRID_H
+
+#include "rtweekend.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <vector>
+
+// Trilinear Grid
+//
+// Floats sampled at the corners of a regular grid of cells over a box and
+// looked up with trilinear interpolation: one cache-friendly gather of eight
+// floats. Baked turbulence (perlin.h) and density grids (medium.h) are both
+// one of these.
+
+class trilinear_grid {
+public:
+	trilinear_grid() {}
+
+	// `resolution` samples along the box's longest side and proportionally
+	// fewer along the others, all zero until fill() is called. Empty if the
+	// box is flat or `resolution` is below 2.
+	trilinear_grid(const point3& min, const point3& max, int resolution) : min_corner(min) {
+		vec3 extent = max - min;
+		double longest = std::max(extent.x(), std::max(extent.y(), extent.z()));
+		if (!(longest > 0) || resolution < 2) return;
+
+		sample_spacing = longest / (resolution - 1);
+		inv_spacing = 1 / sample_spacing;
+		for (int a = 0; a < 3; a++) {
+			size[a] = std::max(2, int(std::ceil(extent[a] / sample_spacing)) + 1);
+			cell_counts[a] = size[a] - 1;
+		}
+
+		values.assign(size_t(size[0]) * size[1] * size[2], 0.0f);
+	}
+
+	bool empty() const { return values.empty(); }
+	const point3& origin() const { return min_corner; }
+	double spacing() const { return sample_spacing; }
+	int cells(int axis) const { return cell_counts[axis]; }
+	size_t sample_count() const { return values.size(); }
+
+	float sample(int i, int j, int k) const {
+		return values[(size_t(k) * size[1] + j) * size[0] + i];
+	}
+
+	// Sets every sample to `value(p)` at its position, a z slice at a time on
+	// the render threads.
+	template <typename Value>
+	void fill(const Value& value) {
+		thread_pool::shared().for_each(size[2], [&](int k) {
+			float* slice = &values[size_t(k) * size[0] * size[1]];
+			for (int j = 0; j < size[1]; j++)
+				for (int i = 0; i < size[0]; i++)
+					slice[size_t(j) * size[0] + i] = float(value(min_corner + sample_spacing * vec3(i, j, k)));
+		});
+	}
+
+	// False if `p` lies outside the grid.
+	bool lookup(const point3& p, float& value) const {
+		if (values.empty()) return false;
+
+		double x = (p.x() - min_corner.x()) * inv_spacing;
+		double y = (p.y() - min_corner.y()) * inv_spacing;
+		double z = (p.z() - min_corner.z()) * inv_spacing;
+		if (!(x >= 0 && y >= 0 && z >= 0 && x <= cell_counts[0] && y <= cell_counts[1] && z <= cell_counts[2])) return false;
+
+		int i = std::min(int(x), cell_counts[0] - 1);
+		int j = std::min(int(y), cell_counts[1] - 1);
+		int k = std::min(int(z), cell_counts[2] - 1);
+		float fx = float(x - i), fy = float(y - j), fz = float(z - k);
+
+		size_t row = size_t(size[0]);
+		size_t slice = row * size[1];
+		const float* c = &values[size_t(k) * slice + size_t(j) * row + i];
+
+		float c00 = c[0] + fx * (c[1] - c[0]);
+		float c10 = c[row] + fx * (c[row + 1] - c[row]);
+		float c01 = c[slice] + fx * (c[slice + 1] - c[slice]);
+		float c11 = c[slice + row] + fx * (c[slice + row + 1] - c[slice + row]);
+		float c0 = c00 + fy * (c10 - c00);
+		float c1 = c01 + fy * (c11 - c01);
+		value = c0 + fz * (c1 - c0);
+		return true;
+	}
+
+private:
+	point3 min_corner;
+	double sample_spacing = 0;
+	double inv_spacing = 0;
+	int size[3] = { 0, 0, 0 };        // Samples along each axis
+	int cell_counts[3] = { 0, 0, 0 }; // size - 1
+	std::vector<float> values;        // x fastest, then y, then z
+};
+
+#endif // !TRILINEAR_GRID_H